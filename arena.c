@@ -0,0 +1,87 @@
+#include "arena.h"
+
+#include "mem.h"
+
+#include <stdlib.h>
+
+/* first block size, later blocks at least double the total */
+static const size_t arena_initial_size = 0x10000;
+static const size_t arena_align = 16;
+
+static kl_arena_t frame_arena = KL_ARENA_INIT(KL_MEM_RENDER);
+
+static kl_arena_block_t* block_new(kl_arena_t *arena, size_t size);
+static size_t block_offset(kl_arena_block_t *block); /* next aligned offset into block->data */
+
+/* ------------------------ */
+void* kl_arena_alloc(kl_arena_t *arena, size_t bytes) {
+  kl_arena_block_t *block = arena->blocks;
+  size_t offset = block != NULL ? block_offset(block) : 0;
+  if (block == NULL || offset + bytes > block->size) {
+    size_t size = arena->capacity > 0 ? arena->capacity : arena_initial_size;
+    while (size < bytes + arena_align) {
+      size *= 2;
+    }
+    block = block_new(arena, size);
+    if (block == NULL) return NULL;
+    offset = block_offset(block);
+  }
+
+  block->used = offset + bytes;
+  return block->data + offset;
+}
+
+void kl_arena_reset(kl_arena_t *arena) {
+  kl_arena_block_t *block = arena->blocks;
+  if (block != NULL && block->next != NULL) {
+    /* overflowed last cycle -- replace all blocks with one that fits everything */
+    size_t capacity = arena->capacity;
+    kl_arena_free(arena);
+    block_new(arena, capacity);
+  } else if (block != NULL) {
+    block->used = 0;
+  }
+}
+
+void kl_arena_free(kl_arena_t *arena) {
+  kl_arena_block_t *block = arena->blocks;
+  while (block != NULL) {
+    kl_arena_block_t *next = block->next;
+    kl_mem_free(arena->tag, block);
+    block = next;
+  }
+  arena->blocks   = NULL;
+  arena->capacity = 0;
+}
+
+kl_arena_t* kl_frame_arena() {
+  return &frame_arena;
+}
+
+void* kl_frame_alloc(size_t bytes) {
+  return kl_arena_alloc(&frame_arena, bytes);
+}
+
+void kl_frame_reset() {
+  kl_arena_reset(&frame_arena);
+}
+
+/* ------------------------ */
+static kl_arena_block_t* block_new(kl_arena_t *arena, size_t size) {
+  kl_arena_block_t *block = kl_mem_alloc(arena->tag, sizeof(kl_arena_block_t) + size);
+  if (block == NULL) return NULL;
+  block->next = arena->blocks;
+  block->size = size;
+  block->used = 0;
+  arena->blocks    = block;
+  arena->capacity += size;
+  return block;
+}
+
+static size_t block_offset(kl_arena_block_t *block) {
+  uintptr_t addr = (uintptr_t)(block->data + block->used);
+  uintptr_t next = (addr + arena_align - 1) & ~(uintptr_t)(arena_align - 1);
+  return block->used + (next - addr);
+}
+
+/* vim: set ts=2 sw=2 et */
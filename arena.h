@@ -0,0 +1,38 @@
+#ifndef KL_ARENA_H
+#define KL_ARENA_H
+
+/* linear allocator -- allocations are only released all at once, by kl_arena_reset */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct kl_arena_block {
+  struct kl_arena_block *next;
+  size_t size;
+  size_t used;
+  uint8_t data[];
+} kl_arena_block_t;
+
+typedef struct kl_arena {
+  kl_arena_block_t *blocks;   /* most recent block first */
+  size_t capacity;            /* total bytes across all blocks */
+  int    tag;                 /* kl_mem tag blocks are charged to */
+} kl_arena_t;
+
+#define KL_ARENA_INIT(memtag) {\
+  .blocks = NULL, .capacity = 0, .tag = (memtag)\
+}
+
+void* kl_arena_alloc(kl_arena_t *arena, size_t bytes);
+/* releases every allocation; blocks are coalesced so the next cycle fits in one */
+void  kl_arena_reset(kl_arena_t *arena);
+void  kl_arena_free(kl_arena_t *arena);
+
+/* the per-frame arena, reset at the start of each kl_render_draw */
+kl_arena_t* kl_frame_arena();
+void* kl_frame_alloc(size_t bytes);
+void  kl_frame_reset();
+
+#endif /* KL_ARENA_H */
+
+/* vim: set ts=2 sw=2 et */
@@ -1,54 +1,118 @@
 #include "array.h"
 
+#include "arena.h"
+#include "mem.h"
+
 #include <stdlib.h>
 #include <assert.h>
 
-/* start with 0x100 elements (not bytes) */
-static const int array_initial_size = 0x100;
-/* new size / old size = 3/2 */
-static const int array_grow_mul = 3;
-static const int array_grow_div = 2;
+const kl_array_policy_t kl_array_policy_default = {
+  .initial  = 0x100, /* elements, not bytes */
+  .grow_mul = 3,
+  .grow_div = 2
+};
+
+const kl_array_policy_t kl_array_policy_small = {
+  .initial  = 4,
+  .grow_mul = 2,
+  .grow_div = 1
+};
 
-/* grow one increment w/ exponential scaling */
-static void array_grow(kl_array_t *array);
 /* grow to at least 'size' w/ exponential scaling */
 static void array_growto(kl_array_t *array, int minsize, uint8_t clearbyte);
-/* grow to exactly 'size' entries */
+/* grow (or shrink) to exactly 'size' entries */
 static void array_resize(kl_array_t *array, int size);
 
 /* ------------------------ */
 void kl_array_init(kl_array_t *array, int item_size) {
-  array->data      = malloc(array_initial_size * item_size);
-  array->size      = array_initial_size;
+  array->data      = NULL;
+  array->size      = 0;
   array->item_size = item_size;
   array->num_items = 0;
+  array->arena     = NULL;
+  array->policy    = &kl_array_policy_default;
+}
+
+void kl_array_init_arena(kl_array_t *array, int item_size, kl_arena_t *arena) {
+  kl_array_init(array, item_size);
+  array->arena = arena;
+}
+
+void kl_array_init_frame(kl_array_t *array, int item_size) {
+  kl_array_init_arena(array, item_size, kl_frame_arena());
+}
+
+void kl_array_set_policy(kl_array_t *array, const kl_array_policy_t *policy) {
+  assert(policy->initial > 0);
+  assert(policy->grow_mul > policy->grow_div);
+  array->policy = policy;
 }
 
 void kl_array_clear(kl_array_t *array) {
-  free(array->data);
-  array->data      = malloc(array_initial_size * array->item_size);
-  array->size      = array_initial_size;
   array->num_items = 0;
 }
 
 void kl_array_free(kl_array_t *array) {
-  free(array->data);
+  if (array->arena == NULL) {
+    kl_mem_free(KL_MEM_ARRAY, array->data);
+  }
+  array->data      = NULL;
   array->size      = 0;
   array->item_size = 0;
   array->num_items = 0;
 }
 
+void kl_array_shrink_to_fit(kl_array_t *array) {
+  if (array->arena != NULL) return;
+  if (array->size == array->num_items) return;
+  if (array->num_items == 0) {
+    kl_mem_free(KL_MEM_ARRAY, array->data);
+    array->data = NULL;
+    array->size = 0;
+    return;
+  }
+  array_resize(array, array->num_items);
+}
+
 int kl_array_push(kl_array_t *array, void *item) {
-  int i = array->num_items++;
-  if (array->num_items > array->size) {
-    array_grow(array);
-    assert(i < array->size);
+  if (array->num_items >= array->size) {
+    kl_array_reserve(array, array->num_items + 1);
   }
+  int i = array->num_items++;
   int bytes = array->item_size;
   memcpy(array->data + i * bytes, item, bytes);
   return i;
 }
 
+void kl_array_reserve(kl_array_t *array, int size) {
+  if (size <= array->size) return;
+  const kl_array_policy_t *policy = array->policy;
+  int newsize = array->size > 0 ? array->size : policy->initial;
+  while (newsize < size) {
+    /* a factor too small to move a small size still grows it by one */
+    int grown = newsize * policy->grow_mul / policy->grow_div;
+    newsize = grown > newsize ? grown : newsize + 1;
+  }
+  array_resize(array, newsize);
+}
+
+int kl_array_append_n(kl_array_t *array, const void *items, int n) {
+  int i = array->num_items;
+  if (n <= 0) return i;
+  kl_array_reserve(array, i + n);
+  int bytes = array->item_size;
+  memcpy(array->data + i * bytes, items, n * bytes);
+  array->num_items += n;
+  return i;
+}
+
+void kl_array_resize(kl_array_t *array, int n) {
+  if (n > array->num_items) {
+    array_growto(array, n, 0);
+  }
+  array->num_items = n;
+}
+
 void kl_array_set_expand(kl_array_t *array, int i, void *item, uint8_t clearbyte) {
   if (i < array->num_items) {
     kl_array_set(array, i, item);
@@ -59,23 +123,22 @@ void kl_array_set_expand(kl_array_t *array, int i, void *item, uint8_t clearbyte
   kl_array_set(array, i, item);
 }
 
-static void array_grow(kl_array_t *array) {
-  int size = array->size * array_grow_mul / array_grow_div;
-  array_resize(array, size);
-}
-
 static void array_growto(kl_array_t *array, int minsize, uint8_t clearbyte) {
   int oldsize = array->num_items;
-  int size    = array->size;
-  while (size < minsize) {
-    size = size * array_grow_mul / array_grow_div;
-  }
-  array_resize(array, size);
+  kl_array_reserve(array, minsize);
   memset(array->data + oldsize * array->item_size, clearbyte, (minsize - oldsize) * array->item_size);
 }
 
 static void array_resize(kl_array_t *array, int size) {
-  array->data = realloc(array->data, size * array->item_size);
+  if (array->arena != NULL) {
+    uint8_t *data = kl_arena_alloc(array->arena, size * array->item_size);
+    if (array->data != NULL) {
+      memcpy(data, array->data, array->num_items * array->item_size);
+    }
+    array->data = data;
+  } else {
+    array->data = kl_mem_realloc(KL_MEM_ARRAY, array->data, size * array->item_size);
+  }
   array->size = size;
 }
 /* vim: set ts=2 sw=2 et */
@@ -6,17 +6,48 @@
 #include <string.h>
 #include <assert.h>
 
+struct kl_arena;
+
+/* storage is allocated on first push, 'initial' items at a time, and grows by mul/div (and by at
+ * least one item) */
+typedef struct kl_array_policy {
+  int initial;
+  int grow_mul;
+  int grow_div;
+} kl_array_policy_t;
+
+extern const kl_array_policy_t kl_array_policy_default; /* 0x100 items, grows by 3/2 */
+extern const kl_array_policy_t kl_array_policy_small;   /* 4 items, doubles */
+
 typedef struct kl_array {
   uint8_t *data;
   int      size;
   int      item_size;
   int      num_items;
+  struct kl_arena *arena; /* NULL for heap-backed arrays */
+  const kl_array_policy_t *policy;
 } kl_array_t;
 
+/* initialization doesn't allocate, empty arrays cost nothing */
 void  kl_array_init(kl_array_t *array, int size);
+/* arena-backed arrays never free their storage, it's reclaimed when the arena is reset */
+void  kl_array_init_arena(kl_array_t *array, int size, struct kl_arena *arena);
+/* backed by the per-frame arena, only valid until the next kl_frame_reset */
+void  kl_array_init_frame(kl_array_t *array, int size);
+/* only affects future growth -- set it before the first push */
+void  kl_array_set_policy(kl_array_t *array, const kl_array_policy_t *policy);
+/* removes all items but keeps the storage */
 void  kl_array_clear(kl_array_t *array);
 void  kl_array_free(kl_array_t *array);
+/* releases unused capacity (heap-backed arrays only) */
+void  kl_array_shrink_to_fit(kl_array_t *array);
 int   kl_array_push(kl_array_t *array, void *item);
+/* grows capacity to at least 'size' items (exponentially, so it's cheap to call once per push) */
+void  kl_array_reserve(kl_array_t *array, int size);
+/* copies 'n' items onto the end of the array, returns the index of the first */
+int   kl_array_append_n(kl_array_t *array, const void *items, int n);
+/* sets the number of items, newly added items are zeroed */
+void  kl_array_resize(kl_array_t *array, int n);
 
 static inline int kl_array_pop(kl_array_t *array, void* item) {
   if (array->num_items <= 0) return -1;
@@ -38,6 +69,12 @@ static inline void  kl_array_set(kl_array_t *array, int i, void *item) {
 }
 void kl_array_set_expand(kl_array_t *array, int i, void *item, uint8_t clearbyte);
 
+/* pointer to an item in place -- only valid until the array is next grown */
+static inline void* kl_array_at(kl_array_t *array, int i) {
+  assert(i < array->num_items);
+  return array->data + i * array->item_size;
+}
+
 static inline void* kl_array_data(kl_array_t *array) {
   return array->data;
 }
@@ -50,6 +87,34 @@ static inline int kl_array_size(kl_array_t *array) {
   return array->num_items;
 }
 
+/* typed accessors for a kl_array_t holding items of 'type', e.g.
+ *   KL_ARRAY_DECLARE(kl_model_t*, models)
+ * defines kl_array_models_init(), kl_array_models_push(), kl_array_models_at(),
+ * and kl_array_models_data().  these work on plain kl_array_t's, so typed and
+ * untyped code can share the same arrays.  no trailing semicolon. */
+#define KL_ARRAY_DECLARE(type, name) \
+  static inline void kl_array_##name##_init(kl_array_t *array) { \
+    kl_array_init(array, sizeof(type)); \
+  } \
+  static inline type* kl_array_##name##_data(kl_array_t *array) { \
+    assert(array->item_size == sizeof(type)); \
+    return (type*)array->data; \
+  } \
+  static inline type* kl_array_##name##_at(kl_array_t *array, int i) { \
+    assert(array->item_size == sizeof(type)); \
+    assert(i < array->num_items); \
+    return (type*)array->data + i; \
+  } \
+  static inline int kl_array_##name##_push(kl_array_t *array, type item) { \
+    assert(array->item_size == sizeof(type)); \
+    if (array->num_items >= array->size) { \
+      kl_array_reserve(array, array->num_items + 1); \
+    } \
+    int i = array->num_items++; \
+    ((type*)array->data)[i] = item; \
+    return i; \
+  }
+
 #endif /* KL_ARRAY_H */
 
 /* vim: set ts=2 sw=2 et */
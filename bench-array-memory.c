@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, mkdtemp */
+
+/* bench-array-memory: heap held by kl_arrays which are mostly empty, eagerly allocated the way
+ * kl_array_init used to against allocated on first push.  both cases mirror how the engine uses
+ * the arrays rather than calling into it, since frame.c drags in the renderer and listdir is
+ * private to resource.c:
+ *
+ *   a frame tree of 10k nodes, each with a children array like kl_frame_new's
+ *   a deep asset directory, listed like listdir does, each listing held while its
+ *   subdirectories are listed */
+
+#include "bench.h"
+#include "array.h"
+#include "mem.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define FRAME_NODES  10000
+#define FRAME_FANOUT 8
+
+#define DIR_DEPTH 32 /* directories nested in each other */
+#define DIR_FILES 8  /* files in each of them */
+#define DIR_EMPTY 2  /* empty subdirectories in each of them */
+
+#define PATHLEN 0x100
+
+/* laid out like resource.c's */
+typedef struct diritem {
+  char name[PATHLEN];
+  bool isdir;
+  uint64_t size;
+} diritem_t;
+
+typedef struct frame_node {
+  kl_array_t children;
+} frame_node_t;
+
+static void   array_new(kl_array_t *array, int size, bool eager);
+static size_t frame_tree(bool eager);
+static size_t dir_walk(const char *path, bool eager, size_t *peak);
+static size_t array_bytes();
+static void   dir_make(const char *path, int depth);
+static void   dir_remove(const char *path);
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  char root[] = "/tmp/kl-bench-XXXXXX";
+  if (mkdtemp(root) == NULL) {
+    perror("bench-array-memory: mkdtemp");
+    return 1;
+  }
+  dir_make(root, DIR_DEPTH);
+
+  size_t eager_peak = 0, lazy_peak = 0;
+  size_t eager_bytes = dir_walk(root, true, &eager_peak);
+  size_t lazy_bytes  = dir_walk(root, false, &lazy_peak);
+  dir_remove(root);
+
+  printf("%-34s %14s %14s\n", "bytes held", "eager", "lazy");
+  printf("%-34s %14zu %14zu\n", "frame tree, 10k nodes", frame_tree(true), frame_tree(false));
+  printf("%-34s %14zu %14zu\n", "directory walk, peak", eager_peak, lazy_peak);
+  printf("%-34s %14zu %14zu\n", "directory walk, total allocated", eager_bytes, lazy_bytes);
+  return 0;
+}
+
+/* ------------------------- */
+static void array_new(kl_array_t *array, int size, bool eager) {
+  kl_array_init(array, size);
+  if (eager) {
+    /* what kl_array_init allocated up front before it went lazy */
+    kl_array_reserve(array, kl_array_policy_default.initial);
+  } else {
+    kl_array_set_policy(array, &kl_array_policy_small);
+  }
+}
+
+/* heap held by the children arrays of a complete tree, breadth first */
+static size_t frame_tree(bool eager) {
+  frame_node_t *nodes = malloc(FRAME_NODES * sizeof(frame_node_t));
+  size_t before = array_bytes();
+  for (int i=0; i < FRAME_NODES; i++) {
+    array_new(&nodes[i].children, sizeof(frame_node_t*), eager);
+    if (i > 0) {
+      frame_node_t *child = nodes + i;
+      kl_array_push(&nodes[(i - 1) / FRAME_FANOUT].children, &child);
+    }
+  }
+  size_t bytes = array_bytes() - before;
+  for (int i=0; i < FRAME_NODES; i++) {
+    kl_array_free(&nodes[i].children);
+  }
+  free(nodes);
+  return bytes;
+}
+
+/* returns the bytes allocated for listings, and raises 'peak' to the most held at once */
+static size_t dir_walk(const char *path, bool eager, size_t *peak) {
+  size_t before = array_bytes();
+  kl_array_t items;
+  array_new(&items, sizeof(diritem_t), eager);
+
+  DIR *dir = opendir(path);
+  struct dirent *ent;
+  while (dir != NULL && (ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+    char fullpath[PATHLEN];
+    struct stat s;
+    if (snprintf(fullpath, PATHLEN, "%s/%s", path, ent->d_name) >= PATHLEN) continue;
+    if (stat(fullpath, &s) < 0) continue;
+
+    diritem_t item;
+    strncpy(item.name, ent->d_name, PATHLEN);
+    item.name[PATHLEN-1] = '\0';
+    item.isdir = S_ISDIR(s.st_mode);
+    item.size  = s.st_size;
+    kl_array_push(&items, &item);
+  }
+  if (dir != NULL) closedir(dir);
+
+  size_t total = array_bytes() - before;
+  if (array_bytes() > *peak) *peak = array_bytes();
+  for (int i=0; i < kl_array_size(&items); i++) {
+    diritem_t *item = kl_array_at(&items, i);
+    if (!item->isdir) continue;
+    char subpath[PATHLEN];
+    if (snprintf(subpath, PATHLEN, "%s/%s", path, item->name) >= PATHLEN) continue;
+    total += dir_walk(subpath, eager, peak);
+  }
+  kl_array_free(&items);
+  return total;
+}
+
+static size_t array_bytes() {
+  kl_mem_stats_t stats;
+  kl_mem_stats(KL_MEM_ARRAY, &stats);
+  return stats.live_bytes;
+}
+
+/* a chain of 'depth' directories, each with a few files and empty directories beside the next */
+static void dir_make(const char *path, int depth) {
+  char sub[PATHLEN];
+  for (int i=0; i < DIR_FILES; i++) {
+    snprintf(sub, PATHLEN, "%s/file%d.obj", path, i);
+    FILE *file = fopen(sub, "wb");
+    if (file != NULL) fclose(file);
+  }
+  for (int i=0; i < DIR_EMPTY; i++) {
+    snprintf(sub, PATHLEN, "%s/empty%d", path, i);
+    mkdir(sub, 0755);
+  }
+  if (depth > 1) {
+    snprintf(sub, PATHLEN, "%s/d", path);
+    mkdir(sub, 0755);
+    dir_make(sub, depth - 1);
+  }
+}
+
+static void dir_remove(const char *path) {
+  DIR *dir = opendir(path);
+  struct dirent *ent;
+  while (dir != NULL && (ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+    char sub[PATHLEN];
+    struct stat s;
+    if (snprintf(sub, PATHLEN, "%s/%s", path, ent->d_name) >= PATHLEN) continue;
+    if (stat(sub, &s) == 0 && S_ISDIR(s.st_mode)) {
+      dir_remove(sub);
+    } else {
+      unlink(sub);
+    }
+  }
+  if (dir != NULL) closedir(dir);
+  rmdir(path);
+}
+
+/* vim: set ts=2 sw=2 et */
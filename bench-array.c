@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+/* bench-array: per-element cost of kl_array's generic accessors, which memcpy through a
+ * temporary and were all array.c had before KL_ARRAY_DECLARE, against the typed ones */
+
+#include "bench.h"
+#include "array.h"
+
+#include <stdio.h>
+
+#define BENCH_N    10000000
+#define BENCH_REPS 5
+
+KL_ARRAY_DECLARE(float, float)
+
+typedef double (*bench_cb)(kl_array_t *array);
+
+static double push_generic(kl_array_t *array);
+static double push_typed(kl_array_t *array);
+static double append_n(kl_array_t *array);
+static double read_generic(kl_array_t *array);
+static double read_typed(kl_array_t *array);
+static double update_generic(kl_array_t *array);
+static double update_typed(kl_array_t *array);
+static double best_ns(bench_cb cb, kl_array_t *array);
+
+static volatile float sink;
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  kl_array_t array;
+  kl_array_float_init(&array);
+
+  printf("%-8s %14s %14s\n", "ns/item", "kl_array_get", "typed");
+  printf("%-8s %14.2f %14.2f\n", "push",   best_ns(&push_generic, &array),   best_ns(&push_typed, &array));
+  printf("%-8s %14s %14.2f\n",   "append", "-",                              best_ns(&append_n, &array));
+  printf("%-8s %14.2f %14.2f\n", "read",   best_ns(&read_generic, &array),   best_ns(&read_typed, &array));
+  printf("%-8s %14.2f %14.2f\n", "update", best_ns(&update_generic, &array), best_ns(&update_typed, &array));
+
+  kl_array_free(&array);
+  return 0;
+}
+
+/* ------------------------- */
+static double push_generic(kl_array_t *array) {
+  kl_array_clear(array);
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    float f = i;
+    kl_array_push(array, &f);
+  }
+  return bench_now_ms() - start;
+}
+
+static double push_typed(kl_array_t *array) {
+  kl_array_clear(array);
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    kl_array_float_push(array, i);
+  }
+  return bench_now_ms() - start;
+}
+
+static double append_n(kl_array_t *array) {
+  static float chunk[0x400];
+  for (int i=0; i < 0x400; i++) chunk[i] = i;
+  kl_array_clear(array);
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i += 0x400) {
+    kl_array_append_n(array, chunk, 0x400);
+  }
+  return bench_now_ms() - start;
+}
+
+static double read_generic(kl_array_t *array) {
+  kl_array_resize(array, BENCH_N);
+  double start = bench_now_ms();
+  float sum = 0.0f;
+  for (int i=0; i < BENCH_N; i++) {
+    float f;
+    kl_array_get(array, i, &f);
+    sum += f;
+  }
+  sink = sum;
+  return bench_now_ms() - start;
+}
+
+static double read_typed(kl_array_t *array) {
+  kl_array_resize(array, BENCH_N);
+  double start = bench_now_ms();
+  float *data = kl_array_float_data(array);
+  float sum = 0.0f;
+  for (int i=0; i < BENCH_N; i++) {
+    sum += data[i];
+  }
+  sink = sum;
+  return bench_now_ms() - start;
+}
+
+static double update_generic(kl_array_t *array) {
+  kl_array_resize(array, BENCH_N);
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    float f;
+    kl_array_get(array, i, &f);
+    f = f * 0.5f + 1.0f;
+    kl_array_set(array, i, &f);
+  }
+  return bench_now_ms() - start;
+}
+
+static double update_typed(kl_array_t *array) {
+  kl_array_resize(array, BENCH_N);
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    float *f = kl_array_float_at(array, i);
+    *f = *f * 0.5f + 1.0f;
+  }
+  return bench_now_ms() - start;
+}
+
+/* the fastest of a few runs, the rest are noise */
+static double best_ns(bench_cb cb, kl_array_t *array) {
+  double best = cb(array);
+  for (int i=1; i < BENCH_REPS; i++) {
+    double ms = cb(array);
+    if (ms < best) best = ms;
+  }
+  return best * 1000000.0 / BENCH_N;
+}
+
+/* vim: set ts=2 sw=2 et */
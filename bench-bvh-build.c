@@ -0,0 +1,109 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+/* bench-bvh-build: trees over the same 100k objects built by kl_bvh_build against inserted one at
+ * a time in the order they came, measured by how many nodes a frustum query visits -- every node
+ * kl_bvh_search hands to the filter -- and how long one takes.  both trees must find the same
+ * objects, since the leaves are tested alike */
+
+#include "bench-bvh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_N      100000
+#define BENCH_QUERIES 2000
+#define BENCH_FAR    3000.0f
+
+typedef struct counted {
+  kl_frustum_t *frustum;
+  long visits;
+} counted_t;
+
+typedef struct result {
+  double make; /* ms to put the tree together */
+  int    depth;
+  double visits, found, query; /* per query, the last in ms */
+  uint64_t checksum;
+} result_t;
+
+static void bench_tree(kl_bvh_t *tree, kl_frustum_t *frusta, result_t *result);
+static int  count_filter(kl_sphere_t *bounds, void *data);
+static int  depth(kl_bvh_t *tree, int32_t i);
+static void print_result(const char *name, result_t *result);
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  kl_sphere_t  *bounds = malloc(BENCH_N * sizeof(kl_sphere_t));
+  void        **items  = malloc(BENCH_N * sizeof(void*));
+  kl_frustum_t *frusta = malloc(BENCH_QUERIES * sizeof(kl_frustum_t));
+  uint32_t seed = 12345;
+  bench_bvh_scene(bounds, items, BENCH_N, &seed);
+  bench_bvh_frusta(frusta, BENCH_QUERIES, BENCH_FAR, &seed);
+
+  result_t inserted, built;
+  kl_bvh_t tree = KL_BVH_INIT;
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    kl_bvh_insert(&tree, bounds + i, items[i]);
+  }
+  inserted.make = bench_now_ms() - start;
+  bench_tree(&tree, frusta, &inserted);
+
+  start = bench_now_ms();
+  kl_bvh_build(&tree, items, bounds, BENCH_N, NULL);
+  built.make = bench_now_ms() - start;
+  bench_tree(&tree, frusta, &built);
+  kl_bvh_free(&tree);
+
+  printf("%-24s %10s %8s %14s %12s %12s\n", "100k objects, far 3000", "ms to make", "depth", "visited/query", "found/query", "ms/query");
+  print_result("inserted one by one", &inserted);
+  print_result("kl_bvh_build", &built);
+  if (inserted.checksum != built.checksum) {
+    fprintf(stderr, "bench-bvh-build: the trees found different objects\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* ------------------------- */
+static void bench_tree(kl_bvh_t *tree, kl_frustum_t *frusta, result_t *result) {
+  kl_array_t found;
+  kl_array_init(&found, sizeof(void*));
+  counted_t counted = { .visits = 0 };
+  long total = 0;
+  result->checksum = 0;
+
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_QUERIES; i++) {
+    kl_array_clear(&found);
+    counted.frustum = frusta + i;
+    kl_bvh_search(tree, &count_filter, &counted, &found);
+    total += kl_array_size(&found);
+    result->checksum += bench_bvh_checksum(&found);
+  }
+  result->query  = (bench_now_ms() - start) / BENCH_QUERIES;
+  result->visits = (double)counted.visits / BENCH_QUERIES;
+  result->found  = (double)total / BENCH_QUERIES;
+  result->depth  = depth(tree, tree->root);
+  kl_array_free(&found);
+}
+
+static int count_filter(kl_sphere_t *bounds, void *data) {
+  counted_t *counted = data;
+  counted->visits++;
+  return bench_bvh_infrustum(bounds, counted->frustum);
+}
+
+static int depth(kl_bvh_t *tree, int32_t i) {
+  kl_bvh_node_t *node = tree->nodes + i;
+  if (node->children[0] == KL_BVH_NULL) return 1;
+  int l = depth(tree, node->children[0]);
+  int r = depth(tree, node->children[1]);
+  return 1 + (l > r ? l : r);
+}
+
+static void print_result(const char *name, result_t *result) {
+  printf("%-24s %10.1f %8d %14.0f %12.1f %12.4f\n", name, result->make, result->depth, result->visits, result->found, result->query);
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,109 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+/* bench-bvh-flat: frustum culling through the sphere tree as it's kept -- kl_bvh_search, which
+ * recurses through the node pool calling a filter at every node -- against its flattened copy,
+ * walked with the same filter by kl_bvh_flat_search and with the test inlined by
+ * kl_bvh_flat_cull.  the tree is built both ways, since inserting leaves its nodes in arrival
+ * order all over the pool.  every variant has to find the same objects */
+
+#include "bench-bvh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_N       100000
+#define BENCH_QUERIES 2000
+#define BENCH_RUNS    7
+
+#define WALK_SEARCH      0
+#define WALK_FLAT_SEARCH 1
+#define WALK_FLAT_CULL   2
+
+static double bench_walk(int walk, kl_bvh_t *tree, kl_bvh_flat_t *flat, kl_frustum_t *frusta, uint64_t *checksum);
+
+static const float fars[] = { 800.0f, 3000.0f };
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  kl_sphere_t  *bounds = malloc(BENCH_N * sizeof(kl_sphere_t));
+  void        **items  = malloc(BENCH_N * sizeof(void*));
+  kl_frustum_t *frusta[2];
+  uint32_t seed = 12345;
+  bench_bvh_scene(bounds, items, BENCH_N, &seed);
+  for (int f=0; f < 2; f++) {
+    frusta[f] = malloc(BENCH_QUERIES * sizeof(kl_frustum_t));
+    bench_bvh_frusta(frusta[f], BENCH_QUERIES, fars[f], &seed);
+  }
+
+  kl_bvh_t trees[2] = { KL_BVH_INIT, KL_BVH_INIT };
+  for (int i=0; i < BENCH_N; i++) {
+    kl_bvh_insert(&trees[0], bounds + i, items[i]);
+  }
+  kl_bvh_build(&trees[1], items, bounds, BENCH_N, NULL);
+  uint64_t expected[2];
+  for (int f=0; f < 2; f++) {
+    bench_walk(WALK_SEARCH, &trees[0], NULL, frusta[f], &expected[f]);
+  }
+
+  static const char *names[] = { "inserted", "kl_bvh_build" };
+  static const char *walks[] = { "kl_bvh_search", "kl_bvh_flat_search", "kl_bvh_flat_cull" };
+  int mismatched = 0;
+  printf("%-34s %10s %10s\n", "ms/query, 100k objects", "far 800", "far 3000");
+  for (int t=0; t < 2; t++) {
+    kl_bvh_flat_t flat;
+    kl_bvh_flatten(&flat, &trees[t]);
+    double ms[3][2];
+    for (int w=0; w < 3; w++) {
+      printf("%-14s %-19s", names[t], walks[w]);
+      for (int f=0; f < 2; f++) {
+        uint64_t checksum;
+        ms[w][f] = bench_walk(w, &trees[t], &flat, frusta[f], &checksum);
+        mismatched += checksum != expected[f];
+        printf(" %10.4f", ms[w][f]);
+      }
+      printf("\n");
+    }
+    printf("%-34s %9.1fx %9.1fx\n", "  kl_bvh_flat_cull speedup", ms[0][0] / ms[2][0], ms[0][1] / ms[2][1]);
+    kl_bvh_flat_free(&flat);
+    kl_bvh_free(&trees[t]);
+  }
+
+  if (mismatched > 0) {
+    fprintf(stderr, "bench-bvh-flat: %d walks found different objects\n", mismatched);
+    return 1;
+  }
+  return 0;
+}
+
+/* ------------------------- */
+/* best of BENCH_RUNS over every frustum, and the checksum of everything found */
+static double bench_walk(int walk, kl_bvh_t *tree, kl_bvh_flat_t *flat, kl_frustum_t *frusta, uint64_t *checksum) {
+  kl_array_t found;
+  kl_array_init(&found, sizeof(void*));
+  double best = 0.0;
+  for (int run=0; run < BENCH_RUNS; run++) {
+    *checksum = 0;
+    double start = bench_now_ms();
+    for (int i=0; i < BENCH_QUERIES; i++) {
+      kl_array_clear(&found);
+      switch (walk) {
+        case WALK_SEARCH:
+          kl_bvh_search(tree, &bench_bvh_infrustum, frusta + i, &found);
+          break;
+        case WALK_FLAT_SEARCH:
+          kl_bvh_flat_search(flat, &bench_bvh_infrustum, frusta + i, &found);
+          break;
+        default:
+          kl_bvh_flat_cull(flat, frusta + i, &found);
+          break;
+      }
+      *checksum += bench_bvh_checksum(&found);
+    }
+    double ms = (bench_now_ms() - start) / BENCH_QUERIES;
+    if (run == 0 || ms < best) best = ms;
+  }
+  kl_array_free(&found);
+  return best;
+}
+
+/* vim: set ts=2 sw=2 et */
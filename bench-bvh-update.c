@@ -0,0 +1,143 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+/* bench-bvh-update: per-frame cost of keeping a tree over 100k objects current while 10k of them
+ * move, with kl_bvh_update on each mover, against rebuilding the whole tree every frame.  the
+ * movers drift a few units a frame, as walkers and vehicles do, bouncing off the edges of the
+ * world.  updates leave the tree looser than a fresh build would, so after the last frame both are
+ * culled through four-wide copies and compared -- they have to find the same objects */
+
+#include "bench-bvh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_N       100000
+#define BENCH_MOVING  10000
+#define BENCH_FRAMES  100
+#define BENCH_QUERIES 500
+#define BENCH_FAR     3000.0f
+
+static void   bench_frames(kl_bvh_t *tree, int *handles, kl_sphere_t *bounds, kl_vec3f_t *velocity, double *mean, double *worst);
+static void   move(kl_sphere_t *bounds, kl_vec3f_t *velocity);
+static double bench_cull(kl_bvh_t *tree, kl_frustum_t *frusta, uint64_t *checksum);
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  kl_sphere_t  *bounds   = malloc(BENCH_N * sizeof(kl_sphere_t));
+  void        **items    = malloc(BENCH_N * sizeof(void*));
+  int          *handles  = malloc(BENCH_N * sizeof(int));
+  kl_vec3f_t   *velocity = malloc(BENCH_MOVING * sizeof(kl_vec3f_t));
+  kl_frustum_t *frusta   = malloc(BENCH_QUERIES * sizeof(kl_frustum_t));
+  uint32_t seed = 12345;
+  bench_bvh_scene(bounds, items, BENCH_N, &seed);
+  bench_bvh_frusta(frusta, BENCH_QUERIES, BENCH_FAR, &seed);
+  for (int i=0; i < BENCH_MOVING; i++) {
+    velocity[i].x = (bench_frand(&seed) - 0.5f) * 20.0f;
+    velocity[i].y = (bench_frand(&seed) - 0.5f) * 4.0f;
+    velocity[i].z = (bench_frand(&seed) - 0.5f) * 20.0f;
+  }
+
+  printf("%-28s %12s %12s %14s\n", "100k objects, 10k moving", "ms/frame", "worst frame", "cull ms/query");
+
+  /* the rebuild every frame would cost, over the scene as it starts */
+  kl_bvh_t tree = KL_BVH_INIT;
+  double rebuild = 0.0, worst = 0.0;
+  for (int frame=0; frame < 10; frame++) {
+    double start = bench_now_ms();
+    kl_bvh_build(&tree, items, bounds, BENCH_N, handles);
+    double ms = bench_now_ms() - start;
+    rebuild += ms;
+    if (ms > worst) worst = ms;
+  }
+  printf("%-28s %12.3f %12.3f\n", "kl_bvh_build every frame", rebuild / 10, worst);
+
+  static const char *names[] = { "inserted, updated", "built, updated" };
+  int mismatched = 0;
+  for (int t=0; t < 2; t++) {
+    kl_sphere_t *moved = malloc(BENCH_N * sizeof(kl_sphere_t));
+    kl_vec3f_t  *vel   = malloc(BENCH_MOVING * sizeof(kl_vec3f_t));
+    memcpy(moved, bounds, BENCH_N * sizeof(kl_sphere_t));
+    memcpy(vel, velocity, BENCH_MOVING * sizeof(kl_vec3f_t));
+    if (t == 0) {
+      kl_bvh_free(&tree);
+      for (int i=0; i < BENCH_N; i++) {
+        handles[i] = kl_bvh_insert(&tree, moved + i, items[i]);
+      }
+    } else {
+      kl_bvh_build(&tree, items, moved, BENCH_N, handles);
+    }
+
+    double mean;
+    uint64_t updated, fresh;
+    bench_frames(&tree, handles, moved, vel, &mean, &worst);
+    double cull = bench_cull(&tree, frusta, &updated);
+    printf("%-28s %12.3f %12.3f %14.4f\n", names[t], mean, worst, cull);
+
+    kl_bvh_build(&tree, items, moved, BENCH_N, NULL);
+    cull = bench_cull(&tree, frusta, &fresh);
+    printf("%-28s %12s %12s %14.4f\n", "  rebuilt after the moves", "", "", cull);
+    mismatched += updated != fresh;
+    free(moved);
+    free(vel);
+  }
+  kl_bvh_free(&tree);
+
+  if (mismatched > 0) {
+    fprintf(stderr, "bench-bvh-update: updated trees found different objects to rebuilt ones\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* ------------------------- */
+/* the first BENCH_MOVING objects move every frame, only the updates are timed */
+static void bench_frames(kl_bvh_t *tree, int *handles, kl_sphere_t *bounds, kl_vec3f_t *velocity, double *mean, double *worst) {
+  double total = 0.0;
+  *worst = 0.0;
+  for (int frame=0; frame < BENCH_FRAMES; frame++) {
+    for (int i=0; i < BENCH_MOVING; i++) {
+      move(bounds + i, velocity + i);
+    }
+    double start = bench_now_ms();
+    for (int i=0; i < BENCH_MOVING; i++) {
+      kl_bvh_update(tree, handles[i], bounds + i);
+    }
+    double ms = bench_now_ms() - start;
+    total += ms;
+    if (ms > *worst) *worst = ms;
+  }
+  *mean = total / BENCH_FRAMES;
+}
+
+static void move(kl_sphere_t *bounds, kl_vec3f_t *velocity) {
+  kl_vec3f_add(&bounds->center, &bounds->center, velocity);
+  if (bounds->center.x > 10000.0f || bounds->center.x < -10000.0f) velocity->x = -velocity->x;
+  if (bounds->center.y > 1000.0f  || bounds->center.y < -1000.0f)  velocity->y = -velocity->y;
+  if (bounds->center.z > 10000.0f || bounds->center.z < -10000.0f) velocity->z = -velocity->z;
+}
+
+/* best of a few passes, through a four-wide copy as the renderer culls */
+static double bench_cull(kl_bvh_t *tree, kl_frustum_t *frusta, uint64_t *checksum) {
+  kl_bvh4_t wide;
+  kl_bvh4_flatten(&wide, tree);
+  kl_array_t found;
+  kl_array_init(&found, sizeof(void*));
+  double best = 0.0;
+  for (int run=0; run < 5; run++) {
+    *checksum = 0;
+    double start = bench_now_ms();
+    for (int i=0; i < BENCH_QUERIES; i++) {
+      kl_array_clear(&found);
+      kl_bvh4_cull(&wide, frusta + i, &found);
+      *checksum += bench_bvh_checksum(&found);
+    }
+    double ms = (bench_now_ms() - start) / BENCH_QUERIES;
+    if (run == 0 || ms < best) best = ms;
+  }
+  kl_array_free(&found);
+  kl_bvh4_free(&wide);
+  return best;
+}
+
+/* vim: set ts=2 sw=2 et */
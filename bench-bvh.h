@@ -0,0 +1,84 @@
+#ifndef KL_BENCH_BVH_H
+#define KL_BENCH_BVH_H
+
+/* the scene the bench-bvh* programs cull: objects spread over a 20000 x 2000 x 20000 world, half
+ * of them uniformly and half in fifty tight clusters, the way props gather in towns.  radii run
+ * from 1 to 41, mostly small.  the same seed gives the same scene and cameras, so the programs
+ * can be compared with each other */
+
+#include "bench.h"
+#include "bvhtree.h"
+#include "camera.h"
+#include "plane.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#define BENCH_BVH_CLUSTERS 50
+
+/* item i is (void*)(i + 1), so results can be told apart without allocating anything */
+static inline void bench_bvh_scene(kl_sphere_t *bounds, void **items, int n, uint32_t *seed) {
+  kl_vec3f_t clusters[BENCH_BVH_CLUSTERS];
+  for (int i=0; i < BENCH_BVH_CLUSTERS; i++) {
+    clusters[i].x = bench_frand(seed) * 20000.0f - 10000.0f;
+    clusters[i].y = bench_frand(seed) * 2000.0f - 1000.0f;
+    clusters[i].z = bench_frand(seed) * 20000.0f - 10000.0f;
+  }
+  for (int i=0; i < n; i++) {
+    if (i & 1) {
+      kl_vec3f_t *c = clusters + (int)(bench_frand(seed) * BENCH_BVH_CLUSTERS);
+      bounds[i].center.x = c->x + bench_frand(seed) * 600.0f - 300.0f;
+      bounds[i].center.y = c->y + bench_frand(seed) * 600.0f - 300.0f;
+      bounds[i].center.z = c->z + bench_frand(seed) * 600.0f - 300.0f;
+    } else {
+      bounds[i].center.x = bench_frand(seed) * 20000.0f - 10000.0f;
+      bounds[i].center.y = bench_frand(seed) * 2000.0f - 1000.0f;
+      bounds[i].center.z = bench_frand(seed) * 20000.0f - 10000.0f;
+    }
+    bounds[i].radius = 1.0f + bench_frand(seed) * bench_frand(seed) * 40.0f;
+    items[i] = (void*)(intptr_t)(i + 1);
+  }
+}
+
+/* cameras at ground level anywhere in the middle of the world, looking any way and a little up or
+ * down, seeing out to 'far' */
+static inline void bench_bvh_frusta(kl_frustum_t *frusta, int n, float far, uint32_t *seed) {
+  for (int i=0; i < n; i++) {
+    float yaw   = bench_frand(seed) * 6.283f;
+    float pitch = (bench_frand(seed) - 0.5f) * 0.6f;
+    kl_quat_t qyaw   = { cosf(yaw / 2.0f), 0.0f, sinf(yaw / 2.0f), 0.0f };
+    kl_quat_t qpitch = { cosf(pitch / 2.0f), sinf(pitch / 2.0f), 0.0f, 0.0f };
+    kl_camera_t cam = { .aspect = 1.333f, .fov = 1.047f, .near = 1.0f, .far = far };
+    kl_quat_mul(&cam.orientation, &qyaw, &qpitch);
+    cam.position.x = bench_frand(seed) * 16000.0f - 8000.0f;
+    cam.position.y = 0.0f;
+    cam.position.z = bench_frand(seed) * 16000.0f - 8000.0f;
+    kl_camera_update_frustum(&cam, frusta + i);
+  }
+}
+
+/* a kl_bvh_filter_cb for kl_bvh_search, the same test kl_bvh_flat_cull inlines */
+static inline int bench_bvh_infrustum(kl_sphere_t *bounds, void *data) {
+  kl_frustum_t *frustum = data;
+  if (kl_plane_dist(&frustum->near, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->far, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->top, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->bottom, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->left, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->right, &bounds->center) > bounds->radius) return 0;
+  return 1;
+}
+
+/* order-independent, so results from different layouts can be compared */
+static inline uint64_t bench_bvh_checksum(kl_array_t *results) {
+  uint64_t sum = 0;
+  void **items = kl_array_data(results);
+  for (int i=0; i < kl_array_size(results); i++) {
+    sum += (uint64_t)(intptr_t)items[i] * 0x9e3779b97f4a7c15ull;
+  }
+  return sum;
+}
+
+#endif /* KL_BENCH_BVH_H */
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+/* bench-bvh4: culling throughput of the four-wide copy of a tree, kl_bvh4_cull, against the
+ * flattened sphere tree's kl_bvh_flat_cull.  bench-bvh4-scalar is the same program built without
+ * __SSE__, so kl_bvh4_cull tests the four children one at a time.  both have to find what
+ * kl_bvh_search does, bench-bvh-flat times that one.
+ *
+ * then a frame's worth of views, the camera's and the cube faces of each shadowed light, culled
+ * one at a time against all together through kl_bvh4_cull_views, batched KL_BVH_VIEWS at a time
+ * and sorted out into an array per view as the renderer would.  both have to find the same */
+
+#include "bench-bvh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_N       100000
+#define BENCH_QUERIES 1000
+#define BENCH_RUNS    7
+#define BENCH_FARS    3
+
+#define CULL_FLAT 0
+#define CULL_WIDE 1
+
+#define BENCH_FRAMES       200
+#define BENCH_LIGHTS       20
+#define BENCH_LIGHT_RADIUS 2530.0f /* main.c's lights, 16 * sqrt(25000) */
+#define BENCH_VIEWS        (1 + 6 * BENCH_LIGHTS)
+
+#define CULL_EACH  0
+#define CULL_VIEWS 1
+
+KL_ARRAY_DECLARE(void*, ptr)
+KL_ARRAY_DECLARE(kl_bvh_visible_t, visible)
+
+typedef struct trees {
+  kl_bvh_t      tree;
+  kl_bvh_flat_t flat;
+  kl_bvh4_t     wide;
+} trees_t;
+
+static double   bench_cull(int cull, trees_t *trees, kl_frustum_t *frusta, uint64_t *checksum);
+static uint64_t search_checksum(kl_bvh_t *tree, kl_frustum_t *frusta);
+static double   bench_frame(int cull, kl_bvh4_t *wide, kl_frustum_t *views, int lights, uint64_t *checksum);
+
+static const float fars[BENCH_FARS] = { 800.0f, 3000.0f, 10000.0f };
+static const int   lights[] = { 0, 1, 5, 20 };
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  kl_sphere_t  *bounds = malloc(BENCH_N * sizeof(kl_sphere_t));
+  void        **items  = malloc(BENCH_N * sizeof(void*));
+  kl_frustum_t *frusta[BENCH_FARS];
+  uint32_t seed = 12345;
+  bench_bvh_scene(bounds, items, BENCH_N, &seed);
+  for (int f=0; f < BENCH_FARS; f++) {
+    frusta[f] = malloc(BENCH_QUERIES * sizeof(kl_frustum_t));
+    bench_bvh_frusta(frusta[f], BENCH_QUERIES, fars[f], &seed);
+  }
+
+  trees_t trees[2] = { { .tree = KL_BVH_INIT }, { .tree = KL_BVH_INIT } };
+  for (int i=0; i < BENCH_N; i++) {
+    kl_bvh_insert(&trees[0].tree, bounds + i, items[i]);
+  }
+  kl_bvh_build(&trees[1].tree, items, bounds, BENCH_N, NULL);
+  for (int t=0; t < 2; t++) {
+    kl_bvh_flatten(&trees[t].flat, &trees[t].tree);
+    kl_bvh4_flatten(&trees[t].wide, &trees[t].tree);
+  }
+
+  static const char *names[] = { "inserted", "kl_bvh_build" };
+#ifdef __SSE__
+  static const char *culls[] = { "kl_bvh_flat_cull", "kl_bvh4_cull, sse" };
+#else
+  static const char *culls[] = { "kl_bvh_flat_cull", "kl_bvh4_cull, scalar" };
+#endif
+  uint64_t expected[BENCH_FARS];
+  for (int f=0; f < BENCH_FARS; f++) {
+    expected[f] = search_checksum(&trees[0].tree, frusta[f]);
+  }
+
+  int mismatched = 0;
+  printf("%-36s %10s %10s %10s\n", "queries/s, 100k objects", "far 800", "far 3000", "far 10000");
+  for (int t=0; t < 2; t++) {
+    for (int c=0; c < 2; c++) {
+      printf("%-14s %-21s", names[t], culls[c]);
+      for (int f=0; f < BENCH_FARS; f++) {
+        uint64_t checksum;
+        double ms = bench_cull(c, &trees[t], frusta[f], &checksum);
+        mismatched += checksum != expected[f];
+        printf(" %10.0f", 1000.0 / ms);
+      }
+      printf("\n");
+    }
+  }
+
+  /* the lights are around wherever the camera is */
+  kl_frustum_t *views = malloc(BENCH_FRAMES * BENCH_VIEWS * sizeof(kl_frustum_t));
+  for (int i=0; i < BENCH_FRAMES; i++) {
+    kl_frustum_t *frame = views + i * BENCH_VIEWS;
+    bench_bvh_frusta(frame, 1, 3000.0f, &seed);
+    for (int l=0; l < BENCH_LIGHTS; l++) {
+      kl_vec3f_t position = { bench_frand(&seed) * 16000.0f - 8000.0f, 0.0f, bench_frand(&seed) * 16000.0f - 8000.0f };
+      kl_camera_cube_frusta(&position, BENCH_LIGHT_RADIUS, frame + 1 + 6 * l);
+    }
+  }
+  static const char *frames[] = { "kl_bvh4_cull per view", "kl_bvh4_cull_views" };
+  printf("\n%-36s %10s %10s %10s %10s\n", "ms/frame, camera and lights", "0 lights", "1 light", "5 lights", "20 lights");
+  for (int t=0; t < 2; t++) {
+    uint64_t each[4];
+    for (int c=0; c < 2; c++) {
+      printf("%-14s %-21s", names[t], frames[c]);
+      for (int l=0; l < 4; l++) {
+        uint64_t checksum;
+        double ms = bench_frame(c, &trees[t].wide, views, lights[l], &checksum);
+        if (c == CULL_EACH) each[l] = checksum;
+        mismatched += checksum != each[l];
+        printf(" %10.4f", ms);
+      }
+      printf("\n");
+    }
+  }
+  free(views);
+
+  for (int t=0; t < 2; t++) {
+    kl_bvh4_free(&trees[t].wide);
+    kl_bvh_flat_free(&trees[t].flat);
+    kl_bvh_free(&trees[t].tree);
+  }
+
+  if (mismatched > 0) {
+    fprintf(stderr, "bench-bvh4: %d culls found different objects\n", mismatched);
+    return 1;
+  }
+  return 0;
+}
+
+/* ------------------------- */
+/* best of BENCH_RUNS in ms per query, and the checksum of everything found */
+static double bench_cull(int cull, trees_t *trees, kl_frustum_t *frusta, uint64_t *checksum) {
+  kl_array_t found;
+  kl_array_init(&found, sizeof(void*));
+  double best = 0.0;
+  for (int run=0; run < BENCH_RUNS; run++) {
+    *checksum = 0;
+    double start = bench_now_ms();
+    for (int i=0; i < BENCH_QUERIES; i++) {
+      kl_array_clear(&found);
+      if (cull == CULL_FLAT) {
+        kl_bvh_flat_cull(&trees->flat, frusta + i, &found);
+      } else {
+        kl_bvh4_cull(&trees->wide, frusta + i, &found);
+      }
+      *checksum += bench_bvh_checksum(&found);
+    }
+    double ms = (bench_now_ms() - start) / BENCH_QUERIES;
+    if (run == 0 || ms < best) best = ms;
+  }
+  kl_array_free(&found);
+  return best;
+}
+
+/* best of BENCH_RUNS in ms per frame, the checksum tells apart which view found what */
+static double bench_frame(int cull, kl_bvh4_t *wide, kl_frustum_t *views, int lights, uint64_t *checksum) {
+  int n = 1 + 6 * lights;
+  kl_array_t found[BENCH_VIEWS], visible;
+  for (int v=0; v < n; v++) {
+    kl_array_init(found + v, sizeof(void*));
+  }
+  kl_array_init(&visible, sizeof(kl_bvh_visible_t));
+  double best = 0.0;
+  for (int run=0; run < BENCH_RUNS; run++) {
+    *checksum = 0;
+    double start = bench_now_ms();
+    for (int i=0; i < BENCH_FRAMES; i++) {
+      kl_frustum_t *frame = views + i * BENCH_VIEWS;
+      for (int v=0; v < n; v++) {
+        kl_array_clear(found + v);
+      }
+      if (cull == CULL_EACH) {
+        for (int v=0; v < n; v++) {
+          kl_bvh4_cull(wide, frame + v, found + v);
+        }
+      } else {
+        for (int first=0; first < n; first += KL_BVH_VIEWS) {
+          kl_array_clear(&visible);
+          kl_bvh4_cull_views(wide, frame + first, n - first, &visible);
+          kl_bvh_visible_t *visiblev = kl_array_visible_data(&visible);
+          for (int j=0; j < kl_array_size(&visible); j++) {
+            for (uint32_t seen = visiblev[j].views; seen; seen &= seen - 1) {
+              kl_array_ptr_push(found + first + __builtin_ctz(seen), visiblev[j].item);
+            }
+          }
+        }
+      }
+      for (int v=0; v < n; v++) {
+        *checksum += bench_bvh_checksum(found + v) * (v + 1);
+      }
+    }
+    double ms = (bench_now_ms() - start) / BENCH_FRAMES;
+    if (run == 0 || ms < best) best = ms;
+  }
+  for (int v=0; v < n; v++) {
+    kl_array_free(found + v);
+  }
+  kl_array_free(&visible);
+  return best;
+}
+
+static uint64_t search_checksum(kl_bvh_t *tree, kl_frustum_t *frusta) {
+  kl_array_t found;
+  kl_array_init(&found, sizeof(void*));
+  uint64_t checksum = 0;
+  for (int i=0; i < BENCH_QUERIES; i++) {
+    kl_array_clear(&found);
+    kl_bvh_search(tree, &bench_bvh_infrustum, frusta + i, &found);
+    checksum += bench_bvh_checksum(&found);
+  }
+  kl_array_free(&found);
+  return checksum;
+}
+
+/* vim: set ts=2 sw=2 et */
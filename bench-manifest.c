@@ -0,0 +1,134 @@
+#define _XOPEN_SOURCE 700 /* clock_gettime, mkdtemp, sync */
+
+/* bench-manifest: startup cost of registering a 100k-file asset tree with kl_resource_add_dir, with
+ * no manifest beside it (the first run, which lists everything and writes one) against a manifest
+ * that's up to date.  kl_resource_scan_dir, which never touches a manifest, is the baseline.
+ *
+ * each case is run with the page cache as the previous run left it, and again after dropping it
+ * when that's allowed (root on linux), since a cold start is mostly stat()s missing the cache */
+
+#include "bench.h"
+#include "resource.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define TREE_GROUPS 10  /* top-level directories */
+#define TREE_DIRS   100 /* directories in each of them */
+#define TREE_FILES  100 /* files in each of those */
+
+#define BENCH_RUNS 5
+#define PATHLEN 0x100
+
+typedef int (*register_cb)(const char *path, const char *vpath);
+
+static double bench_case(register_cb reg, const char *root, const char *manifest, bool keep_manifest, bool cold);
+static bool   drop_caches();
+static void   tree_make(const char *root);
+static void   tree_remove(const char *path);
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  char root[] = "/tmp/kl-bench-XXXXXX";
+  if (mkdtemp(root) == NULL) {
+    perror("bench-manifest: mkdtemp");
+    return 1;
+  }
+  char manifest[PATHLEN];
+  snprintf(manifest, PATHLEN, "%s.kidx", root);
+  tree_make(root);
+
+  bool cold = drop_caches();
+  printf("%-30s %12s %12s\n", "ms, 100k files", "warm cache", cold ? "cold cache" : "");
+  printf("%-30s %12.1f", "scan, no manifest", bench_case(&kl_resource_scan_dir, root, manifest, false, false));
+  if (cold) printf(" %12.1f", bench_case(&kl_resource_scan_dir, root, manifest, false, true));
+  printf("\n%-30s %12.1f", "add, writing the manifest", bench_case(&kl_resource_add_dir, root, manifest, false, false));
+  if (cold) printf(" %12.1f", bench_case(&kl_resource_add_dir, root, manifest, false, true));
+  printf("\n%-30s %12.1f", "add, manifest up to date", bench_case(&kl_resource_add_dir, root, manifest, true, false));
+  if (cold) printf(" %12.1f", bench_case(&kl_resource_add_dir, root, manifest, true, true));
+  printf("\n");
+  if (!cold) printf("(can't drop the page cache here, run as root for cold-cache numbers)\n");
+
+  unlink(manifest);
+  tree_remove(root);
+  return 0;
+}
+
+/* ------------------------- */
+/* best of BENCH_RUNS, registering the tree from scratch each time */
+static double bench_case(register_cb reg, const char *root, const char *manifest, bool keep_manifest, bool cold) {
+  double best = 0.0;
+  if (keep_manifest) {
+    /* the manifest only vouches for directories older than itself, so write it a second on */
+    sleep(1);
+    kl_resource_add_dir(root, "bench");
+    kl_resource_remove_dir("bench");
+  }
+
+  for (int run=0; run < BENCH_RUNS; run++) {
+    if (!keep_manifest) unlink(manifest);
+    if (cold) drop_caches();
+
+    double start = bench_now_ms();
+    if (reg(root, "bench") < 0) fprintf(stderr, "bench-manifest: failed to register %s\n", root);
+    double ms = bench_now_ms() - start;
+    if (run == 0 || ms < best) best = ms;
+
+    kl_resource_remove_dir("bench");
+  }
+  return best;
+}
+
+static bool drop_caches() {
+  sync();
+  FILE *file = fopen("/proc/sys/vm/drop_caches", "w");
+  if (file == NULL) return false;
+  bool ok = fputs("3\n", file) >= 0;
+  return fclose(file) == 0 && ok;
+}
+
+/* shaped like an asset tree: a thousand directories of a hundred files, under a few groups */
+static void tree_make(const char *root) {
+  static const char *exts[] = { "png", "obj", "mtl", "iqm" };
+  char path[PATHLEN];
+  for (int g=0; g < TREE_GROUPS; g++) {
+    snprintf(path, PATHLEN, "%s/group%02d", root, g);
+    mkdir(path, 0755);
+    for (int d=0; d < TREE_DIRS; d++) {
+      snprintf(path, PATHLEN, "%s/group%02d/dir%03d", root, g, d);
+      mkdir(path, 0755);
+      for (int f=0; f < TREE_FILES; f++) {
+        snprintf(path, PATHLEN, "%s/group%02d/dir%03d/file%03d.%s", root, g, d, f, exts[f & 3]);
+        FILE *file = fopen(path, "wb");
+        if (file != NULL) fclose(file);
+      }
+    }
+  }
+}
+
+static void tree_remove(const char *path) {
+  DIR *dir = opendir(path);
+  struct dirent *ent;
+  while (dir != NULL && (ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+    char sub[PATHLEN];
+    struct stat s;
+    if (snprintf(sub, PATHLEN, "%s/%s", path, ent->d_name) >= PATHLEN) continue;
+    if (stat(sub, &s) == 0 && S_ISDIR(s.st_mode)) {
+      tree_remove(sub);
+    } else {
+      unlink(sub);
+    }
+  }
+  if (dir != NULL) closedir(dir);
+  rmdir(path);
+}
+
+/* vim: set ts=2 sw=2 et */
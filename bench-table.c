@@ -0,0 +1,186 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+/* bench-table: insert and lookup throughput of the resource table against the bucket chains it
+ * replaced, over 1M virtual paths.  the chains are reproduced here as resource.c had them: 0x1000
+ * buckets of malloc'd items holding their paths inline, told apart by id alone.  they're run with
+ * the old rotate-xor hash and with the new one, which separates the table from the hash.  filling
+ * the chains takes a couple of minutes */
+
+#include "bench.h"
+#include "resource.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_N 1000000
+#define PATHLEN 0x40
+/* 0x1000 buckets make for long chains at this size, so only every this many paths are looked up in them */
+#define CHAIN_SAMPLE 100
+
+#define CHAIN_BUCKETS 0x1000
+
+typedef kl_resource_id_t (*hash_cb)(const char *str);
+
+typedef struct chain_item {
+  char path[KL_RESITEM_PATHLEN];
+  char vpath[KL_RESITEM_PATHLEN];
+  kl_resource_id_t resid;
+  int refs;
+  void *loader;
+  void *item;
+  struct chain_item *next;
+} chain_item_t;
+
+typedef struct chains {
+  chain_item_t *buckets[CHAIN_BUCKETS];
+  hash_cb hash;
+} chains_t;
+
+typedef struct result {
+  double insert, hit, miss; /* ns per op */
+  int rejected, false_hits;
+} result_t;
+
+static void bench_chains(chains_t *chains, const char *paths, const char *misses, int step, result_t *result);
+static void bench_table(const char *paths, const char *misses, result_t *result);
+static kl_resource_id_t old_getid(const char *str);
+static bool chain_exists(chains_t *chains, kl_resource_id_t resid);
+static int  chain_add(chains_t *chains, const char *path, const char *vpath);
+static void make_paths(char *paths, const char *prefix);
+static void print_result(const char *name, result_t *result);
+
+static chains_t old_chains = { .hash = &old_getid };
+static chains_t new_chains = { .hash = &kl_resource_getid };
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  char *paths  = malloc((size_t)BENCH_N * PATHLEN);
+  char *misses = malloc((size_t)BENCH_N * PATHLEN);
+  make_paths(paths, "assets");
+  make_paths(misses, "missing");
+
+  result_t old, chained, table;
+  bench_chains(&old_chains, paths, misses, CHAIN_SAMPLE, &old);
+  bench_chains(&new_chains, paths, misses, CHAIN_SAMPLE, &chained);
+  bench_table(paths, misses, &table);
+
+  printf("%-26s %10s %10s %10s %10s %12s\n", "ns/op, 1M paths", "insert", "hit", "miss", "rejected", "false hits");
+  print_result("bucket chains, old hash", &old);
+  print_result("bucket chains, new hash", &chained);
+  print_result("robin hood", &table);
+  return 0;
+}
+
+/* ------------------------- */
+/* lookups go by id alone, like they used to -- 'step' thins them out */
+static void bench_chains(chains_t *chains, const char *paths, const char *misses, int step, result_t *result) {
+  int lookups = (BENCH_N + step - 1) / step;
+  *result = (result_t){ .rejected = 0, .false_hits = 0 };
+
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    if (chain_add(chains, paths + i * PATHLEN, paths + i * PATHLEN) < 0) result->rejected++;
+  }
+  result->insert = (bench_now_ms() - start) * 1000000.0 / BENCH_N;
+
+  start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i += step) {
+    chain_exists(chains, chains->hash(paths + i * PATHLEN));
+  }
+  result->hit = (bench_now_ms() - start) * 1000000.0 / lookups;
+
+  start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i += step) {
+    result->false_hits += chain_exists(chains, chains->hash(misses + i * PATHLEN));
+  }
+  result->miss = (bench_now_ms() - start) * 1000000.0 / lookups;
+}
+
+static void bench_table(const char *paths, const char *misses, result_t *result) {
+  *result = (result_t){ .rejected = 0, .false_hits = 0 };
+
+  double start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    if (kl_resource_add_entry(paths + i * PATHLEN, paths + i * PATHLEN) < 0) result->rejected++;
+  }
+  result->insert = (bench_now_ms() - start) * 1000000.0 / BENCH_N;
+
+  start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    if (kl_resource_find(paths + i * PATHLEN) == NULL) {
+      fprintf(stderr, "bench-table: %s went missing\n", paths + i * PATHLEN);
+    }
+  }
+  result->hit = (bench_now_ms() - start) * 1000000.0 / BENCH_N;
+
+  start = bench_now_ms();
+  for (int i=0; i < BENCH_N; i++) {
+    result->false_hits += kl_resource_find(misses + i * PATHLEN) != NULL;
+  }
+  result->miss = (bench_now_ms() - start) * 1000000.0 / BENCH_N;
+}
+
+/* kl_resource_getid as it was, including hashing the raw character after normalizing it */
+static kl_resource_id_t old_getid(const char *str) {
+  kl_resource_id_t h = 0;
+  char p = '\0';
+  for (int i=0; str[i] != '\0'; i++) {
+    char c = str[i];
+    if (c >= 'A' && c <= 'Z') {
+      c |= 0x20;
+    }
+    if (c == '\\') {
+      c = '/';
+    }
+    if (c == '/' && p == '/') {
+      continue;
+    }
+
+    h ^= str[i];
+    h  = (h << 11) | (h >> 53);
+  }
+  return h;
+}
+
+static bool chain_exists(chains_t *chains, kl_resource_id_t resid) {
+  for (chain_item_t *curr = chains->buckets[resid % CHAIN_BUCKETS]; curr != NULL; curr = curr->next) {
+    if (curr->resid == resid) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int chain_add(chains_t *chains, const char *path, const char *vpath) {
+  kl_resource_id_t resid = chains->hash(vpath);
+  if (chain_exists(chains, resid)) return -1; /* possible hash collision */
+
+  int bucket = resid % CHAIN_BUCKETS;
+  chain_item_t *item = malloc(sizeof(chain_item_t));
+  strncpy(item->path, path, KL_RESITEM_PATHLEN-1);
+  item->path[KL_RESITEM_PATHLEN-1] = '\0';
+  strncpy(item->vpath, vpath, KL_RESITEM_PATHLEN-1);
+  item->vpath[KL_RESITEM_PATHLEN-1] = '\0';
+  item->resid  = resid;
+  item->refs   = 0;
+  item->loader = NULL;
+  item->item   = NULL;
+  item->next   = chains->buckets[bucket];
+  chains->buckets[bucket] = item;
+  return 0;
+}
+
+/* shaped like an asset tree: a thousand directories of a thousand files */
+static void make_paths(char *paths, const char *prefix) {
+  static const char *exts[] = { "png", "obj", "mtl", "iqm" };
+  for (int i=0; i < BENCH_N; i++) {
+    snprintf(paths + i * PATHLEN, PATHLEN, "%s/dir%03d/file%06d.%s", prefix, i / 1000, i, exts[i & 3]);
+  }
+}
+
+static void print_result(const char *name, result_t *result) {
+  printf("%-26s %10.1f %10.1f %10.1f %10d %12d\n", name, result->insert, result->hit, result->miss, result->rejected, result->false_hits);
+}
+
+/* vim: set ts=2 sw=2 et */
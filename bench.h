@@ -0,0 +1,24 @@
+#ifndef KL_BENCH_H
+#define KL_BENCH_H
+
+/* helpers shared by the bench-* programs -- each defines _POSIX_C_SOURCE before including this */
+
+#include <stdint.h>
+#include <time.h>
+
+/* monotonic, in milliseconds */
+static inline double bench_now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+/* a repeatable sequence in [0, 1), so runs can be compared */
+static inline float bench_frand(uint32_t *seed) {
+  *seed = *seed * 1664525u + 1013904223u;
+  return (*seed >> 8) / 16777216.0f;
+}
+
+#endif /* KL_BENCH_H */
+
+/* vim: set ts=2 sw=2 et */
@@ -1,112 +1,1387 @@
+#define _POSIX_C_SOURCE 200809L /* sysconf */
+
 #include "bvhtree.h"
 
+#include "camera.h"
+#include "plane.h"
+#include "mem.h"
+
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#define BUILD_BINS     16
+#define BUILD_PARALLEL 0x1000 /* smallest subtree worth handing to another thread */
+#define WIDE_STACK     64     /* deeper trees allocate their traversal stack */
+#define POOL_INITIAL   0x40
+#define NEAR_HEAP      64     /* bigger queues for kl_bvh_nearest are allocated */
+
+typedef struct build_ref {
+  kl_sphere_t bounds;
+  void *item;
+  int index; /* in the caller's arrays */
+} build_ref_t;
+
+typedef struct box {
+  kl_vec3f_t min, max;
+} box_t;
+
+/* a subtree over n refs takes exactly 2n-1 nodes, so each one is built into its own range of
+ * the pool starting at 'base' and threads never share a node */
+typedef struct build_task {
+  kl_bvh_t *tree;
+  build_ref_t *refs;
+  int n, depth;
+  int32_t base;
+  int *handles;
+  int threads;   /* subtrees built at once, at most */
+  box_t centers; /* around the refs' centers, found by the parent's split */
+} build_task_t;
+
+/* a frustum plane, with the rows of kl_bvh4_node_t.box that hold each child's corner
+ * nearest to the inside of it */
+typedef struct wide_plane {
+  float norm[3];
+  float dist;
+  int   row[3];
+#ifdef __SSE__
+  __m128 x, y, z, d; /* the above, in every lane */
+#endif
+} wide_plane_t;
+
+/* a node still to visit, and the planes its children may cross */
+typedef struct wide_pending {
+  uint32_t node;
+  int planes;
+} wide_pending_t;
+
+/* a ray as cast: the inverse direction for slab tests, and the furthest a hit can still be */
+typedef struct ray_state {
+  kl_bvh_ray_t *ray;
+  kl_vec3f_t inv;
+  float dd; /* dir . dir */
+  float bound;
+  kl_array_t *hits;   /* the ray's own array, or scratch when there are others */
+  kl_array_t scratch;
+  int base; /* where this cast's hits start in hits */
+} ray_state_t;
+
+/* a ray that reaches a node, and where it enters the node's bounds */
+typedef struct ray_entry {
+  int   ray;
+  float t;
+} ray_entry_t;
+
+typedef struct ray_query {
+  kl_bvh_node_t *nodes;
+  ray_state_t *states;
+  kl_array_t entries; /* a stack of each pending node's rays */
+} ray_query_t;
+
+/* a node kl_bvh_nearest hasn't opened yet, and the least distance to anything in it */
+typedef struct near_entry {
+  int32_t node;
+  float   dist;
+} near_entry_t;
 
-static float node_dist(kl_bvh_node_t *s1, kl_bvh_node_t *s2);
-static kl_bvh_leaf_t* leaf_new(kl_sphere_t *bounds, void *item);
-static kl_bvh_node_t* leaf_insert(kl_bvh_node_t *curr, kl_bvh_leaf_t *leaf);
-static kl_bvh_branch_t* branch_new(kl_bvh_node_t *left, kl_bvh_node_t *right);
+typedef struct near_heap {
+  near_entry_t *entries;
+  int n, size;
+  near_entry_t local[NEAR_HEAP];
+} near_heap_t;
+
+/* the same for kl_bvh4_cull_views: the views its children may cross, and the ones it's inside */
+typedef struct wide_views {
+  uint32_t node;
+  uint32_t partial, inside;
+  uint8_t  planes[KL_BVH_VIEWS]; /* for each partial view, the planes still to test */
+} wide_views_t;
+
+typedef struct wide_copy {
+  kl_bvh_t  *tree;
+  kl_bvh4_t *wide;
+  uint32_t depth;
+} wide_copy_t;
+
+KL_ARRAY_DECLARE(void*, ptr)
+KL_ARRAY_DECLARE(ray_entry_t, entry)
+KL_ARRAY_DECLARE(kl_bvh_hit_t, hit)
+KL_ARRAY_DECLARE(kl_bvh_visible_t, visible)
+
+static int32_t node_alloc(kl_bvh_t *tree);
+static void  node_release(kl_bvh_t *tree, int32_t i);
+static bool  node_isleaf(kl_bvh_t *tree, int32_t i);
+static void  node_leaf(kl_bvh_node_t *node, kl_sphere_t *bounds, void *item);
+static void  node_fit(kl_bvh_t *tree, int32_t i);
+static void  node_box(kl_bvh_node_t *node, box_t *box);
+static float node_box_dist2(kl_bvh_node_t *node, kl_vec3f_t *point);
+static void  node_replace(kl_bvh_t *tree, int32_t parent, int32_t from, int32_t to);
+static void  leaf_attach(kl_bvh_t *tree, int32_t leaf);
+static void  leaf_detach(kl_bvh_t *tree, int32_t leaf);
+static int32_t leaf_sibling(kl_bvh_t *tree, box_t *box);
+static float descend_cost(kl_bvh_t *tree, int32_t i, box_t *box);
+static void  refit(kl_bvh_t *tree, int32_t i);
+static bool  rotate(kl_bvh_t *tree, int32_t i);
+static void  search(kl_bvh_node_t *nodes, int32_t i, kl_bvh_filter_cb filtercb, void *filter_data, kl_array_t *results);
+static void  debug(kl_bvh_node_t *nodes, int32_t i, kl_array_t *results);
+static void  raycast(ray_query_t *query, int32_t i, int first, int n);
+static int   ray_enter(ray_query_t *query, int32_t i, ray_entry_t *from, int n, ray_entry_t *to);
+static bool  ray_box(ray_state_t *state, kl_bvh_node_t *node, float *t);
+static bool  ray_sphere(ray_state_t *state, kl_sphere_t *sphere, float *t);
+static void  ray_hit(ray_state_t *state, void *item, float t);
+static float near_dist(kl_bvh_node_t *node, kl_vec3f_t *point);
+static void  near_push(near_heap_t *heap, int32_t node, float dist);
+static near_entry_t near_pop(near_heap_t *heap);
+static int   within(kl_bvh_node_t *nodes, int32_t i, kl_vec3f_t *point, float radius, void **items, int max, int found);
+static void  build(build_task_t *task);
+static void* build_main(void *arg);
+static int  build_split(build_ref_t *refs, int n, box_t *centers, box_t *bounds, box_t halves[2]);
+static void build_centers(build_ref_t *refs, int n, box_t *centers);
+static int  build_threads();
+static bool build_enclose(build_ref_t *refs, int n, box_t *box, float limit, kl_sphere_t *bounds);
+static inline int build_bin(float offset, float scale, int bins);
+static inline void  box_empty(box_t *box);
+static inline void  box_grow(box_t *box, kl_sphere_t *sphere);
+static inline void  box_merge(box_t *dst, box_t *src);
+static inline float box_area(box_t *box);
+static bool  box_contains(box_t *outer, box_t *inner);
+static float axis_of(kl_vec3f_t *v, int axis);
+static uint32_t flat_count(kl_bvh_node_t *nodes, int32_t i);
+static uint32_t flat_copy(kl_bvh_flat_node_t *flat, uint32_t f, kl_bvh_node_t *nodes, int32_t i);
+static uint32_t wide_copy(wide_copy_t *copy, int32_t node, uint32_t depth);
+static void wide_planes(wide_plane_t *planes, kl_frustum_t *frustum);
+static inline int wide_test(kl_bvh4_node_t *node, wide_plane_t *planes, int active, int inside[6]);
+static inline int wide_side(kl_bvh4_node_t *node, wide_plane_t *plane, int *inside);
+static inline int wide_straddle(int inside[6], int k);
 
 /* -------------------------- */
 
-void kl_bvh_insert(kl_bvh_node_t **root, kl_sphere_t *bounds, void *item) {
-  kl_bvh_leaf_t *leaf = leaf_new(bounds, item);
-  *root = leaf_insert(*root, leaf); 
+void kl_bvh_init(kl_bvh_t *tree) {
+  *tree = (kl_bvh_t)KL_BVH_INIT;
 }
 
-void kl_bvh_search(kl_bvh_node_t *root, kl_bvh_filter_cb filtercb, void *filter_data, kl_array_t *results) {
-  if (root == NULL) return;
-  
-  if (!filtercb(&root->header.bounds, filter_data)) return;
+void kl_bvh_free(kl_bvh_t *tree) {
+  kl_mem_free(KL_MEM_BVH, tree->nodes);
+  kl_bvh_init(tree);
+}
+
+int kl_bvh_insert(kl_bvh_t *tree, kl_sphere_t *bounds, void *item) {
+  int32_t leaf = node_alloc(tree);
+  node_leaf(tree->nodes + leaf, bounds, item);
+  tree->count++;
+  leaf_attach(tree, leaf);
+  return leaf;
+}
 
-  switch (root->header.type) {
-    case KL_BVH_LEAF:
-      kl_array_push(results, &root->leaf.item);
-      return;
-    case KL_BVH_BRANCH:
-      kl_bvh_search(root->branch.children[0], filtercb, filter_data, results);
-      kl_bvh_search(root->branch.children[1], filtercb, filter_data, results);
-      return;
+void kl_bvh_remove(kl_bvh_t *tree, int handle) {
+  leaf_detach(tree, handle);
+  node_release(tree, handle);
+  tree->count--;
+}
+
+void kl_bvh_update(kl_bvh_t *tree, int handle, kl_sphere_t *bounds) {
+  kl_bvh_node_t *leaf = tree->nodes + handle;
+  node_leaf(leaf, bounds, leaf->item);
+  if (leaf->parent == KL_BVH_NULL) return;
+
+  /* refitting never moves a leaf further than a rotation away, one that's left its parent
+   * behind would drag the whole branch along with it */
+  box_t box, parent;
+  node_box(leaf, &box);
+  node_box(tree->nodes + leaf->parent, &parent);
+  if (box_contains(&parent, &box)) {
+    refit(tree, leaf->parent);
+  } else {
+    leaf_detach(tree, handle);
+    leaf_attach(tree, handle);
   }
 }
 
-void kl_bvh_debug(kl_bvh_node_t* root, kl_array_t *results) {
-  if (root == NULL) return;
-  
-  kl_array_push(results, &root);
+void kl_bvh_build(kl_bvh_t *tree, void **items, kl_sphere_t *bounds, int n, int *handles) {
+  kl_bvh_free(tree);
+  if (n <= 0) return;
 
-  if (root->header.type == KL_BVH_BRANCH) {
-      kl_bvh_debug(root->branch.children[0], results);
-      kl_bvh_debug(root->branch.children[1], results);
+  build_ref_t *refs = kl_mem_alloc(KL_MEM_BVH, n * sizeof(build_ref_t));
+  for (int i=0; i < n; i++) {
+    refs[i].bounds = bounds[i];
+    refs[i].item   = items[i];
+    refs[i].index  = i;
   }
+  tree->capacity = 2 * n - 1;
+  tree->nodes    = kl_mem_alloc(KL_MEM_BVH, tree->capacity * sizeof(kl_bvh_node_t));
+  tree->count    = n;
+  tree->root     = 0;
+
+  build_task_t task = { .tree = tree, .refs = refs, .n = n, .depth = 0, .base = 0, .handles = handles, .threads = build_threads() };
+  build_centers(refs, n, &task.centers);
+  build(&task);
+  tree->nodes[0].parent = KL_BVH_NULL;
+  kl_mem_free(KL_MEM_BVH, refs);
 }
 
+void kl_bvh_search(kl_bvh_t *tree, kl_bvh_filter_cb filtercb, void *filter_data, kl_array_t *results) {
+  if (tree->root == KL_BVH_NULL) return;
+  search(tree->nodes, tree->root, filtercb, filter_data, results);
+}
 
-/* --------------------------- */
- 
+void kl_bvh_flatten(kl_bvh_flat_t *flat, kl_bvh_t *tree) {
+  flat->n     = tree->root != KL_BVH_NULL ? flat_count(tree->nodes, tree->root) : 0;
+  flat->nodes = NULL;
+  if (flat->n == 0) return;
+  flat->nodes = kl_mem_alloc(KL_MEM_BVH, flat->n * sizeof(kl_bvh_flat_node_t));
+  flat_copy(flat->nodes, 0, tree->nodes, tree->root);
+}
 
-static float node_dist(kl_bvh_node_t *s1, kl_bvh_node_t *s2) {
-  return kl_vec3f_dist(&s1->header.bounds.center, &s2->header.bounds.center);
+void kl_bvh_flat_free(kl_bvh_flat_t *flat) {
+  kl_mem_free(KL_MEM_BVH, flat->nodes);
+  flat->nodes = NULL;
+  flat->n     = 0;
 }
 
-static kl_bvh_leaf_t* leaf_new(kl_sphere_t *bounds, void *item) {
-  kl_bvh_leaf_t *leaf = malloc(sizeof(kl_bvh_leaf_t));
-  *leaf = (kl_bvh_leaf_t){
-    .header = {
-      .type   = KL_BVH_LEAF,
-      .bounds = *bounds
-    },
-    .item = item,
-  };
+void kl_bvh_flat_search(kl_bvh_flat_t *flat, kl_bvh_filter_cb filtercb, void *filter_data, kl_array_t *results) {
+  kl_bvh_flat_node_t *nodes = flat->nodes;
+  uint32_t i = 0;
+  while (i < flat->n) {
+    kl_bvh_flat_node_t *node = nodes + i;
+    if (!filtercb(&node->bounds, filter_data)) {
+      i = node->skip;
+      continue;
+    }
+    if (node->right == 0) kl_array_ptr_push(results, node->item);
+    i++;
+  }
+}
 
-  return leaf;
+void kl_bvh_flat_cull(kl_bvh_flat_t *flat, struct kl_frustum *frustum, kl_array_t *results) {
+  kl_bvh_flat_node_t *nodes = flat->nodes;
+  uint32_t n = flat->n;
+  uint32_t i = 0;
+  while (i < n) {
+    kl_bvh_flat_node_t *node = nodes + i;
+    kl_sphere_t *bounds = &node->bounds;
+    if (kl_plane_dist(&frustum->near,   &bounds->center) > bounds->radius ||
+        kl_plane_dist(&frustum->far,    &bounds->center) > bounds->radius ||
+        kl_plane_dist(&frustum->top,    &bounds->center) > bounds->radius ||
+        kl_plane_dist(&frustum->bottom, &bounds->center) > bounds->radius ||
+        kl_plane_dist(&frustum->left,   &bounds->center) > bounds->radius ||
+        kl_plane_dist(&frustum->right,  &bounds->center) > bounds->radius) {
+      i = node->skip;
+      continue;
+    }
+    if (node->right == 0) kl_array_ptr_push(results, node->item);
+    i++;
+  }
 }
 
-static kl_bvh_node_t* leaf_insert(kl_bvh_node_t *curr, kl_bvh_leaf_t *leaf) {
-  if (curr == NULL) return (kl_bvh_node_t*)leaf;
+void kl_bvh4_flatten(kl_bvh4_t *wide, kl_bvh_t *tree) {
+  wide->nodes    = NULL;
+  wide->items    = NULL;
+  wide->nodes_n  = 0;
+  wide->items_n  = 0;
+  wide->stack_n  = 0;
+  if (tree->root == KL_BVH_NULL) return;
+
+  /* every node but a lone leaf at the root opens at least one branch, and there's one branch
+   * fewer than there are leaves -- so this is enough, and trimmed afterwards */
+  uint32_t n = tree->count;
+  wide->nodes = kl_mem_alloc(KL_MEM_BVH, n * sizeof(kl_bvh4_node_t));
+  wide->items = kl_mem_alloc(KL_MEM_BVH, n * sizeof(void*));
 
-  kl_bvh_node_t *l;
-  kl_bvh_node_t *r;
-  switch (curr->header.type) {
-    case KL_BVH_LEAF:
-      return (kl_bvh_node_t*)branch_new(curr, (kl_bvh_node_t*)leaf);
-    case KL_BVH_BRANCH:
-      l = curr->branch.children[0];
-      r = curr->branch.children[1];
+  wide_copy_t copy = { .tree = tree, .wide = wide, .depth = 0 };
+  wide_copy(&copy, tree->root, 1);
+  wide->nodes   = kl_mem_realloc(KL_MEM_BVH, wide->nodes, wide->nodes_n * sizeof(kl_bvh4_node_t));
+  /* each level pops one node and pushes up to four */
+  wide->stack_n = 3 * copy.depth + 1;
+}
 
-      float dl = node_dist((kl_bvh_node_t*)leaf, l);
-      float dr = node_dist((kl_bvh_node_t*)leaf, r);
-      if (dl < dr) {
-        l = leaf_insert(l, leaf);
+void kl_bvh4_free(kl_bvh4_t *wide) {
+  kl_mem_free(KL_MEM_BVH, wide->nodes);
+  kl_mem_free(KL_MEM_BVH, wide->items);
+  wide->nodes    = NULL;
+  wide->items    = NULL;
+  wide->nodes_n  = 0;
+  wide->items_n  = 0;
+  wide->stack_n  = 0;
+}
+
+void kl_bvh4_cull(kl_bvh4_t *wide, struct kl_frustum *frustum, kl_array_t *results) {
+  if (wide->nodes_n == 0) return;
+
+  wide_plane_t planes[6];
+  wide_planes(planes, frustum);
+
+  wide_pending_t  local[WIDE_STACK];
+  wide_pending_t *stack = local;
+  if (wide->stack_n > WIDE_STACK) {
+    stack = kl_mem_alloc(KL_MEM_BVH, wide->stack_n * sizeof(wide_pending_t));
+  }
+
+  int top = 0;
+  stack[top++] = (wide_pending_t){ .node = 0, .planes = 0x3f };
+  while (top > 0) {
+    wide_pending_t  pending = stack[--top];
+    kl_bvh4_node_t *node    = wide->nodes + pending.node;
+    int inside[6] = { 0xf, 0xf, 0xf, 0xf, 0xf, 0xf };
+    int mask = wide_test(node, planes, pending.planes, inside);
+    /* last child first, so the first is popped next and the walk runs forward through nodes */
+    while (mask) {
+      int k = 31 - __builtin_clz(mask);
+      mask &= ~(1 << k);
+      uint32_t child = node->child[k];
+      if (child & KL_BVH4_LEAF) {
+        kl_array_ptr_push(results, wide->items[child & ~KL_BVH4_LEAF]);
+        continue;
+      }
+      int straddle = wide_straddle(inside, k);
+      if (straddle == 0) {
+        kl_bvh4_node_t *within = wide->nodes + child;
+        kl_array_append_n(results, wide->items + within->first, within->last - within->first);
       } else {
-        r = leaf_insert(r, leaf);
+        stack[top++] = (wide_pending_t){ .node = child, .planes = straddle };
       }
+    }
+  }
 
-      curr->branch.children[0] = l;
-      curr->branch.children[1] = r;
-      kl_sphere_merge(&curr->header.bounds, &l->header.bounds, &r->header.bounds);
+  if (stack != local) kl_mem_free(KL_MEM_BVH, stack);
+}
+
+void kl_bvh4_cull_views(kl_bvh4_t *wide, struct kl_frustum *frusta, int n, kl_array_t *results) {
+  if (wide->nodes_n == 0 || n <= 0) return;
+  if (n > KL_BVH_VIEWS) n = KL_BVH_VIEWS;
+
+  wide_plane_t planes[KL_BVH_VIEWS][6];
+  for (int v=0; v < n; v++) {
+    wide_planes(planes[v], frusta + v);
+  }
+
+  wide_views_t  local[WIDE_STACK];
+  wide_views_t *stack = local;
+  if (wide->stack_n > WIDE_STACK) {
+    stack = kl_mem_alloc(KL_MEM_BVH, wide->stack_n * sizeof(wide_views_t));
+  }
+
+  int top = 0;
+  stack[top].node    = 0;
+  stack[top].partial = 0xffffffffu >> (32 - n);
+  stack[top].inside  = 0;
+  memset(stack[top].planes, 0x3f, sizeof(stack[top].planes));
+  top++;
+  while (top > 0) {
+    wide_views_t   *pending = stack + --top;
+    kl_bvh4_node_t *node    = wide->nodes + pending->node;
 
-      return curr;
+    /* every child starts out inside whatever its parent was inside */
+    uint32_t partial[4] = { 0, 0, 0, 0 };
+    uint32_t inside[4]  = { pending->inside, pending->inside, pending->inside, pending->inside };
+    uint8_t  straddle[4][KL_BVH_VIEWS];
+    memset(straddle, 0, sizeof(straddle));
+    for (uint32_t views = pending->partial; views;) {
+      int v = __builtin_ctz(views);
+      views &= views - 1;
+      int active = pending->planes[v];
+      int sides[6] = { 0xf, 0xf, 0xf, 0xf, 0xf, 0xf };
+      int mask = wide_test(node, planes[v], active, sides);
+      while (mask) {
+        int k = __builtin_ctz(mask);
+        mask &= mask - 1;
+        /* leaves have nothing below them to pass planes down to */
+        int crossed = node->child[k] & KL_BVH4_LEAF ? 0x3f : wide_straddle(sides, k);
+        if (crossed == 0) {
+          inside[k]  |= 1u << v;
+        } else {
+          partial[k] |= 1u << v;
+          straddle[k][v] = crossed;
+        }
+      }
+    }
+
+    /* last child first, as kl_bvh4_cull does */
+    for (int k=3; k >= 0; k--) {
+      uint32_t child = node->child[k];
+      uint32_t views = partial[k] | inside[k];
+      if (child == KL_BVH4_EMPTY || views == 0) continue;
+      if (child & KL_BVH4_LEAF) {
+        kl_array_visible_push(results, (kl_bvh_visible_t){ .item = wide->items[child & ~KL_BVH4_LEAF], .views = views });
+      } else if (partial[k] == 0) {
+        kl_bvh4_node_t   *within = wide->nodes + child;
+        int               count  = within->last - within->first;
+        int               first  = kl_array_size(results);
+        kl_array_resize(results, first + count);
+        kl_bvh_visible_t *dst    = kl_array_visible_data(results) + first;
+        for (int i=0; i < count; i++) {
+          dst[i] = (kl_bvh_visible_t){ .item = wide->items[within->first + i], .views = views };
+        }
+      } else {
+        /* pending was the top of the stack, which this overwrites -- it's done with by now */
+        wide_views_t *push = stack + top++;
+        push->node    = child;
+        push->partial = partial[k];
+        push->inside  = inside[k];
+        memcpy(push->planes, straddle[k], sizeof(push->planes));
+      }
+    }
   }
-  return NULL; /* should never be reached */ 
+
+  if (stack != local) kl_mem_free(KL_MEM_BVH, stack);
 }
 
-static kl_bvh_branch_t* branch_new(kl_bvh_node_t *left, kl_bvh_node_t *right) {
-  kl_bvh_branch_t *branch = malloc(sizeof(kl_bvh_branch_t));
+int kl_bvh_raycast(kl_bvh_t *tree, kl_vec3f_t *origin, kl_vec3f_t *dir, float tmax, int max, kl_array_t *hits) {
+  int before = kl_array_size(hits);
+  kl_bvh_ray_t ray = { .origin = *origin, .dir = *dir, .tmax = tmax, .max = max, .hits = hits };
+  kl_bvh_raycast_n(tree, &ray, 1);
+  return kl_array_size(hits) - before;
+}
 
-  kl_sphere_t bounds;
-  kl_sphere_merge(&bounds, &left->header.bounds, &right->header.bounds);
-
-  *branch = (kl_bvh_branch_t){
-    .header = {
-      .type   = KL_BVH_BRANCH,
-      .bounds = bounds
-    },
-    .children = { left, right }
+void kl_bvh_raycast_n(kl_bvh_t *tree, kl_bvh_ray_t *rays, int n) {
+  if (tree->root == KL_BVH_NULL || n <= 0) return;
+
+  ray_query_t query = { .nodes = tree->nodes };
+  query.states = kl_mem_alloc(KL_MEM_BVH, n * sizeof(ray_state_t));
+  kl_array_entry_init(&query.entries);
+  for (int r=0; r < n; r++) {
+    ray_state_t *state = query.states + r;
+    kl_vec3f_t  *dir   = &rays[r].dir;
+    state->ray   = rays + r;
+    /* a zero component gives an infinite slab, which is what it is */
+    state->inv   = (kl_vec3f_t){ .x = 1.0f / dir->x, .y = 1.0f / dir->y, .z = 1.0f / dir->z };
+    state->dd    = kl_vec3f_dot(dir, dir);
+    state->bound = rays[r].tmax;
+    /* rays can share an array, so with more than one each keeps its hits apart until the end --
+     * interleaved, they'd break each other's order and max */
+    state->hits  = n == 1 ? rays[r].hits : &state->scratch;
+    if (n > 1) {
+      kl_array_init(&state->scratch, sizeof(kl_bvh_hit_t));
+      kl_array_set_policy(&state->scratch, &kl_array_policy_small);
+    }
+    state->base  = kl_array_size(state->hits);
+    kl_array_entry_push(&query.entries, (ray_entry_t){ .ray = r, .t = 0.0f });
+  }
+
+  kl_array_resize(&query.entries, 2 * n);
+  ray_entry_t *entries = kl_array_entry_data(&query.entries);
+  int entered = ray_enter(&query, tree->root, entries, n, entries + n);
+  kl_array_resize(&query.entries, n + entered);
+  raycast(&query, tree->root, n, entered);
+
+  for (int r=0; n > 1 && r < n; r++) {
+    kl_array_t *scratch = &query.states[r].scratch;
+    kl_array_append_n(rays[r].hits, kl_array_data(scratch), kl_array_size(scratch));
+    kl_array_free(scratch);
+  }
+  kl_array_free(&query.entries);
+  kl_mem_free(KL_MEM_BVH, query.states);
+}
+
+int kl_bvh_nearest(kl_bvh_t *tree, kl_vec3f_t *point, int k, float radius, kl_array_t *hits) {
+  if (tree->root == KL_BVH_NULL || k <= 0) return 0;
+
+  near_heap_t heap;
+  heap.entries = heap.local;
+  heap.n       = 0;
+  heap.size    = NEAR_HEAP;
+  near_push(&heap, tree->root, near_dist(tree->nodes + tree->root, point));
+
+  /* a leaf's distance is exact and every branch's is a lower bound, so leaves come off the
+   * queue in order */
+  int found = 0;
+  while (heap.n > 0 && found < k) {
+    near_entry_t   entry = near_pop(&heap);
+    kl_bvh_node_t *node  = tree->nodes + entry.node;
+    if (entry.dist > radius) break;
+    if (node->children[0] == KL_BVH_NULL) {
+      kl_array_hit_push(hits, (kl_bvh_hit_t){ .item = node->item, .t = entry.dist });
+      found++;
+      continue;
+    }
+    for (int c=0; c < 2; c++) {
+      float dist = near_dist(tree->nodes + node->children[c], point);
+      if (dist <= radius) near_push(&heap, node->children[c], dist);
+    }
+  }
+
+  if (heap.entries != heap.local) kl_mem_free(KL_MEM_BVH, heap.entries);
+  return found;
+}
+
+int kl_bvh_within(kl_bvh_t *tree, kl_vec3f_t *point, float radius, void **items, int max) {
+  if (tree->root == KL_BVH_NULL) return 0;
+  return within(tree->nodes, tree->root, point, radius, items, max, 0);
+}
+
+void kl_bvh_debug(kl_bvh_t *tree, kl_array_t *results) {
+  if (tree->root == KL_BVH_NULL) return;
+  debug(tree->nodes, tree->root, results);
+}
+
+
+/* --------------------------- */
+
+
+static int32_t node_alloc(kl_bvh_t *tree) {
+  if (tree->free == KL_BVH_NULL) {
+    int32_t capacity = tree->capacity > 0 ? tree->capacity * 2 : POOL_INITIAL;
+    tree->nodes = kl_mem_realloc(KL_MEM_BVH, tree->nodes, capacity * sizeof(kl_bvh_node_t));
+    for (int32_t i=tree->capacity; i < capacity; i++) {
+      tree->nodes[i].parent = i + 1 < capacity ? i + 1 : KL_BVH_NULL;
+    }
+    tree->free     = tree->capacity;
+    tree->capacity = capacity;
+  }
+  int32_t i = tree->free;
+  tree->free = tree->nodes[i].parent;
+  return i;
+}
+
+static void node_release(kl_bvh_t *tree, int32_t i) {
+  tree->nodes[i].parent = tree->free;
+  tree->free = i;
+}
+
+static bool node_isleaf(kl_bvh_t *tree, int32_t i) {
+  return tree->nodes[i].children[0] == KL_BVH_NULL;
+}
+
+static void node_leaf(kl_bvh_node_t *node, kl_sphere_t *bounds, void *item) {
+  box_t box;
+  box_empty(&box);
+  box_grow(&box, bounds);
+  node->bounds      = *bounds;
+  node->min         = box.min;
+  node->max         = box.max;
+  node->item        = item;
+  node->children[0] = KL_BVH_NULL;
+  node->children[1] = KL_BVH_NULL;
+}
+
+/* recomputes a branch's box and sphere from its children's */
+static void node_fit(kl_bvh_t *tree, int32_t i) {
+  kl_bvh_node_t *nodes = tree->nodes;
+  kl_bvh_node_t *node  = nodes + i;
+  kl_bvh_node_t *l = nodes + node->children[0];
+  kl_bvh_node_t *r = nodes + node->children[1];
+  box_t box, right;
+  node_box(l, &box);
+  node_box(r, &right);
+  box_merge(&box, &right);
+  node->min = box.min;
+  node->max = box.max;
+
+  /* merged spheres get looser with every level, the one around the box doesn't */
+  kl_sphere_merge(&node->bounds, &l->bounds, &r->bounds);
+  kl_vec3f_t center, diagonal;
+  kl_vec3f_add(&center, &box.min, &box.max);
+  kl_vec3f_scale(&center, &center, 0.5f);
+  kl_vec3f_sub(&diagonal, &box.max, &box.min);
+  float radius = kl_vec3f_magnitude(&diagonal) * 0.5f;
+  if (radius < node->bounds.radius) {
+    node->bounds.center = center;
+    node->bounds.radius = radius;
+  }
+}
+
+/* squared, 0 inside */
+static float node_box_dist2(kl_bvh_node_t *node, kl_vec3f_t *point) {
+  float box = 0.0f;
+  for (int axis=0; axis < 3; axis++) {
+    float p = axis_of(point, axis);
+    float d = fmaxf(axis_of(&node->min, axis) - p, p - axis_of(&node->max, axis));
+    if (d > 0.0f) box += d * d;
+  }
+  return box;
+}
+
+static void node_box(kl_bvh_node_t *node, box_t *box) {
+  box->min = node->min;
+  box->max = node->max;
+}
+
+/* points whatever referred to 'from' at 'to' instead */
+static void node_replace(kl_bvh_t *tree, int32_t parent, int32_t from, int32_t to) {
+  tree->nodes[to].parent = parent;
+  if (parent == KL_BVH_NULL) {
+    tree->root = to;
+    return;
+  }
+  kl_bvh_node_t *node = tree->nodes + parent;
+  node->children[node->children[0] == from ? 0 : 1] = to;
+}
+
+/* pairs the leaf with the best sibling under a new branch */
+static void leaf_attach(kl_bvh_t *tree, int32_t leaf) {
+  if (tree->root == KL_BVH_NULL) {
+    tree->root = leaf;
+    tree->nodes[leaf].parent = KL_BVH_NULL;
+    return;
+  }
+  box_t box;
+  node_box(tree->nodes + leaf, &box);
+  int32_t sibling = leaf_sibling(tree, &box);
+  int32_t branch  = node_alloc(tree);
+  kl_bvh_node_t *nodes = tree->nodes;
+  int32_t parent = nodes[sibling].parent;
+
+  nodes[branch].item        = NULL;
+  nodes[branch].children[0] = sibling;
+  nodes[branch].children[1] = leaf;
+  node_fit(tree, branch);
+  node_replace(tree, parent, sibling, branch);
+  nodes[sibling].parent = branch;
+  nodes[leaf].parent    = branch;
+  refit(tree, parent);
+}
+
+/* takes the leaf out along with its parent, whose other child moves up into its place */
+static void leaf_detach(kl_bvh_t *tree, int32_t leaf) {
+  kl_bvh_node_t *nodes = tree->nodes;
+  int32_t parent = nodes[leaf].parent;
+  if (parent == KL_BVH_NULL) {
+    tree->root = KL_BVH_NULL;
+    return;
+  }
+  int32_t grandparent = nodes[parent].parent;
+  int32_t sibling = nodes[parent].children[nodes[parent].children[0] == leaf ? 1 : 0];
+  node_replace(tree, grandparent, parent, sibling);
+  node_release(tree, parent);
+  nodes[leaf].parent = KL_BVH_NULL;
+  refit(tree, grandparent);
+}
+
+/* descends towards the cheapest spot, a new branch costs the area of its box and every
+ * ancestor's growth -- stops once going further can't be cheaper than pairing up here */
+static int32_t leaf_sibling(kl_bvh_t *tree, box_t *box) {
+  kl_bvh_node_t *nodes = tree->nodes;
+  int32_t i = tree->root;
+  while (!node_isleaf(tree, i)) {
+    box_t merged;
+    node_box(nodes + i, &merged);
+    float area = box_area(&merged);
+    box_merge(&merged, box);
+    float combined = box_area(&merged);
+    float cost     = 2.0f * combined;
+    float inherit  = 2.0f * (combined - area);
+
+    float cost0 = descend_cost(tree, nodes[i].children[0], box) + inherit;
+    float cost1 = descend_cost(tree, nodes[i].children[1], box) + inherit;
+    if (cost < cost0 && cost < cost1) break;
+    i = nodes[i].children[cost0 < cost1 ? 0 : 1];
+  }
+  return i;
+}
+
+/* a lower bound on what going down into node i costs */
+static float descend_cost(kl_bvh_t *tree, int32_t i, box_t *box) {
+  box_t merged;
+  node_box(tree->nodes + i, &merged);
+  float area = box_area(&merged);
+  box_merge(&merged, box);
+  float cost = box_area(&merged);
+  if (!node_isleaf(tree, i)) cost -= area;
+  return cost;
+}
+
+/* recomputes the bounds of i and its ancestors, up to the first one that comes out the same --
+ * nothing above it could change either */
+static void refit(kl_bvh_t *tree, int32_t i) {
+  kl_bvh_node_t *nodes = tree->nodes;
+  while (i != KL_BVH_NULL) {
+    kl_bvh_node_t *node  = nodes + i;
+    kl_bvh_node_t before = *node;
+    bool rotated = rotate(tree, i);
+    node_fit(tree, i);
+    /* the sphere and box are the first fields */
+    if (!rotated && memcmp(&before, node, offsetof(kl_bvh_node_t, item)) == 0) break;
+    i = node->parent;
+  }
+}
+
+/* swaps one of i's children with a grandchild on the other side if that shrinks the branch
+ * between them, i itself covers the same leaves either way */
+static bool rotate(kl_bvh_t *tree, int32_t i) {
+  kl_bvh_node_t *nodes = tree->nodes;
+  int32_t *children = nodes[i].children;
+
+  float best_gain = 0.0f;
+  int   best_side = -1;
+  int   best_k    = 0;
+  for (int side=0; side < 2; side++) {
+    int32_t branch = children[side];
+    int32_t moved  = children[1 - side];
+    if (node_isleaf(tree, branch)) continue;
+    box_t box;
+    node_box(nodes + branch, &box);
+    float area = box_area(&box);
+    for (int k=0; k < 2; k++) {
+      box_t merged, stays;
+      node_box(nodes + moved, &merged);
+      node_box(nodes + nodes[branch].children[1 - k], &stays);
+      box_merge(&merged, &stays);
+      float gain = area - box_area(&merged);
+      if (gain > best_gain) {
+        best_gain = gain;
+        best_side = side;
+        best_k    = k;
+      }
+    }
+  }
+  if (best_side < 0) return false;
+
+  int32_t branch = children[best_side];
+  int32_t moved  = children[1 - best_side];
+  int32_t raised = nodes[branch].children[best_k];
+  children[1 - best_side]        = raised;
+  nodes[raised].parent           = i;
+  nodes[branch].children[best_k] = moved;
+  nodes[moved].parent            = branch;
+  node_fit(tree, branch);
+  return true;
+}
+
+static void search(kl_bvh_node_t *nodes, int32_t i, kl_bvh_filter_cb filtercb, void *filter_data, kl_array_t *results) {
+  kl_bvh_node_t *node = nodes + i;
+  if (!filtercb(&node->bounds, filter_data)) return;
+
+  if (node->children[0] == KL_BVH_NULL) {
+    kl_array_ptr_push(results, node->item);
+    return;
+  }
+  search(nodes, node->children[0], filtercb, filter_data, results);
+  search(nodes, node->children[1], filtercb, filter_data, results);
+}
+
+static void debug(kl_bvh_node_t *nodes, int32_t i, kl_array_t *results) {
+  kl_array_ptr_push(results, nodes + i);
+
+  if (nodes[i].children[0] != KL_BVH_NULL) {
+    debug(nodes, nodes[i].children[0], results);
+    debug(nodes, nodes[i].children[1], results);
+  }
+}
+
+/* entries[first..first+n) are the rays that reach node i */
+static void raycast(ray_query_t *query, int32_t i, int first, int n) {
+  kl_bvh_node_t *node = query->nodes + i;
+  ray_entry_t *entries = kl_array_entry_data(&query->entries);
+  if (node->children[0] == KL_BVH_NULL) {
+    for (int e=first; e < first + n; e++) {
+      ray_state_t *state = query->states + entries[e].ray;
+      if (entries[e].t <= state->bound) ray_hit(state, node->item, entries[e].t);
+    }
+    return;
+  }
+
+  /* the children's rays go on top of the stack, and come off again before returning */
+  int top = kl_array_size(&query->entries);
+  kl_array_resize(&query->entries, top + 2 * n);
+  entries = kl_array_entry_data(&query->entries);
+  int32_t near = node->children[0];
+  int32_t far  = node->children[1];
+  int near_first = top;
+  int near_n     = ray_enter(query, near, entries + first, n, entries + near_first);
+  int far_first  = near_first + near_n;
+  int far_n      = ray_enter(query, far, entries + first, n, entries + far_first);
+  kl_array_resize(&query->entries, far_first + far_n);
+
+  /* the rays don't agree on which child is nearer, go with most of them */
+  int votes = 0;
+  for (int a=near_first, b=far_first; a < far_first && b < far_first + far_n;) {
+    if (entries[a].ray < entries[b].ray) {
+      a++;
+    } else if (entries[b].ray < entries[a].ray) {
+      b++;
+    } else {
+      votes += entries[a].t <= entries[b].t ? 1 : -1;
+      a++;
+      b++;
+    }
+  }
+  if (votes < 0) {
+    raycast(query, far, far_first, far_n);
+    if (near_n > 0) raycast(query, near, near_first, near_n);
+  } else {
+    if (near_n > 0) raycast(query, near, near_first, near_n);
+    if (far_n  > 0) raycast(query, far,  far_first,  far_n);
+  }
+  kl_array_resize(&query->entries, top);
+}
+
+/* copies each of the n entries in 'from' whose ray reaches node i no further than its bound
+ * to 'to', with where it enters.  returns how many did */
+static int ray_enter(ray_query_t *query, int32_t i, ray_entry_t *from, int n, ray_entry_t *to) {
+  kl_bvh_node_t *node = query->nodes + i;
+  bool leaf = node->children[0] == KL_BVH_NULL;
+  int entered = 0;
+  for (int e=0; e < n; e++) {
+    ray_state_t *state = query->states + from[e].ray;
+    if (from[e].t > state->bound) continue;
+    /* leaves are entered at their sphere, so that's what hits measure */
+    float t;
+    if (leaf ? ray_sphere(state, &node->bounds, &t) : ray_box(state, node, &t)) {
+      to[entered].ray = from[e].ray;
+      to[entered].t   = t;
+      entered++;
+    }
+  }
+  return entered;
+}
+
+static bool ray_box(ray_state_t *state, kl_bvh_node_t *node, float *t) {
+  kl_vec3f_t *origin = &state->ray->origin;
+  float lo = 0.0f;
+  float hi = state->bound;
+  for (int axis=0; axis < 3; axis++) {
+    float o   = axis_of(origin, axis);
+    float inv = axis_of(&state->inv, axis);
+    float t0  = (axis_of(&node->min, axis) - o) * inv;
+    float t1  = (axis_of(&node->max, axis) - o) * inv;
+    /* written so a NaN, from an origin on the slab of an axis the ray runs along, is ignored */
+    if (t0 > t1) {
+      float swap = t0;
+      t0 = t1;
+      t1 = swap;
+    }
+    if (t0 > lo) lo = t0;
+    if (t1 < hi) hi = t1;
+  }
+  *t = lo;
+  return lo <= hi;
+}
+
+static bool ray_sphere(ray_state_t *state, kl_sphere_t *sphere, float *t) {
+  kl_vec3f_t *dir = &state->ray->dir;
+  kl_vec3f_t  offset;
+  kl_vec3f_sub(&offset, &state->ray->origin, &sphere->center);
+  float c = kl_vec3f_dot(&offset, &offset) - sphere->radius * sphere->radius;
+  if (c <= 0.0f) {
+    *t = 0.0f;
+    return true;
+  }
+  float b = kl_vec3f_dot(&offset, dir);
+  if (b >= 0.0f) return false;
+  /* measured from the closest approach rather than as b*b - dd*c, which loses everything to
+   * cancellation for small spheres far away */
+  float closest = -b / state->dd;
+  kl_vec3f_t miss;
+  kl_vec3f_scale(&miss, dir, closest);
+  kl_vec3f_add(&miss, &miss, &offset);
+  float disc = sphere->radius * sphere->radius - kl_vec3f_dot(&miss, &miss);
+  if (disc < 0.0f) return false;
+  *t = closest - sqrtf(disc / state->dd);
+  return *t <= state->bound;
+}
+
+/* inserts a hit in order, dropping the furthest once there are more than the ray keeps.  hits
+ * mostly arrive nearest first, so this seldom moves anything */
+static void ray_hit(ray_state_t *state, void *item, float t) {
+  kl_array_t *hits = state->hits;
+  int i = kl_array_hit_push(hits, (kl_bvh_hit_t){ .item = item, .t = t });
+  kl_bvh_hit_t *data = kl_array_hit_data(hits);
+  for (; i > state->base && data[i-1].t > t; i--) {
+    kl_bvh_hit_t swap = data[i];
+    data[i]   = data[i-1];
+    data[i-1] = swap;
+  }
+  int max = state->ray->max;
+  if (max > 0 && kl_array_size(hits) - state->base >= max) {
+    kl_array_resize(hits, state->base + max);
+    state->bound = data[state->base + max - 1].t;
+  }
+}
+
+/* the larger of the distances to the node's box and to its sphere, both of which hold everything
+ * below it.  a leaf's box is around its sphere, so for leaves it's the sphere's */
+static float near_dist(kl_bvh_node_t *node, kl_vec3f_t *point) {
+  float sphere = kl_vec3f_dist(point, &node->bounds.center) - node->bounds.radius;
+  return fmaxf(fmaxf(sqrtf(node_box_dist2(node, point)), sphere), 0.0f);
+}
+
+static void near_push(near_heap_t *heap, int32_t node, float dist) {
+  if (heap->n == heap->size) {
+    heap->size *= 2;
+    if (heap->entries == heap->local) {
+      heap->entries = kl_mem_alloc(KL_MEM_BVH, heap->size * sizeof(near_entry_t));
+      memcpy(heap->entries, heap->local, heap->n * sizeof(near_entry_t));
+    } else {
+      heap->entries = kl_mem_realloc(KL_MEM_BVH, heap->entries, heap->size * sizeof(near_entry_t));
+    }
+  }
+  near_entry_t *entries = heap->entries;
+  int i = heap->n++;
+  while (i > 0 && entries[(i - 1) / 2].dist > dist) {
+    entries[i] = entries[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  entries[i] = (near_entry_t){ .node = node, .dist = dist };
+}
+
+static near_entry_t near_pop(near_heap_t *heap) {
+  near_entry_t *entries = heap->entries;
+  near_entry_t  top     = entries[0];
+  near_entry_t  last    = entries[--heap->n];
+  int i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= heap->n) break;
+    if (child + 1 < heap->n && entries[child + 1].dist < entries[child].dist) child++;
+    if (entries[child].dist >= last.dist) break;
+    entries[i] = entries[child];
+    i = child;
+  }
+  entries[i] = last;
+  return top;
+}
+
+/* 'found' items have been counted so far, returns the count after this subtree */
+static int within(kl_bvh_node_t *nodes, int32_t i, kl_vec3f_t *point, float radius, void **items, int max, int found) {
+  kl_bvh_node_t *node = nodes + i;
+  float reach = node->bounds.radius + radius;
+  kl_vec3f_t offset;
+  kl_vec3f_sub(&offset, point, &node->bounds.center);
+  if (kl_vec3f_dot(&offset, &offset) > reach * reach) return found;
+
+  if (node->children[0] == KL_BVH_NULL) {
+    if (found < max) items[found] = node->item;
+    return found + 1;
+  }
+  /* the box is tighter around long thin branches */
+  if (node_box_dist2(node, point) > radius * radius) return found;
+
+  found = within(nodes, node->children[0], point, radius, items, max, found);
+  return  within(nodes, node->children[1], point, radius, items, max, found);
+}
+
+/* splits refs in two (in place) and builds each half -- the halves are disjoint, so the
+ * larger ones near the top are built on their own threads */
+static void build(build_task_t *task) {
+  kl_bvh_node_t *node = task->tree->nodes + task->base;
+  build_ref_t *refs = task->refs;
+  int n = task->n;
+  if (n == 1) {
+    node_leaf(node, &refs[0].bounds, refs[0].item);
+    if (task->handles != NULL) task->handles[refs[0].index] = task->base;
+    return;
+  }
+
+  box_t bounds, halves[2];
+  int mid = build_split(refs, n, &task->centers, &bounds, halves);
+  build_task_t left  = *task;
+  build_task_t right = *task;
+  left.n        = mid;
+  left.depth    = task->depth + 1;
+  left.base     = task->base + 1;
+  left.centers  = halves[0];
+  right.refs    = refs + mid;
+  right.n       = n - mid;
+  right.depth   = task->depth + 1;
+  right.base    = left.base + 2 * mid - 1;
+  right.centers = halves[1];
+
+  pthread_t thread;
+  bool spawned = false;
+  if (n >= BUILD_PARALLEL && (1 << (task->depth + 1)) <= task->threads) {
+    spawned = pthread_create(&thread, NULL, &build_main, &left) == 0;
+  }
+  if (!spawned) build(&left);
+  build(&right);
+  if (spawned) pthread_join(thread, NULL);
+
+  kl_bvh_node_t *nodes = task->tree->nodes;
+  node->item        = NULL;
+  node->children[0] = left.base;
+  node->children[1] = right.base;
+  nodes[left.base].parent  = task->base;
+  nodes[right.base].parent = task->base;
+  node_fit(task->tree, task->base);
+  /* tighter still, a sphere around the items themselves -- the children reordered refs, but
+   * they're still the same ones */
+  kl_sphere_t tight;
+  if (build_enclose(refs, n, &bounds, node->bounds.radius, &tight)) {
+    node->bounds = tight;
+  }
+}
+
+static void* build_main(void *arg) {
+  build(arg);
+  return NULL;
+}
+
+/* returns the number of refs moved to the left half, which is never 0 or n, along with the box
+ * around all their spheres and the boxes around each half's centers, which the halves split on.
+ * every axis is binned in the one pass, and small splits get a bin per ref rather than testing
+ * BUILD_BINS mostly empty ones -- most splits are over a handful */
+static int build_split(build_ref_t *refs, int n, box_t *centers, box_t *bounds, box_t halves[2]) {
+  int bins = n < BUILD_BINS ? n : BUILD_BINS;
+  float lo[3], scale[3];
+  for (int axis=0; axis < 3; axis++) {
+    lo[axis] = axis_of(&centers->min, axis);
+    float ext = axis_of(&centers->max, axis) - lo[axis];
+    scale[axis] = ext > 0.0f ? bins / ext : 0.0f;
+  }
+
+  box_t boxes[3][BUILD_BINS];
+  int counts[3][BUILD_BINS];
+  for (int axis=0; axis < 3; axis++) {
+    for (int b=0; b < bins; b++) {
+      box_empty(&boxes[axis][b]);
+      counts[axis][b] = 0;
+    }
+  }
+  for (int i=0; i < n; i++) {
+    kl_vec3f_t *c = &refs[i].bounds.center;
+    float r = refs[i].bounds.radius;
+    box_t box = { { c->x - r, c->y - r, c->z - r }, { c->x + r, c->y + r, c->z + r } };
+    int bx = build_bin(c->x - lo[0], scale[0], bins);
+    int by = build_bin(c->y - lo[1], scale[1], bins);
+    int bz = build_bin(c->z - lo[2], scale[2], bins);
+    box_merge(&boxes[0][bx], &box);
+    box_merge(&boxes[1][by], &box);
+    box_merge(&boxes[2][bz], &box);
+    counts[0][bx]++;
+    counts[1][by]++;
+    counts[2][bz]++;
+  }
+  box_empty(bounds);
+  for (int b=0; b < bins; b++) {
+    box_merge(bounds, &boxes[0][b]);
+  }
+
+  /* the cost of a split is each side's surface area times its item count, measured on the
+   * boxes around the spheres since those are cheap to merge */
+  int   best_axis = -1;
+  int   best_bin  = 0;
+  float best_cost = FLT_MAX;
+  for (int axis=0; axis < 3; axis++) {
+    if (scale[axis] == 0.0f) continue;
+
+    float left_cost[BUILD_BINS];
+    box_t acc;
+    box_empty(&acc);
+    int count = 0;
+    for (int b=0; b < bins - 1; b++) {
+      box_merge(&acc, &boxes[axis][b]);
+      count += counts[axis][b];
+      left_cost[b] = count > 0 ? box_area(&acc) * count : 0.0f;
+    }
+    box_empty(&acc);
+    count = 0;
+    for (int b=bins - 1; b > 0; b--) {
+      box_merge(&acc, &boxes[axis][b]);
+      count += counts[axis][b];
+      float cost = left_cost[b-1] + (count > 0 ? box_area(&acc) * count : 0.0f);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin  = b;
+      }
+    }
+  }
+
+  /* every center in the same place, any split is as good as another */
+  if (best_axis < 0) {
+    halves[0] = halves[1] = *centers;
+    return n / 2;
+  }
+
+  box_empty(&halves[0]);
+  box_empty(&halves[1]);
+  int i = 0;
+  int j = n - 1;
+  while (i <= j) {
+    kl_sphere_t point = { .center = refs[i].bounds.center, .radius = 0.0f };
+    if (build_bin(axis_of(&point.center, best_axis) - lo[best_axis], scale[best_axis], bins) < best_bin) {
+      box_grow(&halves[0], &point);
+      i++;
+    } else {
+      box_grow(&halves[1], &point);
+      build_ref_t temp = refs[i];
+      refs[i] = refs[j];
+      refs[j] = temp;
+      j--;
+    }
+  }
+  if (i > 0 && i < n) return i;
+
+  /* float error put everything in one bin */
+  build_centers(refs, n / 2, &halves[0]);
+  build_centers(refs + n / 2, n - n / 2, &halves[1]);
+  return n / 2;
+}
+
+/* no more than there are cores to run them, a thread per subtree only ever added overhead on one */
+static int build_threads() {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  long cpus = info.dwNumberOfProcessors;
+#else
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (cpus < 1) return 1;
+  return cpus < KL_BVH_BUILD_THREADS ? cpus : KL_BVH_BUILD_THREADS;
+}
+
+static void build_centers(build_ref_t *refs, int n, box_t *centers) {
+  box_empty(centers);
+  for (int i=0; i < n; i++) {
+    kl_sphere_t point = { .center = refs[i].bounds.center, .radius = 0.0f };
+    box_grow(centers, &point);
+  }
+}
+
+/* centered on the box around the items, so it's never further off than the box's corner -- gives
+ * up, returning false, as soon as it's no smaller than limit */
+static bool build_enclose(build_ref_t *refs, int n, box_t *box, float limit, kl_sphere_t *bounds) {
+  kl_vec3f_t center;
+  kl_vec3f_add(&center, &box->min, &box->max);
+  kl_vec3f_scale(&center, &center, 0.5f);
+
+  float radius = 0.0f;
+  for (int i=0; i < n; i++) {
+    float r = kl_vec3f_dist(&center, &refs[i].bounds.center) + refs[i].bounds.radius;
+    if (r >= limit) return false;
+    if (r > radius) radius = r;
+  }
+  bounds->center = center;
+  bounds->radius = radius;
+  return true;
+}
+
+static inline int build_bin(float offset, float scale, int bins) {
+  int b = (int)(offset * scale);
+  if (b < 0) return 0;
+  if (b >= bins) return bins - 1;
+  return b;
+}
+
+static inline void box_empty(box_t *box) {
+  box->min = (kl_vec3f_t){ .x =  FLT_MAX, .y =  FLT_MAX, .z =  FLT_MAX };
+  box->max = (kl_vec3f_t){ .x = -FLT_MAX, .y = -FLT_MAX, .z = -FLT_MAX };
+}
+
+/* written as selects rather than ifs, which compile to minss/maxss instead of branches that
+ * mispredict all through kl_bvh_build's binning */
+static inline void box_grow(box_t *box, kl_sphere_t *sphere) {
+  kl_vec3f_t *c = &sphere->center;
+  float r = sphere->radius;
+  box->min.x = c->x - r < box->min.x ? c->x - r : box->min.x;
+  box->min.y = c->y - r < box->min.y ? c->y - r : box->min.y;
+  box->min.z = c->z - r < box->min.z ? c->z - r : box->min.z;
+  box->max.x = c->x + r > box->max.x ? c->x + r : box->max.x;
+  box->max.y = c->y + r > box->max.y ? c->y + r : box->max.y;
+  box->max.z = c->z + r > box->max.z ? c->z + r : box->max.z;
+}
+
+static inline void box_merge(box_t *dst, box_t *src) {
+  dst->min.x = src->min.x < dst->min.x ? src->min.x : dst->min.x;
+  dst->min.y = src->min.y < dst->min.y ? src->min.y : dst->min.y;
+  dst->min.z = src->min.z < dst->min.z ? src->min.z : dst->min.z;
+  dst->max.x = src->max.x > dst->max.x ? src->max.x : dst->max.x;
+  dst->max.y = src->max.y > dst->max.y ? src->max.y : dst->max.y;
+  dst->max.z = src->max.z > dst->max.z ? src->max.z : dst->max.z;
+}
+
+/* half of it, only ever compared */
+static inline float box_area(box_t *box) {
+  float dx = box->max.x - box->min.x;
+  float dy = box->max.y - box->min.y;
+  float dz = box->max.z - box->min.z;
+  return dx * dy + dy * dz + dz * dx;
+}
+
+static bool box_contains(box_t *outer, box_t *inner) {
+  return inner->min.x >= outer->min.x && inner->max.x <= outer->max.x &&
+         inner->min.y >= outer->min.y && inner->max.y <= outer->max.y &&
+         inner->min.z >= outer->min.z && inner->max.z <= outer->max.z;
+}
+
+static float axis_of(kl_vec3f_t *v, int axis) {
+  switch (axis) {
+    case 0:  return v->x;
+    case 1:  return v->y;
+    default: return v->z;
+  }
+}
+
+static uint32_t flat_count(kl_bvh_node_t *nodes, int32_t i) {
+  if (nodes[i].children[0] == KL_BVH_NULL) return 1;
+  return 1 + flat_count(nodes, nodes[i].children[0]) + flat_count(nodes, nodes[i].children[1]);
+}
+
+/* returns the index after the subtree */
+static uint32_t flat_copy(kl_bvh_flat_node_t *flat, uint32_t f, kl_bvh_node_t *nodes, int32_t i) {
+  kl_bvh_flat_node_t *dst  = flat + f;
+  kl_bvh_node_t      *node = nodes + i;
+  dst->bounds = node->bounds;
+  if (node->children[0] == KL_BVH_NULL) {
+    dst->skip  = f + 1;
+    dst->right = 0;
+    dst->item  = node->item;
+    return f + 1;
+  }
+  dst->item  = NULL;
+  dst->right = flat_copy(flat, f + 1, nodes, node->children[0]);
+  dst->skip  = flat_copy(flat, dst->right, nodes, node->children[1]);
+  return dst->skip;
+}
+
+/* gathers up to four children by repeatedly opening the largest branch among them, returns
+ * the index of the copy */
+static uint32_t wide_copy(wide_copy_t *copy, int32_t node, uint32_t depth) {
+  kl_bvh_node_t *nodes = copy->tree->nodes;
+  kl_bvh4_t     *wide  = copy->wide;
+  int32_t children[4];
+  int n = 0;
+  if (nodes[node].children[0] == KL_BVH_NULL) {
+    children[n++] = node;
+  } else {
+    children[n++] = nodes[node].children[0];
+    children[n++] = nodes[node].children[1];
+  }
+  while (n < 4) {
+    int open = -1;
+    for (int k=0; k < n; k++) {
+      if (nodes[children[k]].children[0] == KL_BVH_NULL) continue;
+      if (open < 0 || nodes[children[k]].bounds.radius > nodes[children[open]].bounds.radius) open = k;
+    }
+    if (open < 0) break;
+    int32_t branch = children[open];
+    children[open] = nodes[branch].children[0];
+    children[n++]  = nodes[branch].children[1];
+  }
+  if (depth > copy->depth) copy->depth = depth;
+
+  uint32_t i = wide->nodes_n++;
+  wide->nodes[i].first = wide->items_n;
+  for (int k=0; k < 4; k++) {
+    box_t child;
+    kl_sphere_t sphere = { .center = { 0.0f, 0.0f, 0.0f }, .radius = 0.0f };
+    uint32_t index;
+    if (k >= n) {
+      box_empty(&child);
+      index = KL_BVH4_EMPTY;
+    } else if (nodes[children[k]].children[0] == KL_BVH_NULL) {
+      node_box(nodes + children[k], &child);
+      sphere = nodes[children[k]].bounds;
+      index  = wide->items_n++;
+      wide->items[index] = nodes[children[k]].item;
+      index |= KL_BVH4_LEAF;
+    } else {
+      node_box(nodes + children[k], &child);
+      sphere = nodes[children[k]].bounds;
+      index  = wide_copy(copy, children[k], depth + 1);
+    }
+    kl_bvh4_node_t *dst = wide->nodes + i;
+    dst->box[0][k]    = child.min.x;
+    dst->box[1][k]    = child.max.x;
+    dst->box[2][k]    = child.min.y;
+    dst->box[3][k]    = child.max.y;
+    dst->box[4][k]    = child.min.z;
+    dst->box[5][k]    = child.max.z;
+    dst->sphere[0][k] = sphere.center.x;
+    dst->sphere[1][k] = sphere.center.y;
+    dst->sphere[2][k] = sphere.center.z;
+    dst->sphere[3][k] = sphere.radius;
+    dst->child[k]     = index;
+  }
+  wide->nodes[i].last = wide->items_n;
+  return i;
+}
+
+static void wide_planes(wide_plane_t *planes, kl_frustum_t *frustum) {
+  kl_plane_t *src[6] = {
+    &frustum->near, &frustum->far, &frustum->top, &frustum->bottom, &frustum->left, &frustum->right
   };
+  for (int p=0; p < 6; p++) {
+    float norm[3] = { src[p]->norm.x, src[p]->norm.y, src[p]->norm.z };
+    for (int a=0; a < 3; a++) {
+      planes[p].norm[a] = norm[a];
+      /* normals point out of the frustum, the corner furthest against one is the min */
+      planes[p].row[a]  = 2 * a + (norm[a] > 0.0f ? 0 : 1);
+    }
+    planes[p].dist = src[p]->dist;
+#ifdef __SSE__
+    planes[p].x = _mm_set1_ps(norm[0]);
+    planes[p].y = _mm_set1_ps(norm[1]);
+    planes[p].z = _mm_set1_ps(norm[2]);
+    planes[p].d = _mm_set1_ps(src[p]->dist);
+#endif
+  }
+}
 
-  return branch;
+/* tests the children against the planes in 'active', returns a bit for each child whose box and
+ * sphere both aren't out of any of them, and sets a bit in inside[p] for each child that's
+ * entirely inside plane p */
+static inline int wide_test(kl_bvh4_node_t *node, wide_plane_t *planes, int active, int inside[6]) {
+  int out = 0;
+  for (int p=0; p < 6; p++) {
+    if (!(active & (1 << p))) continue;
+    out |= wide_side(node, planes + p, inside + p);
+  }
+  return ~out & 0xf;
 }
 
+/* a box is out when its innermost corner is outside the plane, and inside it when its outermost
+ * corner is.  returns a bit for each child that's out -- an empty slot's corner is at +/-FLT_MAX,
+ * which is out of every plane.  spheres are compared just like kl_plane_dist does, so results
+ * match the sphere tree's to the bit */
+static inline int wide_side(kl_bvh4_node_t *node, wide_plane_t *plane, int *inside) {
+#ifdef __SSE__
+  __m128 r = _mm_loadu_ps(node->sphere[3]);
+  __m128 d =        _mm_mul_ps(plane->x, _mm_loadu_ps(node->box[plane->row[0]]));
+  d = _mm_add_ps(d, _mm_mul_ps(plane->y, _mm_loadu_ps(node->box[plane->row[1]])));
+  d = _mm_add_ps(d, _mm_mul_ps(plane->z, _mm_loadu_ps(node->box[plane->row[2]])));
+  __m128 e =        _mm_mul_ps(plane->x, _mm_loadu_ps(node->box[plane->row[0] ^ 1]));
+  e = _mm_add_ps(e, _mm_mul_ps(plane->y, _mm_loadu_ps(node->box[plane->row[1] ^ 1])));
+  e = _mm_add_ps(e, _mm_mul_ps(plane->z, _mm_loadu_ps(node->box[plane->row[2] ^ 1])));
+  __m128 s =        _mm_mul_ps(plane->x, _mm_loadu_ps(node->sphere[0]));
+  s = _mm_add_ps(s, _mm_mul_ps(plane->y, _mm_loadu_ps(node->sphere[1])));
+  s = _mm_add_ps(s, _mm_mul_ps(plane->z, _mm_loadu_ps(node->sphere[2])));
+  s = _mm_sub_ps(s, plane->d);
+
+  *inside = _mm_movemask_ps(_mm_or_ps(_mm_cmple_ps(e, plane->d),
+                                      _mm_cmple_ps(s, _mm_sub_ps(_mm_setzero_ps(), r))));
+  return _mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(d, plane->d), _mm_cmpgt_ps(s, r)));
+#else
+  int out = 0;
+  *inside = 0;
+  for (int k=0; k < 4; k++) {
+    float r = node->sphere[3][k];
+    float d = plane->norm[0] * node->box[plane->row[0]][k] +
+              plane->norm[1] * node->box[plane->row[1]][k] +
+              plane->norm[2] * node->box[plane->row[2]][k];
+    float e = plane->norm[0] * node->box[plane->row[0] ^ 1][k] +
+              plane->norm[1] * node->box[plane->row[1] ^ 1][k] +
+              plane->norm[2] * node->box[plane->row[2] ^ 1][k];
+    float s = plane->norm[0] * node->sphere[0][k] +
+              plane->norm[1] * node->sphere[1][k] +
+              plane->norm[2] * node->sphere[2][k] - plane->dist;
+    if (d > plane->dist || s > r)    out     |= 1 << k;
+    if (e <= plane->dist || s <= -r) *inside |= 1 << k;
+  }
+  return out;
+#endif
+}
+
+/* the planes child k isn't entirely inside */
+static inline int wide_straddle(int inside[6], int k) {
+  int planes = 0;
+  for (int p=0; p < 6; p++) {
+    planes |= (~inside[p] >> k & 1) << p;
+  }
+  return planes;
+}
 
 /* vim: set ts=2 sw=2 et */
@@ -4,36 +4,142 @@
 #include "sphere.h"
 #include "array.h"
 
-#define KL_BVH_LEAF   0x01
-#define KL_BVH_BRANCH 0x02
+#include <stdint.h>
 
-typedef struct kl_bvh_header {
-  int type;
+struct kl_frustum;
+
+#define KL_BVH_BUILD_THREADS 4 /* most subtrees kl_bvh_build works on at once */
+
+#define KL_BVH_NULL -1
+
+#define KL_BVH_VIEWS 32 /* the most frusta kl_bvh4_cull_views takes at once */
+
+/* nodes are pooled in one array and refer to each other by index.  a leaf's index is the handle
+ * for its item, and stays valid until it's removed */
+typedef struct kl_bvh_node {
   kl_sphere_t bounds;
-} kl_bvh_header_t;
+  kl_vec3f_t  min, max; /* the box around the same leaves, what insertion costs are measured on */
+  void   *item;        /* leaves only */
+  int32_t parent;      /* KL_BVH_NULL at the root, the next free node while unused */
+  int32_t children[2]; /* both KL_BVH_NULL for leaves */
+} kl_bvh_node_t;
+
+typedef struct kl_bvh {
+  kl_bvh_node_t *nodes;
+  int32_t root;
+  int32_t free; /* first unused node */
+  int32_t capacity;
+  int32_t count; /* items */
+} kl_bvh_t;
 
-typedef struct kl_bvh_branch {
-  struct kl_bvh_header  header;
-  union  kl_bvh_node   *children[2]; /* these should never be NULL */
-} kl_bvh_branch_t;
+#define KL_BVH_INIT {\
+  .nodes = NULL, .root = KL_BVH_NULL, .free = KL_BVH_NULL, .capacity = 0, .count = 0\
+}
+
+/* a tree copied into one array in depth-first order: a branch's first child is the next node,
+ * and 'skip' is the first node after its subtree, so culling is a single forward loop */
+typedef struct kl_bvh_flat_node {
+  kl_sphere_t bounds;
+  uint32_t skip;
+  uint32_t right; /* index of a branch's second child, 0 for leaves */
+  void *item;     /* leaves only */
+} kl_bvh_flat_node_t;
 
-typedef struct kl_bvh_leaf {
-  struct kl_bvh_header header;
+typedef struct kl_bvh_flat {
+  kl_bvh_flat_node_t *nodes;
+  uint32_t n;
+} kl_bvh_flat_t;
+
+/* a four-wide copy: each node keeps the boxes and spheres of up to four children side by side,
+ * so a single pass over the frustum planes tests all of them at once -- with SSE where it's
+ * available.  a child is out when either its box or its sphere is, which is tighter than both,
+ * and inside a plane when either one is.  items are stored in depth-first order, so a subtree
+ * that's inside every plane is appended as one run */
+#define KL_BVH4_LEAF  0x80000000 /* set in a child index that refers to items[] */
+#define KL_BVH4_EMPTY 0xffffffff /* unused slots, their boxes are inside out and never pass */
+
+typedef struct kl_bvh4_node {
+  float box[6][4];    /* minx, maxx, miny, maxy, minz, maxz for each child */
+  float sphere[4][4]; /* x, y, z, radius */
+  uint32_t child[4];
+  uint32_t first, last; /* items[first..last) are everything under this node */
+} kl_bvh4_node_t;
+
+typedef struct kl_bvh4 {
+  kl_bvh4_node_t *nodes; /* the root is nodes[0] */
+  void **items;
+  uint32_t nodes_n, items_n;
+  uint32_t stack_n; /* the most nodes a traversal ever has pending */
+} kl_bvh4_t;
+
+/* an item a query found, and how far along the ray it enters the item's bounds -- or for
+ * kl_bvh_nearest, how far from the point their surface is.  0 when it starts inside */
+typedef struct kl_bvh_hit {
   void *item;
-} kl_bvh_leaf_t;
+  float t;
+} kl_bvh_hit_t;
 
-typedef union kl_bvh_node {
-  struct kl_bvh_header header;
-  struct kl_bvh_branch branch;
-  struct kl_bvh_leaf   leaf;
-} kl_bvh_node_t;
+typedef struct kl_bvh_ray {
+  kl_vec3f_t origin;
+  kl_vec3f_t dir;   /* t is measured in its lengths, so a segment is dir = end - origin, tmax = 1 */
+  float tmax;
+  int   max;        /* the most hits to keep, the nearest ones -- 0 for all of them */
+  kl_array_t *hits; /* kl_bvh_hit_t's are appended here, nearest first.  rays can share one,
+                     * each ray's hits then follow the previous ray's */
+} kl_bvh_ray_t;
+
+/* an item inside at least one of the frusta given to kl_bvh4_cull_views */
+typedef struct kl_bvh_visible {
+  void *item;
+  uint32_t views; /* bit v is set when it's inside frusta[v] */
+} kl_bvh_visible_t;
 
 typedef int  (*kl_bvh_filter_cb)(kl_sphere_t*, void*);
 
-void kl_bvh_insert(kl_bvh_node_t **root, kl_sphere_t *bounds, void *item);
-void kl_bvh_search(kl_bvh_node_t *root, kl_bvh_filter_cb filtercb, void *filter_data, kl_array_t *results);
-/* iterates through each node, for building graphs or displaying bounds: */
-void kl_bvh_debug(kl_bvh_node_t* root, kl_array_t *results);
+void kl_bvh_init(kl_bvh_t *tree);
+void kl_bvh_free(kl_bvh_t *tree);
+/* returns the item's handle.  it goes wherever it adds the least surface area to the tree */
+int  kl_bvh_insert(kl_bvh_t *tree, kl_sphere_t *bounds, void *item);
+void kl_bvh_remove(kl_bvh_t *tree, int handle);
+/* small moves refit the item's ancestors, rotating them where that tightens the tree; items that
+ * leave their parent's bounds are reinserted */
+void kl_bvh_update(kl_bvh_t *tree, int handle, kl_sphere_t *bounds);
+/* replaces the tree with one built over n items at once, top-down with a binned surface area
+ * heuristic -- better balanced than inserting them one by one.  handles receives each item's
+ * handle unless it's NULL */
+void kl_bvh_build(kl_bvh_t *tree, void **items, kl_sphere_t *bounds, int n, int *handles);
+void kl_bvh_search(kl_bvh_t *tree, kl_bvh_filter_cb filtercb, void *filter_data, kl_array_t *results);
+/* the tree is left as it is, flatten it again after changing it */
+void kl_bvh_flatten(kl_bvh_flat_t *flat, kl_bvh_t *tree);
+void kl_bvh_flat_free(kl_bvh_flat_t *flat);
+void kl_bvh_flat_search(kl_bvh_flat_t *flat, kl_bvh_filter_cb filtercb, void *filter_data, kl_array_t *results);
+/* kl_bvh_flat_search with the frustum test inlined */
+void kl_bvh_flat_cull(kl_bvh_flat_t *flat, struct kl_frustum *frustum, kl_array_t *results);
+/* collapses the tree into four-wide nodes, again leaving it as it is */
+void kl_bvh4_flatten(kl_bvh4_t *wide, kl_bvh_t *tree);
+void kl_bvh4_free(kl_bvh4_t *wide);
+/* only the planes a node straddles are tested below it */
+void kl_bvh4_cull(kl_bvh4_t *wide, struct kl_frustum *frustum, kl_array_t *results);
+/* culls against n <= KL_BVH_VIEWS frusta at once, appending a kl_bvh_visible_t for each item
+ * inside any of them.  a node is only tested against the views it straddles, and each item is
+ * reported once however many views see it.  for the masks -- it's no faster than a kl_bvh4_cull
+ * per view, see bench-bvh4 */
+void kl_bvh4_cull_views(kl_bvh4_t *wide, struct kl_frustum *frusta, int n, kl_array_t *results);
+/* visits nearer children first and skips anything further than the furthest hit it would keep,
+ * so a small 'max' ends early.  returns the number of hits appended */
+int  kl_bvh_raycast(kl_bvh_t *tree, kl_vec3f_t *origin, kl_vec3f_t *dir, float tmax, int max, kl_array_t *hits);
+/* casts n rays in one traversal, each node is fetched once for all the rays that reach it */
+void kl_bvh_raycast_n(kl_bvh_t *tree, kl_bvh_ray_t *rays, int n);
+/* best-first: appends up to k of the items whose bounds come within 'radius' of point, nearest
+ * first.  returns the number appended */
+int  kl_bvh_nearest(kl_bvh_t *tree, kl_vec3f_t *point, int k, float radius, kl_array_t *hits);
+/* stores the items whose bounds come within 'radius' of point in items[], in no particular
+ * order, and allocates nothing.  returns how many there are, which can be more than 'max' --
+ * only the first 'max' are stored */
+int  kl_bvh_within(kl_bvh_t *tree, kl_vec3f_t *point, float radius, void **items, int max);
+/* iterates through each node, for building graphs or displaying bounds -- the pointers are only
+ * good until the tree changes: */
+void kl_bvh_debug(kl_bvh_t *tree, kl_array_t *results);
 
 #endif /* KL_BVHTREE_H */
 
@@ -146,6 +146,30 @@ void kl_camera_update_frustum(kl_camera_t *cam, kl_frustum_t *frustum) {
   };
 }
 
+void kl_camera_cube_frusta(kl_vec3f_t *center, float radius, kl_frustum_t *frusta) {
+  /* each turns the camera's forward, -z, onto its face's axis */
+  float h = sqrtf(0.5f);
+  kl_quat_t faces[6] = {
+    { .r = h,    .i = 0.0f, .j = -h,   .k = 0.0f },
+    { .r = h,    .i = 0.0f, .j = h,    .k = 0.0f },
+    { .r = h,    .i = h,    .j = 0.0f, .k = 0.0f },
+    { .r = h,    .i = -h,   .j = 0.0f, .k = 0.0f },
+    { .r = 0.0f, .i = 0.0f, .j = 1.0f, .k = 0.0f },
+    { .r = 1.0f, .i = 0.0f, .j = 0.0f, .k = 0.0f }
+  };
+  for (int f=0; f < 6; f++) {
+    kl_camera_t cam = {
+      .position    = *center,
+      .orientation = faces[f],
+      .aspect      = 1.0f,
+      .fov         = 2.0f * atanf(1.0f),
+      .near        = 0.0f,
+      .far         = radius
+    };
+    kl_camera_update_frustum(&cam, frusta + f);
+  }
+}
+
 void kl_camera_local_move(kl_camera_t *cam, kl_vec3f_t *offset) {
   kl_vec3f_t offset_world;
   kl_quat_rotate(&offset_world, &cam->orientation, offset);
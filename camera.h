@@ -34,6 +34,9 @@ typedef struct kl_camera {
 
 void kl_camera_update_scene(kl_camera_t *cam, kl_scene_t *scene);
 void kl_camera_update_frustum(kl_camera_t *cam, kl_frustum_t *frustum);
+/* the six square 90 degree frusta around a point out to 'radius', in cube map face order:
+ * +x, -x, +y, -y, +z, -z */
+void kl_camera_cube_frusta(kl_vec3f_t *center, float radius, kl_frustum_t *frusta);
 void kl_camera_local_move(kl_camera_t *cam, kl_vec3f_t *offset);
 void kl_camera_local_rotate(kl_camera_t *cam, kl_vec3f_t *ang);
 
@@ -0,0 +1,516 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+/* kl-cook: turns a source asset tree into the files the engine loads
+ *
+ *   kl-cook [-j threads] [-p pakfile] [-f] srcdir outdir
+ *
+ * OBJ models are parsed, deduplicated and given tangents, and PNG textures
+ * are decoded and given gamma-correct mip chains.  both keep their names, so
+ * virtual paths don't change, and the engine tells cooked files apart by
+ * their magic numbers.  everything else is copied as is.
+ *
+ * the key of each cooked file (a hash of its input, its kind and the cooker
+ * version) is kept in outdir.kcook, and files whose key hasn't changed are
+ * left alone.  each output depends on nothing but its own input: cooked
+ * models name their materials rather than embedding them. */
+
+#include "model-obj.h"
+#include "model-data.h"
+#include "texture-png.h"
+#include "texture-cooked.h"
+#include "resource.h"
+#include "resource-pak.h"
+#include "array.h"
+#include "mem.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#endif
+
+#define COOK_VERSION 1 /* bump whenever a cooked format or the cooking itself changes */
+
+#define COOK_DB_MAGIC   0x4244434b /* "KCDB" */
+#define COOK_DB_VERSION 1
+
+#define KIND_COPY    0
+#define KIND_TEXTURE 1
+#define KIND_MODEL   2
+
+#define JOB_PENDING  0
+#define JOB_COOKED   1
+#define JOB_UPTODATE 2
+#define JOB_FAILED   3
+
+#define MAX_THREADS 0x40
+
+typedef struct cook_job {
+  char src[KL_RESITEM_PATHLEN];
+  char dst[KL_RESITEM_PATHLEN];
+  char rel[KL_RESITEM_PATHLEN]; /* relative to srcdir, what the database is keyed by */
+  uint64_t key;
+  uint64_t size;
+  int kind;
+  int result;
+} cook_job_t;
+
+typedef struct db_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_entries;
+  uint32_t num_strings; /* bytes */
+} db_header_t;
+
+typedef struct db_entry {
+  uint64_t key;
+  uint32_t rel; /* offset into the string table */
+  uint32_t pad;
+} db_entry_t;
+
+typedef struct cook_db {
+  kl_array_t entries; /* sorted by relative path */
+  kl_array_t strings;
+} cook_db_t;
+
+KL_ARRAY_DECLARE(cook_job_t, job)
+KL_ARRAY_DECLARE(db_entry_t, dbentry)
+
+static int  walkdir(const char *src, const char *dst, const char *rel, kl_array_t *jobs);
+static int  makedir(const char *path);
+static void *worker_main(void *arg);
+static void cook(cook_job_t *job);
+static int  cook_file(cook_job_t *job, const uint8_t *data, size_t size, FILE *out);
+static bool has_extension(const char *path, const char *ext);
+static void db_init(cook_db_t *db);
+static void db_free(cook_db_t *db);
+static int  db_load(cook_db_t *db, const char *path);
+static int  db_write(kl_array_t *jobs, const char *path);
+static uint64_t* db_find(cook_db_t *db, const char *rel);
+static int  compare_jobs(const void *a, const void *b);
+static int  compare_job_rel(const void *key, const void *job);
+static int  default_threads();
+static double now_ms();
+
+static kl_array_t jobs;
+static cook_db_t  db;
+static bool force = false;
+static int  next_job = 0;
+static int  toolong  = 0; /* assets whose paths don't fit, failed without being cooked */
+
+/* ------------------ */
+int main(int argc, char **argv) {
+  int threads = default_threads();
+  const char *pakpath = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "j:p:f")) != -1) {
+    switch (opt) {
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'p':
+        pakpath = optarg;
+        break;
+      case 'f':
+        force = true;
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (argc - optind != 2) goto usage;
+  if (threads < 1) threads = 1;
+  if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+  char srcdir[KL_RESITEM_PATHLEN];
+  char outdir[KL_RESITEM_PATHLEN];
+  char dbpath[KL_RESITEM_PATHLEN + 8];
+  snprintf(srcdir, KL_RESITEM_PATHLEN, "%s", argv[optind]);
+  snprintf(outdir, KL_RESITEM_PATHLEN, "%s", argv[optind+1]);
+  /* trailing slashes would end up in every path, and in the database's name */
+  for (int n = strlen(srcdir); n > 1 && srcdir[n-1] == '/'; n--) srcdir[n-1] = '\0';
+  for (int n = strlen(outdir); n > 1 && outdir[n-1] == '/'; n--) outdir[n-1] = '\0';
+  /* beside the output rather than in it, so it isn't packed */
+  snprintf(dbpath, sizeof(dbpath), "%s.kcook", outdir);
+
+  double start = now_ms();
+
+  kl_array_job_init(&jobs);
+  db_init(&db);
+  if (makedir(outdir) < 0) return 1;
+  if (walkdir(srcdir, outdir, "", &jobs) < 0) return 1;
+  qsort(kl_array_data(&jobs), kl_array_size(&jobs), sizeof(cook_job_t), &compare_jobs);
+  if (!force && db_load(&db, dbpath) < 0) {
+    fprintf(stderr, "kl-cook: No usable database at %s, cooking everything\n", dbpath);
+  }
+
+  /* one job at a time from a shared counter, big textures don't hold up a whole slice of the tree */
+  pthread_t workers[MAX_THREADS];
+  int num_workers = threads < kl_array_size(&jobs) ? threads : kl_array_size(&jobs);
+  for (int i=0; i < num_workers; i++) {
+    if (pthread_create(&workers[i], NULL, &worker_main, NULL) != 0) {
+      num_workers = i;
+      break;
+    }
+  }
+  if (num_workers == 0) worker_main(NULL);
+  for (int i=0; i < num_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  int cooked = 0, uptodate = 0, failed = toolong;
+  uint64_t bytes = 0;
+
+  /* outputs of sources which have since been deleted */
+  int removed = 0;
+  db_entry_t *entries = kl_array_dbentry_data(&db.entries);
+  for (int i=0; i < kl_array_size(&db.entries); i++) {
+    const char *rel = (char*)kl_array_data(&db.strings) + entries[i].rel;
+    if (bsearch(rel, kl_array_data(&jobs), kl_array_size(&jobs), sizeof(cook_job_t), &compare_job_rel) != NULL) continue;
+    char path[KL_RESITEM_PATHLEN];
+    if (snprintf(path, KL_RESITEM_PATHLEN, "%s/%s", outdir, rel) >= KL_RESITEM_PATHLEN) {
+      fprintf(stderr, "kl-cook: Path too long, can't remove %s/%s\n", outdir, rel);
+      failed++;
+      continue;
+    }
+    if (remove(path) == 0) removed++;
+  }
+
+  cook_job_t *data = kl_array_job_data(&jobs);
+  for (int i=0; i < kl_array_size(&jobs); i++) {
+    switch (data[i].result) {
+      case JOB_COOKED:
+        cooked++;
+        bytes += data[i].size;
+        break;
+      case JOB_UPTODATE:
+        uptodate++;
+        break;
+      default:
+        fprintf(stderr, "kl-cook: Failed to cook %s\n", data[i].src);
+        failed++;
+        break;
+    }
+  }
+  int err = db_write(&jobs, dbpath);
+  double ms = now_ms() - start;
+
+  double secs = ms > 0.0 ? ms / 1000.0 : 1e-6;
+  printf("kl-cook: %d assets in %.1f ms with %d threads: %d cooked, %d up to date, %d failed, %d removed\n",
+    kl_array_size(&jobs), ms, num_workers > 0 ? num_workers : 1, cooked, uptodate, failed, removed);
+  printf("kl-cook: %.1f assets/s, %.1f MB/s of source cooked\n", cooked / secs, bytes / secs / (1024.0 * 1024.0));
+
+  if (pakpath != NULL) {
+    double pakstart = now_ms();
+    if (kl_pak_write(pakpath, outdir, "", true) < 0) err = -1;
+    else printf("kl-cook: packed %s in %.1f ms\n", pakpath, now_ms() - pakstart);
+  }
+
+  kl_array_free(&jobs);
+  db_free(&db);
+  return (err < 0 || failed > 0) ? 1 : 0;
+
+  usage:
+  fprintf(stderr, "usage: %s [-j threads] [-p pakfile] [-f] srcdir outdir\n", argv[0]);
+  fprintf(stderr, "\t-j  cook with this many threads (default: one per core, %d here)\n", threads);
+  fprintf(stderr, "\t-p  pack the cooked tree into a .kpak afterwards\n");
+  fprintf(stderr, "\t-f  recook everything, even if it's up to date\n");
+  return 2;
+}
+
+/* ------------------ */
+static int walkdir(const char *src, const char *dst, const char *rel, kl_array_t *jobs) {
+  DIR *dir = opendir(src);
+  if (dir == NULL) {
+    fprintf(stderr, "kl-cook: Failed to read directory %s!\n\tDetails: %s\n", src, strerror(errno));
+    return -1;
+  }
+
+  int err = 0;
+  struct dirent *ent;
+  struct stat    s;
+  cook_job_t     job;
+  while ((ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, "..") == 0) continue;
+    if (strcmp(ent->d_name, ".") == 0) continue;
+
+    if (snprintf(job.src, KL_RESITEM_PATHLEN, "%s/%s", src, ent->d_name) >= KL_RESITEM_PATHLEN ||
+        snprintf(job.dst, KL_RESITEM_PATHLEN, "%s/%s", dst, ent->d_name) >= KL_RESITEM_PATHLEN ||
+        snprintf(job.rel, KL_RESITEM_PATHLEN, "%s%s%s", rel, rel[0] != '\0' ? "/" : "", ent->d_name) >= KL_RESITEM_PATHLEN) {
+      fprintf(stderr, "kl-cook: Path too long, failed to cook %s/%s\n", src, ent->d_name);
+      toolong++;
+      continue;
+    }
+
+    if (stat(job.src, &s) < 0) continue;
+    if (S_ISDIR(s.st_mode)) {
+      /* created up front, so the workers never race to make the same directory */
+      err = makedir(job.dst);
+      if (err < 0) break;
+      err = walkdir(job.src, job.dst, job.rel, jobs);
+      if (err < 0) break;
+    } else if (S_ISREG(s.st_mode)) {
+      job.key    = 0;
+      job.size   = s.st_size;
+      job.kind   = KIND_COPY;
+      job.result = JOB_PENDING;
+      kl_array_push(jobs, &job);
+    }
+  }
+
+  closedir(dir);
+  return err;
+}
+
+static int makedir(const char *path) {
+#ifdef _WIN32
+  int err = mkdir(path);
+#else
+  int err = mkdir(path, 0755);
+#endif
+  if (err < 0 && errno != EEXIST) {
+    fprintf(stderr, "kl-cook: Failed to create directory %s!\n\tDetails: %s\n", path, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static void *worker_main(void *arg) {
+  int n = kl_array_size(&jobs);
+  for (;;) {
+    int i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED);
+    if (i >= n) break;
+    cook(kl_array_job_at(&jobs, i));
+  }
+  return NULL;
+}
+
+static void cook(cook_job_t *job) {
+  size_t size = 0;
+  uint8_t *data = kl_resource_mapfile(job->src, &size);
+  if (data == NULL) size = 0; /* empty files aren't mapped */
+
+  if (kl_model_isobj(data, size)) {
+    job->kind = KIND_MODEL;
+  } else if (has_extension(job->src, ".png")) {
+    job->kind = KIND_TEXTURE;
+  }
+
+  /* the kind is in the key so a file which starts being cooked differently is recooked */
+  kl_resource_blob_t blob = { .data = data, .size = size };
+  job->key  = kl_resource_blob_hash(&blob);
+  job->key ^= ((uint64_t)COOK_VERSION << 32 | job->kind) * 0x9e3779b97f4a7c15ull;
+  job->size = size;
+
+  struct stat s;
+  uint64_t *key = db_find(&db, job->rel);
+  if (key != NULL && *key == job->key && stat(job->dst, &s) == 0) {
+    job->result = JOB_UPTODATE;
+    kl_resource_unmapfile(data, size);
+    return;
+  }
+
+  /* written aside and renamed into place, so an interrupted cook never leaves a partial file behind */
+  char tmp[KL_RESITEM_PATHLEN + 8];
+  snprintf(tmp, sizeof(tmp), "%s.cooking", job->dst);
+  FILE *out = fopen(tmp, "wb");
+  if (out == NULL) {
+    fprintf(stderr, "kl-cook: Failed to create %s\n\tDetails: %s\n", tmp, strerror(errno));
+    job->result = JOB_FAILED;
+    kl_resource_unmapfile(data, size);
+    return;
+  }
+  int err = cook_file(job, data, size, out);
+  if (fclose(out) != 0) err = -1;
+  kl_resource_unmapfile(data, size);
+
+#ifdef _WIN32
+  if (err == 0) remove(job->dst); /* rename won't replace an existing file */
+#endif
+  if (err == 0 && rename(tmp, job->dst) != 0) {
+    fprintf(stderr, "kl-cook: Failed to rename %s\n\tDetails: %s\n", tmp, strerror(errno));
+    err = -1;
+  }
+  if (err < 0) remove(tmp);
+  job->result = err < 0 ? JOB_FAILED : JOB_COOKED;
+}
+
+static int cook_file(cook_job_t *job, const uint8_t *data, size_t size, FILE *out) {
+  int err = -1;
+  switch (job->kind) {
+    case KIND_TEXTURE: {
+      kl_texture_image_t image;
+      if (!kl_texture_decodepng(data, size, job->src, &image)) break;
+      err = kl_texture_cook(&image, out);
+      kl_mem_free(KL_MEM_TEXTURE, image.data);
+      break;
+    }
+    case KIND_MODEL: {
+      kl_model_data_t model;
+      /* nothing to prefetch, the MTL is cooked on its own */
+      if (!kl_model_parseobj((uint8_t*)data, size, NULL, &model)) break;
+      err = kl_model_data_write(&model, out);
+      kl_model_data_free(&model);
+      break;
+    }
+    default:
+      err = (size == 0 || fwrite(data, size, 1, out) == 1) ? 0 : -1;
+      break;
+  }
+  return err;
+}
+
+static bool has_extension(const char *path, const char *ext) {
+  size_t n = strlen(path);
+  size_t m = strlen(ext);
+  if (n < m) return false;
+  for (size_t i=0; i < m; i++) {
+    char c = path[n - m + i];
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    if (c != ext[i]) return false;
+  }
+  return true;
+}
+
+static void db_init(cook_db_t *db) {
+  kl_array_dbentry_init(&db->entries);
+  kl_array_init(&db->strings, sizeof(char));
+}
+
+static void db_free(cook_db_t *db) {
+  kl_array_free(&db->entries);
+  kl_array_free(&db->strings);
+}
+
+static int db_load(cook_db_t *db, const char *path) {
+  size_t size;
+  uint8_t *data = kl_resource_mapfile(path, &size);
+  if (data == NULL) return -1;
+
+  int err = -1;
+  db_header_t header;
+  if (size < sizeof(header)) goto cleanup;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != COOK_DB_MAGIC || header.version != COOK_DB_VERSION) goto cleanup;
+  size_t entrybytes = (size_t)header.num_entries * sizeof(db_entry_t);
+  if (size != sizeof(header) + entrybytes + header.num_strings) goto cleanup;
+
+  kl_array_append_n(&db->entries, data + sizeof(header), header.num_entries);
+  kl_array_append_n(&db->strings, data + sizeof(header) + entrybytes, header.num_strings);
+  char *strings = kl_array_data(&db->strings);
+  if (header.num_entries > 0 && (header.num_strings == 0 || strings[header.num_strings-1] != '\0')) goto cleanup;
+  db_entry_t *entries = kl_array_dbentry_data(&db->entries);
+  for (uint32_t i=0; i < header.num_entries; i++) {
+    if (entries[i].rel >= header.num_strings) goto cleanup;
+    /* written in job order, but binary searched */
+    if (i > 0 && strcmp(strings + entries[i-1].rel, strings + entries[i].rel) >= 0) goto cleanup;
+  }
+  err = 0;
+
+  cleanup:
+
+  if (err < 0) {
+    kl_array_clear(&db->entries);
+    kl_array_clear(&db->strings);
+  }
+  kl_resource_unmapfile(data, size);
+  return err;
+}
+
+static int db_write(kl_array_t *jobs, const char *path) {
+  kl_array_t entries;
+  kl_array_dbentry_init(&entries);
+  kl_array_t strings;
+  kl_array_init(&strings, sizeof(char));
+
+  /* failed jobs are left out, so they're retried next time */
+  cook_job_t *data = kl_array_job_data(jobs);
+  for (int i=0; i < kl_array_size(jobs); i++) {
+    if (data[i].result != JOB_COOKED && data[i].result != JOB_UPTODATE) continue;
+    db_entry_t entry = {
+      .key = data[i].key,
+      .rel = kl_array_append_n(&strings, data[i].rel, strlen(data[i].rel) + 1),
+      .pad = 0
+    };
+    kl_array_push(&entries, &entry);
+  }
+
+  db_header_t header = {
+    .magic       = COOK_DB_MAGIC,
+    .version     = COOK_DB_VERSION,
+    .num_entries = kl_array_size(&entries),
+    .num_strings = kl_array_size(&strings)
+  };
+
+  int err = -1;
+  FILE *out = fopen(path, "wb");
+  if (out == NULL) goto cleanup;
+  if (fwrite(&header, sizeof(header), 1, out) != 1) goto cleanup;
+  if (header.num_entries > 0 && fwrite(kl_array_data(&entries), sizeof(db_entry_t), header.num_entries, out) != header.num_entries) goto cleanup;
+  if (header.num_strings > 0 && fwrite(kl_array_data(&strings), 1, header.num_strings, out) != header.num_strings) goto cleanup;
+  err = 0;
+
+  cleanup:
+
+  if (out != NULL && fclose(out) != 0) err = -1;
+  if (err < 0) {
+    fprintf(stderr, "kl-cook: Failed to write %s\n", path);
+  }
+  kl_array_free(&entries);
+  kl_array_free(&strings);
+  return err;
+}
+
+static uint64_t* db_find(cook_db_t *db, const char *rel) {
+  /* read-only while the workers run */
+  char *strings = kl_array_data(&db->strings);
+  db_entry_t *entries = kl_array_dbentry_data(&db->entries);
+  int lo = 0, hi = kl_array_size(&db->entries);
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    int cmp = strcmp(rel, strings + entries[mid].rel);
+    if (cmp == 0) return &entries[mid].key;
+    if (cmp < 0) hi = mid;
+    else lo = mid + 1;
+  }
+  return NULL;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+  return strcmp(((cook_job_t*)a)->rel, ((cook_job_t*)b)->rel);
+}
+
+static int compare_job_rel(const void *key, const void *job) {
+  return strcmp((const char*)key, ((cook_job_t*)job)->rel);
+}
+
+static int default_threads() {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+#endif
+}
+
+static double now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -1,6 +1,7 @@
 #include "frame.h"
 
 #include "vec.h"
+#include "mem.h"
 
 #include <stdint.h>
 
@@ -16,7 +17,7 @@ static uint32_t hash(char *str) {
 }
 
 kl_frame_t* kl_frame_new(char *id, kl_frame_coord_t *preferred_size, kl_frame_anchor_t *anchor_primary, kl_frame_anchor_t *anchor_secondary) {
-  kl_frame_t *frame = malloc(sizeof(kl_frame_t));
+  kl_frame_t *frame = kl_mem_alloc(KL_MEM_UI, sizeof(kl_frame_t));
 
   kl_frame_coord_t coord_none = {
     .type = KL_FRAME_COORD_NORMALIZED,
@@ -57,6 +58,7 @@ kl_frame_t* kl_frame_new(char *id, kl_frame_coord_t *preferred_size, kl_frame_an
   header->effective_size.y = 1.0f;
 
   kl_array_init(&header->children, sizeof(kl_frame_t*));
+  kl_array_set_policy(&header->children, &kl_array_policy_small); /* most frames are leaves */
 
   return frame;
 }
@@ -95,7 +97,7 @@ void kl_frame_delete(kl_frame_t *frame) {
   
   frame_free_resources(frame);
 
-  free(frame);
+  kl_mem_free(KL_MEM_UI, frame);
 }
 
 void kl_frame_add(kl_frame_t *frame, kl_frame_t *child) {
@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L /* pthread_rwlock_t */
+
+#include "intern.h"
+
+#include "arena.h"
+#include "mem.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/* each string is prefixed by its hash, in the pool's arena -- resource ids are cached by the items instead */
+typedef struct intern_rec {
+  uint64_t hash; /* of the exact string, for the pool's own table */
+  uint32_t len;
+  char str[];
+} intern_rec_t;
+
+/* open-addressed (linear probing) table, strings are never removed */
+typedef struct intern_pool {
+  intern_rec_t **slots;
+  uint32_t mask; /* number of slots - 1 */
+  uint32_t count;
+  size_t   bytes;
+  kl_arena_t arena;
+} intern_pool_t;
+static intern_pool_t pool = {
+  .slots = NULL, .mask = 0, .count = 0, .bytes = 0, .arena = KL_ARENA_INIT(KL_MEM_RESOURCE)
+};
+static pthread_rwlock_t pool_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* slots, must be a power of two */
+static const uint32_t intern_initial_slots = 0x1000;
+
+static uint64_t hash_str(const char *str, uint32_t *len);
+static intern_rec_t* pool_find(const char *str, uint64_t hash, uint32_t len);
+static void pool_insert(intern_rec_t *rec);
+static void pool_grow();
+
+/* ------------------------ */
+const char* kl_intern(const char *str) {
+  uint32_t len;
+  uint64_t hash = hash_str(str, &len);
+
+  pthread_rwlock_rdlock(&pool_lock);
+  intern_rec_t *rec = pool_find(str, hash, len);
+  pthread_rwlock_unlock(&pool_lock);
+  if (rec != NULL) return rec->str;
+
+  pthread_rwlock_wrlock(&pool_lock);
+  rec = pool_find(str, hash, len); /* may have been added in the meantime */
+  if (rec == NULL) {
+    rec = kl_arena_alloc(&pool.arena, sizeof(intern_rec_t) + len + 1);
+    rec->hash  = hash;
+    rec->len   = len;
+    memcpy(rec->str, str, len + 1);
+    pool_insert(rec);
+    pool.bytes += sizeof(intern_rec_t) + len + 1;
+  }
+  pthread_rwlock_unlock(&pool_lock);
+  return rec->str;
+}
+
+const char* kl_intern_find(const char *str) {
+  uint32_t len;
+  uint64_t hash = hash_str(str, &len);
+
+  pthread_rwlock_rdlock(&pool_lock);
+  intern_rec_t *rec = pool_find(str, hash, len);
+  pthread_rwlock_unlock(&pool_lock);
+  return rec != NULL ? rec->str : NULL;
+}
+
+void kl_intern_stats(size_t *count, size_t *bytes) {
+  pthread_rwlock_rdlock(&pool_lock);
+  *count = pool.count;
+  *bytes = pool.bytes + (pool.slots != NULL ? (pool.mask + 1) * sizeof(intern_rec_t*) : 0);
+  pthread_rwlock_unlock(&pool_lock);
+}
+
+/* ------------------------ */
+static uint64_t hash_str(const char *str, uint32_t *len) {
+  /* FNV-1a, exact rather than normalized -- the pool keeps a path's case for the filesystem */
+  uint64_t h = 0xcbf29ce484222325ULL;
+  uint32_t n = 0;
+  for (; str[n] != '\0'; n++) {
+    h ^= (uint8_t)str[n];
+    h *= 0x100000001b3ULL;
+  }
+  *len = n;
+  return h ^ (h >> 32);
+}
+
+static intern_rec_t* pool_find(const char *str, uint64_t hash, uint32_t len) {
+  if (pool.slots == NULL) return NULL;
+  for (uint32_t i = hash & pool.mask;; i = (i + 1) & pool.mask) {
+    intern_rec_t *rec = pool.slots[i];
+    if (rec == NULL) return NULL;
+    if (rec->hash == hash && rec->len == len && memcmp(rec->str, str, len) == 0) return rec;
+  }
+}
+
+static void pool_insert(intern_rec_t *rec) {
+  /* grow at 3/4 full */
+  if (pool.slots == NULL || (pool.count + 1) * 4 > (pool.mask + 1) * 3) {
+    pool_grow();
+  }
+  uint32_t i = rec->hash & pool.mask;
+  while (pool.slots[i] != NULL) {
+    i = (i + 1) & pool.mask;
+  }
+  pool.slots[i] = rec;
+  pool.count++;
+}
+
+static void pool_grow() {
+  intern_rec_t **oldslots = pool.slots;
+  uint32_t oldsize = oldslots != NULL ? pool.mask + 1 : 0;
+  uint32_t newsize = oldsize > 0 ? oldsize * 2 : intern_initial_slots;
+
+  pool.slots = kl_mem_alloc(KL_MEM_RESOURCE, newsize * sizeof(intern_rec_t*));
+  memset(pool.slots, 0, newsize * sizeof(intern_rec_t*));
+  pool.mask  = newsize - 1;
+  pool.count = 0;
+
+  for (uint32_t i=0; i < oldsize; i++) {
+    if (oldslots[i] != NULL) {
+      pool_insert(oldslots[i]);
+    }
+  }
+  kl_mem_free(KL_MEM_RESOURCE, oldslots);
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,18 @@
+#ifndef KL_INTERN_H
+#define KL_INTERN_H
+
+/* string pool -- each distinct string is stored once and never freed, so interned strings
+ * can be compared by pointer and held onto without copying */
+
+#include <stddef.h>
+
+/* the pooled copy of str, added if necessary */
+const char* kl_intern(const char *str);
+/* the pooled copy of str, or NULL if it was never interned */
+const char* kl_intern_find(const char *str);
+/* number of strings and bytes held by the pool */
+void kl_intern_stats(size_t *count, size_t *bytes);
+
+#endif /* KL_INTERN_H */
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,148 @@
+#include "lz4.h"
+
+#include <string.h>
+
+#define LZ4_MINMATCH   4
+#define LZ4_LASTLITS   5  /* the last 5 bytes are always literals */
+#define LZ4_MFLIMIT    12 /* the last match must start at least 12 bytes before the end */
+#define LZ4_MAXOFFSET  0xFFFF
+#define LZ4_HASHBITS   12
+
+static uint32_t read32(const uint8_t *p);
+static uint32_t hash32(uint32_t x);
+static uint8_t* write_length(uint8_t *op, uint8_t *oend, int n);
+static uint8_t* write_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, int litlen, int offset, int matchlen);
+
+/* ------------------ */
+int kl_lz4_compress(const uint8_t *src, int srclen, uint8_t *dst, int dstlen) {
+  int table[1 << LZ4_HASHBITS];
+  memset(table, 0xFF, sizeof(table)); /* -1, no match */
+
+  uint8_t *op   = dst;
+  uint8_t *oend = dst + dstlen;
+  int anchor = 0;
+  int ip     = 0;
+
+  while (ip < srclen - LZ4_MFLIMIT) {
+    uint32_t seq = read32(src + ip);
+    uint32_t h   = hash32(seq);
+    int ref = table[h];
+    table[h] = ip;
+    if (ref < 0 || ip - ref > LZ4_MAXOFFSET || read32(src + ref) != seq) {
+      ip++;
+      continue;
+    }
+
+    int len = LZ4_MINMATCH;
+    while (ip + len < srclen - LZ4_LASTLITS && src[ref + len] == src[ip + len]) {
+      len++;
+    }
+
+    op = write_sequence(op, oend, src + anchor, ip - anchor, ip - ref, len);
+    if (op == NULL) return -1;
+    ip    += len;
+    anchor = ip;
+  }
+
+  op = write_sequence(op, oend, src + anchor, srclen - anchor, 0, 0);
+  if (op == NULL) return -1;
+  return op - dst;
+}
+
+int kl_lz4_decompress(const uint8_t *src, int srclen, uint8_t *dst, int dstlen) {
+  const uint8_t *ip   = src;
+  const uint8_t *iend = src + srclen;
+  uint8_t *op   = dst;
+  uint8_t *oend = dst + dstlen;
+
+  while (ip < iend) {
+    int token  = *ip++;
+    int litlen = token >> 4;
+    if (litlen == 15) {
+      int n;
+      do {
+        if (ip >= iend) return -1;
+        n = *ip++;
+        litlen += n;
+      } while (n == 255);
+    }
+    if (litlen > iend - ip || litlen > oend - op) return -1;
+    memcpy(op, ip, litlen);
+    op += litlen;
+    ip += litlen;
+
+    if (ip >= iend) break; /* the last sequence has no match */
+
+    if (iend - ip < 2) return -1;
+    int offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > op - dst) return -1;
+
+    int matchlen = (token & 0x0F) + LZ4_MINMATCH;
+    if ((token & 0x0F) == 15) {
+      int n;
+      do {
+        if (ip >= iend) return -1;
+        n = *ip++;
+        matchlen += n;
+      } while (n == 255);
+    }
+    if (matchlen > oend - op) return -1;
+
+    /* matches may overlap their own output, so copy forward bytewise */
+    const uint8_t *ref = op - offset;
+    for (int i=0; i < matchlen; i++) {
+      op[i] = ref[i];
+    }
+    op += matchlen;
+  }
+  return op - dst;
+}
+
+/* ------------------ */
+static uint32_t read32(const uint8_t *p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+static uint32_t hash32(uint32_t x) {
+  return (x * 2654435761U) >> (32 - LZ4_HASHBITS);
+}
+
+static uint8_t* write_length(uint8_t *op, uint8_t *oend, int n) {
+  for (; n >= 255; n -= 255) {
+    if (op >= oend) return NULL;
+    *op++ = 255;
+  }
+  if (op >= oend) return NULL;
+  *op++ = n;
+  return op;
+}
+
+static uint8_t* write_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, int litlen, int offset, int matchlen) {
+  if (op >= oend) return NULL;
+  uint8_t *token = op++;
+  *token = (litlen >= 15 ? 15 : litlen) << 4;
+  if (litlen >= 15) {
+    op = write_length(op, oend, litlen - 15);
+    if (op == NULL) return NULL;
+  }
+  if (litlen > oend - op) return NULL;
+  memcpy(op, lit, litlen);
+  op += litlen;
+
+  if (matchlen == 0) return op; /* last literals */
+
+  if (oend - op < 2) return NULL;
+  *op++ = offset & 0xFF;
+  *op++ = offset >> 8;
+  matchlen -= LZ4_MINMATCH;
+  *token |= matchlen >= 15 ? 15 : matchlen;
+  if (matchlen >= 15) {
+    op = write_length(op, oend, matchlen - 15);
+  }
+  return op;
+}
+
+/* vim: set ts=2 sw=2 et */
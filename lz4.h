@@ -0,0 +1,17 @@
+#ifndef KL_LZ4_H
+#define KL_LZ4_H
+
+/* LZ4 block format (no frame header) -- used for compressed pak entries */
+
+#include <stdint.h>
+
+/* worst-case compressed size for n bytes of input */
+#define KL_LZ4_BOUND(n) ((n) + (n)/255 + 16)
+
+/* returns compressed size, or -1 if it doesn't fit in dstlen */
+int kl_lz4_compress(const uint8_t *src, int srclen, uint8_t *dst, int dstlen);
+/* returns decompressed size, or -1 if the input is malformed or doesn't fit in dstlen */
+int kl_lz4_decompress(const uint8_t *src, int srclen, uint8_t *dst, int dstlen);
+
+#endif /* KL_LZ4_H */
+/* vim: set ts=2 sw=2 et */
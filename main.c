@@ -2,6 +2,8 @@
 #include "input.h"
 #include "renderer.h"
 #include "resource.h"
+#include "resource-watch.h"
+#include "texture.h"
 
 #include "terrain.h"
 #include "model.h"
@@ -11,13 +13,29 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdbool.h>
+#include <unistd.h>
+
+/* written by: kl-cook -p test_assets.kpak test_assets test_assets_cooked
+ * or, uncooked: kl-pak test_assets.kpak test_assets */
+#define COOKED_ASSETS "test_assets_cooked"
+
+static kl_model_t* load_model(const char *name);
 
 int main(int argc, char **argv) {
   kl_evt_generic_t evt;
 
-  kl_resource_add_dir("./test_assets/", "");
+  /* prefer the packed assets when they've been built, then the cooked ones */
+  if (kl_resource_add_pak("./test_assets.kpak") < 0) {
+    kl_resource_watch_init(); /* pick up edits to loose assets while running */
+    if (access("./" COOKED_ASSETS "/", R_OK) == 0) {
+      kl_resource_add_dir("./" COOKED_ASSETS "/", "");
+    } else {
+      kl_resource_add_dir("./test_assets/", "");
+    }
+  }
 
   if (kl_vid_init() < 0) return -1;
+  kl_resource_set_main_thread(); /* where the GL context is current */
   if (kl_input_init() < 0) return -1;
   if (kl_render_init() < 0) return -1;
   
@@ -36,11 +54,11 @@ int main(int argc, char **argv) {
 
   kl_terrain_testsphere();
 
-  kl_model_t *model1 = kl_model_load("test_assets/test.iqm");
+  kl_model_t *model1 = load_model("test.iqm");
   kl_render_add_model(model1);
-  kl_model_t *model2 = kl_model_load("test_assets/sponza.obj");
+  kl_model_t *model2 = load_model("sponza.obj");
   kl_render_add_model(model2);
-  kl_model_t *model3 = kl_model_load("test_assets/colorcalibration.obj");
+  kl_model_t *model3 = load_model("colorcalibration.obj");
   kl_render_add_model(model3);
 
   kl_vec3f_t light1_pos = { .x = 500.0f, .y = 400.0f, .z = 0.0f };
@@ -70,7 +88,11 @@ int main(int argc, char **argv) {
         case KL_EVT_BUTTON:
           switch (evt.button.code) {
             case KL_BTN_ESC:
-              if (evt.button.isdown) return 0;
+              if (evt.button.isdown) {
+                kl_resource_dump(stderr, 16);
+                kl_texture_dump_shared(stderr);
+                return 0;
+              }
               break;
             case KL_BTN_W:
               move_f = evt.button.isdown;
@@ -130,8 +152,21 @@ int main(int argc, char **argv) {
     kl_vec3f_scale(&offset, &offset, 320.0f * dt);
     kl_camera_local_move(&cam, &offset);
 
+    kl_resource_pump(2.0f); /* finish background loads, ms */
     kl_render_draw(&cam);
     kl_vid_swap();
   }
 }
+
+/* ------------------ */
+static kl_model_t* load_model(const char *name) {
+  /* models aren't resources yet, so they're found by filesystem path */
+  char path[0x100];
+  snprintf(path, sizeof(path), COOKED_ASSETS "/%s", name);
+  if (access(path, R_OK) != 0) {
+    snprintf(path, sizeof(path), "test_assets/%s", name);
+  }
+  return kl_model_load(path);
+}
+
 /* vim: set ts=2 sw=2 et */
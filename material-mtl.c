@@ -2,51 +2,72 @@
 
 #include "material.h"
 #include "resource.h"
+#include "intern.h"
 #include "array.h"
 #include "strsep.h"
+#include "mem.h"
 
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 
-#define MTL_PATHLEN 0x100
+/* all interned */
 typedef struct mtl_entry {
-  char path[MTL_PATHLEN];
-  char map_diffuse[MTL_PATHLEN];
-  char map_specular[MTL_PATHLEN];
-  char map_normal[MTL_PATHLEN];
-  char map_emissive[MTL_PATHLEN];
+  const char *path;
+  const char *map_diffuse;
+  const char *map_specular;
+  const char *map_normal;
+  const char *map_emissive;
 } mtl_entry_t;
 
 static void parseline(kl_array_t *entries, mtl_entry_t *entry, char *line);
-static void* mtl_load(char *path, char *vpath);
+static const char* intern_map(const char *name);
+static void* mtl_decode(kl_resource_blob_t *blob, const char *vpath);
+static void* mtl_upload(void *data, const char *path, const char *vpath);
 static void mtl_free(void *item);
+static void mtl_size(void *item, size_t *cpu, size_t *gpu);
+static void mtl_reload(void *item, void *fresh);
+static void mtl_deps(void *data, const char *vpath);
+static void loader_init();
 
 static kl_resource_loader_t *loader = NULL;
+static pthread_once_t loader_once = PTHREAD_ONCE_INIT;
 
 /* -------------- */
 
-kl_array_t *kl_material_mtl_incref(char *path) {
-  if (loader == NULL) {
-    loader = kl_resource_loader_new((kl_resources_load_cb)&mtl_load, (kl_resources_free_cb)&mtl_free);
-  }
-  kl_resource_id_t resid = kl_resource_getid(path);
-  kl_array_t *entries = kl_resource_incref(loader, resid);
+kl_array_t *kl_material_mtl_incref(const char *path) {
+  pthread_once(&loader_once, &loader_init);
+  kl_array_t *entries = kl_resource_incref(loader, path);
   return entries;
 }
 
-void kl_material_mtl_decref(char *path) {
-  kl_resource_id_t resid = kl_resource_getid(path);
-  kl_resource_decref(resid);
+void kl_material_mtl_decref(const char *path) {
+  kl_resource_decref(path);
+}
+
+void kl_material_mtl_prefetch(const char *path) {
+  pthread_once(&loader_once, &loader_init);
+  kl_resource_prefetch(loader, path);
 }
 
-bool kl_material_loadfrommtl(kl_array_t *entries, char *vpath, char *entvpath, kl_material_t *material) {
+bool kl_material_loadfrommtl(kl_array_t *entries, const char *vpath, const char *entvpath, kl_material_t *material) {
+  /* entry names are interned, so one that was never interned can't be in here */
+  const char *name = kl_intern_find(entvpath);
+  if (name == NULL) return false;
+
   mtl_entry_t entry;
-  /* FIXME: Use hash table implementation (already written for resource manager) for MTL entries */
   for (int i=0; i < kl_array_size(entries); i++) {
     kl_array_get(entries, i, &entry);
-    if (strcmp(entry.path, entvpath) == 0) {
-      strncpy(material->path, vpath, KL_MATERIAL_PATHLEN);
+    if (entry.path == name) {
+      material->path = kl_intern(vpath);
+      /* get all maps decoding in parallel, the synchronous increfs below pick them up */
+      kl_resource_item_t *pending[4] = {
+        kl_texture_incref_async(entry.map_diffuse),
+        kl_texture_incref_async(entry.map_normal),
+        kl_texture_incref_async(entry.map_specular),
+        kl_texture_incref_async(entry.map_emissive)
+      };
       kl_texture_t *diffuse  = kl_texture_incref(entry.map_diffuse);
       kl_texture_t *normal   = kl_texture_incref(entry.map_normal);
       kl_texture_t *specular = kl_texture_incref(entry.map_specular);
@@ -59,6 +80,9 @@ bool kl_material_loadfrommtl(kl_array_t *entries, char *vpath, char *entvpath, k
       material->normal   = normal;
       material->specular = specular;
       material->emissive = emissive;
+      for (int j=0; j < 4; j++) {
+        if (pending[j] != NULL) kl_resource_decref(pending[j]->vpath);
+      }
       return true;
     }
   }
@@ -66,64 +90,84 @@ bool kl_material_loadfrommtl(kl_array_t *entries, char *vpath, char *entvpath, k
 }
 
 /* ------------------ */
+static void loader_init() {
+  loader = kl_resource_loader_new_async(&mtl_decode, &mtl_upload, &mtl_free, &mtl_free);
+  loader->name   = "mtl";
+  loader->size   = &mtl_size;
+  loader->reload = &mtl_reload;
+  loader->deps   = &mtl_deps;
+}
+
 static void parseline(kl_array_t *entries, mtl_entry_t *entry, char *line) {
   while (line[0] == ' ' || line[0] == '\t') { line++; } /* skip leading whitespace */
   char *cur = line;
   char *def;
   def = strsep(&cur, " \t");
   if (strcmp(def, "newmtl") == 0) {
-    if (entry->path != '\0') {
+    if (entry->path != NULL) {
       kl_array_push(entries, entry);
     }
-    strncpy(entry->path, strsep(&cur, " \t"), MTL_PATHLEN);
-    strncpy(entry->map_diffuse,  "DEFAULT_DIFFUSE",  MTL_PATHLEN);
-    strncpy(entry->map_normal,   "DEFAULT_NORMAL",   MTL_PATHLEN);
-    strncpy(entry->map_specular, "DEFAULT_SPECULAR", MTL_PATHLEN);
-    strncpy(entry->map_emissive, "DEFAULT_EMISSIVE", MTL_PATHLEN);
+    entry->path         = kl_intern(strsep(&cur, " \t"));
+    entry->map_diffuse  = kl_intern("DEFAULT_DIFFUSE");
+    entry->map_normal   = kl_intern("DEFAULT_NORMAL");
+    entry->map_specular = kl_intern("DEFAULT_SPECULAR");
+    entry->map_emissive = kl_intern("DEFAULT_EMISSIVE");
   } else if (strcmp(def, "map_Kd") == 0) {
-    snprintf(entry->map_diffuse, MTL_PATHLEN, "/%s", strsep(&cur, " \t"));
+    entry->map_diffuse  = intern_map(strsep(&cur, " \t"));
   } else if (strcmp(def, "map_Ks") == 0) {
-    snprintf(entry->map_specular, MTL_PATHLEN, "/%s", strsep(&cur, " \t"));
+    entry->map_specular = intern_map(strsep(&cur, " \t"));
   } else if (strcmp(def, "map_bump") == 0) {
-    snprintf(entry->map_normal, MTL_PATHLEN, "/%s", strsep(&cur, " \t"));
+    entry->map_normal   = intern_map(strsep(&cur, " \t"));
   } else if (strcmp(def, "bump") == 0) {
-    snprintf(entry->map_normal, MTL_PATHLEN, "/%s", strsep(&cur, " \t"));
+    entry->map_normal   = intern_map(strsep(&cur, " \t"));
   } else if (strcmp(def, "map_emissive") == 0) {
-    snprintf(entry->map_emissive, MTL_PATHLEN, "/%s", strsep(&cur, " \t"));
+    entry->map_emissive = intern_map(strsep(&cur, " \t"));
   }
 }
 
-static void* mtl_load(char *path, char *vpath) {
-  static char line[0x400];
-  static char ent_vpath[KL_RESITEM_PATHLEN];
+static const char* intern_map(const char *name) {
+  /* map paths are relative to the virtual root */
+  char buf[KL_RESITEM_PATHLEN];
+  snprintf(buf, KL_RESITEM_PATHLEN, "/%s", name != NULL ? name : "");
+  return kl_intern(buf);
+}
+
+static void* mtl_decode(kl_resource_blob_t *blob, const char *vpath) {
+  char line[0x400];
 
-  FILE *file = fopen(path, "r");
-  if (file == NULL) {
+  if (blob->data == NULL) {
     return NULL;
   }
 
-  kl_array_t *entries = malloc(sizeof(kl_array_t));
+  kl_array_t *entries = kl_mem_alloc(KL_MEM_RESOURCE, sizeof(kl_array_t));
   kl_array_init(entries, sizeof(mtl_entry_t));
 
   mtl_entry_t entry;
-  entry.path[0] = '\0';
-  while (!feof(file)) {
-    for (int i=0; i < 0x400; i++) {
-      char c = fgetc(file);
-      if (c == '\n' || c == '\r') {
-        line[i] = '\0';
-        break;
-      } else {
-        line[i] = c;
-      }
+  entry.path = NULL;
+  const char *cur = (const char*)blob->data;
+  const char *end = cur + blob->size;
+  while (cur < end) {
+    int n = 0;
+    while (cur < end && *cur != '\n' && *cur != '\r') {
+      if (n < 0x3FF) line[n++] = *cur;
+      cur++;
     }
-    line[0x399] = '\0';
+    cur++; /* skip the line break */
+    line[n] = '\0';
     parseline(entries, &entry, line);
   }
-  if (entry.path[0] != '\0') {
+  if (entry.path != NULL) {
     kl_array_push(entries, &entry);
   }
-  
+
+  return (void*)entries;
+}
+
+static void* mtl_upload(void *data, const char *path, const char *vpath) {
+  char ent_vpath[KL_RESITEM_PATHLEN];
+
+  kl_array_t *entries = data;
+  mtl_entry_t entry;
   for (int i=0; i < kl_array_size(entries); i++) {
     kl_array_get(entries, i, &entry);
     snprintf(ent_vpath, KL_RESITEM_PATHLEN, "%s|%s", vpath, entry.path);
@@ -136,7 +180,33 @@ static void* mtl_load(char *path, char *vpath) {
 static void mtl_free(void *item) {
   kl_array_t *entries = item;
   kl_array_free(entries);
-  free(item);
+  kl_mem_free(KL_MEM_RESOURCE, item);
+}
+
+static void mtl_reload(void *item, void *fresh) {
+  /* materials which were already loaded keep their maps until they're reloaded themselves */
+  kl_array_t entries = *(kl_array_t*)item;
+  *(kl_array_t*)item  = *(kl_array_t*)fresh;
+  *(kl_array_t*)fresh = entries;
+  mtl_free(fresh);
+}
+
+static void mtl_deps(void *data, const char *vpath) {
+  kl_array_t *entries = data;
+  mtl_entry_t entry;
+  for (int i=0; i < kl_array_size(entries); i++) {
+    kl_array_get(entries, i, &entry);
+    kl_texture_prefetch(entry.map_diffuse);
+    kl_texture_prefetch(entry.map_normal);
+    kl_texture_prefetch(entry.map_specular);
+    kl_texture_prefetch(entry.map_emissive);
+  }
+}
+
+static void mtl_size(void *item, size_t *cpu, size_t *gpu) {
+  kl_array_t *entries = item;
+  *cpu = sizeof(kl_array_t) + (size_t)entries->size * entries->item_size;
+  *gpu = 0;
 }
   
 
@@ -6,9 +6,11 @@
 
 #include <stdbool.h>
 
-kl_array_t *kl_material_mtl_incref(char *path);
-void kl_material_mtl_decref(char *path);
-bool kl_material_loadfrommtl(kl_array_t *entries, char *vpath, char *entvpath, kl_material_t *material);
+kl_array_t *kl_material_mtl_incref(const char *path);
+void kl_material_mtl_decref(const char *path);
+/* starts loading an MTL and every map it lists in the background */
+void kl_material_mtl_prefetch(const char *path);
+bool kl_material_loadfrommtl(kl_array_t *entries, const char *vpath, const char *entvpath, kl_material_t *material);
 
 #endif /* KL_MTL_H */
 /* vim: set ts=2 sw=2 et */
@@ -3,42 +3,42 @@
 #include "material-mtl.h"
 #include "resource.h"
 #include "texture.h"
+#include "intern.h"
 #include "array.h"
+#include "mem.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
-static kl_material_t* material_load(char *path, char *vpath);
+static kl_material_t* material_load(const char *path, const char *vpath);
 static void material_free(kl_material_t *material);
-static void material_load_raw(char *path, kl_material_t *material);
-static void material_load_default(char *path, kl_material_t *material);
+static void material_load_raw(const char *path, kl_material_t *material); /* path must be interned */
+static void material_load_default(const char *path, kl_material_t *material);
 static bool path_split(char *vpath, char **mtlvpath, char **entvpath); /* this is destructive, like strtok */
+static void loader_init();
 
 static kl_resource_loader_t *loader = NULL;
-static kl_array_t *mtl_entries = NULL;
+static pthread_once_t loader_once = PTHREAD_ONCE_INIT;
+static const char *default_material; /* interned */
 
 /* --------------- */
-kl_material_t *kl_material_incref(char *path) {
-  if (loader == NULL) {
-    loader = kl_resource_loader_new((kl_resources_load_cb)&material_load, (kl_resources_free_cb)&material_free);
-    kl_resource_add_entry("", "DEFAULT_MATERIAL");
-  }
+kl_material_t *kl_material_incref(const char *path) {
+  pthread_once(&loader_once, &loader_init);
 
   /* MTL must be loaded prior to loading materials */
-  static char buf[KL_RESITEM_PATHLEN];
+  char buf[KL_RESITEM_PATHLEN];
   strncpy(buf, path, KL_RESITEM_PATHLEN);
   buf[KL_RESITEM_PATHLEN-1] = '\0';
   char *mtlvpath;
   char *entvpath;
+  kl_array_t *mtl_entries = NULL;
   if (path_split(buf, &mtlvpath, &entvpath)) {
     mtl_entries = kl_material_mtl_incref(mtlvpath);
-  } else {
-    mtl_entries = NULL;
   }
 
-  kl_resource_id_t resid = kl_resource_getid(path);
-  kl_material_t *material = kl_resource_incref(loader, resid);
+  kl_material_t *material = kl_resource_incref(loader, path);
   if (mtl_entries != NULL && material == NULL) {
     /* this causes a double-free, why? */
     //kl_material_mtl_decref(mtlvpath);
@@ -47,7 +47,7 @@ kl_material_t *kl_material_incref(char *path) {
 }
 
 void kl_material_decref(kl_material_t *material) {
-  static char buf[KL_RESITEM_PATHLEN];
+  char buf[KL_RESITEM_PATHLEN];
   strncpy(buf, material->path, KL_RESITEM_PATHLEN);
   buf[KL_RESITEM_PATHLEN-1] = '\0';
   char *mtlvpath;
@@ -56,11 +56,18 @@ void kl_material_decref(kl_material_t *material) {
     kl_material_mtl_decref(mtlvpath);
   }
 
-  kl_resource_id_t resid = kl_resource_getid(material->path);
-  kl_resource_decref(resid);
+  kl_resource_decref(material->path);
 }
 
 /* --------------- */
+static void loader_init() {
+  /* no size callback: a cached material would keep its textures referenced, so it's freed right away and the textures are cached instead */
+  loader = kl_resource_loader_new((kl_resources_load_cb)&material_load, (kl_resources_free_cb)&material_free);
+  loader->name = "material";
+  default_material = kl_intern("DEFAULT_MATERIAL");
+  kl_resource_add_entry("", default_material);
+}
+
 static bool path_split(char *vpath, char **mtlvpath, char **entvpath) {
   *mtlvpath = vpath;
   *entvpath = NULL;
@@ -75,21 +82,22 @@ static bool path_split(char *vpath, char **mtlvpath, char **entvpath) {
   return true;
 }
 
-static kl_material_t *material_load(char *path, char *vpath) {
-  kl_material_t *material = malloc(sizeof(kl_material_t));
+static kl_material_t *material_load(const char *path, const char *vpath) {
+  kl_material_t *material = kl_mem_alloc(KL_MEM_RESOURCE, sizeof(kl_material_t));
 
-  if (strcmp(vpath, "DEFAULT_MATERIAL") == 0) {
+  if (vpath == default_material) {
     material_load_default(vpath, material);
     return material;
   }
-  if (mtl_entries != NULL) {
-    static char buf[KL_RESITEM_PATHLEN];
-    strncpy(buf, vpath, KL_RESITEM_PATHLEN);
-    buf[KL_RESITEM_PATHLEN-1] = '\0';
-    char *mtlvpath;
-    char *entvpath;
-    path_split(buf, &mtlvpath, &entvpath);
-    if (kl_material_loadfrommtl(mtl_entries, vpath, entvpath, material)) {
+  char buf[KL_RESITEM_PATHLEN];
+  strncpy(buf, vpath, KL_RESITEM_PATHLEN);
+  buf[KL_RESITEM_PATHLEN-1] = '\0';
+  char *mtlvpath;
+  char *entvpath;
+  if (path_split(buf, &mtlvpath, &entvpath)) {
+    /* referenced by kl_material_incref for as long as the material is */
+    kl_array_t *mtl_entries = kl_resource_get(kl_resource_find(mtlvpath));
+    if (mtl_entries != NULL && kl_material_loadfrommtl(mtl_entries, vpath, entvpath, material)) {
       return material;
     }
   }
@@ -102,10 +110,10 @@ static void material_free(kl_material_t *material) {
   kl_texture_decref(material->normal);
   kl_texture_decref(material->specular);
   kl_texture_decref(material->emissive);
-  free(material);
+  kl_mem_free(KL_MEM_RESOURCE, material);
 }
 
-static void material_load_raw(char *path, kl_material_t *material) {
+static void material_load_raw(const char *path, kl_material_t *material) {
   char  buf[256];
   snprintf(buf, 256, "%s", path);
   kl_texture_t *diffuse  = kl_texture_incref(buf);
@@ -133,15 +141,15 @@ static void material_load_raw(char *path, kl_material_t *material) {
   assert(specular != NULL);
   assert(emissive != NULL);
 
-  strncpy(material->path, path, KL_MATERIAL_PATHLEN);
+  material->path     = path;
   material->diffuse  = diffuse;
   material->normal   = normal;
   material->specular = specular;
   material->emissive = emissive;
 }
 
-static void material_load_default(char *path, kl_material_t *material) {
-  strncpy(material->path, path, KL_MATERIAL_PATHLEN);
+static void material_load_default(const char *path, kl_material_t *material) {
+  material->path     = path;
   material->diffuse  = kl_texture_incref("DEFAULT_DIFFUSE");
   material->normal   = kl_texture_incref("DEFAULT_NORMAL");
   material->specular = kl_texture_incref("DEFAULT_SPECULAR");
@@ -0,0 +1,163 @@
+#include "mem.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+static const char *tagnames[KL_MEM_NUMTAGS] = {
+  "array", "bvh", "terrain", "resource", "texture", "model", "render", "ui"
+};
+
+static int dump_interval = 0;
+static int dump_frames   = 0;
+
+#ifdef KL_MEM_TRACKING
+/* each block is prefixed by a header, padded to keep the user pointer 16-byte aligned */
+typedef union mem_header {
+  struct {
+    size_t size;
+    int    tag;
+  } info;
+  uint8_t pad[16];
+} mem_header_t;
+
+typedef struct mem_counters {
+  size_t   live_bytes;
+  size_t   peak_bytes;
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t frame_allocs;
+  uint64_t frame_allocs_last;
+} mem_counters_t;
+
+static mem_counters_t counters[KL_MEM_NUMTAGS];
+static __thread uint64_t thread_heapcalls = 0;
+
+/* counters are touched by loader threads too, so they're updated atomically */
+static void count_alloc(int tag, size_t size);
+static void count_free(int tag, size_t size);
+
+/* ------------------------ */
+void* kl_mem_alloc(int tag, size_t size) {
+  assert(tag >= 0 && tag < KL_MEM_NUMTAGS);
+  mem_header_t *header = malloc(sizeof(mem_header_t) + size);
+  if (header == NULL) return NULL;
+  header->info.size = size;
+  header->info.tag  = tag;
+  count_alloc(tag, size);
+  thread_heapcalls++;
+  return header + 1;
+}
+
+void* kl_mem_realloc(int tag, void *ptr, size_t size) {
+  if (ptr == NULL) return kl_mem_alloc(tag, size);
+  mem_header_t *header = (mem_header_t*)ptr - 1;
+  assert(header->info.tag == tag);
+  size_t oldsize = header->info.size;
+  header = realloc(header, sizeof(mem_header_t) + size);
+  if (header == NULL) return NULL;
+  header->info.size = size;
+  count_free(tag, oldsize);
+  count_alloc(tag, size);
+  thread_heapcalls++;
+  return header + 1;
+}
+
+void kl_mem_free(int tag, void *ptr) {
+  if (ptr == NULL) return;
+  mem_header_t *header = (mem_header_t*)ptr - 1;
+  assert(header->info.tag == tag);
+  count_free(tag, header->info.size);
+  thread_heapcalls++;
+  free(header);
+}
+
+void kl_mem_stats(int tag, kl_mem_stats_t *stats) {
+  assert(tag >= 0 && tag < KL_MEM_NUMTAGS);
+  mem_counters_t *c = &counters[tag];
+  *stats = (kl_mem_stats_t){
+    .live_bytes   = __atomic_load_n(&c->live_bytes, __ATOMIC_RELAXED),
+    .peak_bytes   = __atomic_load_n(&c->peak_bytes, __ATOMIC_RELAXED),
+    .allocs       = __atomic_load_n(&c->allocs, __ATOMIC_RELAXED),
+    .frees        = __atomic_load_n(&c->frees, __ATOMIC_RELAXED),
+    .frame_allocs = __atomic_load_n(&c->frame_allocs_last, __ATOMIC_RELAXED)
+  };
+}
+
+uint64_t kl_mem_thread_heapcalls() {
+  return thread_heapcalls;
+}
+
+void kl_mem_tick() {
+  for (int i=0; i < KL_MEM_NUMTAGS; i++) {
+    uint64_t n = __atomic_exchange_n(&counters[i].frame_allocs, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters[i].frame_allocs_last, n, __ATOMIC_RELAXED);
+  }
+  if (dump_interval > 0 && ++dump_frames >= dump_interval) {
+    dump_frames = 0;
+    kl_mem_dump(stderr);
+  }
+}
+
+/* ------------------------ */
+static void count_alloc(int tag, size_t size) {
+  mem_counters_t *c = &counters[tag];
+  size_t live = __atomic_add_fetch(&c->live_bytes, size, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&c->peak_bytes, __ATOMIC_RELAXED);
+  while (live > peak) {
+    if (__atomic_compare_exchange_n(&c->peak_bytes, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+  }
+  __atomic_add_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->frame_allocs, 1, __ATOMIC_RELAXED);
+}
+
+static void count_free(int tag, size_t size) {
+  mem_counters_t *c = &counters[tag];
+  __atomic_sub_fetch(&c->live_bytes, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->frees, 1, __ATOMIC_RELAXED);
+}
+
+#else /* KL_MEM_TRACKING */
+
+void kl_mem_stats(int tag, kl_mem_stats_t *stats) {
+  *stats = (kl_mem_stats_t){ .live_bytes = 0 };
+}
+
+uint64_t kl_mem_thread_heapcalls() {
+  return 0;
+}
+
+void kl_mem_tick() {
+  if (dump_interval > 0 && ++dump_frames >= dump_interval) {
+    dump_frames = 0;
+    kl_mem_dump(stderr);
+  }
+}
+
+#endif /* KL_MEM_TRACKING */
+
+const char* kl_mem_tagname(int tag) {
+  if (tag < 0 || tag >= KL_MEM_NUMTAGS) return "unknown";
+  return tagnames[tag];
+}
+
+void kl_mem_set_dump_interval(int frames) {
+  dump_interval = frames;
+  dump_frames   = 0;
+}
+
+void kl_mem_dump(FILE *out) {
+#ifdef KL_MEM_TRACKING
+  fprintf(out, "Memory: %-10s %12s %12s %12s %12s %8s\n", "tag", "live", "peak", "allocs", "frees", "frame");
+  for (int i=0; i < KL_MEM_NUMTAGS; i++) {
+    kl_mem_stats_t s;
+    kl_mem_stats(i, &s);
+    fprintf(out, "Memory: %-10s %12zu %12zu %12" PRIu64 " %12" PRIu64 " %8" PRIu64 "\n",
+      kl_mem_tagname(i), s.live_bytes, s.peak_bytes, s.allocs, s.frees, s.frame_allocs);
+  }
+#else
+  fprintf(out, "Memory: tracking disabled (built with NDEBUG)\n");
+#endif
+}
+
+/* vim: set ts=2 sw=2 et */
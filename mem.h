@@ -0,0 +1,59 @@
+#ifndef KL_MEM_H
+#define KL_MEM_H
+
+/* tagged heap allocation w/ per-subsystem statistics
+ *
+ * tracking is on by default in debug builds, and compiles down to plain
+ * malloc/realloc/free when NDEBUG is defined (unless KL_MEM_TRACKING is) */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#if !defined(KL_MEM_TRACKING) && !defined(NDEBUG)
+#define KL_MEM_TRACKING
+#endif
+
+#define KL_MEM_ARRAY    0x00
+#define KL_MEM_BVH      0x01
+#define KL_MEM_TERRAIN  0x02
+#define KL_MEM_RESOURCE 0x03
+#define KL_MEM_TEXTURE  0x04
+#define KL_MEM_MODEL    0x05
+#define KL_MEM_RENDER   0x06
+#define KL_MEM_UI       0x07
+#define KL_MEM_NUMTAGS  0x08
+
+typedef struct kl_mem_stats {
+  size_t   live_bytes;
+  size_t   peak_bytes;
+  uint64_t allocs;       /* lifetime, reallocs count as allocations */
+  uint64_t frees;
+  uint64_t frame_allocs; /* during the last complete frame */
+} kl_mem_stats_t;
+
+#ifdef KL_MEM_TRACKING
+void* kl_mem_alloc(int tag, size_t size);
+void* kl_mem_realloc(int tag, void *ptr, size_t size);
+void  kl_mem_free(int tag, void *ptr);
+#else
+#define kl_mem_alloc(tag, size)        malloc(size)
+#define kl_mem_realloc(tag, ptr, size) realloc(ptr, size)
+#define kl_mem_free(tag, ptr)          free(ptr)
+#endif
+
+/* zeroed when tracking is disabled */
+void  kl_mem_stats(int tag, kl_mem_stats_t *stats);
+/* allocations, reallocations and frees under any tag made so far by the calling thread, zero when
+ * tracking is disabled -- the difference across a stretch of code is what that code did, whatever
+ * other threads were doing meanwhile */
+uint64_t kl_mem_thread_heapcalls();
+const char* kl_mem_tagname(int tag);
+/* marks a frame boundary, and writes a dump every 'interval' frames if enabled */
+void  kl_mem_tick();
+void  kl_mem_set_dump_interval(int frames); /* zero disables periodic dumps */
+void  kl_mem_dump(FILE *out);
+
+#endif /* KL_MEM_H */
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,173 @@
+#include "model-data.h"
+
+#include "intern.h"
+#include "mem.h"
+
+#include <string.h>
+
+typedef struct cooked_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vert_n;
+  uint32_t tris_n;
+  uint32_t mesh_n;
+  uint32_t num_strings; /* bytes */
+  kl_sphere_t bounds;
+} cooked_header_t;
+
+typedef struct cooked_mesh {
+  uint32_t material; /* offset into the string table */
+  uint32_t tris_i;
+  uint32_t tris_n;
+} cooked_mesh_t;
+
+#define VERTEX_BYTES (2 * sizeof(kl_vec3f_t) + sizeof(kl_vec2f_t) + sizeof(kl_vec4f_t))
+
+static size_t align(size_t n);
+
+/* ------------------ */
+void kl_model_data_alloc(kl_model_data_t *data, unsigned int vert_n, unsigned int tris_n, unsigned int mesh_n) {
+  size_t offsets[6];
+  size_t size = 0;
+  offsets[0] = size; size += align(mesh_n * sizeof(kl_model_data_mesh_t));
+  offsets[1] = size; size += align(vert_n * sizeof(kl_vec4f_t));
+  offsets[2] = size; size += align(vert_n * sizeof(kl_vec3f_t));
+  offsets[3] = size; size += align(vert_n * sizeof(kl_vec3f_t));
+  offsets[4] = size; size += align(vert_n * sizeof(kl_vec2f_t));
+  offsets[5] = size; size += align(tris_n * 3 * sizeof(unsigned int));
+
+  uint8_t *storage = kl_mem_alloc(KL_MEM_MODEL, size > 0 ? size : 1);
+  data->vert_n   = vert_n;
+  data->tris_n   = tris_n;
+  data->mesh_n   = mesh_n;
+  data->mesh     = (kl_model_data_mesh_t*)(storage + offsets[0]);
+  data->tangent  = (kl_vec4f_t*)(storage + offsets[1]);
+  data->position = (kl_vec3f_t*)(storage + offsets[2]);
+  data->normal   = (kl_vec3f_t*)(storage + offsets[3]);
+  data->texcoord = (kl_vec2f_t*)(storage + offsets[4]);
+  data->tris     = (unsigned int*)(storage + offsets[5]);
+  data->storage  = storage;
+}
+
+void kl_model_data_free(kl_model_data_t *data) {
+  kl_mem_free(KL_MEM_MODEL, data->storage);
+  data->storage = NULL;
+}
+
+bool kl_model_data_iscooked(const uint8_t *data, size_t size) {
+  if (data == NULL) return false;
+  if (size < sizeof(cooked_header_t)) return false;
+  uint32_t magic;
+  memcpy(&magic, data, sizeof(magic));
+  return magic == KL_MODEL_COOKED_MAGIC;
+}
+
+bool kl_model_data_read(const uint8_t *buf, size_t size, const char *name, kl_model_data_t *data) {
+  cooked_header_t header;
+  if (!kl_model_data_iscooked(buf, size)) {
+    fprintf(stderr, "Model-cooked: %s is not a cooked model\n", name);
+    return false;
+  }
+  memcpy(&header, buf, sizeof(header));
+  if (header.version != KL_MODEL_COOKED_VERSION) {
+    fprintf(stderr, "Model-cooked: %s was cooked by a different version, recook it\n", name);
+    return false;
+  }
+
+  uint64_t vertbytes = (uint64_t)header.vert_n * VERTEX_BYTES;
+  uint64_t trisbytes = (uint64_t)header.tris_n * 3 * sizeof(uint32_t);
+  uint64_t meshbytes = (uint64_t)header.mesh_n * sizeof(cooked_mesh_t);
+  if (size != sizeof(header) + vertbytes + trisbytes + meshbytes + header.num_strings) {
+    fprintf(stderr, "Model-cooked: %s is truncated\n", name);
+    return false;
+  }
+
+  const uint8_t *cur = buf + sizeof(header);
+  const uint8_t *tris    = cur + vertbytes;
+  const uint8_t *meshes  = tris + trisbytes;
+  const char    *strings = (const char*)(meshes + meshbytes);
+  if (header.mesh_n > 0 && (header.num_strings == 0 || strings[header.num_strings-1] != '\0')) {
+    fprintf(stderr, "Model-cooked: %s has a bad string table\n", name);
+    return false;
+  }
+
+  kl_model_data_alloc(data, header.vert_n, header.tris_n, header.mesh_n);
+  data->bounds = header.bounds;
+  memcpy(data->position, cur, header.vert_n * sizeof(kl_vec3f_t));
+  cur += header.vert_n * sizeof(kl_vec3f_t);
+  memcpy(data->texcoord, cur, header.vert_n * sizeof(kl_vec2f_t));
+  cur += header.vert_n * sizeof(kl_vec2f_t);
+  memcpy(data->normal, cur, header.vert_n * sizeof(kl_vec3f_t));
+  cur += header.vert_n * sizeof(kl_vec3f_t);
+  memcpy(data->tangent, cur, header.vert_n * sizeof(kl_vec4f_t));
+  memcpy(data->tris, tris, trisbytes);
+
+  /* an index out of range would have the GPU read past the vertex buffers */
+  for (uint64_t i=0; i < (uint64_t)header.tris_n * 3; i++) {
+    if (data->tris[i] >= header.vert_n) {
+      fprintf(stderr, "Model-cooked: %s has a bad vertex index\n", name);
+      kl_model_data_free(data);
+      return false;
+    }
+  }
+  for (unsigned int i=0; i < header.mesh_n; i++) {
+    cooked_mesh_t mesh;
+    memcpy(&mesh, meshes + i * sizeof(mesh), sizeof(mesh));
+    if (mesh.material >= header.num_strings || mesh.tris_i > header.tris_n || mesh.tris_n > header.tris_n - mesh.tris_i) {
+      fprintf(stderr, "Model-cooked: %s has a bad mesh\n", name);
+      kl_model_data_free(data);
+      return false;
+    }
+    data->mesh[i].material = kl_intern(strings + mesh.material);
+    data->mesh[i].tris_i   = mesh.tris_i;
+    data->mesh[i].tris_n   = mesh.tris_n;
+  }
+  return true;
+}
+
+int kl_model_data_write(kl_model_data_t *data, FILE *out) {
+  cooked_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic   = KL_MODEL_COOKED_MAGIC;
+  header.version = KL_MODEL_COOKED_VERSION;
+  header.vert_n  = data->vert_n;
+  header.tris_n  = data->tris_n;
+  header.mesh_n  = data->mesh_n;
+  header.bounds  = data->bounds;
+  for (unsigned int i=0; i < data->mesh_n; i++) {
+    header.num_strings += strlen(data->mesh[i].material) + 1;
+  }
+
+  unsigned int n = data->vert_n;
+  if (fwrite(&header, sizeof(header), 1, out) != 1) return -1;
+  if (n > 0) {
+    if (fwrite(data->position, sizeof(kl_vec3f_t), n, out) != n) return -1;
+    if (fwrite(data->texcoord, sizeof(kl_vec2f_t), n, out) != n) return -1;
+    if (fwrite(data->normal,   sizeof(kl_vec3f_t), n, out) != n) return -1;
+    if (fwrite(data->tangent,  sizeof(kl_vec4f_t), n, out) != n) return -1;
+  }
+  if (data->tris_n > 0 && fwrite(data->tris, 3 * sizeof(uint32_t), data->tris_n, out) != data->tris_n) return -1;
+
+  uint32_t offset = 0;
+  for (unsigned int i=0; i < data->mesh_n; i++) {
+    cooked_mesh_t mesh = {
+      .material = offset,
+      .tris_i   = data->mesh[i].tris_i,
+      .tris_n   = data->mesh[i].tris_n
+    };
+    offset += strlen(data->mesh[i].material) + 1;
+    if (fwrite(&mesh, sizeof(mesh), 1, out) != 1) return -1;
+  }
+  for (unsigned int i=0; i < data->mesh_n; i++) {
+    const char *material = data->mesh[i].material;
+    if (fwrite(material, strlen(material) + 1, 1, out) != 1) return -1;
+  }
+  return 0;
+}
+
+/* ------------------ */
+static size_t align(size_t n) {
+  return (n + 0xf) & ~(size_t)0xf;
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,50 @@
+#ifndef KL_MODEL_DATA_H
+#define KL_MODEL_DATA_H
+
+/* a static model's vertex data before upload, and its cooked on-disk form
+ *
+ * this is what the OBJ parser produces, so kl-cook can store the parsed,
+ * deduplicated and tangent-space-complete result and the runtime only has to
+ * upload it.  cooked layout: header, positions, texcoords, normals, tangents,
+ * triangles, meshes, then the NUL-terminated material names.  all integers
+ * are little-endian. */
+
+#include "sphere.h"
+#include "vec.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define KL_MODEL_COOKED_MAGIC   0x4c444d4b /* "KMDL" */
+#define KL_MODEL_COOKED_VERSION 1
+
+typedef struct kl_model_data_mesh {
+  const char *material; /* interned */
+  unsigned int tris_i, tris_n;
+} kl_model_data_mesh_t;
+
+typedef struct kl_model_data {
+  kl_sphere_t  bounds;
+  unsigned int vert_n, tris_n, mesh_n;
+  kl_vec3f_t  *position;
+  kl_vec2f_t  *texcoord;
+  kl_vec3f_t  *normal;
+  kl_vec4f_t  *tangent;
+  unsigned int *tris; /* 3 indices per triangle */
+  kl_model_data_mesh_t *mesh;
+  void *storage; /* everything above lives in this one block */
+} kl_model_data_t;
+
+/* the arrays are left uninitialized */
+void kl_model_data_alloc(kl_model_data_t *data, unsigned int vert_n, unsigned int tris_n, unsigned int mesh_n);
+void kl_model_data_free(kl_model_data_t *data);
+
+bool kl_model_data_iscooked(const uint8_t *data, size_t size);
+/* validates and copies out a cooked model, name is only used for errors */
+bool kl_model_data_read(const uint8_t *buf, size_t size, const char *name, kl_model_data_t *data);
+int  kl_model_data_write(kl_model_data_t *data, FILE *out);
+
+#endif /* KL_MODEL_DATA_H */
+/* vim: set ts=2 sw=2 et */
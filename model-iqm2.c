@@ -1,6 +1,7 @@
 #include "model-iqm2.h"
 
 #include "renderer.h"
+#include "mem.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -181,7 +182,7 @@ kl_model_t* kl_model_loadiqm2(uint8_t *data, int size) {
     }
   }
 
-  kl_model_t *model = malloc(sizeof(kl_model_t) + header->mesh_n * sizeof(kl_mesh_t));
+  kl_model_t *model = kl_mem_alloc(KL_MEM_MODEL, sizeof(kl_model_t) + header->mesh_n * sizeof(kl_mesh_t));
 
   model->type = KL_MODEL_ACTOR;
   kl_sphere_bounds(&model->bounds, (kl_vec3f_t*)(data + va_position->offset), header->vert_n);
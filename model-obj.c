@@ -1,11 +1,10 @@
 #include "model-obj.h"
 
-#include "model.h"
-#include "material-mtl.h"
-#include "renderer.h"
 #include "array.h"
 #include "vec.h"
 #include "strsep.h"
+#include "mem.h"
+#include "intern.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -47,7 +46,7 @@ typedef struct obj_face {
 
 #define OBJ_PATHLEN 0x100
 typedef struct obj_mesh {
-  char material[OBJ_PATHLEN];
+  const char *material; /* interned */
   unsigned int tris_i, tris_n;
 } obj_mesh_t;
 
@@ -59,10 +58,17 @@ typedef struct obj_data {
   /* vertex data to be loaded into renderer */
   kl_array_t bufposition, bufnormal, buftangent, bufbitangent, buftexcoord;
   kl_array_t tris, meshes;
+  /* parser state */
+  obj_mesh_t curmesh;
+  char curmtl[OBJ_PATHLEN];
+  kl_model_obj_mtllib_cb mtllib;
 } obj_data_t;
 
-static obj_mesh_t obj_curmesh;
-static char obj_curmtl[OBJ_PATHLEN] = "\0";
+KL_ARRAY_DECLARE(kl_vec2f_t, vec2f)
+KL_ARRAY_DECLARE(kl_vec3f_t, vec3f)
+KL_ARRAY_DECLARE(kl_vec4f_t, vec4f)
+KL_ARRAY_DECLARE(triangle_t, tris)
+KL_ARRAY_DECLARE(indexmap_t, indexmap)
 
 static void objdata_init(obj_data_t *data);
 static void objdata_free(obj_data_t *data);
@@ -84,18 +90,15 @@ bool kl_model_isobj(uint8_t *data, int size) {
   return magic == OBJ_MAGIC;
 }
   
-kl_model_t* kl_model_loadobj(uint8_t *data, int size) {
-  kl_model_t *model = NULL;
+bool kl_model_parseobj(uint8_t *data, int size, kl_model_obj_mtllib_cb mtllib, kl_model_data_t *model) {
+  bool ok = false;
 
   obj_data_t objdata;
   objdata_init(&objdata);
-
-  obj_curmesh.material[0] = '\0';
-  obj_curmesh.tris_i = 0;
-  obj_curmesh.tris_n = 0;
+  objdata.mtllib = mtllib;
 
   /* load data from file */
-  char *buf  = malloc(size+1);
+  char *buf  = kl_mem_alloc(KL_MEM_MODEL, size+1);
   memcpy(buf, data, size);
   buf[size] = '\0';
 
@@ -103,23 +106,26 @@ kl_model_t* kl_model_loadobj(uint8_t *data, int size) {
   char *line;
   do {
     line = strsep(&cur, "\n\r");
-    if (parseline(&objdata, line) < 0) goto cleanup;
+    if (parseline(&objdata, line) < 0) {
+      kl_mem_free(KL_MEM_MODEL, buf);
+      goto cleanup;
+    }
   } while (cur != NULL);
-  free(buf);
+  kl_mem_free(KL_MEM_MODEL, buf);
 
   int tris_i = kl_array_size(&objdata.tris);
-  if (tris_i > obj_curmesh.tris_i) {
-    obj_curmesh.tris_n = tris_i - obj_curmesh.tris_i;
-    kl_array_push(&objdata.meshes, &obj_curmesh);
+  if (tris_i > objdata.curmesh.tris_i) {
+    objdata.curmesh.tris_n = tris_i - objdata.curmesh.tris_i;
+    kl_array_push(&objdata.meshes, &objdata.curmesh);
   }
 
   /* generate tangent data */
+  triangle_t *tris = kl_array_tris_data(&objdata.tris);
   for (int i=0; i < kl_array_size(&objdata.tris); i++) {
-    triangle_t tri;
-    kl_array_get(&objdata.tris, i, &tri);
-    updatetangent(&objdata, tri.vert[0], tri.vert[1], tri.vert[2]);
-    updatetangent(&objdata, tri.vert[1], tri.vert[2], tri.vert[0]);
-    updatetangent(&objdata, tri.vert[2], tri.vert[0], tri.vert[1]);
+    triangle_t *tri = tris + i;
+    updatetangent(&objdata, tri->vert[0], tri->vert[1], tri->vert[2]);
+    updatetangent(&objdata, tri->vert[1], tri->vert[2], tri->vert[0]);
+    updatetangent(&objdata, tri->vert[2], tri->vert[0], tri->vert[1]);
   }
   for (int i=0; i < kl_array_size(&objdata.buftangent); i++) {
     orthogonalize(&objdata, i);
@@ -131,87 +137,29 @@ kl_model_t* kl_model_loadobj(uint8_t *data, int size) {
     kl_array_size(&objdata.rawtexcoord),
     kl_array_size(&objdata.meshes));
 
-  /* load model data */
+  int num_verts  = kl_array_size(&objdata.bufposition);
+  int num_tris   = kl_array_size(&objdata.tris);
   int num_meshes = kl_array_size(&objdata.meshes);
-  model = malloc(sizeof(kl_model_t) + num_meshes * sizeof(kl_mesh_t));
-
-  model->type = KL_MODEL_PROP;
-  kl_sphere_bounds(&model->bounds, (kl_vec3f_t*)kl_array_data(&objdata.bufposition), kl_array_size(&objdata.bufposition));
-  model->winding = KL_RENDER_CCW;
-
-  kl_model_bufs_prop_t *bufs = &model->bufs.prop;
-  bufs->position = 0;
-  bufs->texcoord = 0;
-  bufs->normal   = 0;
-  bufs->tangent  = 0;
-
-  int bytes;
-  unsigned int vbo;
-
-  bytes = kl_array_size(&objdata.bufposition) * sizeof(kl_vec3f_t);
-  vbo   = kl_render_upload_vertdata(kl_array_data(&objdata.bufposition), bytes);
-  bufs->position = vbo;
-
-  bytes = kl_array_size(&objdata.bufnormal) * sizeof(kl_vec3f_t);
-  vbo   = kl_render_upload_vertdata(kl_array_data(&objdata.bufnormal), bytes);
-  bufs->normal = vbo;
-
-  bytes = kl_array_size(&objdata.buftangent) * sizeof(kl_vec4f_t);
-  vbo   = kl_render_upload_vertdata(kl_array_data(&objdata.buftangent), bytes);
-  bufs->tangent = vbo;
-
-  bytes = kl_array_size(&objdata.buftexcoord) * sizeof(kl_vec2f_t);
-  vbo   = kl_render_upload_vertdata(kl_array_data(&objdata.buftexcoord), bytes);
-  bufs->texcoord = vbo;
-
-  bytes = kl_array_size(&objdata.tris) * sizeof(triangle_t);
-  model->tris = kl_render_upload_tris((unsigned int*)kl_array_data(&objdata.tris), bytes);
-
-  kl_render_attrib_t cfg[4];
-  cfg[0] = (kl_render_attrib_t){
-    .index  = 0,
-    .size   = 3,
-    .type   = KL_RENDER_FLOAT,
-    .buffer = bufs->position
-  };
-  cfg[1] = (kl_render_attrib_t){
-    .index  = 1,
-    .size   = 2,
-    .type   = KL_RENDER_FLOAT,
-    .buffer = bufs->texcoord
-  };
-  cfg[2] = (kl_render_attrib_t){
-    .index  = 2,
-    .size   = 3,
-    .type   = KL_RENDER_FLOAT,
-    .buffer = bufs->normal
-  };
-  cfg[3] = (kl_render_attrib_t){
-    .index  = 3,
-    .size   = 4,
-    .type   = KL_RENDER_FLOAT,
-    .buffer = bufs->tangent
-  };
-
-  model->attribs = kl_render_define_attribs(model->tris, cfg, 4);
-  
-  model->mesh_n = num_meshes;
+  kl_model_data_alloc(model, num_verts, num_tris, num_meshes);
+
+  kl_sphere_bounds(&model->bounds, kl_array_vec3f_data(&objdata.bufposition), num_verts);
+  memcpy(model->position, kl_array_data(&objdata.bufposition), num_verts * sizeof(kl_vec3f_t));
+  memcpy(model->texcoord, kl_array_data(&objdata.buftexcoord), num_verts * sizeof(kl_vec2f_t));
+  memcpy(model->normal,   kl_array_data(&objdata.bufnormal),   num_verts * sizeof(kl_vec3f_t));
+  memcpy(model->tangent,  kl_array_data(&objdata.buftangent),  num_verts * sizeof(kl_vec4f_t));
+  memcpy(model->tris,     kl_array_data(&objdata.tris),        num_tris * sizeof(triangle_t));
   for (int i=0; i < num_meshes; i++) {
     obj_mesh_t mesh;
     kl_array_get(&objdata.meshes, i, &mesh);
-    kl_material_t *material = kl_material_incref(mesh.material);
-    if (material == NULL) {
-      material = kl_material_incref("DEFAULT_MATERIAL");
-    }
-    assert(material != NULL);
-    model->mesh[i].material = material;
+    model->mesh[i].material = mesh.material;
     model->mesh[i].tris_i   = mesh.tris_i;
     model->mesh[i].tris_n   = mesh.tris_n;
   }
+  ok = true;
 
   cleanup:
   objdata_free(&objdata);
-  return model;
+  return ok;
 }
 
 /* -------------------- */
@@ -227,6 +175,11 @@ static void objdata_init(obj_data_t *data) {
   kl_array_init(&data->buftexcoord, sizeof(kl_vec2f_t));
   kl_array_init(&data->tris,        sizeof(triangle_t));
   kl_array_init(&data->meshes,      sizeof(obj_mesh_t));
+  data->curmesh.material = "";
+  data->curmesh.tris_i   = 0;
+  data->curmesh.tris_n   = 0;
+  data->curmtl[0] = '\0';
+  data->mtllib    = NULL;
 }
 
 static void objdata_free(obj_data_t *data) {
@@ -244,20 +197,18 @@ static void objdata_free(obj_data_t *data) {
 }
 
 static int objdata_getvertidx(obj_data_t *objdata, obj_face_vert_t *vert) {
-  indexmap_t map;
+  indexmap_t *map = NULL;
   if (vert->posidx < kl_array_size(&objdata->indexmap)) {
-    kl_array_get(&objdata->indexmap, vert->posidx, &map);
-    for (int i=0; i < map.n; i++) {
-      if (map.texidx[i] == vert->texidx && map.normidx[i] == vert->normidx) {
-        return map.vertidx[i];
+    map = kl_array_indexmap_at(&objdata->indexmap, vert->posidx);
+    for (int i=0; i < map->n; i++) {
+      if (map->texidx[i] == vert->texidx && map->normidx[i] == vert->normidx) {
+        return map->vertidx[i];
       }
     }
-    if (map.n >= INDEXMAP_MAXENTRIES) {
+    if (map->n >= INDEXMAP_MAXENTRIES) {
       fprintf(stderr, "Mesh-OBJ: Overloaded vertex!  Increase INDEX_MAXENTRIES or simplify mesh!\n");
       return -1;
     }
-  } else {
-    map.n = 0;
   }
 
   kl_vec3f_t position;
@@ -266,9 +217,9 @@ static int objdata_getvertidx(obj_data_t *objdata, obj_face_vert_t *vert) {
   kl_vec3f_t bitangent = { .x = 0.0f, .y = 0.0f, .z = 0.0f };
   kl_vec2f_t texcoord;
 
-  kl_array_get(&objdata->rawposition, vert->posidx,  &position);
+  position = *kl_array_vec3f_at(&objdata->rawposition, vert->posidx);
   if (vert->normidx >= 0) {
-    kl_array_get(&objdata->rawnormal,   vert->normidx, &normal);
+    normal = *kl_array_vec3f_at(&objdata->rawnormal, vert->normidx);
   } else {
     /* todo: construct default normal from face verts */
     normal.x = 0.0f;
@@ -276,24 +227,28 @@ static int objdata_getvertidx(obj_data_t *objdata, obj_face_vert_t *vert) {
     normal.z = 1.0f;
   }
   if (vert->texidx >= 0) {
-    kl_array_get(&objdata->rawtexcoord, vert->texidx,  &texcoord);
+    texcoord = *kl_array_vec2f_at(&objdata->rawtexcoord, vert->texidx);
   } else {
     /* todo: better default texture projection based on face normals */
     texcoord.x = position.x;
     texcoord.y = position.y;
   }
   
-  int vertidx = kl_array_push(&objdata->bufposition, &position);
-  kl_array_set_expand(&objdata->bufnormal,   vertidx, &normal,   0);
-  kl_array_set_expand(&objdata->buftangent,  vertidx, &tangent,  0);
-  kl_array_set_expand(&objdata->bufbitangent, vertidx, &bitangent, 0);
-  kl_array_set_expand(&objdata->buftexcoord, vertidx, &texcoord, 0);
-
-  int i = map.n++;
-  map.texidx[i]  = vert->texidx;
-  map.normidx[i] = vert->normidx;
-  map.vertidx[i] = vertidx;
-  kl_array_set_expand(&objdata->indexmap, vert->posidx, &map, 0);
+  /* vertex buffers always grow in lockstep */
+  int vertidx = kl_array_vec3f_push(&objdata->bufposition, position);
+  kl_array_vec3f_push(&objdata->bufnormal,    normal);
+  kl_array_vec4f_push(&objdata->buftangent,   tangent);
+  kl_array_vec3f_push(&objdata->bufbitangent, bitangent);
+  kl_array_vec2f_push(&objdata->buftexcoord,  texcoord);
+
+  if (map == NULL) {
+    kl_array_resize(&objdata->indexmap, vert->posidx + 1); /* zeroed, so new maps are empty */
+    map = kl_array_indexmap_at(&objdata->indexmap, vert->posidx);
+  }
+  int i = map->n++;
+  map->texidx[i]  = vert->texidx;
+  map->normidx[i] = vert->normidx;
+  map->vertidx[i] = vertidx;
 
   return vertidx;
 }
@@ -320,17 +275,26 @@ static int parseline(obj_data_t *objdata, char *line) {
   if (strcmp(def, "mtllib") == 0) {
     char *path = strsep(&cur, " \t");
     /* prepend forward slash (paths are taken to be relative to virtual root) */
-    snprintf(obj_curmtl, OBJ_PATHLEN, "/%s", path);
+    if (snprintf(objdata->curmtl, OBJ_PATHLEN, "/%s", path) >= OBJ_PATHLEN) {
+      fprintf(stderr, "Mesh-OBJ: Material library path too long!\n");
+      return -1;
+    }
+    if (objdata->mtllib != NULL) objdata->mtllib(objdata->curmtl);
   } else if (strcmp(def, "usemtl") == 0) {
     int tris_i = kl_array_size(&objdata->tris);
-    if (tris_i > obj_curmesh.tris_i) {
-      obj_curmesh.tris_n = tris_i - obj_curmesh.tris_i;
-      kl_array_push(&objdata->meshes, &obj_curmesh);
+    if (tris_i > objdata->curmesh.tris_i) {
+      objdata->curmesh.tris_n = tris_i - objdata->curmesh.tris_i;
+      kl_array_push(&objdata->meshes, &objdata->curmesh);
     }
     char *path = strsep(&cur, " \t");
-    snprintf(obj_curmesh.material, OBJ_PATHLEN, "%s|%s", obj_curmtl, path);
-    obj_curmesh.tris_i = tris_i;
-    obj_curmesh.tris_n = 0;
+    char material[OBJ_PATHLEN];
+    if (snprintf(material, OBJ_PATHLEN, "%s|%s", objdata->curmtl, path) >= OBJ_PATHLEN) {
+      fprintf(stderr, "Mesh-OBJ: Material name too long!\n");
+      return -1;
+    }
+    objdata->curmesh.material = kl_intern(material);
+    objdata->curmesh.tris_i = tris_i;
+    objdata->curmesh.tris_n = 0;
   }
   return 0;
 }
@@ -341,7 +305,7 @@ static int parsevertex(obj_data_t *objdata, char *line) {
     fprintf(stderr, "Mesh-OBJ: Failed to read vertex coordinate!\n");
     return -1;
   }
-  kl_array_push(&objdata->rawposition, &position);
+  kl_array_vec3f_push(&objdata->rawposition, position);
   return 0;
 } 
 
@@ -352,7 +316,7 @@ static int parsenormal(obj_data_t *objdata, char *line) {
     return -1;
   }
   kl_vec3f_norm(&normal, &normal);
-  kl_array_push(&objdata->rawnormal, &normal);
+  kl_array_vec3f_push(&objdata->rawnormal, normal);
   return 0;
 }
  
@@ -365,7 +329,7 @@ static int parsetexcoord(obj_data_t *objdata, char *line) {
   /* these are backwards for some reason... */
   //texcoord.x = -texcoord.x;
   texcoord.y = -texcoord.y;
-  kl_array_push(&objdata->rawtexcoord, &texcoord);
+  kl_array_vec2f_push(&objdata->rawtexcoord, texcoord);
   return 0;
 }
 
@@ -401,7 +365,7 @@ static int parseface(obj_data_t *objdata, char *line) {
     if (vert < 0) return -1;
     tri.vert[2] = vert;
 
-    kl_array_push(&objdata->tris, &tri);
+    kl_array_tris_push(&objdata->tris, tri);
   }
   return 0;
 }
@@ -435,25 +399,23 @@ static int parsefacevert(char *str, obj_face_vert_t *dst) {
   return -1;
 }
 static void updatetangent(obj_data_t *objdata, unsigned int idx1, unsigned int idx2, unsigned int idx3) {
-  kl_vec3f_t p0, p1, p2;
-  kl_array_get(&objdata->bufposition, idx1, &p0);
-  kl_array_get(&objdata->bufposition, idx2, &p1);
-  kl_array_get(&objdata->bufposition, idx3, &p2);
-  kl_vec3f_t normal;
-  kl_array_get(&objdata->bufposition, idx1, &normal);
-  kl_vec2f_t t0, t1, t2;
-  kl_array_get(&objdata->buftexcoord, idx1, &t0);
-  kl_array_get(&objdata->buftexcoord, idx2, &t1);
-  kl_array_get(&objdata->buftexcoord, idx3, &t2);
+  kl_vec3f_t *position = kl_array_vec3f_data(&objdata->bufposition);
+  kl_vec2f_t *texcoord = kl_array_vec2f_data(&objdata->buftexcoord);
+  kl_vec3f_t *p0 = position + idx1;
+  kl_vec3f_t *p1 = position + idx2;
+  kl_vec3f_t *p2 = position + idx3;
+  kl_vec2f_t *t0 = texcoord + idx1;
+  kl_vec2f_t *t1 = texcoord + idx2;
+  kl_vec2f_t *t2 = texcoord + idx3;
 
   kl_vec3f_t dp1, dp2;
-  kl_vec3f_sub(&dp1, &p1, &p0);
-  kl_vec3f_sub(&dp2, &p2, &p0);
+  kl_vec3f_sub(&dp1, p1, p0);
+  kl_vec3f_sub(&dp2, p2, p0);
 
-  float du1 = t1.x - t0.x;
-  float du2 = t2.x - t0.x;
-  float dv1 = t1.y - t0.y;
-  float dv2 = t2.y - t0.y;
+  float du1 = t1->x - t0->x;
+  float du2 = t2->x - t0->x;
+  float dv1 = t1->y - t0->y;
+  float dv2 = t2->y - t0->y;
 
   kl_vec3f_t dv2dp1, dv1dp2, du1dp2, du2dp1;
   kl_vec3f_scale(&dv2dp1, &dp1, dv2);
@@ -470,48 +432,37 @@ static void updatetangent(obj_data_t *objdata, unsigned int idx1, unsigned int i
     kl_vec3f_negate(&B, &B);
   }
 
-  kl_vec4f_t avgtan;
-  kl_vec3f_t avgbitan;
-  kl_array_get(&objdata->buftangent, idx1, &avgtan);
-  kl_array_get(&objdata->bufbitangent, idx1, &avgbitan);
-  avgtan.x += T.x;
-  avgtan.y += T.y;
-  avgtan.z += T.z;
-  avgbitan.x += B.x;
-  avgbitan.y += B.y;
-  avgbitan.z += B.z;
-  kl_array_set(&objdata->buftangent, idx1, &avgtan);
-  kl_array_set(&objdata->bufbitangent, idx1, &avgbitan);
+  kl_vec4f_t *avgtan   = kl_array_vec4f_at(&objdata->buftangent, idx1);
+  kl_vec3f_t *avgbitan = kl_array_vec3f_at(&objdata->bufbitangent, idx1);
+  avgtan->x += T.x;
+  avgtan->y += T.y;
+  avgtan->z += T.z;
+  avgbitan->x += B.x;
+  avgbitan->y += B.y;
+  avgbitan->z += B.z;
 }
 
 static void orthogonalize(obj_data_t *objdata, unsigned int idx) {
-  kl_vec3f_t tangent, bitangent, normal;
-  kl_vec4f_t temp;
-  kl_array_get(&objdata->buftangent, idx, &temp);
-  kl_array_get(&objdata->bufbitangent, idx, &bitangent);
-  kl_array_get(&objdata->bufnormal, idx, &normal);
-  tangent.x = temp.x;
-  tangent.y = temp.y;
-  tangent.z = temp.z;
+  kl_vec4f_t *temp      = kl_array_vec4f_at(&objdata->buftangent, idx);
+  kl_vec3f_t *bitangent = kl_array_vec3f_at(&objdata->bufbitangent, idx);
+  kl_vec3f_t *normal    = kl_array_vec3f_at(&objdata->bufnormal, idx);
+  kl_vec3f_t tangent = { .x = temp->x, .y = temp->y, .z = temp->z };
   
   kl_vec3f_t tprojn;
-  kl_vec3f_scale(&tprojn, &normal, kl_vec3f_dot(&normal, &tangent));
+  kl_vec3f_scale(&tprojn, normal, kl_vec3f_dot(normal, &tangent));
   kl_vec3f_sub(&tangent, &tangent, &tprojn);
   kl_vec3f_norm(&tangent, &tangent);
 
   kl_vec3f_t nxt;
-  kl_vec3f_cross(&nxt, &normal, &tangent);
-  float handedness = kl_vec3f_dot(&nxt, &bitangent) > 0.0f ? 1.0f : -1.0f;
+  kl_vec3f_cross(&nxt, normal, &tangent);
+  float handedness = kl_vec3f_dot(&nxt, bitangent) > 0.0f ? 1.0f : -1.0f;
   
-  temp.x = tangent.x;
-  temp.y = tangent.y;
-  temp.z = tangent.z;
-  temp.w = handedness;
+  temp->x = tangent.x;
+  temp->y = tangent.y;
+  temp->z = tangent.z;
+  temp->w = handedness;
   
-  kl_vec3f_norm(&bitangent, &bitangent);
-
-  kl_array_set(&objdata->buftangent, idx, &temp);
-  kl_array_set(&objdata->bufbitangent, idx, &bitangent);
+  kl_vec3f_norm(bitangent, bitangent);
 }
 
 /* vim: set ts=2 sw=2 et */
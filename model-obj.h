@@ -1,13 +1,17 @@
 #ifndef KL_MDLOBJ_H
 #define KL_MDLOBJ_H
 
-#include "model.h"
+#include "model-data.h"
 
 #include <stdint.h>
 #include <stdbool.h>
 
+/* called with the MTL's virtual path as soon as the parser reaches a mtllib line */
+typedef void (*kl_model_obj_mtllib_cb)(const char *path);
+
 bool kl_model_isobj(uint8_t *data, int size);
-kl_model_t* kl_model_loadobj(uint8_t *data, int size);
+/* parses, deduplicates vertices and generates tangents -- doesn't touch the renderer, so kl-cook can use it too */
+bool kl_model_parseobj(uint8_t *data, int size, kl_model_obj_mtllib_cb mtllib, kl_model_data_t *model);
 
 #endif /* KL_MDLOBJ_H */
 
@@ -2,7 +2,12 @@
 
 #include "model-iqm2.h"
 #include "model-obj.h"
+#include "model-data.h"
+#include "material-mtl.h"
+#include "renderer.h"
+#include "mem.h"
 
+#include <assert.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
@@ -16,6 +21,9 @@
 #include <fcntl.h>
 #endif
 
+static kl_model_t* model_build(kl_model_data_t *data);
+
+/* ------------------ */
 kl_model_t *kl_model_load(char *path) {
 #ifdef _WIN32
   HANDLE fd   = CreateFile(path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -57,8 +65,19 @@ kl_model_t *kl_model_load(char *path) {
   kl_model_t *model = NULL;
   if (kl_model_isiqm2(data, size)) {
     model = kl_model_loadiqm2(data, size);
+  } else if (kl_model_data_iscooked(data, size)) {
+    kl_model_data_t modeldata;
+    if (kl_model_data_read(data, size, path, &modeldata)) {
+      model = model_build(&modeldata);
+      kl_model_data_free(&modeldata);
+    }
   } else if (kl_model_isobj(data, size)) {
-    model = kl_model_loadobj(data, size);
+    /* the MTL and its textures load while the rest of the file is parsed */
+    kl_model_data_t modeldata;
+    if (kl_model_parseobj(data, size, &kl_material_mtl_prefetch, &modeldata)) {
+      model = model_build(&modeldata);
+      kl_model_data_free(&modeldata);
+    }
   }
 
   if (model == NULL) {
@@ -80,5 +99,62 @@ kl_model_t *kl_model_load(char *path) {
   return model;
 }
 
+/* ------------------ */
+static kl_model_t* model_build(kl_model_data_t *data) {
+  kl_model_t *model = kl_mem_alloc(KL_MEM_MODEL, sizeof(kl_model_t) + data->mesh_n * sizeof(kl_mesh_t));
+
+  model->type    = KL_MODEL_PROP;
+  model->bounds  = data->bounds;
+  model->winding = KL_RENDER_CCW;
+
+  kl_model_bufs_prop_t *bufs = &model->bufs.prop;
+  bufs->position = kl_render_upload_vertdata(data->position, data->vert_n * sizeof(kl_vec3f_t));
+  bufs->normal   = kl_render_upload_vertdata(data->normal,   data->vert_n * sizeof(kl_vec3f_t));
+  bufs->tangent  = kl_render_upload_vertdata(data->tangent,  data->vert_n * sizeof(kl_vec4f_t));
+  bufs->texcoord = kl_render_upload_vertdata(data->texcoord, data->vert_n * sizeof(kl_vec2f_t));
+
+  model->tris = kl_render_upload_tris(data->tris, data->tris_n * 3 * sizeof(unsigned int));
+
+  kl_render_attrib_t cfg[4];
+  cfg[0] = (kl_render_attrib_t){
+    .index  = 0,
+    .size   = 3,
+    .type   = KL_RENDER_FLOAT,
+    .buffer = bufs->position
+  };
+  cfg[1] = (kl_render_attrib_t){
+    .index  = 1,
+    .size   = 2,
+    .type   = KL_RENDER_FLOAT,
+    .buffer = bufs->texcoord
+  };
+  cfg[2] = (kl_render_attrib_t){
+    .index  = 2,
+    .size   = 3,
+    .type   = KL_RENDER_FLOAT,
+    .buffer = bufs->normal
+  };
+  cfg[3] = (kl_render_attrib_t){
+    .index  = 3,
+    .size   = 4,
+    .type   = KL_RENDER_FLOAT,
+    .buffer = bufs->tangent
+  };
+
+  model->attribs = kl_render_define_attribs(model->tris, cfg, 4);
+
+  model->mesh_n = data->mesh_n;
+  for (int i=0; i < data->mesh_n; i++) {
+    kl_material_t *material = kl_material_incref(data->mesh[i].material);
+    if (material == NULL) {
+      material = kl_material_incref("DEFAULT_MATERIAL");
+    }
+    assert(material != NULL);
+    model->mesh[i].material = material;
+    model->mesh[i].tris_i   = data->mesh[i].tris_i;
+    model->mesh[i].tris_n   = data->mesh[i].tris_n;
+  }
+  return model;
+}
 
 /* vim: set ts=2 sw=2 et */
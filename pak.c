@@ -0,0 +1,56 @@
+#define _POSIX_C_SOURCE 200809L /* getopt */
+
+/* kl-pak: packs a directory into a .kpak the engine can load in its place
+ *
+ *   kl-pak [-u] [-v vpath] pakfile dir
+ *
+ * entries get the virtual paths kl_resource_add_dir would give the loose
+ * files, under vpath if one is given.  kl-cook -p packs its output the same
+ * way, this is for trees which don't need cooking. */
+
+#include "resource-pak.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ------------------ */
+int main(int argc, char **argv) {
+  const char *vpath = "";
+  bool compress = true;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "uv:")) != -1) {
+    switch (opt) {
+      case 'u':
+        compress = false;
+        break;
+      case 'v':
+        vpath = optarg;
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (argc - optind != 2) goto usage;
+
+  char dirpath[KL_RESITEM_PATHLEN];
+  if (snprintf(dirpath, KL_RESITEM_PATHLEN, "%s", argv[optind+1]) >= KL_RESITEM_PATHLEN) {
+    fprintf(stderr, "kl-pak: Path too long: %s\n", argv[optind+1]);
+    return 1;
+  }
+  /* a trailing slash would end up in every path */
+  for (int n = strlen(dirpath); n > 1 && dirpath[n-1] == '/'; n--) dirpath[n-1] = '\0';
+
+  if (kl_pak_write(argv[optind], dirpath, vpath, compress) < 0) return 1;
+  return 0;
+
+  usage:
+  fprintf(stderr, "usage: %s [-u] [-v vpath] pakfile dir\n", argv[0]);
+  fprintf(stderr, "\t-u  store entries uncompressed\n");
+  fprintf(stderr, "\t-v  virtual path to pack the directory under (default: the root)\n");
+  return 2;
+}
+
+/* vim: set ts=2 sw=2 et */
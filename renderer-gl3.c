@@ -2,6 +2,8 @@
 
 #include "renderer.h"
 
+#include "arena.h"
+#include "mem.h"
 #include "model.h"
 #include "vid.h"
 
@@ -49,6 +51,7 @@ static int init_tonemap();
 static void blit(unsigned int texture, float w, float h, float x, float y, float scale, float offset);
 static void blit_cube(unsigned int texture, float w, float h, float x, float y, float scale, float offset);
 static void bind_ubo(unsigned int program, char *name, unsigned int binding);
+static unsigned int upload_texture(void *data, int w, int h, int levels, int format, bool clamp, bool filter);
 
 static unsigned int rbo_depth;
 static unsigned int tex_shadow;
@@ -283,6 +286,10 @@ typedef struct surfacelight {
   float r, g, b;
 } surfacelight_t;
 
+KL_ARRAY_DECLARE(kl_model_t*, models)
+KL_ARRAY_DECLARE(kl_light_t*, lights)
+KL_ARRAY_DECLARE(surfacelight_t, surfacelights)
+
 #define LOGBUFFER_SIZE 0x4000
 static char logbuffer[LOGBUFFER_SIZE];
 
@@ -460,9 +467,9 @@ void kl_gl3_pass_gbuffer(kl_array_t *models) {
   
   glUniform1i(gbufferback_uniform_tdiffuse, 0);
   
+  kl_model_t **modelv = kl_array_models_data(models);
   for (int i = 0; i < kl_array_size(models); i++) {
-    kl_model_t *model;
-    kl_array_get(models, i, &model);
+    kl_model_t *model = modelv[i];
     
     glFrontFace(convertenum(model->winding));
     glBindVertexArray(model->attribs);
@@ -495,8 +502,7 @@ void kl_gl3_pass_gbuffer(kl_array_t *models) {
   glUniform1i(gbuffer_uniform_temissive, 3);
   
   for (int i = 0; i < kl_array_size(models); i++) {
-    kl_model_t *model;
-    kl_array_get(models, i, &model);
+    kl_model_t *model = modelv[i];
     
     glFrontFace(convertenum(model->winding));
     glBindVertexArray(model->attribs);
@@ -629,7 +635,7 @@ void kl_gl3_pass_gbuffer(kl_array_t *models) {
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 }
 
-void kl_gl3_pass_pointshadow(kl_light_t *light) {
+void kl_gl3_pass_pointshadow(kl_light_t *light, kl_array_t *casters) {
   //glEnable(GL_CULL_FACE);
   //glCullFace(GL_FRONT);
   glEnable(GL_DEPTH_TEST);
@@ -639,17 +645,11 @@ void kl_gl3_pass_pointshadow(kl_light_t *light) {
   glUniform3f(cubedepth_uniform_center, light->position.x, light->position.y, light->position.z);
   glUseProgram(0);
   
-  kl_array_t models;
-  kl_array_init(&models, sizeof(kl_model_t*));
   for (int i=0; i < 6; i++) {
-    kl_array_clear(&models);
-    kl_render_query_models(&models);
-    
-    kl_gl3_pass_pointshadow_face(i, &models);
+    kl_gl3_pass_pointshadow_face(i, casters + i);
     glBindBufferBase(GL_UNIFORM_BUFFER, 1, light->id);
-    kl_gl3_pass_pointbounce_face(i, &models);
+    kl_gl3_pass_pointbounce_face(i, casters + i);
   }
-  kl_array_free(&models);
   
   glCullFace(GL_BACK);
   glDisable(GL_CULL_FACE);
@@ -675,9 +675,9 @@ void kl_gl3_pass_pointshadow(kl_light_t *light) {
   kl_gl3_pass_shadowfilter();
   
   /* load up VPL data */
-  kl_vec4f_t *position  = malloc(bouncemapsize * bouncemapsize * 6 * sizeof(kl_vec4f_t));
-  kl_vec4f_t *normal    = malloc(bouncemapsize * bouncemapsize * 6 * sizeof(kl_vec4f_t));
-  kl_vec4f_t *radiosity = malloc(bouncemapsize * bouncemapsize * 6 * sizeof(kl_vec4f_t));
+  kl_vec4f_t *position  = kl_frame_alloc(bouncemapsize * bouncemapsize * 6 * sizeof(kl_vec4f_t));
+  kl_vec4f_t *normal    = kl_frame_alloc(bouncemapsize * bouncemapsize * 6 * sizeof(kl_vec4f_t));
+  kl_vec4f_t *radiosity = kl_frame_alloc(bouncemapsize * bouncemapsize * 6 * sizeof(kl_vec4f_t));
   glBindTexture(GL_TEXTURE_CUBE_MAP, pointbounce_tex_position);
   for (int i = 0; i < 6; i++) {
     int offset = i * bouncemapsize * bouncemapsize;
@@ -701,7 +701,7 @@ void kl_gl3_pass_pointshadow(kl_light_t *light) {
     attenuation += radiosity[i].w;
   }
   kl_array_t surflights;
-  kl_array_init(&surflights, sizeof(surfacelight_t));
+  kl_array_init_frame(&surflights, sizeof(surfacelight_t));
   for (int i = 0; i < bouncemapsize * bouncemapsize * 6; i++) {
     if (!pointbounce_mask[i % bouncemapsize * bouncemapsize]) continue;
     
@@ -726,15 +726,11 @@ void kl_gl3_pass_pointshadow(kl_light_t *light) {
       },
       .r = r, .g = g, .b = b
     };
-    kl_array_push(&surflights, &surflight);
+    kl_array_surfacelights_push(&surflights, surflight);
   }
-  free(position);
-  free(normal);
-  free(radiosity);
   
   /* render */
   kl_gl3_pass_surfacelight(&surflights);
-  kl_array_free(&surflights);
 }
 
 void kl_gl3_pass_surfacelight(kl_array_t *lights) {
@@ -758,13 +754,13 @@ void kl_gl3_pass_surfacelight(kl_array_t *lights) {
     unsigned int attachments[] = {GL_COLOR_ATTACHMENT0};
     glDrawBuffers(1, attachments);
     
+    surfacelight_t *lightv = kl_array_surfacelights_data(lights);
     for (int i = 0; i < kl_array_size(lights); i++) {
-      surfacelight_t light;
-      kl_array_get(lights, i, &light);
+      surfacelight_t *light = lightv + i;
       
-      glUniform3f(surfacelight_uniform_position, light.position.x, light.position.y, light.position.z);
-      glUniform3f(surfacelight_uniform_direction, light.normal.x, light.normal.y, light.normal.z);
-      glUniform3f(surfacelight_uniform_radiosity, light.r, light.g, light.b);
+      glUniform3f(surfacelight_uniform_position, light->position.x, light->position.y, light->position.z);
+      glUniform3f(surfacelight_uniform_direction, light->normal.x, light->normal.y, light->normal.z);
+      glUniform3f(surfacelight_uniform_radiosity, light->r, light->g, light->b);
       
       set_texture(0, gbuffer_tex_depth[level],  GL_TEXTURE_RECTANGLE);
       set_texture(1, gbuffer_tex_normal[level], GL_TEXTURE_RECTANGLE);
@@ -796,9 +792,9 @@ void kl_gl3_pass_pointshadow_face(int face, kl_array_t *models) {
   glClearBufferfv(GL_COLOR, 0, clearcolor);
   glClear(GL_DEPTH_BUFFER_BIT);
   
+  kl_model_t **modelv = kl_array_models_data(models);
   for (int i = 0; i < kl_array_size(models); i++) {
-    kl_model_t *model;
-    kl_array_get(models, i, &model);
+    kl_model_t *model = modelv[i];
     
     glFrontFace(convertenum(model->winding));
     glBindVertexArray(model->attribs);
@@ -837,9 +833,9 @@ void kl_gl3_pass_pointbounce_face(int face, kl_array_t *models) {
   glClearBufferfv(GL_COLOR, 0, clearcolor);
   glClear(GL_DEPTH_BUFFER_BIT);
   
+  kl_model_t **modelv = kl_array_models_data(models);
   for (int i = 0; i < kl_array_size(models); i++) {
-    kl_model_t *model;
-    kl_array_get(models, i, &model);
+    kl_model_t *model = modelv[i];
     
     glFrontFace(convertenum(model->winding));
     glBindVertexArray(model->attribs);
@@ -925,7 +921,7 @@ void kl_gl3_pass_envlight() {
   glDisable(GL_BLEND);
 }
 
-void kl_gl3_pass_pointlight(kl_array_t *lights) {
+void kl_gl3_pass_pointlight(kl_array_t *lights, kl_array_t *casters) {
   /* initialize draw pass uniforms */
   glUseProgram(minimal_program);
 
@@ -942,9 +938,9 @@ void kl_gl3_pass_pointlight(kl_array_t *lights) {
   
   glUseProgram(0);
   
+  kl_light_t **lightv = kl_array_lights_data(lights);
   for (int i = 0; i < kl_array_size(lights); i++) {
-    kl_light_t *light;
-    kl_array_get(lights, i, &light);
+    kl_light_t *light = lightv[i];
   
     kl_mat4f_t scale, translation, modelmatrix;
     kl_mat4f_translation(&translation, &light->position);
@@ -952,7 +948,7 @@ void kl_gl3_pass_pointlight(kl_array_t *lights) {
     kl_mat4f_mul(&modelmatrix, &translation, &scale);
   
     /* draw shadows -- this clobbers the GL state */
-    kl_gl3_pass_pointshadow(light);
+    kl_gl3_pass_pointshadow(light, casters + 6 * i);
 
     /* setup lighting pass */
     glEnable(GL_STENCIL_TEST);
@@ -1057,9 +1053,9 @@ void kl_gl3_pass_tangents(kl_array_t *models) {
 
   glBindBufferBase(GL_UNIFORM_BUFFER, 0, ubo_scene);
   
+  kl_model_t **modelv = kl_array_models_data(models);
   for (int i = 0; i < kl_array_size(models); i++) {
-    kl_model_t *model;
-    kl_array_get(models, i, &model);
+    kl_model_t *model = modelv[i];
     
     glFrontFace(convertenum(model->winding));
     glBindVertexArray(model->attribs);
@@ -1151,7 +1147,7 @@ void kl_gl3_composite(float dt) {
   glGenerateMipmap(GL_TEXTURE_2D);
   glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH,  &w);
   glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &h);
-  float *samples = (float*)malloc(w*h*3*sizeof(float));
+  float *samples = (float*)kl_frame_alloc(w*h*3*sizeof(float));
   glGetTexImage(GL_TEXTURE_2D, level, GL_RGB, GL_FLOAT, samples);
   glBindTexture(GL_TEXTURE_2D, 0);
   
@@ -1178,7 +1174,6 @@ void kl_gl3_composite(float dt) {
   }
   //float mean = expf(num / div);
   float mean = num / div;
-  free(samples);
   
   /* determine half-brightness level */
   const float lambda   = 2.0f; /* rate of decay */
@@ -1317,6 +1312,14 @@ static void downsample(uint8_t *buf, int w, int h, int c, int bias) {
 }
 
 unsigned int kl_gl3_upload_texture(void *data, int w, int h, int format, bool clamp, bool filter) {
+  return upload_texture(data, w, h, 1, format, clamp, filter);
+}
+
+unsigned int kl_gl3_upload_texture_mips(void *data, int w, int h, int levels, int format, bool clamp) {
+  return upload_texture(data, w, h, levels, format, clamp, true);
+}
+
+static unsigned int upload_texture(void *data, int w, int h, int levels, int format, bool clamp, bool filter) {
   unsigned int texture;
   
   int glfmt, glifmt, channels;
@@ -1379,17 +1382,34 @@ unsigned int kl_gl3_upload_texture(void *data, int w, int h, int format, bool cl
   glGenTextures(1, &texture);
   glBindTexture(GL_TEXTURE_2D, texture);
 
-  int bytes = w * h * channels;
-  uint8_t *buf = malloc(bytes);
-  memcpy(buf, data, bytes);
-  if (filter) {
-    downsample(buf, w, h, channels, mipbias);
+  if (levels > 1) {
+    /* a cooked mip chain, the bias just skips its largest levels */
+    uint8_t *level = data;
+    int skip = mipbias < levels ? mipbias : levels - 1;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i=0; i < levels; i++) {
+      if (i >= skip) {
+        glTexImage2D(GL_TEXTURE_2D, i - skip, glifmt, w, h, 0, glfmt, GL_UNSIGNED_BYTE, level);
+      }
+      level += w * h * channels;
+      w = w > 1 ? w / 2 : 1;
+      h = h > 1 ? h / 2 : 1;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - skip - 1);
+  } else {
+    int bytes = w * h * channels;
+    uint8_t *buf = kl_mem_alloc(KL_MEM_RENDER, bytes);
+    memcpy(buf, data, bytes);
+    if (filter) {
+      downsample(buf, w, h, channels, mipbias);
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, glifmt, w >> mipbias, h >> mipbias, 0, glfmt, GL_UNSIGNED_BYTE, buf);
+    kl_mem_free(KL_MEM_RENDER, buf);
   }
-  glTexImage2D(GL_TEXTURE_2D, 0, glifmt, w >> mipbias, h >> mipbias, 0, glfmt, GL_UNSIGNED_BYTE, buf);
-  free(buf);
   
   if (filter) {
-    glGenerateMipmap(GL_TEXTURE_2D);
+    if (levels == 1) glGenerateMipmap(GL_TEXTURE_2D);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
@@ -1967,7 +1987,7 @@ static int init_lighting(int width, int height) {
   }
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   
-  pointbounce_mask = malloc(bouncemapsize * bouncemapsize * sizeof(bool));
+  pointbounce_mask = kl_mem_alloc(KL_MEM_RENDER, bouncemapsize * bouncemapsize * sizeof(bool));
   for (int i = 0; i < bouncemapsize; i++) {
     float x = 2.0f * ((float)i + 0.5f) / bouncemapsize - 1.0f;
     for (int j = 0; j < bouncemapsize; j++) {
@@ -16,9 +16,10 @@ void kl_gl3_clear();
 void kl_gl3_pass_gbuffer(kl_array_t *models);
 
 void kl_gl3_pass_envlight();
-void kl_gl3_pass_pointlight(kl_array_t *models);
+/* 'casters' holds six arrays of models for each light, one per cube face */
+void kl_gl3_pass_pointlight(kl_array_t *lights, kl_array_t *casters);
 
-void kl_gl3_pass_pointshadow(kl_light_t *light);
+void kl_gl3_pass_pointshadow(kl_light_t *light, kl_array_t *casters);
 void kl_gl3_pass_pointshadow_face(int face, kl_array_t *models);
 void kl_gl3_pass_shadowfilter();
 
@@ -36,6 +37,7 @@ unsigned int kl_gl3_upload_vertdata(void *data, int n);
 void kl_gl3_update_vertdata(unsigned int vbo, void *data, int n);
 unsigned int kl_gl3_upload_tris(unsigned int *data, int n);
 unsigned int kl_gl3_upload_texture(void *data, int w, int h, int format, bool clamp, bool filter);
+unsigned int kl_gl3_upload_texture_mips(void *data, int w, int h, int levels, int format, bool clamp);
 unsigned int kl_gl3_upload_light(kl_vec3f_t *position, float r, float g, float b, float intensity);
 void kl_gl3_update_scene(kl_scene_t *scene);
 void kl_gl3_update_envlight(kl_vec3f_t *direction, float amb_r, float amb_g, float amb_b, float amb_intensity, float diff_r, float diff_g, float diff_b, float diff_intensity);
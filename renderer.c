@@ -2,18 +2,34 @@
 
 #include "renderer-gl3.h"
 
+#include "arena.h"
 #include "bvhtree.h"
+#include "mem.h"
 #include "plane.h"
 #include "sphere.h"
 #include "time.h"
 
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 
-static int checkfrustum(kl_sphere_t *bounds, kl_frustum_t *frustum);
+/* frames drawn before the frame arena and the arrays in it have grown to fit */
+#define HEAPCALLS_WARMUP 100
+
+KL_ARRAY_DECLARE(kl_model_t*, models)
+KL_ARRAY_DECLARE(kl_light_t*, lights)
+
 static int alwaystrue(kl_sphere_t *bounds, void* _);
+static void update_wide();
+static void check_heapcalls(uint64_t heapcalls);
+static void cull_views(kl_frustum_t *frustum, kl_array_t *lights, kl_array_t *models, kl_array_t *casters);
 
-static kl_bvh_node_t *bvh_models = NULL;
-static kl_bvh_node_t *bvh_lights = NULL;
+static kl_bvh_t bvh_models = KL_BVH_INIT;
+static kl_bvh_t bvh_lights = KL_BVH_INIT;
+/* what culling walks, recopied from the trees when something's been added */
+static kl_bvh4_t wide_models = { .nodes = NULL, .items = NULL, .nodes_n = 0, .items_n = 0, .stack_n = 0 };
+static kl_bvh4_t wide_lights = { .nodes = NULL, .items = NULL, .nodes_n = 0, .items_n = 0, .stack_n = 0 };
+static bool wide_dirty = false;
 
 static int debugmode = 0;
 
@@ -23,27 +39,34 @@ int kl_render_init() {
 }
 
 void kl_render_draw(kl_camera_t *cam) {
+  /* everything allocated for the previous frame is released here */
+  kl_frame_reset();
+  kl_mem_tick();
+
   static kl_scene_t   scene;
   static kl_frustum_t frustum;
   kl_camera_update_scene(cam, &scene);
   kl_camera_update_frustum(cam, &frustum);
+  update_wide();
+  uint64_t heapcalls = kl_mem_thread_heapcalls();
 
   kl_gl3_update_scene(&scene);
   
   kl_gl3_clear();
 
+  kl_array_t lights;
+  kl_array_init_frame(&lights, sizeof(kl_light_t*));
+  kl_bvh4_cull(&wide_lights, &frustum, &lights);
+
+  /* six arrays of shadow casters for each light, one per cube face */
   kl_array_t models;
-  kl_array_init(&models, sizeof(kl_model_t*));
-  kl_bvh_search(bvh_models, (kl_bvh_filter_cb)&checkfrustum, &frustum, &models);
+  kl_array_t *casters = kl_frame_alloc(6 * kl_array_size(&lights) * sizeof(kl_array_t));
+  cull_views(&frustum, &lights, &models, casters);
   kl_gl3_pass_gbuffer(&models);
 
   kl_gl3_pass_envlight();
   
-  kl_array_t lights;
-  kl_array_init(&lights, sizeof(kl_light_t*));
-  kl_bvh_search(bvh_lights, (kl_bvh_filter_cb)&checkfrustum, &frustum, &lights);
-  kl_gl3_pass_pointlight(&lights);
-  kl_array_free(&lights);
+  kl_gl3_pass_pointlight(&lights, casters);
 
   /*
   kl_gl3_begin_pass_debug();
@@ -57,13 +80,25 @@ void kl_render_draw(kl_camera_t *cam) {
   kl_gl3_composite(dt);
 
   //kl_gl3_pass_tangents(&models);
-  kl_array_free(&models);
 
   kl_gl3_debugtex(debugmode);
+  check_heapcalls(kl_mem_thread_heapcalls() - heapcalls);
 }
 
 void kl_render_query_models(kl_array_t *result) {
-  kl_bvh_search(bvh_models, (kl_bvh_filter_cb)&alwaystrue, NULL, result);
+  kl_bvh_search(&bvh_models, (kl_bvh_filter_cb)&alwaystrue, NULL, result);
+}
+
+int kl_render_raycast_models(kl_vec3f_t *origin, kl_vec3f_t *dir, float tmax, int max, kl_array_t *hits) {
+  return kl_bvh_raycast(&bvh_models, origin, dir, tmax, max, hits);
+}
+
+int kl_render_nearest_lights(kl_vec3f_t *point, int k, kl_array_t *hits) {
+  return kl_bvh_nearest(&bvh_lights, point, k, INFINITY, hits);
+}
+
+int kl_render_models_within(kl_vec3f_t *point, float radius, kl_model_t **models, int max) {
+  return kl_bvh_within(&bvh_models, point, radius, (void**)models, max);
 }
 
 void kl_render_set_debug(int mode) {
@@ -72,6 +107,7 @@ void kl_render_set_debug(int mode) {
 
 void kl_render_add_model(kl_model_t* model) {
   kl_bvh_insert(&bvh_models, &model->bounds, model);
+  wide_dirty = true;
 }
 
 void kl_render_set_envlight(kl_vec3f_t *direction, float amb_r, float amb_g, float amb_b, float amb_intensity, float diff_r, float diff_g, float diff_b, float diff_intensity) {
@@ -82,7 +118,7 @@ void kl_render_add_light(kl_vec3f_t *position, float r, float g, float b, float
   /* 16 * sqrt(intensity) is the distance at which light contribution is less than 1/256 */
   float radius = 16.0f * sqrtf(intensity);
 
-  kl_light_t *light = malloc(sizeof(kl_light_t));
+  kl_light_t *light = kl_mem_alloc(KL_MEM_RENDER, sizeof(kl_light_t));
   *light = (kl_light_t){
     .position = *position,
     .scale    = radius, 
@@ -93,6 +129,7 @@ void kl_render_add_light(kl_vec3f_t *position, float r, float g, float b, float
     .radius = radius
   };
   kl_bvh_insert(&bvh_lights, &bounds, light);
+  wide_dirty = true;
 }
 
 unsigned int kl_render_upload_vertdata(void *data, int n) {
@@ -107,6 +144,10 @@ unsigned int kl_render_upload_texture(void *data, int w, int h, int format, bool
   return kl_gl3_upload_texture(data, w, h, format, clamp, filter);
 }
 
+unsigned int kl_render_upload_texture_mips(void *data, int w, int h, int levels, int format, bool clamp) {
+  return kl_gl3_upload_texture_mips(data, w, h, levels, format, clamp);
+}
+
 void kl_render_free_texture(unsigned int texture) {
   kl_gl3_free_texture(texture);
 }
@@ -116,24 +157,50 @@ unsigned int kl_render_define_attribs(int tris, kl_render_attrib_t *cfg, int n)
 }
 
 /* ------------------------- */
-static int checkfrustum(kl_sphere_t *bounds, kl_frustum_t *frustum) {
-  if (kl_plane_dist(&frustum->near, &bounds->center) > bounds->radius)
-    return 0;
-  if (kl_plane_dist(&frustum->far, &bounds->center) > bounds->radius)
-    return 0;
-  if (kl_plane_dist(&frustum->top, &bounds->center) > bounds->radius)
-    return 0;
-  if (kl_plane_dist(&frustum->bottom, &bounds->center) > bounds->radius)
-    return 0;
-  if (kl_plane_dist(&frustum->left, &bounds->center) > bounds->radius)
-    return 0;
-  if (kl_plane_dist(&frustum->right, &bounds->center) > bounds->radius)
-    return 0;
+static int alwaystrue(kl_sphere_t *bounds, void* _) {
   return 1;
 }
 
-static int alwaystrue(kl_sphere_t *bounds, void* _) {
-  return 1;
+static void update_wide() {
+  if (!wide_dirty) return;
+  kl_bvh4_free(&wide_models);
+  kl_bvh4_free(&wide_lights);
+  kl_bvh4_flatten(&wide_models, &bvh_models);
+  kl_bvh4_flatten(&wide_lights, &bvh_lights);
+  wide_dirty = false;
+}
+
+/* the camera and each light's cube faces are culled one at a time -- going through the models
+ * once for all of them with kl_bvh4_cull_views was slower with any number of lights, see
+ * bench-bvh4 */
+static void cull_views(kl_frustum_t *frustum, kl_array_t *lights, kl_array_t *models, kl_array_t *casters) {
+  kl_light_t **lightv = kl_array_lights_data(lights);
+  kl_array_init_frame(models, sizeof(kl_model_t*));
+  kl_bvh4_cull(&wide_models, frustum, models);
+  for (int l=0; l < kl_array_size(lights); l++) {
+    kl_frustum_t faces[6];
+    kl_camera_cube_frusta(&lightv[l]->position, lightv[l]->scale, faces);
+    for (int f=0; f < 6; f++) {
+      kl_array_init_frame(casters + 6 * l + f, sizeof(kl_model_t*));
+      kl_bvh4_cull(&wide_models, faces + f, casters + 6 * l + f);
+    }
+  }
+}
+
+/* a warmed-up frame should draw without touching the heap -- complains about the first frame that
+ * doesn't, and about any that does worse after that.  stress-bvh asserts it of the same culls,
+ * without a GL context */
+static void check_heapcalls(uint64_t heapcalls) {
+  static int      frames = 0;
+  static uint64_t worst  = 0;
+  if (frames < HEAPCALLS_WARMUP) {
+    frames++;
+    return;
+  }
+  if (heapcalls > worst) {
+    worst = heapcalls;
+    fprintf(stderr, "Renderer: Drawing a frame made %" PRIu64 " heap calls, expected none\n", heapcalls);
+  }
 }
 
 static void draw_bounds(kl_bvh_node_t *node, kl_scene_t *scene) {
@@ -142,8 +209,8 @@ static void draw_bounds(kl_bvh_node_t *node, kl_scene_t *scene) {
   float g = 0.5f;
   float b = 0.0f;
 
-  kl_vec3f_t position = node->header.bounds.center;
-  float      radius   = node->header.bounds.radius;
+  kl_vec3f_t position = node->bounds.center;
+  float      radius   = node->bounds.radius;
 
   kl_mat4f_t scale, translation, modelmatrix, mvpmatrix;
   kl_mat4f_translation(&translation, &position);
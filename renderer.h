@@ -32,6 +32,13 @@ typedef struct kl_light {
 int kl_render_init();
 void kl_render_draw(kl_camera_t *cam);
 void kl_render_query_models(kl_array_t *result); /* TODO: add culling/filtering */
+/* for picking and line of sight: appends a kl_bvh_hit_t for each model whose bounds the ray
+ * crosses, nearest first -- see kl_bvh_raycast */
+int  kl_render_raycast_models(kl_vec3f_t *origin, kl_vec3f_t *dir, float tmax, int max, kl_array_t *hits);
+/* the k lights nearest to a point as kl_bvh_hit_t's, nearest first -- see kl_bvh_nearest */
+int  kl_render_nearest_lights(kl_vec3f_t *point, int k, kl_array_t *hits);
+/* the models within 'radius' of a point, without allocating -- see kl_bvh_within */
+int  kl_render_models_within(kl_vec3f_t *point, float radius, kl_model_t **models, int max);
 void kl_render_set_debug(int mode);
 void kl_render_add_model(kl_model_t *model);
 void kl_render_add_light(kl_vec3f_t *position, float r, float g, float b, float intensity);
@@ -39,6 +46,8 @@ void kl_render_set_envlight(kl_vec3f_t *direction, float amb_r, float amb_g, flo
 unsigned int kl_render_upload_vertdata(void *data, int n);
 unsigned int kl_render_upload_tris(unsigned int *data, int n);
 unsigned int kl_render_upload_texture(void *data, int w, int h, int format, bool clamp, bool filter);
+/* data holds 'levels' mip levels back to back, largest first, always filtered */
+unsigned int kl_render_upload_texture_mips(void *data, int w, int h, int levels, int format, bool clamp);
 void kl_render_free_texture(unsigned int texture);
 unsigned int kl_render_define_attribs(int tris, kl_render_attrib_t *cfg, int n);
 
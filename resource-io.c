@@ -0,0 +1,428 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /* pread, O_CLOEXEC */
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE /* syscall */
+#endif
+
+#include "resource-io.h"
+
+#include "mem.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* a ring per thread, so workers never contend for one -- each batch is submitted and waited out in full,
+ * so the submission queue never holds more than KL_IO_BATCH entries and the head needn't be checked */
+typedef struct io_ring {
+  int fd;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void  *sq_map, *cq_map;
+  size_t sq_len, cq_len, sqes_len;
+  unsigned pending;  /* sqes queued since the last submit */
+  unsigned inflight; /* submitted and not reaped yet */
+} io_ring_t;
+
+static pthread_key_t  ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static void ring_init();
+static io_ring_t* ring_get();
+static int  ring_setup(io_ring_t *ring);
+static void ring_close(io_ring_t *ring);
+static void ring_free(void *ring);
+static void ring_discard(io_ring_t *ring);
+static struct io_uring_sqe* ring_sqe(io_ring_t *ring, uint64_t user_data);
+static int  ring_submit(io_ring_t *ring);
+static bool ring_reap(io_ring_t *ring, uint64_t *user_data, int *res);
+static bool ring_drain(io_ring_t *ring, bool opening);
+static int  uring_read_batch(io_ring_t *ring, kl_io_read_t *reads, int n);
+#endif /* __linux__ */
+
+static int  io_read_one(kl_io_read_t *read);
+static void io_fail(kl_io_read_t *read, int err);
+
+static int backend = -1; /* picked on first use */
+static pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ------------------ */
+int kl_io_backend() {
+  int b = __atomic_load_n(&backend, __ATOMIC_ACQUIRE);
+  if (b >= 0) return b;
+  return kl_io_set_backend(KL_IO_URING);
+}
+
+int kl_io_set_backend(int b) {
+  pthread_mutex_lock(&backend_lock);
+#ifdef __linux__
+  if (b == KL_IO_URING) {
+    /* probe with a throwaway ring, containers and old kernels may refuse */
+    io_ring_t probe;
+    if (ring_setup(&probe) < 0) {
+      fprintf(stderr, "Resource IO: io_uring is not available, using pread\n\tDetails: %s\n", strerror(errno));
+      b = KL_IO_PREAD;
+    } else {
+      ring_close(&probe);
+    }
+  }
+#else
+  if (b == KL_IO_URING) b = KL_IO_PREAD;
+#endif
+  __atomic_store_n(&backend, b, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&backend_lock);
+  return b;
+}
+
+int kl_io_read_batch(kl_io_read_t *reads, int n) {
+  if (n > KL_IO_BATCH) n = KL_IO_BATCH;
+  for (int i=0; i < n; i++) {
+    reads[i].buf  = NULL;
+    reads[i].size = 0;
+    reads[i].err  = 0;
+  }
+
+#ifdef __linux__
+  if (kl_io_backend() == KL_IO_URING) {
+    io_ring_t *ring = ring_get();
+    if (ring != NULL) return uring_read_batch(ring, reads, n);
+  }
+#endif
+
+  int ok = 0;
+  for (int i=0; i < n; i++) {
+    if (io_read_one(&reads[i]) == 0) ok++;
+  }
+  return ok;
+}
+
+/* ------------------ */
+static void io_fail(kl_io_read_t *read, int err) {
+  kl_mem_free(KL_MEM_RESOURCE, read->buf);
+  read->buf  = NULL;
+  read->size = 0;
+  read->err  = err;
+}
+
+static int io_read_one(kl_io_read_t *read) {
+#ifdef _WIN32
+  FILE *f = fopen(read->path, "rb");
+  if (f == NULL) {
+    io_fail(read, errno);
+    return -1;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  read->size = size > 0 ? size : 0;
+  read->buf  = kl_mem_alloc(KL_MEM_RESOURCE, read->size > 0 ? read->size : 1);
+  size_t got = fread(read->buf, 1, read->size, f);
+  fclose(f);
+  if (got != read->size) {
+    io_fail(read, EIO);
+    return -1;
+  }
+  return 0;
+#else
+  int fd = open(read->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    io_fail(read, errno);
+    return -1;
+  }
+  struct stat s;
+  if (fstat(fd, &s) < 0) {
+    io_fail(read, errno);
+    close(fd);
+    return -1;
+  }
+  read->size = s.st_size;
+  read->buf  = kl_mem_alloc(KL_MEM_RESOURCE, read->size > 0 ? read->size : 1);
+
+  size_t done = 0;
+  while (done < read->size) {
+    ssize_t got = pread(fd, (uint8_t*)read->buf + done, read->size - done, done);
+    if (got < 0 && errno == EINTR) continue;
+    if (got < 0) {
+      io_fail(read, errno);
+      close(fd);
+      return -1;
+    }
+    if (got == 0) break; /* truncated since the fstat */
+    done += got;
+  }
+  read->size = done;
+  close(fd);
+  return 0;
+#endif
+}
+
+#ifdef __linux__
+static void ring_init() {
+  pthread_key_create(&ring_key, &ring_free);
+}
+
+static io_ring_t* ring_get() {
+  pthread_once(&ring_once, &ring_init);
+  io_ring_t *ring = pthread_getspecific(ring_key);
+  if (ring != NULL) return ring;
+
+  ring = kl_mem_alloc(KL_MEM_RESOURCE, sizeof(io_ring_t));
+  if (ring_setup(ring) < 0) {
+    fprintf(stderr, "Resource IO: Failed to set up an io_uring, using pread on this thread\n\tDetails: %s\n", strerror(errno));
+    kl_mem_free(KL_MEM_RESOURCE, ring);
+    return NULL;
+  }
+  pthread_setspecific(ring_key, ring);
+  return ring;
+}
+
+static int ring_setup(io_ring_t *ring) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring->fd = syscall(__NR_io_uring_setup, KL_IO_BATCH, &p);
+  if (ring->fd < 0) return -1;
+
+  ring->sq_len   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_len   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_len > ring->sq_len) ring->sq_len = ring->cq_len;
+    ring->cq_len = 0;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_map = MAP_FAILED;
+  ring->sqes   = MAP_FAILED;
+  if (ring->sq_map == MAP_FAILED) goto fail;
+  if (ring->cq_len > 0) {
+    ring->cq_map = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) goto fail;
+  }
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) goto fail;
+
+  uint8_t *sq = ring->sq_map;
+  uint8_t *cq = ring->cq_len > 0 ? ring->cq_map : ring->sq_map;
+  ring->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+  ring->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+  ring->cq_head  = (unsigned*)(cq + p.cq_off.head);
+  ring->cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+  ring->cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+  ring->cqes     = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  ring->pending  = 0;
+  ring->inflight = 0;
+  return 0;
+
+  fail:;
+  int err = errno;
+  if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_len);
+  if (ring->cq_map != MAP_FAILED) munmap(ring->cq_map, ring->cq_len);
+  if (ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_len);
+  close(ring->fd);
+  errno = err;
+  return -1;
+}
+
+static void ring_close(io_ring_t *ring) {
+  munmap(ring->sqes, ring->sqes_len);
+  if (ring->cq_len > 0) munmap(ring->cq_map, ring->cq_len);
+  munmap(ring->sq_map, ring->sq_len);
+  close(ring->fd);
+}
+
+static void ring_free(void *ring) {
+  /* thread exit */
+  ring_close(ring);
+  kl_mem_free(KL_MEM_RESOURCE, ring);
+}
+
+static void ring_discard(io_ring_t *ring) {
+  /* after a failed submit its queues can't be trusted, the thread's next batch sets up a new one */
+  pthread_setspecific(ring_key, NULL);
+  ring_free(ring);
+}
+
+static struct io_uring_sqe* ring_sqe(io_ring_t *ring, uint64_t user_data) {
+  unsigned tail = *ring->sq_tail + ring->pending;
+  unsigned idx  = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = user_data;
+  ring->sq_array[idx] = idx;
+  ring->pending++;
+  return sqe;
+}
+
+/* submits everything queued and waits until it has all completed, returns the number submitted */
+static int ring_submit(io_ring_t *ring) {
+  unsigned n = ring->pending;
+  if (n == 0) return 0;
+  __atomic_store_n(ring->sq_tail, *ring->sq_tail + n, __ATOMIC_RELEASE);
+  ring->pending = 0;
+
+  unsigned submitted = 0;
+  while (submitted < n) {
+    int ret = syscall(__NR_io_uring_enter, ring->fd, n - submitted, n - submitted, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) return -1;
+    submitted += ret;
+    ring->inflight += ret;
+  }
+  /* a completion can trail its submission, wait for stragglers */
+  for (;;) {
+    unsigned ready = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head;
+    if (ready >= n) break;
+    int ret = syscall(__NR_io_uring_enter, ring->fd, 0, n - ready, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno != EINTR) return -1;
+  }
+  return n;
+}
+
+static bool ring_reap(io_ring_t *ring, uint64_t *user_data, int *res) {
+  unsigned head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return false;
+  struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+  *user_data = cqe->user_data;
+  *res       = cqe->res;
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+  ring->inflight--;
+  return true;
+}
+
+/* waits out whatever a failed submit left in flight, so nothing lands in buffers about to be freed --
+ * false if the kernel won't wait for completions either */
+static bool ring_drain(io_ring_t *ring, bool opening) {
+  uint64_t tag;
+  int res;
+  while (ring->inflight > 0) {
+    if (ring_reap(ring, &tag, &res)) {
+      if (opening && res >= 0) close(res); /* an open which went through after all */
+      continue;
+    }
+    int ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno != EINTR) return false;
+  }
+  return true;
+}
+
+static int uring_read_batch(io_ring_t *ring, kl_io_read_t *reads, int n) {
+  int    fds[KL_IO_BATCH];
+  size_t done[KL_IO_BATCH];
+  uint64_t tag;
+  int res, ok = 0;
+  bool opening = true; /* completions are fds rather than byte counts */
+
+  /* every open at once -- on a cold cache the directory lookups are half the wait */
+  for (int i=0; i < n; i++) {
+    struct io_uring_sqe *sqe = ring_sqe(ring, i);
+    sqe->opcode     = IORING_OP_OPENAT;
+    sqe->fd         = AT_FDCWD;
+    sqe->addr       = (uintptr_t)reads[i].path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    fds[i]  = -1;
+    done[i] = 0;
+  }
+  if (ring_submit(ring) < 0) goto fallback;
+  while (ring_reap(ring, &tag, &res)) {
+    if (res >= 0) {
+      fds[tag] = res;
+    } else if (res == -EINVAL) {
+      fds[tag] = open(reads[tag].path, O_RDONLY | O_CLOEXEC); /* kernel predates IORING_OP_OPENAT */
+      if (fds[tag] < 0) reads[tag].err = errno;
+    } else {
+      reads[tag].err = -res;
+    }
+  }
+
+  for (int i=0; i < n; i++) {
+    if (fds[i] < 0) continue;
+    struct stat s;
+    if (fstat(fds[i], &s) < 0) {
+      io_fail(&reads[i], errno);
+      close(fds[i]);
+      fds[i] = -1;
+      continue;
+    }
+    reads[i].size = s.st_size;
+    reads[i].buf  = kl_mem_alloc(KL_MEM_RESOURCE, reads[i].size > 0 ? reads[i].size : 1);
+  }
+
+  /* then every read, resubmitting short ones until nothing's left */
+  opening = false;
+  for (;;) {
+    for (int i=0; i < n; i++) {
+      if (fds[i] < 0 || done[i] >= reads[i].size) continue;
+      size_t len = reads[i].size - done[i];
+      if (len > 0x40000000) len = 0x40000000;
+      struct io_uring_sqe *sqe = ring_sqe(ring, i);
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd     = fds[i];
+      sqe->addr   = (uintptr_t)((uint8_t*)reads[i].buf + done[i]);
+      sqe->len    = len;
+      sqe->off    = done[i];
+    }
+    int submitted = ring_submit(ring);
+    if (submitted == 0) break;
+    if (submitted < 0) goto fallback;
+    while (ring_reap(ring, &tag, &res)) {
+      if (res == -EINVAL) {
+        /* kernel predates IORING_OP_READ */
+        ssize_t got = pread(fds[tag], (uint8_t*)reads[tag].buf + done[tag], reads[tag].size - done[tag], done[tag]);
+        res = got < 0 ? -errno : (int)got;
+      }
+      if (res > 0) {
+        done[tag] += res;
+      } else if (res == 0) {
+        reads[tag].size = done[tag]; /* truncated since the fstat */
+      } else if (res != -EINTR && res != -EAGAIN) {
+        io_fail(&reads[tag], -res);
+        close(fds[tag]);
+        fds[tag] = -1;
+      }
+    }
+  }
+
+  for (int i=0; i < n; i++) {
+    if (fds[i] >= 0) close(fds[i]);
+    if (reads[i].buf != NULL) ok++;
+  }
+  return ok;
+
+  fallback:
+  /* the ring is broken, start over with pread */
+  fprintf(stderr, "Resource IO: io_uring submission failed, retrying with pread\n\tDetails: %s\n", strerror(errno));
+  if (ring_drain(ring, opening)) {
+    ring_discard(ring);
+  } else {
+    /* reads may still land in the buffers, so they're left unfreed, along with the ring */
+    fprintf(stderr, "Resource IO: Couldn't wait for io_uring requests in flight, leaking their buffers\n\tDetails: %s\n", strerror(errno));
+    pthread_setspecific(ring_key, NULL);
+    for (int i=0; i < n; i++) reads[i].buf = NULL;
+  }
+  for (int i=0; i < n; i++) {
+    if (fds[i] >= 0) close(fds[i]);
+    io_fail(&reads[i], 0);
+    if (io_read_one(&reads[i]) == 0) ok++;
+  }
+  return ok;
+}
+#endif /* __linux__ */
+
+/* vim: set ts=2 sw=2 et */
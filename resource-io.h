@@ -0,0 +1,35 @@
+#ifndef KL_RESOURCE_IO_H
+#define KL_RESOURCE_IO_H
+
+/* batched whole-file reads for the resource workers
+ *
+ * on Linux a batch goes through io_uring: every open is submitted at once,
+ * then every read.  elsewhere, or if the kernel won't give us a ring, files
+ * are read one after another with pread, and it's the worker pool which
+ * keeps several of them in flight. */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define KL_IO_MMAP  0 /* no batching, each decode maps its own file (the old path, for comparison) */
+#define KL_IO_PREAD 1
+#define KL_IO_URING 2
+
+#define KL_IO_BATCH 0x20 /* most files read by one call */
+
+typedef struct kl_io_read {
+  const char *path;
+  void  *buf;  /* allocated with KL_MEM_RESOURCE, NULL on failure */
+  size_t size;
+  int    err;  /* errno, 0 on success */
+} kl_io_read_t;
+
+/* KL_IO_URING if the kernel supports it, KL_IO_PREAD otherwise */
+int  kl_io_backend();
+/* returns the backend actually in use, which is KL_IO_PREAD if io_uring was asked for but isn't available */
+int  kl_io_set_backend(int backend);
+/* reads up to KL_IO_BATCH whole files, returns how many succeeded -- safe to call from any thread */
+int  kl_io_read_batch(kl_io_read_t *reads, int n);
+
+#endif /* KL_RESOURCE_IO_H */
+/* vim: set ts=2 sw=2 et */
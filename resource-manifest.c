@@ -0,0 +1,157 @@
+#include "resource-manifest.h"
+
+#include "mem.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct manifest_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_dirs;
+  uint32_t num_entries;
+  uint32_t num_strings; /* bytes */
+  uint32_t vpath;       /* offset into the string table */
+  int64_t  stamp;
+} manifest_header_t;
+
+static bool validate(kl_manifest_t *manifest);
+
+/* ------------------ */
+void kl_manifest_init(kl_manifest_t *manifest) {
+  manifest->stamp = 0;
+  kl_array_mdir_init(&manifest->dirs);
+  kl_array_mentry_init(&manifest->entries);
+  kl_array_init(&manifest->strings, sizeof(char));
+}
+
+void kl_manifest_free(kl_manifest_t *manifest) {
+  kl_array_free(&manifest->dirs);
+  kl_array_free(&manifest->entries);
+  kl_array_free(&manifest->strings);
+}
+
+int kl_manifest_load(kl_manifest_t *manifest, const char *path, const char *vpath) {
+  size_t size;
+  uint8_t *data = kl_resource_mapfile(path, &size);
+  if (data == NULL) return -1;
+
+  int err = -1;
+  manifest_header_t header;
+  if (size < sizeof(header)) goto cleanup;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != KL_MANIFEST_MAGIC || header.version != KL_MANIFEST_VERSION) goto cleanup;
+
+  size_t dirbytes   = (size_t)header.num_dirs * sizeof(kl_manifest_dir_t);
+  size_t entrybytes = (size_t)header.num_entries * sizeof(kl_manifest_entry_t);
+  if (size != sizeof(header) + dirbytes + entrybytes + header.num_strings) goto cleanup;
+
+  uint8_t *cur = data + sizeof(header);
+  kl_array_clear(&manifest->dirs);
+  kl_array_clear(&manifest->entries);
+  kl_array_clear(&manifest->strings);
+  kl_array_append_n(&manifest->dirs, cur, header.num_dirs);
+  cur += dirbytes;
+  kl_array_append_n(&manifest->entries, cur, header.num_entries);
+  cur += entrybytes;
+  kl_array_append_n(&manifest->strings, cur, header.num_strings);
+  manifest->stamp = header.stamp;
+
+  if (!validate(manifest)) goto cleanup;
+  /* ids depend on the virtual path the directory was added under */
+  if (header.vpath >= header.num_strings) goto cleanup;
+  if (strcmp((char*)kl_array_data(&manifest->strings) + header.vpath, vpath) != 0) goto cleanup;
+
+  err = 0;
+
+  cleanup:
+
+  if (err < 0) {
+    kl_array_clear(&manifest->dirs);
+    kl_array_clear(&manifest->entries);
+    kl_array_clear(&manifest->strings);
+  }
+  kl_resource_unmapfile(data, size);
+  return err;
+}
+
+int kl_manifest_write(kl_manifest_t *manifest, const char *path, const char *vpath) {
+  manifest->stamp = time(NULL);
+
+  manifest_header_t header;
+  header.magic       = KL_MANIFEST_MAGIC;
+  header.version     = KL_MANIFEST_VERSION;
+  header.num_dirs    = kl_array_size(&manifest->dirs);
+  header.num_entries = kl_array_size(&manifest->entries);
+  header.vpath       = kl_array_append_n(&manifest->strings, vpath, strlen(vpath) + 1);
+  header.num_strings = kl_array_size(&manifest->strings);
+  header.stamp       = manifest->stamp;
+
+  /* write to a temporary and rename, so a crash can't leave a truncated manifest behind */
+  char tmppath[KL_RESITEM_PATHLEN];
+  snprintf(tmppath, KL_RESITEM_PATHLEN, "%s.tmp", path);
+  tmppath[KL_RESITEM_PATHLEN-1] = '\0';
+
+  FILE *file = fopen(tmppath, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Resource Manager: Failed to write manifest %s\n", path);
+    return -1;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && fwrite(kl_array_data(&manifest->dirs), sizeof(kl_manifest_dir_t), header.num_dirs, file) == header.num_dirs;
+  ok = ok && fwrite(kl_array_data(&manifest->entries), sizeof(kl_manifest_entry_t), header.num_entries, file) == header.num_entries;
+  ok = ok && fwrite(kl_array_data(&manifest->strings), 1, header.num_strings, file) == header.num_strings;
+  ok = fclose(file) == 0 && ok;
+  remove(path); /* rename doesn't replace existing files on Windows */
+  if (!ok || rename(tmppath, path) != 0) {
+    fprintf(stderr, "Resource Manager: Failed to write manifest %s\n", path);
+    remove(tmppath);
+    return -1;
+  }
+  return 0;
+}
+
+int kl_manifest_add_dir(kl_manifest_t *manifest, int64_t mtime) {
+  kl_manifest_dir_t dir = {
+    .mtime = mtime,
+    .first = kl_array_size(&manifest->entries),
+    .count = 0
+  };
+  return kl_array_mdir_push(&manifest->dirs, dir);
+}
+
+int kl_manifest_add_entry(kl_manifest_t *manifest, const char *name, kl_resource_id_t resid, uint64_t size, bool isdir) {
+  kl_manifest_entry_t entry = {
+    .resid = resid,
+    .size  = size,
+    .name  = kl_array_append_n(&manifest->strings, name, strlen(name) + 1),
+    .dir   = isdir ? -2 : -1 /* -2 until the directory itself is added */
+  };
+  kl_array_mdir_at(&manifest->dirs, kl_array_size(&manifest->dirs) - 1)->count++;
+  return kl_array_mentry_push(&manifest->entries, entry);
+}
+
+/* ------------------ */
+static bool validate(kl_manifest_t *manifest) {
+  int ndirs    = kl_array_size(&manifest->dirs);
+  int nentries = kl_array_size(&manifest->entries);
+  int nstrings = kl_array_size(&manifest->strings);
+  if (ndirs == 0) return false;
+  if (nstrings == 0 || ((char*)kl_array_data(&manifest->strings))[nstrings-1] != '\0') return false;
+
+  kl_manifest_dir_t   *dirs    = kl_array_mdir_data(&manifest->dirs);
+  kl_manifest_entry_t *entries = kl_array_mentry_data(&manifest->entries);
+  for (int i=0; i < ndirs; i++) {
+    if (dirs[i].first > nentries || dirs[i].count > nentries - dirs[i].first) return false;
+    for (int j = dirs[i].first; j < dirs[i].first + dirs[i].count; j++) {
+      if (entries[j].name >= nstrings) return false;
+      if (entries[j].dir < -1 || entries[j].dir >= ndirs) return false;
+      /* subdirectories are always recorded after their parents, which rules out cycles */
+      if (entries[j].dir >= 0 && entries[j].dir <= i) return false;
+    }
+  }
+  return true;
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,56 @@
+#ifndef KL_RESOURCE_MANIFEST_H
+#define KL_RESOURCE_MANIFEST_H
+
+/* cached directory listings for kl_resource_add_dir
+ *
+ * a directory's mtime only changes when entries are added, removed or
+ * renamed, so a directory whose mtime matches the manifest can be registered
+ * without reading it or stat'ing its files. */
+
+#include "resource.h"
+#include "array.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KL_MANIFEST_MAGIC   0x5844494b /* "KIDX" */
+#define KL_MANIFEST_VERSION 1
+
+typedef struct kl_manifest_dir {
+  int64_t  mtime;
+  uint32_t first; /* index of the first entry */
+  uint32_t count;
+} kl_manifest_dir_t;
+
+typedef struct kl_manifest_entry {
+  kl_resource_id_t resid; /* of the full virtual path, 0 for directories */
+  uint64_t size;
+  uint32_t name; /* offset into the string table */
+  int32_t  dir;  /* index of the directory record, -1 for files */
+} kl_manifest_entry_t;
+
+typedef struct kl_manifest {
+  int64_t    stamp; /* when it was written, directories modified since are always re-read */
+  kl_array_t dirs;
+  kl_array_t entries;
+  kl_array_t strings;
+} kl_manifest_t;
+
+KL_ARRAY_DECLARE(kl_manifest_dir_t, mdir)
+KL_ARRAY_DECLARE(kl_manifest_entry_t, mentry)
+
+void kl_manifest_init(kl_manifest_t *manifest);
+void kl_manifest_free(kl_manifest_t *manifest);
+/* fails if the file is missing, corrupt, or was written for a different virtual path */
+int  kl_manifest_load(kl_manifest_t *manifest, const char *path, const char *vpath);
+int  kl_manifest_write(kl_manifest_t *manifest, const char *path, const char *vpath);
+/* a directory's entries are contiguous, so add them all before recursing into subdirectories */
+int  kl_manifest_add_dir(kl_manifest_t *manifest, int64_t mtime);
+int  kl_manifest_add_entry(kl_manifest_t *manifest, const char *name, kl_resource_id_t resid, uint64_t size, bool isdir);
+
+static inline char* kl_manifest_name(kl_manifest_t *manifest, kl_manifest_entry_t *entry) {
+  return (char*)kl_array_data(&manifest->strings) + entry->name;
+}
+
+#endif /* KL_RESOURCE_MANIFEST_H */
+/* vim: set ts=2 sw=2 et */
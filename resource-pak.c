@@ -0,0 +1,255 @@
+#include "resource-pak.h"
+
+#include "array.h"
+#include "lz4.h"
+#include "mem.h"
+
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+typedef struct pak_file {
+  kl_resource_id_t resid;
+  char path[KL_RESITEM_PATHLEN];
+  char vpath[KL_RESITEM_PATHLEN];
+} pak_file_t;
+
+static bool validate(kl_pak_t *pak);
+static int  walkdir(const char *path, const char *vpath, kl_array_t *files);
+static int  compare_files(const void *a, const void *b);
+static int  compare_entry(const void *key, const void *entry);
+static bool pad(FILE *file, long align);
+
+/* ------------------ */
+kl_pak_t* kl_pak_open(const char *path) {
+  kl_pak_t *pak = kl_mem_alloc(KL_MEM_RESOURCE, sizeof(kl_pak_t));
+  strncpy(pak->path, path, KL_RESITEM_PATHLEN);
+  pak->path[KL_RESITEM_PATHLEN-1] = '\0';
+
+  pak->base = kl_resource_mapfile(path, &pak->size);
+  if (pak->base == NULL) {
+    fprintf(stderr, "Pak: Failed to map %s\n", path);
+    kl_mem_free(KL_MEM_RESOURCE, pak);
+    return NULL;
+  }
+  if (!validate(pak)) {
+    fprintf(stderr, "Pak: %s is not a valid pak file\n", path);
+    kl_pak_close(pak);
+    return NULL;
+  }
+  return pak;
+}
+
+void kl_pak_close(kl_pak_t *pak) {
+  kl_resource_unmapfile(pak->base, pak->size);
+  kl_mem_free(KL_MEM_RESOURCE, pak);
+}
+
+kl_pak_entry_t* kl_pak_find(kl_pak_t *pak, kl_resource_id_t resid) {
+  return bsearch(&resid, pak->entries, pak->header->num_entries, sizeof(kl_pak_entry_t), &compare_entry);
+}
+
+char* kl_pak_vpath(kl_pak_t *pak, kl_pak_entry_t *entry) {
+  return pak->strings + entry->vpath;
+}
+
+int kl_pak_read(kl_pak_t *pak, kl_pak_entry_t *entry, uint8_t *dst) {
+  uint8_t *src = pak->base + entry->offset;
+  if (!(entry->flags & KL_PAK_LZ4)) {
+    memcpy(dst, src, entry->size);
+    return entry->size;
+  }
+  int n = kl_lz4_decompress(src, entry->size, dst, entry->rawsize);
+  if (n != entry->rawsize) return -1;
+  return n;
+}
+
+int kl_pak_write(const char *pakpath, const char *dirpath, const char *vpath, bool compress) {
+  int err = -1;
+
+  kl_array_t files;
+  kl_array_init(&files, sizeof(pak_file_t));
+  kl_array_t index;
+  kl_array_init(&index, sizeof(kl_pak_entry_t));
+  kl_array_t strings;
+  kl_array_init(&strings, sizeof(char));
+  FILE    *out = NULL;
+  uint8_t *buf = NULL;
+
+  if (walkdir(dirpath, vpath, &files) < 0) goto cleanup;
+  /* the index is sorted by id so it can be binary searched */
+  qsort(kl_array_data(&files), kl_array_size(&files), sizeof(pak_file_t), &compare_files);
+
+  out = fopen(pakpath, "wb");
+  if (out == NULL) {
+    fprintf(stderr, "Pak: Failed to create %s\n\tDetails: %s\n", pakpath, strerror(errno));
+    goto cleanup;
+  }
+
+  kl_pak_header_t header;
+  memset(&header, 0, sizeof(header));
+  if (fwrite(&header, sizeof(header), 1, out) != 1) goto cleanup;
+
+  for (int i=0; i < kl_array_size(&files); i++) {
+    pak_file_t *file = kl_array_at(&files, i);
+
+    size_t size;
+    uint8_t *data = kl_resource_mapfile(file->path, &size);
+    if (data == NULL) size = 0;
+
+    kl_pak_entry_t entry;
+    entry.resid   = file->resid;
+    entry.size    = size;
+    entry.rawsize = size;
+    entry.vpath   = kl_array_append_n(&strings, file->vpath, strlen(file->vpath) + 1);
+    entry.flags   = 0;
+
+    uint8_t *src = data;
+    if (compress && size > 0) {
+      buf = kl_mem_realloc(KL_MEM_RESOURCE, buf, KL_LZ4_BOUND(size));
+      int n = kl_lz4_compress(data, size, buf, KL_LZ4_BOUND(size));
+      /* not worth decompressing unless it saves at least 1/8th */
+      if (n > 0 && n < size - size/8) {
+        src         = buf;
+        entry.size  = n;
+        entry.flags = KL_PAK_LZ4;
+      }
+    }
+
+    bool ok = pad(out, KL_PAK_ALIGN);
+    entry.offset = ftell(out);
+    if (ok && entry.size > 0) {
+      ok = fwrite(src, entry.size, 1, out) == 1;
+    }
+    kl_resource_unmapfile(data, size);
+    if (!ok) goto cleanup;
+
+    kl_array_push(&index, &entry);
+  }
+
+  if (!pad(out, sizeof(uint64_t))) goto cleanup;
+  header.index_offset = ftell(out);
+  if (kl_array_size(&index) > 0 && fwrite(kl_array_data(&index), sizeof(kl_pak_entry_t), kl_array_size(&index), out) != kl_array_size(&index)) goto cleanup;
+  header.strings_offset = ftell(out);
+  if (kl_array_size(&strings) > 0 && fwrite(kl_array_data(&strings), 1, kl_array_size(&strings), out) != kl_array_size(&strings)) goto cleanup;
+
+  header.magic       = KL_PAK_MAGIC;
+  header.version     = KL_PAK_VERSION;
+  header.num_entries = kl_array_size(&index);
+  header.flags       = 0;
+  fseek(out, 0, SEEK_SET);
+  if (fwrite(&header, sizeof(header), 1, out) != 1) goto cleanup;
+
+  err = 0;
+
+  cleanup:
+
+  if (out != NULL && fclose(out) != 0) err = -1;
+  if (err < 0) {
+    fprintf(stderr, "Pak: Failed to write %s\n", pakpath);
+  }
+  kl_mem_free(KL_MEM_RESOURCE, buf);
+  kl_array_free(&files);
+  kl_array_free(&index);
+  kl_array_free(&strings);
+
+  return err;
+}
+
+/* ------------------ */
+static bool validate(kl_pak_t *pak) {
+  if (pak->size < sizeof(kl_pak_header_t)) return false;
+  kl_pak_header_t *header = (kl_pak_header_t*)pak->base;
+  if (header->magic != KL_PAK_MAGIC || header->version != KL_PAK_VERSION) return false;
+
+  uint64_t n = header->num_entries;
+  if (header->index_offset % sizeof(uint64_t) != 0) return false;
+  if (header->index_offset > pak->size || n * sizeof(kl_pak_entry_t) > pak->size - header->index_offset) return false;
+  if (header->strings_offset > pak->size) return false;
+
+  pak->header  = header;
+  pak->entries = (kl_pak_entry_t*)(pak->base + header->index_offset);
+  pak->strings = (char*)(pak->base + header->strings_offset);
+
+  /* the string table must be NUL-terminated so a bad offset can't run off the end */
+  uint64_t nstrings = pak->size - header->strings_offset;
+  if (n > 0 && (nstrings == 0 || pak->strings[nstrings-1] != '\0')) return false;
+  for (uint64_t i=0; i < n; i++) {
+    kl_pak_entry_t *entry = pak->entries + i;
+    if (entry->offset > pak->size || entry->size > pak->size - entry->offset) return false;
+    if (entry->vpath >= nstrings) return false;
+    if (!(entry->flags & KL_PAK_LZ4) && entry->rawsize != entry->size) return false;
+  }
+  return true;
+}
+
+static int walkdir(const char *path, const char *vpath, kl_array_t *files) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    fprintf(stderr, "Pak: Failed to read directory %s!\n\tDetails: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  int err = 0;
+  struct dirent *ent;
+  struct stat    s;
+  pak_file_t     file;
+  while ((ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, "..") == 0) continue;
+    if (strcmp(ent->d_name, ".") == 0) continue;
+
+    /* a truncated path would pack the wrong file, or under the wrong name */
+    if (snprintf(file.path, KL_RESITEM_PATHLEN, "%s/%s", path, ent->d_name) >= KL_RESITEM_PATHLEN ||
+        snprintf(file.vpath, KL_RESITEM_PATHLEN, "%s/%s", vpath, ent->d_name) >= KL_RESITEM_PATHLEN) {
+      fprintf(stderr, "Pak: Path too long: %s/%s\n", path, ent->d_name);
+      err = -1;
+      break;
+    }
+
+    if (stat(file.path, &s) < 0) continue;
+    if (S_ISDIR(s.st_mode)) {
+      err = walkdir(file.path, file.vpath, files);
+      if (err < 0) break;
+    } else if (S_ISREG(s.st_mode)) {
+      /* same renaming as kl_resource_add_dir, '|' separates MTL entries */
+      for (int i=0; file.vpath[i] != '\0'; i++) {
+        if (file.vpath[i] == '|') {
+          file.vpath[i] = ':';
+        }
+      }
+      file.resid = kl_resource_getid(file.vpath);
+      kl_array_push(files, &file);
+    }
+  }
+
+  closedir(dir);
+  return err;
+}
+
+static int compare_files(const void *a, const void *b) {
+  kl_resource_id_t ida = ((pak_file_t*)a)->resid;
+  kl_resource_id_t idb = ((pak_file_t*)b)->resid;
+  return ida < idb ? -1 : ida > idb ? 1 : 0;
+}
+
+static int compare_entry(const void *key, const void *entry) {
+  kl_resource_id_t ida = *(kl_resource_id_t*)key;
+  kl_resource_id_t idb = ((kl_pak_entry_t*)entry)->resid;
+  return ida < idb ? -1 : ida > idb ? 1 : 0;
+}
+
+static bool pad(FILE *file, long align) {
+  long pos = ftell(file);
+  for (; pos % align != 0; pos++) {
+    if (fputc(0, file) == EOF) return false;
+  }
+  return true;
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,62 @@
+#ifndef KL_RESOURCE_PAK_H
+#define KL_RESOURCE_PAK_H
+
+/* .kpak asset archives
+ *
+ * layout: header, entry data (each entry starts on a page boundary), index
+ * sorted by resid, then the NUL-terminated virtual paths.  all integers are
+ * little-endian. */
+
+#include "resource.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define KL_PAK_MAGIC   0x4b41504b /* "KPAK" */
+#define KL_PAK_VERSION 1
+#define KL_PAK_ALIGN   0x1000
+
+#define KL_PAK_LZ4 0x01 /* entry is an LZ4 block, rawsize is the decompressed size */
+
+typedef struct kl_pak_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_entries;
+  uint32_t flags;
+  uint64_t index_offset;
+  uint64_t strings_offset;
+} kl_pak_header_t;
+
+typedef struct kl_pak_entry {
+  kl_resource_id_t resid;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t rawsize;
+  uint32_t vpath; /* offset into the string table */
+  uint32_t flags;
+} kl_pak_entry_t;
+
+typedef struct kl_pak {
+  char path[KL_RESITEM_PATHLEN];
+  uint8_t *base;
+  size_t   size;
+  kl_pak_header_t *header;
+  kl_pak_entry_t  *entries;
+  char            *strings;
+} kl_pak_t;
+
+/* maps and validates a pak, NULL on failure */
+kl_pak_t* kl_pak_open(const char *path);
+void kl_pak_close(kl_pak_t *pak);
+/* binary search of the index */
+kl_pak_entry_t* kl_pak_find(kl_pak_t *pak, kl_resource_id_t resid);
+/* virtual path of an entry */
+char* kl_pak_vpath(kl_pak_t *pak, kl_pak_entry_t *entry);
+/* copies or decompresses an entry, dst must hold entry->rawsize bytes */
+int kl_pak_read(kl_pak_t *pak, kl_pak_entry_t *entry, uint8_t *dst);
+/* packs the contents of a directory, with the same virtual paths kl_resource_add_dir would give them */
+int kl_pak_write(const char *pakpath, const char *dirpath, const char *vpath, bool compress);
+
+#endif /* KL_RESOURCE_PAK_H */
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,191 @@
+#include "resource-watch.h"
+
+#include "resource.h"
+
+#include <stdio.h>
+
+#ifdef __linux__
+
+#include "array.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR)
+
+typedef struct watch {
+  int  wd;
+  char path[KL_RESITEM_PATHLEN];
+  char vpath[KL_RESITEM_PATHLEN];
+} watch_t;
+
+KL_ARRAY_DECLARE(watch_t, watch)
+
+static int        watch_fd = -1;
+static kl_array_t watches;
+
+static watch_t* find_watch(int wd);
+static void remove_watches(const char *vpath);
+static void handle_event(struct inotify_event *event);
+
+/* ------------------ */
+int kl_resource_watch_init() {
+  if (watch_fd >= 0) return 0;
+
+  watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch_fd < 0) {
+    fprintf(stderr, "Resource Watch: Failed to initialize inotify\n\tDetails: %s\n", strerror(errno));
+    return -1;
+  }
+  kl_array_watch_init(&watches);
+  return 0;
+}
+
+void kl_resource_watch_free() {
+  if (watch_fd < 0) return;
+  close(watch_fd);
+  watch_fd = -1;
+  kl_array_free(&watches);
+}
+
+void kl_resource_watch_add(const char *path, const char *vpath) {
+  if (watch_fd < 0) return;
+
+  int wd = inotify_add_watch(watch_fd, path, WATCH_EVENTS);
+  if (wd < 0) {
+    fprintf(stderr, "Resource Watch: Failed to watch %s\n\tDetails: %s\n", path, strerror(errno));
+    return;
+  }
+
+  /* watching the same directory twice gives back the same descriptor */
+  watch_t *watch = find_watch(wd);
+  if (watch == NULL) {
+    kl_array_resize(&watches, kl_array_size(&watches) + 1);
+    watch = kl_array_watch_at(&watches, kl_array_size(&watches) - 1);
+  }
+  watch->wd = wd;
+  strncpy(watch->path, path, KL_RESITEM_PATHLEN);
+  watch->path[KL_RESITEM_PATHLEN-1] = '\0';
+  strncpy(watch->vpath, vpath, KL_RESITEM_PATHLEN);
+  watch->vpath[KL_RESITEM_PATHLEN-1] = '\0';
+}
+
+void kl_resource_watch_poll() {
+  if (watch_fd < 0) return;
+
+  union {
+    struct inotify_event event; /* for alignment */
+    char buf[0x1000];
+  } events;
+  for (;;) {
+    ssize_t n = read(watch_fd, events.buf, sizeof(events.buf));
+    if (n <= 0) break; /* EAGAIN, nothing left */
+
+    for (char *cur = events.buf; cur < events.buf + n;) {
+      struct inotify_event *event = (struct inotify_event*)cur;
+      handle_event(event);
+      cur += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+/* ------------------ */
+static watch_t* find_watch(int wd) {
+  watch_t *watchv = kl_array_watch_data(&watches);
+  for (int i=0; i < kl_array_size(&watches); i++) {
+    if (watchv[i].wd == wd) return watchv + i;
+  }
+  return NULL;
+}
+
+static void remove_watches(const char *vpath) {
+  /* a directory that's been moved away is still watched under its new name */
+  int n = strlen(vpath);
+  watch_t *watchv = kl_array_watch_data(&watches);
+  for (int i=0; i < kl_array_size(&watches);) {
+    if (strncmp(watchv[i].vpath, vpath, n) == 0 && (watchv[i].vpath[n] == '\0' || watchv[i].vpath[n] == '/')) {
+      inotify_rm_watch(watch_fd, watchv[i].wd);
+      watchv[i] = watchv[kl_array_size(&watches) - 1];
+      kl_array_resize(&watches, kl_array_size(&watches) - 1);
+    } else {
+      i++;
+    }
+  }
+}
+
+static void handle_event(struct inotify_event *event) {
+  char subpath[KL_RESITEM_PATHLEN];
+  char subvpath[KL_RESITEM_PATHLEN];
+
+  if (event->mask & IN_Q_OVERFLOW) {
+    fprintf(stderr, "Resource Watch: Event queue overflowed, some changes were missed\n");
+    return;
+  }
+
+  watch_t *watch = find_watch(event->wd);
+  if (watch == NULL) return;
+  if (event->mask & IN_IGNORED) {
+    /* the directory itself is gone */
+    *watch = *kl_array_watch_at(&watches, kl_array_size(&watches) - 1);
+    kl_array_resize(&watches, kl_array_size(&watches) - 1);
+    return;
+  }
+  if (event->len == 0) return;
+
+  /* it couldn't have been registered under a truncated name either */
+  if (snprintf(subpath, KL_RESITEM_PATHLEN, "%s/%s", watch->path, event->name) >= KL_RESITEM_PATHLEN ||
+      snprintf(subvpath, KL_RESITEM_PATHLEN, "%s/%s", watch->vpath, event->name) >= KL_RESITEM_PATHLEN) {
+    fprintf(stderr, "Resource Watch: Path too long: %s/%s\n", watch->path, event->name);
+    return;
+  }
+
+  if (event->mask & IN_ISDIR) {
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+      kl_resource_scan_dir(subpath, subvpath);
+    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+      kl_resource_remove_dir(subvpath);
+      remove_watches(subvpath);
+    }
+    return;
+  }
+
+  /* same renaming as kl_resource_add_dir */
+  for (int i=0; subvpath[i] != '\0'; i++) {
+    if (subvpath[i] == '|') {
+      subvpath[i] = ':';
+    }
+  }
+  if (event->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE)) {
+    if (kl_resource_exists(subvpath)) {
+      kl_resource_reload(subvpath);
+    } else {
+      kl_resource_add_entry(subpath, subvpath);
+    }
+  } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+    if (kl_resource_remove_entry(subvpath) < 0 && kl_resource_exists(subvpath)) {
+      fprintf(stderr, "Resource Watch: %s was removed, but it's still in use\n", subvpath);
+    }
+  }
+}
+
+#else /* !__linux__ */
+
+int kl_resource_watch_init() {
+  fprintf(stderr, "Resource Watch: Not supported on this platform\n");
+  return -1;
+}
+
+void kl_resource_watch_free() {
+}
+
+void kl_resource_watch_add(const char *path, const char *vpath) {
+}
+
+void kl_resource_watch_poll() {
+}
+
+#endif
+
+/* vim: set ts=2 sw=2 et */
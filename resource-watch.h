@@ -0,0 +1,18 @@
+#ifndef KL_RESOURCE_WATCH_H
+#define KL_RESOURCE_WATCH_H
+
+/* optional hot-reloading of directories added with kl_resource_add_dir
+ *
+ * only implemented on Linux (inotify), elsewhere kl_resource_watch_init
+ * fails and the rest are no-ops. */
+
+/* watches every directory added from now on */
+int  kl_resource_watch_init();
+void kl_resource_watch_free();
+/* called by kl_resource_add_dir for each directory it visits */
+void kl_resource_watch_add(const char *path, const char *vpath);
+/* applies pending changes to the resource table, called by kl_resource_pump on the main thread */
+void kl_resource_watch_poll();
+
+#endif /* KL_RESOURCE_WATCH_H */
+/* vim: set ts=2 sw=2 et */
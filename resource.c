@@ -1,10 +1,21 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+#endif
+
 #include "resource.h"
 
+#include "resource-pak.h"
+#include "resource-manifest.h"
+#include "resource-watch.h"
+#include "resource-io.h"
+#include "intern.h"
 #include "array.h"
+#include "mem.h"
 
 #include <errno.h>
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -13,92 +24,1189 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 
+/* open-addressed (robin hood) table of entries, keyed by kl_resource_getid of the virtual path */
+typedef struct resource_slot {
+  kl_resource_id_t    hash;
+  kl_resource_item_t *item; /* NULL for empty slots */
+} resource_slot_t;
 
-#define KL_RESOURCE_BUCKETS 0x1000
 typedef struct resources {
-  kl_resource_item_t *buckets[KL_RESOURCE_BUCKETS];
+  resource_slot_t *slots;
+  uint32_t mask; /* number of slots - 1 */
+  uint32_t count;
 } resources_t;
-static resources_t resource_cache;
+static resources_t resource_cache = { .slots = NULL, .mask = 0, .count = 0 };
+/* readers look entries up, writers add and remove them */
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* an item's state, refs and loader only change under the lock of its stripe, picked by resid --
+ * no callback runs under it, loading is claimed by setting an item PENDING instead */
+#define RESOURCE_STRIPES 0x40
+typedef struct resource_stripe {
+  pthread_mutex_t lock;
+  pthread_cond_t  cond; /* signals threads waiting on a PENDING item */
+} resource_stripe_t;
+static resource_stripe_t stripes[RESOURCE_STRIPES];
+static pthread_once_t    stripes_once = PTHREAD_ONCE_INIT;
+
+/* unreferenced, loaded items -- most recently released at the head */
+typedef struct resource_lru {
+  kl_resource_item_t *head, *tail;
+  size_t cpu_used, gpu_used; /* by every loaded item, referenced or not */
+  size_t cpu_budget, gpu_budget;
+} resource_lru_t;
+static resource_lru_t resource_lru = {
+  .head = NULL, .tail = NULL,
+  .cpu_used = 0, .gpu_used = 0,
+  .cpu_budget = KL_RESOURCE_CPU_BUDGET, .gpu_budget = KL_RESOURCE_GPU_BUDGET
+};
+/* taken after a stripe lock, never before one (lru_evict only tries) */
+static pthread_mutex_t lru_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* slots, must be a power of two */
+static const uint32_t resource_initial_slots = 0x400;
+
+/* async loading -- both queues are guarded by queue_lock, which is taken after stripe locks */
+KL_ARRAY_DECLARE(kl_resource_item_t*, item)
+
+typedef struct resource_queue {
+  kl_array_t items; /* removed items are NULLed out rather than shifted */
+  int head;
+} resource_queue_t;
+
+static pthread_mutex_t  queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   jobs_cond  = PTHREAD_COND_INITIALIZER; /* signals workers */
+static resource_queue_t jobs;
+static resource_queue_t done;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t *workers     = NULL;
+static int        num_workers = 0;
+static bool       quit        = false;
+
+/* in-place reloads go one at a time, they swap contents and write stats outside the stripe lock,
+ * so the dumps hold it too while they copy those out */
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* where main_thread loaders run, set once at startup */
+static pthread_t main_thread;
+static bool      main_thread_set = false;
+
+/* every loader ever created, for reports -- loader_lock also guards their stats, except hits and misses which are atomic */
+KL_ARRAY_DECLARE(kl_resource_loader_t*, loader)
+static kl_array_t loaders;
+static pthread_mutex_t loader_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* interned, so they stay valid while entries are removed */
+KL_ARRAY_DECLARE(const char*, vpath)
+
+static const char *state_names[] = { "unloaded", "pending", "decoded", "loaded", "failed" };
+
+/* what the dumps print of a loaded item, copied while it can't be removed */
+typedef struct item_snapshot {
+  const char *vpath;  /* interned, so it outlives the item */
+  const char *loader; /* loaders are never freed either */
+  bool   packed;
+  double load_ms, loaded_at;
+  size_t bytes_read, cpu_bytes, gpu_bytes;
+} item_snapshot_t;
+
+KL_ARRAY_DECLARE(item_snapshot_t, snapshot)
 
 typedef struct diritem {
   char name[KL_RESITEM_PATHLEN];
   bool isdir;
+  uint64_t size;
 } diritem_t;
 
-kl_resource_id_t kl_resource_getid(char *str) {
-  kl_resource_id_t h = 0;
+static char path_normchar(char c);
+static bool path_equal(const char *a, const char *b);
+static uint32_t slot_dist(uint32_t i, kl_resource_id_t hash);
+static int  table_find(kl_resource_id_t hash, const char *vpath);
+static void table_insert(kl_resource_id_t hash, kl_resource_item_t *item);
+static void table_remove(int i);
+static void table_grow();
+static kl_resource_item_t* insert_entry(const char *path, const char *vpath, kl_resource_id_t resid, struct kl_pak *pak, struct kl_pak_entry *pakentry);
+static int  listdir(const char *path, kl_array_t *items);
+static int  scan_dir(kl_manifest_t *old, int olddir, kl_manifest_t *manifest, const char *path, const char *vpath, bool *changed);
+static kl_resource_item_t* item_new(const char *path, const char *vpath, kl_resource_id_t resid);
+static void blob_open(kl_resource_item_t *item, kl_resource_blob_t *blob);
+static void blob_close(kl_resource_blob_t *blob);
+static void queue_push(resource_queue_t *queue, kl_resource_item_t *item);
+static kl_resource_item_t* queue_pop(resource_queue_t *queue);
+static bool queue_remove(resource_queue_t *queue, kl_resource_item_t *item);
+static void* worker_main(void *arg);
+static int  worker_batch();
+static void worker_publish(kl_resource_item_t *item, void *decoded);
+static void workers_start(int n);
+static void workers_stop();
+static void workers_ensure(kl_resource_loader_t *loader);
+static bool off_main_thread(kl_resource_loader_t *loader);
+static void stripes_init();
+static resource_stripe_t* item_stripe(kl_resource_item_t *item);
+static resource_stripe_t* item_lock(kl_resource_item_t *item);
+static int  item_state(kl_resource_item_t *item);
+static int  item_refs(kl_resource_item_t *item);
+static kl_resource_item_t* item_acquire(kl_resource_loader_t *loader, const char *vpath, resource_stripe_t **stripe);
+static void item_put(kl_resource_item_t *item);
+static void* item_release(kl_resource_item_t *item, kl_resources_free_cb *freecb);
+static bool item_queue(kl_resource_item_t *item);
+static bool item_claim(kl_resource_item_t *item, resource_stripe_t *stripe);
+static void item_finish(kl_resource_item_t *item, resource_stripe_t *stripe);
+static void item_settle(kl_resource_item_t *item);
+static void* item_decode(kl_resource_item_t *item, kl_resource_blob_t *preread);
+static void item_load(kl_resource_item_t *item);
+static void item_finalize(kl_resource_item_t *item);
+static void item_discard(kl_resource_item_t *item);
+static void* item_unload(kl_resource_item_t *item, kl_resources_free_cb *freecb);
+static bool lru_contains(kl_resource_item_t *item);
+static void lru_push(kl_resource_item_t *item);
+static void lru_remove(kl_resource_item_t *item);
+static bool lru_take(kl_resource_item_t *item);
+static void lru_account(kl_resource_item_t *item, int sign);
+static void lru_evict();
+static double now_ms();
+static void item_record(kl_resource_item_t *item, bool ok);
+static const char* loader_name(kl_resource_loader_t *loader);
+static kl_resource_stats_t loader_stats(kl_resource_loader_t *loader);
+static void collect_slowest(kl_array_t *items);
+static int  compare_load_ms(const void *a, const void *b);
+static void json_string(FILE *out, const char *str);
+
+kl_resource_id_t kl_resource_getid(const char *str) {
+  /* FNV-1a over the normalized path, then a murmur3 finalizer to mix the low bits used for indexing */
+  kl_resource_id_t h = 0xcbf29ce484222325ULL;
   char p = '\0';
   for (int i=0; str[i] != '\0'; i++) {
-    char c = str[i];
-    /* case-insensitivity */
-    if (c >= 'A' && c <= 'Z') {
-      c |= 0x20;
-    }
-    /* normalize path separators */
-    if (c == '\\') {
-      c = '/';
-    }
+    char c = path_normchar(str[i]);
     /* skip duplicate path separators */
     if (c == '/' && p == '/') {
       continue;
     }
+    p = c;
 
-    h ^= str[i];
-    h  = (h << 11) | (h >> 53); /* shift of 11 bits is coprime to 64 */
+    h ^= (uint8_t)c;
+    h *= 0x100000001b3ULL;
   }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
   return h;
 }
 
-bool kl_resource_exists(kl_resource_id_t resid) {
-  kl_resource_id_t bucket = resid % KL_RESOURCE_BUCKETS;
-  kl_resource_item_t *first = resource_cache.buckets[bucket];
-  kl_resource_item_t *curr;
+uint64_t kl_resource_blob_hash(const kl_resource_blob_t *blob) {
+  if (blob->data == NULL || blob->size == 0) return 0;
+
+  /* a word at a time, then the same finalizer as kl_resource_getid */
+  uint64_t h = 0xcbf29ce484222325ULL ^ blob->size;
+  size_t i = 0;
+  for (; i + 8 <= blob->size; i += 8) {
+    uint64_t w;
+    memcpy(&w, blob->data + i, 8);
+    h ^= w * 0x87c37b91114253d5ULL;
+    h  = ((h << 27) | (h >> 37)) * 0x4cf5ad432745937fULL;
+  }
+  for (; i < blob->size; i++) {
+    h ^= blob->data[i];
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h == 0 ? 1 : h;
+}
+
+uint64_t kl_resource_blob_check(const kl_resource_blob_t *blob) {
+  if (blob->data == NULL || blob->size == 0) return 0;
+
+  /* xxh64's rounds and primes, nothing in common with kl_resource_blob_hash but the word size */
+  uint64_t h = 0x27d4eb2f165667c5ULL + blob->size;
+  size_t i = 0;
+  for (; i + 8 <= blob->size; i += 8) {
+    uint64_t w;
+    memcpy(&w, blob->data + i, 8);
+    w *= 0xc2b2ae3d27d4eb4fULL;
+    w  = ((w << 31) | (w >> 33)) * 0x9e3779b185ebca87ULL;
+    h ^= w;
+    h  = ((h << 27) | (h >> 37)) * 0x9e3779b185ebca87ULL + 0x85ebca77c2b2ae63ULL;
+  }
+  for (; i < blob->size; i++) {
+    h ^= blob->data[i] * 0x27d4eb2f165667c5ULL;
+    h  = ((h << 11) | (h >> 53)) * 0x9e3779b185ebca87ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xc2b2ae3d27d4eb4fULL;
+  h ^= h >> 29;
+  h *= 0x165667b19e3779f9ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+bool kl_resource_exists(const char *vpath) {
+  return kl_resource_find(vpath) != NULL;
+}
+
+kl_resource_item_t* kl_resource_find(const char *vpath) {
+  pthread_rwlock_rdlock(&table_lock);
+  int i = table_find(kl_resource_getid(vpath), vpath);
+  kl_resource_item_t *item = i >= 0 ? resource_cache.slots[i].item : NULL;
+  pthread_rwlock_unlock(&table_lock);
+  return item;
+}
+
+int kl_resource_add_entry(const char *path, const char *vpath) {
+  return insert_entry(path, vpath, kl_resource_getid(vpath), NULL, NULL) != NULL ? 0 : -1;
+}
+
+int kl_resource_add_pak(const char *path) {
+  kl_pak_t *pak = kl_pak_open(path);
+  if (pak == NULL) return -1;
+
+  /* ids are precomputed, so registering an entry is just a table insert */
+  for (uint32_t i=0; i < pak->header->num_entries; i++) {
+    kl_pak_entry_t *entry = pak->entries + i;
+    char *vpath = kl_pak_vpath(pak, entry);
+    insert_entry(pak->path, vpath, entry->resid, pak, entry); /* fails if shadowed by an earlier entry */
+  }
+  return 0;
+}
+
+void *kl_resource_mapfile(const char *path, size_t *size) {
+#ifndef _WIN32
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat s;
+  void *data = NULL;
+  if (fstat(fd, &s) == 0 && s.st_size > 0) {
+    data = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) data = NULL;
+    *size = s.st_size;
+  }
+  close(fd); /* the mapping keeps the file open */
+  return data;
+#else
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long n = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  void *data = NULL;
+  if (n > 0) {
+    data = kl_mem_alloc(KL_MEM_RESOURCE, n);
+    if (fread(data, 1, n, file) != n) {
+      kl_mem_free(KL_MEM_RESOURCE, data);
+      data = NULL;
+    }
+    *size = n;
+  }
+  fclose(file);
+  return data;
+#endif
+}
+
+void kl_resource_unmapfile(void *data, size_t size) {
+  if (data == NULL) return;
+#ifndef _WIN32
+  munmap(data, size);
+#else
+  kl_mem_free(KL_MEM_RESOURCE, data);
+#endif
+}
+
+int kl_resource_remove_entry(const char *vpath) {
+  pthread_rwlock_wrlock(&table_lock);
+  int i = table_find(kl_resource_getid(vpath), vpath);
+  if (i < 0) {
+    pthread_rwlock_unlock(&table_lock);
+    return -1;
+  }
+  kl_resource_item_t *item = resource_cache.slots[i].item;
+  resource_stripe_t *stripe = item_lock(item);
+  pthread_mutex_lock(&queue_lock);
+  bool pumping = item->pumping;
+  pthread_mutex_unlock(&queue_lock);
+  if (pumping || item_refs(item) > 0 || item->state == KL_RESOURCE_PENDING || item->state == KL_RESOURCE_DECODED) {
+    pthread_mutex_unlock(&stripe->lock);
+    pthread_rwlock_unlock(&table_lock);
+    return -1;
+  }
+  /* unreferenced and loaded is normally cached, but don't count on it */
+  kl_resources_free_cb freecb = NULL;
+  void *data = NULL;
+  if (item->state == KL_RESOURCE_LOADED) {
+    lru_take(item);
+    data = item_unload(item, &freecb);
+  }
+  table_remove(i);
+  pthread_mutex_unlock(&stripe->lock);
+  pthread_rwlock_unlock(&table_lock);
+
+  if (data != NULL) freecb(data);
+  kl_mem_free(KL_MEM_RESOURCE, item);
+  return 0;
+}
+
+int kl_resource_remove_dir(const char *vpath) {
+  int n = strlen(vpath);
+  kl_array_t vpaths;
+  kl_array_vpath_init(&vpaths);
+
+  /* collect first, removal shifts entries around in the table */
+  pthread_rwlock_rdlock(&table_lock);
+  for (uint32_t i=0; resource_cache.slots != NULL && i <= resource_cache.mask; i++) {
+    kl_resource_item_t *item = resource_cache.slots[i].item;
+    if (item == NULL) continue;
+    if (strncmp(item->vpath, vpath, n) == 0 && item->vpath[n] == '/') {
+      kl_array_vpath_push(&vpaths, item->vpath);
+    }
+  }
+  pthread_rwlock_unlock(&table_lock);
+
+  int err = 0;
+  for (int i=0; i < kl_array_size(&vpaths); i++) {
+    const char *itemvpath = kl_array_vpath_data(&vpaths)[i];
+    if (kl_resource_remove_entry(itemvpath) < 0) {
+      fprintf(stderr, "Resource Manager: Can't remove %s, it's still in use\n", itemvpath);
+      err = -1;
+    }
+  }
+
+  kl_array_free(&vpaths);
+  return err;
+}
+
+int kl_resource_scan_dir(const char *path, const char *vpath) {
+  kl_manifest_t old, manifest;
+  kl_manifest_init(&old);
+  kl_manifest_init(&manifest);
+
+  bool changed = true;
+  int err = scan_dir(&old, -1, &manifest, path, vpath, &changed);
+
+  kl_manifest_free(&old);
+  kl_manifest_free(&manifest);
+  return err < 0 ? -1 : 0;
+}
+
+int kl_resource_add_dir(const char *path, const char *vpath) {
+  /* the manifest lives next to the directory, writing it inside would change the directory's mtime */
+  char manifestpath[KL_RESITEM_PATHLEN];
+  int n = strlen(path);
+  while (n > 1 && (path[n-1] == '/' || path[n-1] == '\\')) n--;
+  if (snprintf(manifestpath, KL_RESITEM_PATHLEN, "%.*s.kidx", n, path) >= KL_RESITEM_PATHLEN) {
+    fprintf(stderr, "Resource Manager: Path too long: %s\n", path);
+    return -1;
+  }
+
+  kl_manifest_t old, manifest;
+  kl_manifest_init(&old);
+  kl_manifest_init(&manifest);
+
+  bool changed = kl_manifest_load(&old, manifestpath, vpath) < 0;
+  int err = scan_dir(&old, changed ? -1 : 0, &manifest, path, vpath, &changed);
+  if (err >= 0 && changed) {
+    kl_manifest_write(&manifest, manifestpath, vpath);
+  }
+
+  kl_manifest_free(&old);
+  kl_manifest_free(&manifest);
+  return err < 0 ? -1 : 0;
+}
+
+kl_resource_loader_t* kl_resource_loader_new(kl_resources_load_cb load, kl_resources_free_cb free) {
+  static int type = 0;
+  kl_resource_loader_t *loader = kl_mem_alloc(KL_MEM_RESOURCE, sizeof(kl_resource_loader_t));
+  loader->type    = __atomic_fetch_add(&type, 1, __ATOMIC_RELAXED);
+  loader->name    = NULL;
+  loader->load    = load;
+  loader->free    = free;
+  loader->decode  = NULL;
+  loader->upload  = NULL;
+  loader->discard = NULL;
+  loader->size    = NULL;
+  loader->reload  = NULL;
+  loader->deps    = NULL;
+  loader->main_thread = false;
+  loader->stats   = (kl_resource_stats_t){ .loads = 0 };
+
+  pthread_mutex_lock(&loader_lock);
+  if (loaders.item_size == 0) {
+    kl_array_loader_init(&loaders);
+  }
+  kl_array_loader_push(&loaders, loader);
+  pthread_mutex_unlock(&loader_lock);
+  return loader;
+}
+
+kl_resource_loader_t* kl_resource_loader_new_async(kl_resources_decode_cb decode, kl_resources_upload_cb upload, kl_resources_free_cb discard, kl_resources_free_cb free) {
+  kl_resource_loader_t *loader = kl_resource_loader_new(NULL, free);
+  loader->decode  = decode;
+  loader->upload  = upload;
+  loader->discard = discard;
+  return loader;
+}
+
+void *kl_resource_incref(kl_resource_loader_t *loader, const char *vpath) {
+  bool deferred = off_main_thread(loader);
+  if (deferred) workers_ensure(loader);
+
+  resource_stripe_t *stripe;
+  kl_resource_item_t *curr = item_acquire(loader, vpath, &stripe);
+  if (curr == NULL) return NULL;
+
+  if (deferred) {
+    /* the main thread's kl_resource_pump finishes it, wherever it's got to */
+    item_queue(curr);
+    while (curr->state != KL_RESOURCE_LOADED && curr->state != KL_RESOURCE_FAILED) {
+      pthread_cond_wait(&stripe->cond, &stripe->lock);
+    }
+  } else if (item_claim(curr, stripe)) {
+    item_finish(curr, stripe);
+  }
+  void *item = curr->state == KL_RESOURCE_LOADED ? curr->item : NULL;
+  pthread_mutex_unlock(&stripe->lock);
+
+  if (item == NULL) {
+    item_put(curr); /* failed, don't keep it referenced */
+  }
+  lru_evict();
+  return item;
+}
+
+kl_resource_item_t* kl_resource_incref_async(kl_resource_loader_t *loader, const char *vpath) {
+  workers_ensure(loader);
+
+  resource_stripe_t *stripe;
+  kl_resource_item_t *curr = item_acquire(loader, vpath, &stripe);
+  if (curr == NULL) return NULL;
+
+  item_queue(curr);
+  pthread_mutex_unlock(&stripe->lock);
+  return curr;
+}
+
+void kl_resource_prefetch(kl_resource_loader_t *loader, const char *vpath) {
+  workers_ensure(loader);
+
+  resource_stripe_t *stripe;
+  kl_resource_item_t *curr = item_acquire(loader, vpath, &stripe);
+  if (curr == NULL) return;
+
+  /* the reference is handed over to the load, which drops it in item_settle */
+  bool queued = item_queue(curr);
+  if (queued) curr->prefetch = true;
+  pthread_mutex_unlock(&stripe->lock);
+
+  if (!queued) item_put(curr); /* already loaded or on its way */
+}
+
+void *kl_resource_get(kl_resource_item_t *handle) {
+  if (handle == NULL || item_state(handle) != KL_RESOURCE_LOADED) return NULL;
+  return handle->item;
+}
+
+void kl_resource_decref(const char *vpath) {
+  kl_resource_item_t *curr = kl_resource_find(vpath);
+  if (curr == NULL) return;
+  item_put(curr);
+}
+
+int kl_resource_reload(const char *vpath) {
+  /* locked before the table lock is dropped, like item_acquire, or it could be removed underneath */
+  pthread_rwlock_rdlock(&table_lock);
+  int i = table_find(kl_resource_getid(vpath), vpath);
+  kl_resource_item_t *curr = i >= 0 ? resource_cache.slots[i].item : NULL;
+  resource_stripe_t *stripe = curr != NULL ? item_lock(curr) : NULL;
+  pthread_rwlock_unlock(&table_lock);
+  if (curr == NULL) return -1;
+
+  if (lru_take(curr)) {
+    /* nobody's using it, just load it fresh next time */
+    kl_resources_free_cb freecb;
+    void *data = item_unload(curr, &freecb);
+    pthread_mutex_unlock(&stripe->lock);
+    freecb(data);
+    return 0;
+  }
+  if (curr->state == KL_RESOURCE_PENDING || curr->state == KL_RESOURCE_DECODED) {
+    /* may have been read already, item_finish loads it again */
+    curr->stale = true;
+    pthread_mutex_unlock(&stripe->lock);
+    return 0;
+  }
+  if (curr->state != KL_RESOURCE_LOADED) {
+    pthread_mutex_unlock(&stripe->lock);
+    return 0;
+  }
+
+  kl_resource_loader_t *loader = curr->loader;
+  assert(!off_main_thread(loader));
+  if (loader->reload == NULL) {
+    pthread_mutex_unlock(&stripe->lock);
+    fprintf(stderr, "Resource Manager: %s changed, but it can't be reloaded while in use\n", vpath);
+    return -1;
+  }
+  /* held until the swap is done, so it can't be unloaded underneath */
+  __atomic_add_fetch(&curr->refs, 1, __ATOMIC_ACQ_REL);
+  pthread_mutex_unlock(&stripe->lock);
+
+  pthread_mutex_lock(&reload_lock);
+  double start = now_ms();
+  void *fresh;
+  if (loader->decode == NULL) {
+    fresh = loader->load(curr->path, curr->vpath);
+  } else {
+    void *decoded = item_decode(curr, NULL);
+    fresh = decoded != NULL ? loader->upload(decoded, curr->path, curr->vpath) : NULL;
+  }
+  if (fresh == NULL) {
+    fprintf(stderr, "Resource Manager: Failed to reload %s, keeping the old version\n", vpath);
+    item_record(curr, false);
+    pthread_mutex_unlock(&reload_lock);
+    item_put(curr);
+    return -1;
+  }
+
+  loader->reload(curr->item, fresh);
+  if (loader->size != NULL) {
+    lru_account(curr, -1);
+    loader->size(curr->item, &curr->cpu_bytes, &curr->gpu_bytes);
+    lru_account(curr, 1);
+  }
+  if (loader->decode == NULL) curr->bytes_read = 0;
+  curr->load_ms = now_ms() - start;
+  pthread_mutex_lock(&loader_lock);
+  loader->stats.reloads++;
+  pthread_mutex_unlock(&loader_lock);
+  item_record(curr, true);
+  pthread_mutex_unlock(&reload_lock);
+  item_put(curr);
+  lru_evict();
+  return 0;
+}
+
+int kl_resource_pump(float budget_ms) {
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  kl_resource_watch_poll();
+
+  int n = 0;
+  for (;;) {
+    pthread_mutex_lock(&queue_lock);
+    kl_resource_item_t *curr = queue_pop(&done);
+    if (curr != NULL) curr->pumping = true; /* or it could be released and removed before it's locked */
+    pthread_mutex_unlock(&queue_lock);
+    if (curr == NULL) break;
+
+    resource_stripe_t *stripe = item_lock(curr);
+    pthread_mutex_lock(&queue_lock);
+    curr->pumping = false;
+    pthread_mutex_unlock(&queue_lock);
+    if (curr->state == KL_RESOURCE_DECODED && off_main_thread(curr->loader)) {
+      /* put back for the main thread, and leave the rest to it too rather than going round in circles */
+      pthread_mutex_lock(&queue_lock);
+      queue_push(&done, curr);
+      pthread_mutex_unlock(&queue_lock);
+      pthread_mutex_unlock(&stripe->lock);
+      break;
+    }
+    kl_resources_free_cb freecb = NULL;
+    void *data = NULL;
+    if (curr->state != KL_RESOURCE_DECODED) {
+      /* already finished by a thread waiting on it */
+    } else if (item_refs(curr) <= 0) {
+      /* released while in flight */
+      data = item_release(curr, &freecb);
+    } else {
+      if (item_claim(curr, stripe)) {
+        item_finish(curr, stripe);
+        n++;
+      }
+      /* only prefetched, it goes straight to the cache */
+      if (item_refs(curr) <= 0) data = item_release(curr, &freecb);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    if (data != NULL) freecb(data);
+    lru_evict();
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    float elapsed = (now.tv_sec - start.tv_sec) * 1000.0f + (now.tv_nsec - start.tv_nsec) / 1000000.0f;
+    if (elapsed >= budget_ms) break;
+  }
+  return n;
+}
+
+void kl_resource_set_main_thread() {
+  main_thread = pthread_self();
+  __atomic_store_n(&main_thread_set, true, __ATOMIC_RELEASE);
+}
+
+void kl_resource_set_budget(size_t cpu, size_t gpu) {
+  pthread_mutex_lock(&lru_lock);
+  resource_lru.cpu_budget = cpu;
+  resource_lru.gpu_budget = gpu;
+  pthread_mutex_unlock(&lru_lock);
+  lru_evict();
+}
+
+void kl_resource_set_workers(int n) {
+  pthread_mutex_lock(&pool_lock);
+  workers_stop();
+  workers_start(n);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+void kl_resource_shutdown() {
+  pthread_mutex_lock(&pool_lock);
+  workers_stop();
+  pthread_mutex_unlock(&pool_lock);
+}
+
+void kl_resource_dump(FILE *out, int topn) {
+  fprintf(out, "Resource: %-10s %8s %6s %8s %8s %7s %10s %9s %12s %12s\n",
+    "loader", "loads", "fail", "hits", "misses", "reload", "total ms", "max ms", "read", "uploaded");
+  pthread_mutex_lock(&loader_lock);
+  for (int i=0; i < kl_array_size(&loaders); i++) {
+    kl_resource_loader_t *loader = kl_array_loader_data(&loaders)[i];
+    kl_resource_stats_t stats = loader_stats(loader), *s = &stats;
+    fprintf(out, "Resource: %-10s %8" PRIu64 " %6" PRIu64 " %8" PRIu64 " %8" PRIu64 " %7" PRIu64 " %10.2f %9.2f %12" PRIu64 " %12" PRIu64 "\n",
+      loader_name(loader), s->loads, s->failures, s->hits, s->misses, s->reloads, s->total_ms, s->max_ms, s->bytes_read, s->bytes_uploaded);
+  }
+  pthread_mutex_unlock(&loader_lock);
 
-  for (curr = first; curr != NULL; curr = curr->next) {
-    if (curr->resid == resid) {
+  kl_array_t items;
+  collect_slowest(&items);
+  int n = kl_array_size(&items) < topn ? kl_array_size(&items) : topn;
+  double now = now_ms();
+  fprintf(out, "Resource: %d slowest of %d loaded:\n", n, kl_array_size(&items));
+  for (int i=0; i < n; i++) {
+    item_snapshot_t *item = kl_array_snapshot_data(&items) + i;
+    fprintf(out, "Resource: %9.2f ms %12zu bytes %8.1f s ago  %-10s %s\n",
+      item->load_ms, item->bytes_read, (now - item->loaded_at) / 1000.0, item->loader, item->vpath);
+  }
+  kl_array_free(&items);
+}
+
+void kl_resource_dump_json(FILE *out, int topn) {
+  fprintf(out, "{\n  \"loaders\": [");
+  pthread_mutex_lock(&loader_lock);
+  for (int i=0; i < kl_array_size(&loaders); i++) {
+    kl_resource_loader_t *loader = kl_array_loader_data(&loaders)[i];
+    kl_resource_stats_t stats = loader_stats(loader), *s = &stats;
+    fprintf(out, "%s\n    { \"name\": ", i > 0 ? "," : "");
+    json_string(out, loader_name(loader));
+    fprintf(out, ", \"loads\": %" PRIu64 ", \"failures\": %" PRIu64 ", \"hits\": %" PRIu64 ", \"misses\": %" PRIu64
+      ", \"reloads\": %" PRIu64 ", \"total_ms\": %.3f, \"max_ms\": %.3f, \"bytes_read\": %" PRIu64 ", \"bytes_uploaded\": %" PRIu64 " }",
+      s->loads, s->failures, s->hits, s->misses, s->reloads, s->total_ms, s->max_ms, s->bytes_read, s->bytes_uploaded);
+  }
+  pthread_mutex_unlock(&loader_lock);
+  fprintf(out, "\n  ],\n  \"slowest\": [");
+
+  kl_array_t items;
+  collect_slowest(&items);
+  int n = kl_array_size(&items) < topn ? kl_array_size(&items) : topn;
+  double now = now_ms();
+  for (int i=0; i < n; i++) {
+    item_snapshot_t *item = kl_array_snapshot_data(&items) + i;
+    fprintf(out, "%s\n    { \"vpath\": ", i > 0 ? "," : "");
+    json_string(out, item->vpath);
+    fprintf(out, ", \"loader\": ");
+    json_string(out, item->loader);
+    fprintf(out, ", \"packed\": %s, \"load_ms\": %.3f, \"age_ms\": %.0f, \"bytes_read\": %zu, \"cpu_bytes\": %zu, \"gpu_bytes\": %zu }",
+      item->packed ? "true" : "false", item->load_ms, now - item->loaded_at, item->bytes_read, item->cpu_bytes, item->gpu_bytes);
+  }
+  kl_array_free(&items);
+  fprintf(out, "\n  ]\n}\n");
+}
+
+void kl_resource_printall() {
+  pthread_rwlock_rdlock(&table_lock);
+  for (uint32_t i=0; resource_cache.slots != NULL && i <= resource_cache.mask; i++) {
+    kl_resource_item_t *item = resource_cache.slots[i].item;
+    if (item == NULL) continue;
+    resource_stripe_t *stripe = item_lock(item);
+    fprintf(stderr, "Resource: %016" PRIx64 " %-8s refs %-3d %-10s %8.2f ms  %s -> %s\n",
+      item->resid, state_names[item->state], item_refs(item), item->loader != NULL ? loader_name(item->loader) : "-",
+      item->load_ms, item->vpath, item->pak != NULL ? item->pak->path : item->path);
+    pthread_mutex_unlock(&stripe->lock);
+  }
+  pthread_rwlock_unlock(&table_lock);
+}
+
+void kl_resource_strip_extension(char *path) {
+  int n = strlen(path);
+  for (int i = n-1; i >= 0; i--) {
+    if (path[i] == '/' || path[i] == '\\' || path[i] == '|') { /* stop at last path separator */
+      break;
+    }
+    if (path[i] == '.') {
+      path[i] = '\0';
+      break;
+    }
+  }
+}
+
+/* ------------------------ */
+static void queue_push(resource_queue_t *queue, kl_resource_item_t *item) {
+  if (queue->items.item_size == 0) {
+    kl_array_item_init(&queue->items);
+  }
+  kl_array_item_push(&queue->items, item);
+}
+
+static kl_resource_item_t* queue_pop(resource_queue_t *queue) {
+  while (queue->head < kl_array_size(&queue->items)) {
+    kl_resource_item_t *item = kl_array_item_data(&queue->items)[queue->head++];
+    if (item != NULL) return item;
+  }
+  /* drained, reuse the storage from the start */
+  kl_array_clear(&queue->items);
+  queue->head = 0;
+  return NULL;
+}
+
+static bool queue_remove(resource_queue_t *queue, kl_resource_item_t *item) {
+  for (int i = queue->head; i < kl_array_size(&queue->items); i++) {
+    kl_resource_item_t **slot = kl_array_item_at(&queue->items, i);
+    if (*slot == item) {
+      *slot = NULL;
       return true;
     }
   }
   return false;
 }
 
-int kl_resource_add_entry(char *path, char *vpath) {
-  kl_resource_id_t resid = kl_resource_getid(vpath);
-  if (kl_resource_exists(resid)) return -1; /* possible hash collision */
+static void* worker_main(void *arg) {
+  kl_resource_item_t *batch[KL_IO_BATCH];
+  kl_io_read_t        reads[KL_IO_BATCH];
+  kl_resource_blob_t  blobs[KL_IO_BATCH];
+
+  pthread_mutex_lock(&queue_lock);
+  for (;;) {
+    int n = 0;
+    int max = worker_batch();
+    kl_resource_item_t *item;
+    while (n < max && (item = queue_pop(&jobs)) != NULL) {
+      batch[n++] = item;
+    }
+    if (n == 0) {
+      if (quit) break;
+      pthread_cond_wait(&jobs_cond, &queue_lock);
+      continue;
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    /* path, vpath and loader don't change while an item is pending -- loose files are read in one go, paks are mapped already,
+     * and with KL_IO_MMAP each decode maps its own file */
+    bool preread = kl_io_backend() != KL_IO_MMAP;
+    int nreads = 0;
+    for (int i=0; i < n; i++) {
+      if (preread && batch[i]->pak == NULL && batch[i]->path[0] != '\0') {
+        reads[nreads++].path = batch[i]->path;
+      }
+    }
+    if (nreads > 0) kl_io_read_batch(reads, nreads);
+
+    for (int i=0, j=0; i < n; i++) {
+      kl_resource_blob_t *blob = NULL;
+      if (j < nreads && reads[j].path == batch[i]->path) {
+        kl_io_read_t *read = &reads[j++];
+        if (read->buf != NULL) {
+          blob = &blobs[i];
+          blob->data   = read->buf;
+          blob->size   = read->size;
+          blob->buf    = read->buf;
+          blob->mapped = 0;
+        }
+      }
+      worker_publish(batch[i], item_decode(batch[i], blob));
+    }
+    pthread_mutex_lock(&queue_lock);
+  }
+  pthread_mutex_unlock(&queue_lock);
+  return NULL;
+}
+
+/* queue_lock held -- how many jobs to take at once, an even share so the others aren't left idle */
+static int worker_batch() {
+  if (kl_io_backend() == KL_IO_MMAP) return 1;
+  int queued  = kl_array_size(&jobs.items) - jobs.head;
+  int workers = __atomic_load_n(&num_workers, __ATOMIC_RELAXED);
+  int n = workers > 0 ? (queued + workers - 1) / workers : queued;
+  if (n < 1) n = 1;
+  if (n > KL_IO_BATCH) n = KL_IO_BATCH;
+  return n;
+}
 
-  int bucket = resid % KL_RESOURCE_BUCKETS;
+static void worker_publish(kl_resource_item_t *item, void *decoded) {
+  resource_stripe_t *stripe = item_lock(item);
+  item->decoded = decoded;
+  __atomic_store_n(&item->state, KL_RESOURCE_DECODED, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&queue_lock);
+  queue_push(&done, item);
+  pthread_cond_broadcast(&stripe->cond);
+  pthread_mutex_unlock(&stripe->lock);
+  pthread_mutex_unlock(&queue_lock);
+}
+
+static void workers_start(int n) {
+  if (n < 1) n = 1;
+
+  pthread_t *threads = kl_mem_alloc(KL_MEM_RESOURCE, n * sizeof(pthread_t));
+  for (int i=0; i < n; i++) {
+    if (pthread_create(&threads[num_workers], NULL, &worker_main, NULL) != 0) {
+      fprintf(stderr, "Resource Manager: Failed to start worker thread!\n");
+      break;
+    }
+    __atomic_add_fetch(&num_workers, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&workers, threads, __ATOMIC_RELEASE);
+}
+
+static void workers_stop() {
+  if (workers == NULL) return;
+
+  pthread_mutex_lock(&queue_lock);
+  quit = true;
+  pthread_cond_broadcast(&jobs_cond);
+  pthread_mutex_unlock(&queue_lock);
+
+  for (int i=0; i < num_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  kl_mem_free(KL_MEM_RESOURCE, workers);
+  __atomic_store_n(&workers, NULL, __ATOMIC_RELEASE);
+  __atomic_store_n(&num_workers, 0, __ATOMIC_RELAXED);
+  quit        = false;
+}
+
+static void workers_ensure(kl_resource_loader_t *loader) {
+  if (loader->decode == NULL || __atomic_load_n(&workers, __ATOMIC_ACQUIRE) != NULL) return;
+  pthread_mutex_lock(&pool_lock);
+  if (workers == NULL) workers_start(KL_RESOURCE_WORKERS);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+static bool off_main_thread(kl_resource_loader_t *loader) {
+  return loader->main_thread && __atomic_load_n(&main_thread_set, __ATOMIC_ACQUIRE) && !pthread_equal(pthread_self(), main_thread);
+}
+
+static void stripes_init() {
+  for (int i=0; i < RESOURCE_STRIPES; i++) {
+    pthread_mutex_init(&stripes[i].lock, NULL);
+    pthread_cond_init(&stripes[i].cond, NULL);
+  }
+}
 
-  kl_resource_item_t *item = malloc(sizeof(kl_resource_item_t));
-  strncpy(item->path, path, KL_RESITEM_PATHLEN);
-  strncpy(item->vpath, vpath, KL_RESITEM_PATHLEN);
-  item->resid  = resid;
-  item->refs   = 0;
+static resource_stripe_t* item_stripe(kl_resource_item_t *item) {
+  pthread_once(&stripes_once, &stripes_init);
+  return &stripes[item->resid & (RESOURCE_STRIPES-1)];
+}
+
+static resource_stripe_t* item_lock(kl_resource_item_t *item) {
+  resource_stripe_t *stripe = item_stripe(item);
+  pthread_mutex_lock(&stripe->lock);
+  return stripe;
+}
+
+static int item_state(kl_resource_item_t *item) {
+  /* for peeking without the stripe lock -- the value may be stale by the time it's used */
+  return __atomic_load_n(&item->state, __ATOMIC_ACQUIRE);
+}
+
+static int item_refs(kl_resource_item_t *item) {
+  /* decrements don't take the stripe lock unless they reach zero */
+  return __atomic_load_n(&item->refs, __ATOMIC_ACQUIRE);
+}
+
+/* looks up and references an item, returning with its stripe locked -- NULL if it doesn't exist or belongs to another loader */
+static kl_resource_item_t* item_acquire(kl_resource_loader_t *loader, const char *vpath, resource_stripe_t **stripe) {
+  /* the table lock keeps the entry from being removed until it's referenced */
+  pthread_rwlock_rdlock(&table_lock);
+  int i = table_find(kl_resource_getid(vpath), vpath);
+  kl_resource_item_t *item = i >= 0 ? resource_cache.slots[i].item : NULL;
+  if (item != NULL) {
+    *stripe = item_lock(item);
+    if (item->loader != NULL && item->loader->type != loader->type) {
+      pthread_mutex_unlock(&(*stripe)->lock);
+      item = NULL;
+    }
+  }
+  pthread_rwlock_unlock(&table_lock);
+  if (item == NULL) return NULL;
+
+  if (__atomic_fetch_add(&item->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    lru_take(item); /* revived without reloading */
+  }
+  if (item->state == KL_RESOURCE_UNLOADED || item->state == KL_RESOURCE_FAILED) {
+    item->loader = loader;
+    __atomic_add_fetch(&loader->stats.misses, 1, __ATOMIC_RELAXED);
+  } else {
+    __atomic_add_fetch(&loader->stats.hits, 1, __ATOMIC_RELAXED);
+  }
+  return item;
+}
+
+/* drops a reference, without a lock unless it's the last one -- that one goes with the stripe locked,
+ * along with the release, or kl_resource_remove_entry could free the item in between */
+static void item_put(kl_resource_item_t *item) {
+  int refs = item_refs(item);
+  while (refs > 1) {
+    if (__atomic_compare_exchange_n(&item->refs, &refs, refs - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+  }
+
+  resource_stripe_t *stripe = item_lock(item);
+  refs = __atomic_sub_fetch(&item->refs, 1, __ATOMIC_ACQ_REL);
+  assert(refs >= 0);
+  kl_resources_free_cb freecb = NULL;
+  void *data = NULL;
+  if (refs == 0) data = item_release(item, &freecb);
+  pthread_mutex_unlock(&stripe->lock);
+
+  if (data != NULL) freecb(data);
+  lru_evict();
+}
+
+/* lets go of an unreferenced item, stripe locked -- returns what the caller has to free once it's unlocked */
+static void* item_release(kl_resource_item_t *item, kl_resources_free_cb *freecb) {
+  switch (item->state) {
+    case KL_RESOURCE_LOADED:
+      if (item->loader->size == NULL) {
+        return item_unload(item, freecb);
+      }
+      pthread_mutex_lock(&lru_lock);
+      if (!lru_contains(item)) lru_push(item);
+      pthread_mutex_unlock(&lru_lock);
+      return NULL;
+    case KL_RESOURCE_DECODED:
+      pthread_mutex_lock(&queue_lock);
+      queue_remove(&done, item);
+      pthread_mutex_unlock(&queue_lock);
+      item_discard(item);
+      break;
+    case KL_RESOURCE_PENDING:
+      return NULL; /* dealt with by whoever finishes it */
+  }
+  __atomic_store_n(&item->state, KL_RESOURCE_UNLOADED, __ATOMIC_RELEASE);
   item->loader = NULL;
-  item->item   = NULL;
-  item->next   = resource_cache.buckets[bucket];
-  resource_cache.buckets[bucket] = item;
-  return 0;
+  return NULL;
 }
 
-static int listdir(char *path, kl_array_t *items) {
+/* queues an unloaded or failed item for loading, stripe locked -- returns false if it's already loaded or on its way */
+static bool item_queue(kl_resource_item_t *item) {
+  if (item->state != KL_RESOURCE_UNLOADED && item->state != KL_RESOURCE_FAILED) return false;
+
+  pthread_mutex_lock(&queue_lock);
+  if (item->loader->decode == NULL) {
+    /* nothing to do off-thread, so the whole load happens in kl_resource_pump */
+    __atomic_store_n(&item->state, KL_RESOURCE_DECODED, __ATOMIC_RELEASE);
+    queue_push(&done, item);
+  } else {
+    __atomic_store_n(&item->state, KL_RESOURCE_PENDING, __ATOMIC_RELEASE);
+    queue_push(&jobs, item);
+    pthread_cond_signal(&jobs_cond);
+  }
+  pthread_mutex_unlock(&queue_lock);
+  return true;
+}
+
+/* waits out loads in flight, stripe locked -- returns true if the item still has to be loaded or finalized,
+ * in which case it's left PENDING for the caller to item_finish */
+static bool item_claim(kl_resource_item_t *item, resource_stripe_t *stripe) {
+  for (;;) {
+    bool stolen;
+    switch (item->state) {
+      case KL_RESOURCE_UNLOADED:
+      case KL_RESOURCE_FAILED:
+        item->decoded = NULL;
+        __atomic_store_n(&item->state, KL_RESOURCE_PENDING, __ATOMIC_RELEASE);
+        return true;
+      case KL_RESOURCE_PENDING:
+        pthread_mutex_lock(&queue_lock);
+        stolen = queue_remove(&jobs, item);
+        pthread_mutex_unlock(&queue_lock);
+        /* not picked up by a worker yet, decode it here instead */
+        if (stolen) return true;
+        pthread_cond_wait(&stripe->cond, &stripe->lock);
+        break;
+      case KL_RESOURCE_DECODED:
+        pthread_mutex_lock(&queue_lock);
+        queue_remove(&done, item);
+        pthread_mutex_unlock(&queue_lock);
+        if (item->loader->decode != NULL && item->decoded == NULL) {
+          /* the decode failed, nothing to upload */
+          __atomic_store_n(&item->state, KL_RESOURCE_FAILED, __ATOMIC_RELEASE);
+          item_record(item, false);
+          item_settle(item);
+          pthread_cond_broadcast(&stripe->cond);
+          return false;
+        }
+        __atomic_store_n(&item->state, KL_RESOURCE_PENDING, __ATOMIC_RELEASE);
+        return true;
+      default:
+        return false;
+    }
+  }
+}
+
+/* loads a claimed item, dropping the stripe lock meanwhile since the callbacks may use the resource system --
+ * over again if its file changes in the meantime */
+static void item_finish(kl_resource_item_t *item, resource_stripe_t *stripe) {
+  for (;;) {
+    /* decoded before kl_resource_reload saw the file change */
+    if (item->stale) item_discard(item);
+    item->stale = false;
+    pthread_mutex_unlock(&stripe->lock);
+    item_load(item);
+    pthread_mutex_lock(&stripe->lock);
+    if (!item->stale || item->item == NULL) break;
+
+    /* changed while loading, nobody has seen this one yet */
+    kl_resource_loader_t *loader = item->loader;
+    void *data = item->item;
+    lru_account(item, -1);
+    item->cpu_bytes = 0;
+    item->gpu_bytes = 0;
+    item->item = NULL;
+    pthread_mutex_unlock(&stripe->lock);
+    loader->free(data);
+    pthread_mutex_lock(&stripe->lock);
+  }
+  item->stale = false;
+  __atomic_store_n(&item->state, item->item != NULL ? KL_RESOURCE_LOADED : KL_RESOURCE_FAILED, __ATOMIC_RELEASE);
+  item_settle(item);
+  pthread_cond_broadcast(&stripe->cond);
+}
+
+/* drops the reference held by kl_resource_prefetch once a load is over, stripe locked --
+ * if it was the last one, the caller has to item_release the item */
+static void item_settle(kl_resource_item_t *item) {
+  if (!item->prefetch) return;
+  item->prefetch = false;
+  __atomic_sub_fetch(&item->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+/* preread is the item's contents if a worker has read them already, NULL to open them here */
+static void* item_decode(kl_resource_item_t *item, kl_resource_blob_t *preread) {
+  double start = now_ms();
+  kl_resource_blob_t blob;
+  if (preread != NULL) {
+    blob = *preread;
+  } else {
+    blob_open(item, &blob);
+  }
+  void *decoded = item->loader->decode(&blob, item->vpath);
+  item->bytes_read = blob.size;
+  blob_close(&blob);
+  /* finished off by item_finalize, which adds the upload */
+  item->load_ms = now_ms() - start;
+  if (decoded != NULL && item->loader->deps != NULL) {
+    /* get dependencies going before this one is even uploaded */
+    item->loader->deps(decoded, item->vpath);
+  }
+  return decoded;
+}
+
+static void item_load(kl_resource_item_t *item) {
+  if (item->loader->decode != NULL && item->decoded == NULL) {
+    item->decoded = item_decode(item, NULL);
+  }
+  item_finalize(item);
+}
+
+static void item_finalize(kl_resource_item_t *item) {
+  double start = now_ms();
+  kl_resource_loader_t *loader = item->loader;
+  if (loader->decode == NULL) {
+    item->load_ms    = 0.0;
+    item->bytes_read = 0;
+    item->item = loader->load(item->path, item->vpath);
+  } else if (item->decoded != NULL) {
+    item->item = loader->upload(item->decoded, item->path, item->vpath);
+  } else {
+    item->item = NULL;
+  }
+  item->decoded  = NULL;
+  item->load_ms += now_ms() - start;
+
+  if (item->item != NULL && loader->size != NULL) {
+    loader->size(item->item, &item->cpu_bytes, &item->gpu_bytes);
+    lru_account(item, 1);
+  }
+  item_record(item, item->item != NULL);
+}
+
+static void item_record(kl_resource_item_t *item, bool ok) {
+  kl_resource_stats_t *stats = &item->loader->stats;
+  pthread_mutex_lock(&loader_lock);
+  if (!ok) {
+    stats->failures++;
+  } else {
+    item->loaded_at = now_ms();
+    stats->loads++;
+    stats->total_ms += item->load_ms;
+    if (item->load_ms > stats->max_ms) stats->max_ms = item->load_ms;
+    stats->bytes_read     += item->bytes_read;
+    stats->bytes_uploaded += item->gpu_bytes;
+  }
+  pthread_mutex_unlock(&loader_lock);
+}
+
+static void item_discard(kl_resource_item_t *item) {
+  if (item->decoded != NULL && item->loader->discard != NULL) {
+    item->loader->discard(item->decoded);
+  }
+  item->decoded = NULL;
+}
+
+static kl_resource_item_t* insert_entry(const char *path, const char *vpath, kl_resource_id_t resid, struct kl_pak *pak, struct kl_pak_entry *pakentry) {
+  pthread_rwlock_wrlock(&table_lock);
+  kl_resource_item_t *item = NULL;
+  if (table_find(resid, vpath) < 0) { /* not already registered */
+    item = item_new(path, vpath, resid);
+    item->pak      = pak;
+    item->pakentry = pakentry;
+    table_insert(resid, item);
+  }
+  pthread_rwlock_unlock(&table_lock);
+  return item;
+}
+
+static int listdir(const char *path, kl_array_t *items) {
   DIR *dir = opendir(path);
   if (dir == NULL) {
     fprintf(stderr, "Resource Manager: Failed to read directory %s!\n\tDetails: %s\n", path, strerror(errno));
     return -1;
   }
-  
-  kl_array_init(items, sizeof(diritem_t));
 
+  int err = 0;
   struct dirent *ent;
   struct stat    s;
   diritem_t      item;
   while ((ent = readdir(dir)) != NULL) {
     char fullpath[KL_RESITEM_PATHLEN];
-    snprintf(fullpath, KL_RESITEM_PATHLEN, "%s/%s", path, ent->d_name);
-    fullpath[KL_RESITEM_PATHLEN-1] = '\0';
-    
-    stat(fullpath, &s);
+    if (snprintf(fullpath, KL_RESITEM_PATHLEN, "%s/%s", path, ent->d_name) >= KL_RESITEM_PATHLEN) {
+      fprintf(stderr, "Resource Manager: Path too long: %s/%s\n", path, ent->d_name);
+      err = -1;
+      break;
+    }
+
+    if (stat(fullpath, &s) < 0) continue;
     if (S_ISDIR(s.st_mode)) {
       if (strcmp(ent->d_name, "..") == 0) continue;
       if (strcmp(ent->d_name, ".") == 0) continue;
@@ -106,129 +1214,461 @@ static int listdir(char *path, kl_array_t *items) {
       strncpy(item.name, ent->d_name, KL_RESITEM_PATHLEN);
       item.name[KL_RESITEM_PATHLEN-1] = '\0';
       item.isdir = true;
+      item.size  = 0;
       kl_array_push(items, &item);
     } else if (S_ISREG(s.st_mode)) {
       strncpy(item.name, ent->d_name, KL_RESITEM_PATHLEN);
       item.name[KL_RESITEM_PATHLEN-1] = '\0';
       item.isdir = false;
+      item.size  = s.st_size;
       kl_array_push(items, &item);
     }
   }
   
   closedir(dir);
-  return 0;
+  return err;
 }
 
-int kl_resource_add_dir(char *path, char *vpath) {
+/* records a directory in the new manifest, reusing the old listing if the directory hasn't changed;
+ * returns the index of the directory record */
+static int scan_dir(kl_manifest_t *old, int olddir, kl_manifest_t *manifest, const char *path, const char *vpath, bool *changed) {
+  struct stat s;
+  if (stat(path, &s) < 0) {
+    fprintf(stderr, "Resource Manager: Failed to read directory %s!\n\tDetails: %s\n", path, strerror(errno));
+    return -1;
+  }
 
-  char *subpath   = malloc(KL_RESITEM_PATHLEN);
-  char *subvpath  = malloc(KL_RESITEM_PATHLEN);
+  kl_resource_watch_add(path, vpath);
 
+  char *subpath  = kl_mem_alloc(KL_MEM_RESOURCE, KL_RESITEM_PATHLEN);
+  char *subvpath = kl_mem_alloc(KL_MEM_RESOURCE, KL_RESITEM_PATHLEN);
+  int dir = kl_manifest_add_dir(manifest, s.st_mtime);
   int err = 0;
-  
-  kl_array_t items;
-  if (listdir(path, &items) < 0) goto cleanup;
-  diritem_t item;
-  for (int i = 0; i < kl_array_size(&items); i++) {
-    kl_array_get(&items, i, &item);
-  
-    snprintf(subpath, KL_RESITEM_PATHLEN, "%s/%s", path, item.name);
-    subpath[KL_RESITEM_PATHLEN-1] = '\0';
 
-    snprintf(subvpath, KL_RESITEM_PATHLEN, "%s/%s", vpath, item.name);
-    subvpath[KL_RESITEM_PATHLEN-1] = '\0';
+  kl_manifest_dir_t *prev = olddir >= 0 ? kl_array_mdir_at(&old->dirs, olddir) : NULL;
+  /* mtimes have a resolution of a second, so anything modified since the manifest was written may be newer than its listing */
+  bool fresh = prev != NULL && prev->mtime == s.st_mtime && s.st_mtime < old->stamp;
+  if (fresh) {
+    for (int i=0; i < prev->count; i++) {
+      kl_manifest_entry_t *entry = kl_array_mentry_at(&old->entries, prev->first + i);
+      kl_manifest_add_entry(manifest, kl_manifest_name(old, entry), entry->resid, entry->size, entry->dir >= 0);
+    }
+  } else {
+    *changed = true;
+
+    kl_array_t items;
+    kl_array_init(&items, sizeof(diritem_t));
+    kl_array_set_policy(&items, &kl_array_policy_small);
+    err = listdir(path, &items);
+    for (int i=0; err == 0 && i < kl_array_size(&items); i++) {
+      diritem_t *item = kl_array_at(&items, i);
+      kl_resource_id_t resid = 0;
+      if (!item->isdir) {
+        if (snprintf(subvpath, KL_RESITEM_PATHLEN, "%s/%s", vpath, item->name) >= KL_RESITEM_PATHLEN) {
+          fprintf(stderr, "Resource Manager: Path too long: %s/%s\n", vpath, item->name);
+          err = -1;
+          break;
+        }
+        for (int j=0; subvpath[j] != '\0'; j++) {
+          if (subvpath[j] == '|') {
+            subvpath[j] = ':';
+          }
+        }
+        resid = kl_resource_getid(subvpath);
+      }
+      kl_manifest_add_entry(manifest, item->name, resid, item->size, item->isdir);
+    }
+    kl_array_free(&items);
+  }
+
+  kl_manifest_dir_t *curr = kl_array_mdir_at(&manifest->dirs, dir);
+  int first = curr->first;
+  int count = curr->count;
+  for (int i=0; err == 0 && i < count; i++) {
+    /* the manifest grows while recursing, so don't hold on to pointers into it */
+    kl_manifest_entry_t *entry = kl_array_mentry_at(&manifest->entries, first + i);
+    char *name = kl_manifest_name(manifest, entry);
+    bool isdir = entry->dir != -1;
+    kl_resource_id_t resid = entry->resid;
+
+    /* a truncated path would register the wrong file, or under the wrong name */
+    if (snprintf(subpath, KL_RESITEM_PATHLEN, "%s/%s", path, name) >= KL_RESITEM_PATHLEN ||
+        snprintf(subvpath, KL_RESITEM_PATHLEN, "%s/%s", vpath, name) >= KL_RESITEM_PATHLEN) {
+      fprintf(stderr, "Resource Manager: Path too long: %s/%s\n", path, name);
+      err = -1;
+      break;
+    }
 
-    if (item.isdir) {
-      err = kl_resource_add_dir(subpath, subvpath);
-      if (err < 0) goto cleanup;
+    if (isdir) {
+      int oldchild = -1;
+      if (fresh) {
+        oldchild = kl_array_mentry_at(&old->entries, prev->first + i)->dir;
+      }
+      for (int j=0; !fresh && prev != NULL && j < prev->count; j++) {
+        kl_manifest_entry_t *preventry = kl_array_mentry_at(&old->entries, prev->first + j);
+        if (preventry->dir >= 0 && strcmp(kl_manifest_name(old, preventry), name) == 0) {
+          oldchild = preventry->dir;
+          break;
+        }
+      }
+      int child = scan_dir(old, oldchild, manifest, subpath, subvpath, changed);
+      if (child < 0) {
+        err = -1;
+        break;
+      }
+      kl_array_mentry_at(&manifest->entries, first + i)->dir = child;
     } else {
-      for (int i=0; i < 0x100; i++) {
-        if (subvpath[i] == '|') {
-          subvpath[i] = ':';
+      for (int j=0; subvpath[j] != '\0'; j++) {
+        if (subvpath[j] == '|') {
+          subvpath[j] = ':';
         }
       }
-      err = kl_resource_add_entry(subpath, subvpath);
-      if (err < 0) goto cleanup;
+      if (insert_entry(subpath, subvpath, resid, NULL, NULL) == NULL) err = -1;
     }
   }
 
-  cleanup:
-  
-  kl_array_free(&items);
+  kl_mem_free(KL_MEM_RESOURCE, subpath);
+  kl_mem_free(KL_MEM_RESOURCE, subvpath);
 
-  free(subpath);
-  free(subvpath);
+  return err < 0 ? -1 : dir;
+}
 
-  return err;
+static kl_resource_item_t* item_new(const char *path, const char *vpath, kl_resource_id_t resid) {
+  kl_resource_item_t *item = kl_mem_alloc(KL_MEM_RESOURCE, sizeof(kl_resource_item_t));
+  item->path     = kl_intern(path);
+  item->vpath    = kl_intern(vpath);
+  item->resid    = resid;
+  item->refs     = 0;
+  item->loader   = NULL;
+  item->item     = NULL;
+  item->state    = KL_RESOURCE_UNLOADED;
+  item->decoded  = NULL;
+  item->pak      = NULL;
+  item->pakentry = NULL;
+  item->cpu_bytes = 0;
+  item->gpu_bytes = 0;
+  item->lru_prev  = NULL;
+  item->lru_next  = NULL;
+  item->prefetch  = false;
+  item->stale     = false;
+  item->pumping   = false;
+  item->load_ms    = 0.0;
+  item->loaded_at  = 0.0;
+  item->bytes_read = 0;
+  return item;
 }
 
-kl_resource_loader_t* kl_resource_loader_new(kl_resources_load_cb load, kl_resources_free_cb free) {
-  static int type = 0;
-  kl_resource_loader_t *loader = malloc(sizeof(kl_resource_loader_t));
-  loader->type = type++;
-  loader->load = load;
-  loader->free = free;
-  return loader;
+static void blob_open(kl_resource_item_t *item, kl_resource_blob_t *blob) {
+  blob->data   = NULL;
+  blob->size   = 0;
+  blob->buf    = NULL;
+  blob->mapped = 0;
+
+  if (item->pak != NULL) {
+    kl_pak_entry_t *entry = item->pakentry;
+    if (!(entry->flags & KL_PAK_LZ4)) {
+      /* zero-copy */
+      blob->data = item->pak->base + entry->offset;
+      blob->size = entry->size;
+      return;
+    }
+    blob->buf = kl_mem_alloc(KL_MEM_RESOURCE, entry->rawsize);
+    if (kl_pak_read(item->pak, entry, blob->buf) < 0) {
+      fprintf(stderr, "Resource Manager: Corrupt entry %s in %s\n", item->vpath, item->pak->path);
+      kl_mem_free(KL_MEM_RESOURCE, blob->buf);
+      blob->buf = NULL;
+      return;
+    }
+    blob->data = blob->buf;
+    blob->size = entry->rawsize;
+  } else if (item->path[0] != '\0') {
+    blob->buf  = kl_resource_mapfile(item->path, &blob->mapped);
+    blob->data = blob->buf;
+    if (blob->buf == NULL) blob->mapped = 0;
+    blob->size = blob->mapped;
+  }
 }
 
-void *kl_resource_incref(kl_resource_loader_t *loader, kl_resource_id_t resid) {
-  kl_resource_id_t bucket = resid % KL_RESOURCE_BUCKETS;
-  kl_resource_item_t *first = resource_cache.buckets[bucket];
-  kl_resource_item_t *curr;
+static void blob_close(kl_resource_blob_t *blob) {
+  if (blob->mapped > 0) {
+    kl_resource_unmapfile(blob->buf, blob->mapped);
+  } else if (blob->buf != NULL) {
+    kl_mem_free(KL_MEM_RESOURCE, blob->buf);
+  }
+  blob->data = NULL;
+  blob->buf  = NULL;
+}
 
-  for (curr = first; curr != NULL; curr = curr->next) {
-    if (curr->resid == resid) {
-      if (curr->item == NULL) {
-        curr->item   = loader->load(curr->path, curr->vpath);
-        curr->loader = loader;
-      } else if (curr->loader->type != loader->type) {
-        return NULL;
-      }
-      curr->refs++;
-      return curr->item;
+/* stripe locked -- returns the loaded data for the caller to free once it's unlocked */
+static void* item_unload(kl_resource_item_t *item, kl_resources_free_cb *freecb) {
+  void *data = item->item;
+  *freecb = item->loader->free;
+  lru_account(item, -1);
+  item->cpu_bytes = 0;
+  item->gpu_bytes = 0;
+  item->item   = NULL;
+  item->loader = NULL;
+  __atomic_store_n(&item->state, KL_RESOURCE_UNLOADED, __ATOMIC_RELEASE);
+  return data;
+}
+
+/* the lru functions below expect lru_lock to be held */
+static bool lru_contains(kl_resource_item_t *item) {
+  return item->lru_prev != NULL || resource_lru.head == item;
+}
+
+static void lru_push(kl_resource_item_t *item) {
+  item->lru_prev = NULL;
+  item->lru_next = resource_lru.head;
+  if (resource_lru.head != NULL) {
+    resource_lru.head->lru_prev = item;
+  } else {
+    resource_lru.tail = item;
+  }
+  resource_lru.head = item;
+}
+
+static void lru_remove(kl_resource_item_t *item) {
+  if (item->lru_prev != NULL) {
+    item->lru_prev->lru_next = item->lru_next;
+  } else {
+    resource_lru.head = item->lru_next;
+  }
+  if (item->lru_next != NULL) {
+    item->lru_next->lru_prev = item->lru_prev;
+  } else {
+    resource_lru.tail = item->lru_prev;
+  }
+  item->lru_prev = NULL;
+  item->lru_next = NULL;
+}
+
+/* removes an item from the lru if it's there, stripe locked */
+static bool lru_take(kl_resource_item_t *item) {
+  pthread_mutex_lock(&lru_lock);
+  bool cached = lru_contains(item);
+  if (cached) lru_remove(item);
+  pthread_mutex_unlock(&lru_lock);
+  return cached;
+}
+
+static void lru_account(kl_resource_item_t *item, int sign) {
+  pthread_mutex_lock(&lru_lock);
+  if (sign > 0) {
+    resource_lru.cpu_used += item->cpu_bytes;
+    resource_lru.gpu_used += item->gpu_bytes;
+  } else {
+    resource_lru.cpu_used -= item->cpu_bytes;
+    resource_lru.gpu_used -= item->gpu_bytes;
+  }
+  pthread_mutex_unlock(&lru_lock);
+}
+
+static void lru_evict() {
+  /* only unreferenced items can go, so the budget may stay exceeded */
+  pthread_mutex_lock(&lru_lock);
+  kl_resource_item_t *item = resource_lru.tail;
+  while (item != NULL &&
+    (resource_lru.cpu_used > resource_lru.cpu_budget || resource_lru.gpu_used > resource_lru.gpu_budget)) {
+    resource_stripe_t *stripe = item_stripe(item);
+    if (off_main_thread(item->loader)) {
+      /* left for the main thread's next eviction */
+      item = item->lru_prev;
+      continue;
+    }
+    if (pthread_mutex_trylock(&stripe->lock) != 0) {
+      /* waiting would invert the lock order, try the next one */
+      item = item->lru_prev;
+      continue;
     }
+    lru_remove(item);
+    pthread_mutex_unlock(&lru_lock);
+
+    kl_resources_free_cb freecb;
+    void *data = item_unload(item, &freecb);
+    pthread_mutex_unlock(&stripe->lock);
+    freecb(data);
+
+    pthread_mutex_lock(&lru_lock);
+    item = resource_lru.tail;
   }
+  pthread_mutex_unlock(&lru_lock);
+}
 
-  return NULL;
+static char path_normchar(char c) {
+  /* case-insensitivity */
+  if (c >= 'A' && c <= 'Z') {
+    c |= 0x20;
+  }
+  /* normalize path separators */
+  if (c == '\\') {
+    c = '/';
+  }
+  return c;
 }
 
-void kl_resource_decref(kl_resource_id_t resid) {
-  int bucket = resid % KL_RESOURCE_BUCKETS;
-  kl_resource_item_t *first = resource_cache.buckets[bucket];
-  kl_resource_item_t *curr;
+static bool path_equal(const char *a, const char *b) {
+  char pa = '\0';
+  char pb = '\0';
+  for (;;) {
+    char ca = path_normchar(*a);
+    char cb = path_normchar(*b);
+    /* skip duplicate path separators, same as kl_resource_getid */
+    if (ca == '/' && pa == '/') { a++; continue; }
+    if (cb == '/' && pb == '/') { b++; continue; }
+    if (ca != cb) return false;
+    if (ca == '\0') return true;
+    pa = ca; a++;
+    pb = cb; b++;
+  }
+}
 
-  for (curr = first; curr != NULL; curr = curr->next) {
-    if (curr->resid == resid) {
-      curr->refs--;
-      assert(curr->refs >= 0);
-      if (curr->refs <= 0 && curr->item != NULL) {
-        curr->loader->free(curr->item);
-      }
+static uint32_t slot_dist(uint32_t i, kl_resource_id_t hash) {
+  return (i - (uint32_t)hash) & resource_cache.mask;
+}
+
+static int table_find(kl_resource_id_t hash, const char *vpath) {
+  resource_slot_t *slots = resource_cache.slots;
+  if (slots == NULL) return -1;
+
+  uint32_t mask = resource_cache.mask;
+  uint32_t i    = (uint32_t)hash & mask;
+  for (uint32_t dist = 0; ; dist++, i = (i + 1) & mask) {
+    resource_slot_t *slot = slots + i;
+    if (slot->item == NULL) return -1;
+    /* robin hood invariant: once we pass entries closer to home than we'd be, we're done */
+    if (slot_dist(i, slot->hash) < dist) return -1;
+    /* interned paths skip the string compare */
+    if (slot->hash == hash && (slot->item->vpath == vpath || path_equal(slot->item->vpath, vpath))) return i;
+  }
+}
+
+static void table_insert(kl_resource_id_t hash, kl_resource_item_t *item) {
+  if (resource_cache.slots == NULL || (resource_cache.count + 1) * 8 > (resource_cache.mask + 1) * 7) {
+    table_grow();
+  }
+
+  resource_slot_t *slots = resource_cache.slots;
+  uint32_t mask = resource_cache.mask;
+  uint32_t i    = (uint32_t)hash & mask;
+  resource_slot_t curr = { .hash = hash, .item = item };
+  for (uint32_t dist = 0; ; dist++, i = (i + 1) & mask) {
+    resource_slot_t *slot = slots + i;
+    if (slot->item == NULL) {
+      *slot = curr;
       break;
     }
+    /* steal from the rich: displace entries that are closer to their home slot */
+    uint32_t d = slot_dist(i, slot->hash);
+    if (d < dist) {
+      resource_slot_t temp = *slot;
+      *slot = curr;
+      curr  = temp;
+      dist  = d;
+    }
   }
+  resource_cache.count++;
 }
 
-void kl_resource_printall() {
-  for (int i=0; i < KL_RESOURCE_BUCKETS; i++) {
-    kl_resource_item_t *item = resource_cache.buckets[i];
-    while (item != NULL) {
-      item = item->next;
+static void table_remove(int i) {
+  /* backward-shift deletion, so no tombstones are needed */
+  resource_slot_t *slots = resource_cache.slots;
+  uint32_t mask = resource_cache.mask;
+  uint32_t curr = i;
+  for (;;) {
+    uint32_t next = (curr + 1) & mask;
+    if (slots[next].item == NULL || slot_dist(next, slots[next].hash) == 0) break;
+    slots[curr] = slots[next];
+    curr = next;
+  }
+  slots[curr].item = NULL;
+  slots[curr].hash = 0;
+  resource_cache.count--;
+}
+
+static void table_grow() {
+  resource_slot_t *oldslots = resource_cache.slots;
+  uint32_t oldsize = oldslots != NULL ? resource_cache.mask + 1 : 0;
+  uint32_t newsize = oldsize > 0 ? oldsize * 2 : resource_initial_slots;
+
+  resource_cache.slots = kl_mem_alloc(KL_MEM_RESOURCE, newsize * sizeof(resource_slot_t));
+  memset(resource_cache.slots, 0, newsize * sizeof(resource_slot_t));
+  resource_cache.mask  = newsize - 1;
+  resource_cache.count = 0;
+
+  for (uint32_t i=0; i < oldsize; i++) {
+    if (oldslots[i].item != NULL) {
+      table_insert(oldslots[i].hash, oldslots[i].item);
     }
   }
+  kl_mem_free(KL_MEM_RESOURCE, oldslots);
 }
 
-void kl_resource_strip_extension(char *path) {
-  int n = strlen(path);
-  for (int i = n-1; i >= 0; i--) {
-    if (path[i] == '/' || path[i] == '\\' || path[i] == '|') { /* stop at last path separator */
-      break;
+static double now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+static const char* loader_name(kl_resource_loader_t *loader) {
+  return loader->name != NULL ? loader->name : "unnamed";
+}
+
+/* with loader_lock held, which leaves hits and misses to read atomically */
+static kl_resource_stats_t loader_stats(kl_resource_loader_t *loader) {
+  kl_resource_stats_t stats = loader->stats;
+  stats.hits   = __atomic_load_n(&loader->stats.hits, __ATOMIC_RELAXED);
+  stats.misses = __atomic_load_n(&loader->stats.misses, __ATOMIC_RELAXED);
+  return stats;
+}
+
+/* snapshots of the loaded items, slowest first -- copied under the locks, since the items
+ * themselves can be removed as soon as the table lock is dropped.  reload_lock keeps out a reload
+ * halfway through rewriting the numbers, and goes first, as it does in kl_resource_reload */
+static void collect_slowest(kl_array_t *items) {
+  kl_array_snapshot_init(items);
+  pthread_mutex_lock(&reload_lock);
+  pthread_rwlock_rdlock(&table_lock);
+  for (uint32_t i=0; resource_cache.slots != NULL && i <= resource_cache.mask; i++) {
+    kl_resource_item_t *item = resource_cache.slots[i].item;
+    if (item == NULL) continue;
+    resource_stripe_t *stripe = item_lock(item);
+    if (item->state == KL_RESOURCE_LOADED) {
+      item_snapshot_t snapshot = {
+        .vpath = item->vpath, .loader = loader_name(item->loader), .packed = item->pak != NULL,
+        .load_ms = item->load_ms, .loaded_at = item->loaded_at,
+        .bytes_read = item->bytes_read, .cpu_bytes = item->cpu_bytes, .gpu_bytes = item->gpu_bytes
+      };
+      kl_array_snapshot_push(items, snapshot);
     }
-    if (path[i] == '.') {
-      path[i] = '\0';
-      break;
+    pthread_mutex_unlock(&stripe->lock);
+  }
+  pthread_rwlock_unlock(&table_lock);
+  pthread_mutex_unlock(&reload_lock);
+  if (kl_array_size(items) > 1) {
+    qsort(kl_array_snapshot_data(items), kl_array_size(items), sizeof(item_snapshot_t), &compare_load_ms);
+  }
+}
+
+static int compare_load_ms(const void *a, const void *b) {
+  double ta = ((item_snapshot_t*)a)->load_ms;
+  double tb = ((item_snapshot_t*)b)->load_ms;
+  return (ta < tb) - (ta > tb);
+}
+
+static void json_string(FILE *out, const char *str) {
+  fputc('"', out);
+  for (int i=0; str[i] != '\0'; i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
     }
   }
+  fputc('"', out);
 }
 
 /* vim: set ts=2 sw=2 et */
@@ -1,47 +1,154 @@
 #ifndef KL_RESOURCE_H
 #define KL_RESOURCE_H
 
-/* resource cache system */
+/* resource cache system -- safe to use from any thread, load and upload callbacks run on whichever thread finishes the load,
+ * except for main_thread loaders once kl_resource_set_main_thread has been called */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 typedef uint64_t kl_resource_id_t;
 
-typedef void* (*kl_resources_load_cb)(char *path, char *vpath);
+/* the contents of an entry: a pointer into a pak or a mapped file, read-only */
+typedef struct kl_resource_blob {
+  const uint8_t *data; /* NULL for placeholders and missing files */
+  size_t size;
+  void  *buf;    /* private */
+  size_t mapped; /* private */
+} kl_resource_blob_t;
+
+/* path and vpath are interned, loaders can hold on to them */
+typedef void* (*kl_resources_load_cb)(const char *path, const char *vpath);
 typedef void  (*kl_resources_free_cb)(void *item);
+/* split loading: decode runs on a worker thread and must not touch GL or the resource table,
+ * upload runs in kl_resource_pump or the kl_resource_incref which needed it, and takes ownership of the decoded data */
+typedef void* (*kl_resources_decode_cb)(kl_resource_blob_t *blob, const char *vpath);
+typedef void* (*kl_resources_upload_cb)(void *data, const char *path, const char *vpath);
+/* estimated memory held by a loaded item, in bytes */
+typedef void  (*kl_resources_size_cb)(void *item, size_t *cpu, size_t *gpu);
+/* moves a freshly loaded copy into an existing item, so pointers to it stay valid, then frees the leftovers in fresh */
+typedef void  (*kl_resources_reload_cb)(void *item, void *fresh);
+/* runs on the decoding thread right after a successful decode, to kl_resource_prefetch whatever the item refers to */
+typedef void  (*kl_resources_deps_cb)(void *decoded, const char *vpath);
+
+/* accumulated per loader */
+typedef struct kl_resource_stats {
+  uint64_t loads;    /* successful loads, reloads included */
+  uint64_t failures;
+  uint64_t hits;     /* increfs of items which were already loaded, cached or in flight */
+  uint64_t misses;   /* increfs which started a load */
+  uint64_t reloads;
+  double   total_ms; /* decode and upload, whichever threads they ran on */
+  double   max_ms;
+  uint64_t bytes_read;     /* raw file contents handed to decode */
+  uint64_t bytes_uploaded; /* gpu bytes reported by the size callback */
+} kl_resource_stats_t;
 
 typedef struct kl_resource_loader {
   int type;
-  kl_resources_load_cb load;
-  kl_resources_free_cb free;
+  const char *name; /* for reports, optional */
+  kl_resources_load_cb   load;
+  kl_resources_free_cb   free;
+  kl_resources_decode_cb decode;  /* NULL if the loader can't be split */
+  kl_resources_upload_cb upload;
+  kl_resources_free_cb   discard; /* frees decoded data which was never uploaded */
+  kl_resources_size_cb   size;    /* optional -- items without a size are freed as soon as they're unreferenced */
+  kl_resources_reload_cb reload;  /* optional -- needed to pick up changes to resources which are in use */
+  kl_resources_deps_cb   deps;    /* optional, async loaders only */
+  bool main_thread; /* load, upload, reload and evictions only on the main thread (for GL) -- other threads wait on kl_resource_pump */
+  kl_resource_stats_t    stats;
 } kl_resource_loader_t;
 
-#define KL_RESITEM_PATHLEN 0x100
+#define KL_RESOURCE_UNLOADED 0
+#define KL_RESOURCE_PENDING  1 /* queued, or being decoded by a worker */
+#define KL_RESOURCE_DECODED  2 /* waiting for kl_resource_pump */
+#define KL_RESOURCE_LOADED   3
+#define KL_RESOURCE_FAILED   4
+
+#define KL_RESOURCE_WORKERS 4 /* default size of the worker pool */
+
+/* unreferenced items stay loaded until these are exceeded, bytes */
+#define KL_RESOURCE_CPU_BUDGET 0x04000000
+#define KL_RESOURCE_GPU_BUDGET 0x10000000
+
+#define KL_RESITEM_PATHLEN 0x100 /* longest path, including the terminator */
 typedef struct kl_resource_item {
-  char path[KL_RESITEM_PATHLEN];
-  char vpath[KL_RESITEM_PATHLEN];
+  const char *path;  /* interned */
+  const char *vpath; /* interned */
   kl_resource_id_t resid;
   int refs;
   kl_resource_loader_t *loader;
   void *item;
-  struct kl_resource_item *next;
+  int   state;
+  void *decoded;
+  struct kl_pak       *pak; /* NULL for loose files */
+  struct kl_pak_entry *pakentry;
+  size_t cpu_bytes, gpu_bytes;
+  struct kl_resource_item *lru_prev, *lru_next; /* unreferenced but still loaded */
+  bool prefetch;     /* holds a reference on behalf of kl_resource_prefetch until it's loaded or failed */
+  bool stale;        /* its file changed while it was being loaded, which is redone before it's published */
+  bool pumping;      /* popped off the done queue by kl_resource_pump, which hasn't locked it yet -- guarded by the queue lock */
+  double load_ms;    /* duration of the last (re)load */
+  double loaded_at;  /* when it finished, ms on the monotonic clock -- zero if never loaded */
+  size_t bytes_read; /* by the last decode */
 } kl_resource_item_t;
 
-/* a simple case-insensitive hashing function */
-kl_resource_id_t kl_resource_getid(char *str);
+/* 64-bit hash of a virtual path -- case-insensitive, '\\' and '/' are equivalent, and repeated separators are ignored */
+kl_resource_id_t kl_resource_getid(const char *str);
+/* 64-bit fingerprint of a blob's contents, for spotting identical files under different paths -- 0 for empty blobs */
+uint64_t kl_resource_blob_hash(const kl_resource_blob_t *blob);
+/* a second fingerprint, computed independently of the first -- together they tell files apart without keeping them */
+uint64_t kl_resource_blob_check(const kl_resource_blob_t *blob);
 /* registers a new resource type */
 kl_resource_loader_t* kl_resource_loader_new(kl_resources_load_cb load, kl_resources_free_cb free);
+/* registers a new resource type which can be decoded off the main thread */
+kl_resource_loader_t* kl_resource_loader_new_async(kl_resources_decode_cb decode, kl_resources_upload_cb upload, kl_resources_free_cb discard, kl_resources_free_cb free);
 /* self-explanitory... */
-bool kl_resource_exists(kl_resource_id_t resid);
-/* adds an entry or placeholder */
-int kl_resource_add_entry(char *path, char *vpath);
+bool kl_resource_exists(const char *vpath);
+/* looks up an entry by virtual path, NULL if it doesn't exist -- only referenced entries are safe from removal */
+kl_resource_item_t* kl_resource_find(const char *vpath);
+/* adds an entry or placeholder, fails if the virtual path is already registered */
+int kl_resource_add_entry(const char *path, const char *vpath);
+/* removes an entry, fails if it's still referenced */
+int kl_resource_remove_entry(const char *vpath);
 /* adds the contents of a directory resource system */
-int kl_resource_add_dir(char *path, char *vpath);
-/* increments reference count for existing resource and loads it if necessary */
-void *kl_resource_incref(kl_resource_loader_t *loader, kl_resource_id_t resid);
-/* decrements refs and unloads resource if it isn't in use */
-void kl_resource_decref(kl_resource_id_t resid);
+int kl_resource_add_dir(const char *path, const char *vpath);
+/* same, without consulting or writing a manifest */
+int kl_resource_scan_dir(const char *path, const char *vpath);
+/* removes every unreferenced entry under a virtual directory */
+int kl_resource_remove_dir(const char *vpath);
+/* adds every entry of a .kpak archive, which stays mapped */
+int kl_resource_add_pak(const char *path);
+/* maps a whole file read-only, NULL on failure */
+void *kl_resource_mapfile(const char *path, size_t *size);
+void kl_resource_unmapfile(void *data, size_t size);
+/* increments reference count for existing resource and loads it if necessary -- waits for in-flight async loads */
+void *kl_resource_incref(kl_resource_loader_t *loader, const char *vpath);
+/* increments reference count and queues the resource for loading, returns a handle without waiting */
+kl_resource_item_t* kl_resource_incref_async(kl_resource_loader_t *loader, const char *vpath);
+/* starts loading a resource in the background without referencing it -- once uploaded it's cached like any unreferenced resource */
+void kl_resource_prefetch(kl_resource_loader_t *loader, const char *vpath);
+/* the loaded resource, or NULL if it is still pending or failed */
+void *kl_resource_get(kl_resource_item_t *handle);
+/* marks the calling thread as the main one, which has to keep calling kl_resource_pump for the others to get main_thread loads */
+void kl_resource_set_main_thread();
+/* finalizes decoded resources on the main thread until budget_ms has elapsed, returns the number finalized */
+int kl_resource_pump(float budget_ms);
+/* sets the size of the worker pool, (re)starting it */
+void kl_resource_set_workers(int n);
+/* stops the worker pool */
+void kl_resource_shutdown();
+/* decrements refs, unreferenced resources are cached until the memory budget runs out */
+void kl_resource_decref(const char *vpath);
+/* picks up changes to an entry's file: reloads it in place if it's in use, drops it if it's only cached */
+int kl_resource_reload(const char *vpath);
+/* sets the memory budget for loaded resources, evicting unreferenced ones to stay under it */
+void kl_resource_set_budget(size_t cpu, size_t gpu);
+/* writes per-loader stats followed by the topn slowest loaded resources */
+void kl_resource_dump(FILE *out, int topn);
+void kl_resource_dump_json(FILE *out, int topn);
 /* for debugging: */
 void kl_resource_printall();
 
@@ -0,0 +1,616 @@
+#define _POSIX_C_SOURCE 200809L
+
+/* stress-bvh: inserts, removes and moves objects in a kl_bvh at random, checking the whole tree
+ * after every change
+ *
+ *   make stress                                   (asserts on, address and undefined checks)
+ *
+ * rotations only happen while a change refits the branches above it, so checking after each
+ * insert, remove and update checks every rotation along with it.  what has to hold:
+ *
+ *   every child points back at its parent, and the root at nothing
+ *   a leaf's box is the one around its sphere, a branch's is exactly its children's merged
+ *   every leaf is inside the sphere and the box of each of its ancestors
+ *   each live handle is a leaf holding its item, reachable from the root exactly once
+ *   the free list holds everything else in the pool, and nothing twice
+ *
+ * now and then a frustum query has to find exactly what testing every object does, through the
+ * tree and through its four-wide copy -- which skips the planes a node's ancestors were inside,
+ * so what it finds is only right if the masking is -- and the tree is rebuilt with kl_bvh_build
+ * and carried on with.  rays are cast one at a time and together, a few of them into one array,
+ * and have to hit what a sphere test of every object does, nearest first, up to their max.
+ * kl_bvh_nearest and kl_bvh_within have to find what measuring the distance to every object
+ * does, with k and max from none to more than there are and radii from 0 up, the empty tree
+ * included.  kl_bvh4_cull_views, with 1, 7 and 32 views of a camera and lights' cube faces, has
+ * to give each item the views kl_bvh4_cull finds it in one at a time -- and a light's six faces
+ * have to find everything within its reach between them.
+ *
+ * last, frames culled the way kl_render_draw does, into arrays on the frame arena: the lights,
+ * then the models and each light's six faces.  once a run of frames has warmed the arena up,
+ * drawing the same frames again must not make a single kl_mem heap call */
+
+#include "bvhtree.h"
+#include "camera.h"
+#include "plane.h"
+#include "arena.h"
+#include "mem.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRESS_ITEMS 1000
+#define STRESS_OPS   20000
+#define STRESS_WORLD 1000.0f
+#define STRESS_RAYS  16
+#define STRESS_LIGHTS 24
+#define STRESS_FRAMES 32
+
+#define MARK_NONE 0
+#define MARK_TREE 1
+#define MARK_FREE 2
+
+typedef struct object {
+  kl_sphere_t bounds;
+  int handle; /* -1 while it's out of the tree */
+} object_t;
+
+static void  stress_ops(kl_bvh_t *tree, unsigned seed);
+static void  check(kl_bvh_t *tree);
+static int   check_node(kl_bvh_t *tree, int32_t i, int32_t parent, uint8_t *marks);
+static void  check_leaf(kl_bvh_t *tree, int32_t leaf);
+static void  check_query(kl_bvh_t *tree, unsigned *seed);
+static void  check_views(kl_bvh_t *tree, unsigned *seed);
+static void  check_frames(kl_bvh_t *tree, unsigned *seed);
+static int   draw_frame(kl_bvh4_t *models, kl_bvh4_t *lights, kl_sphere_t *reach, kl_frustum_t *frustum);
+static void  random_frustum(kl_frustum_t *frustum, unsigned *seed);
+static void  check_found(kl_array_t *found, const bool *expected, int n);
+static void  check_rays(kl_bvh_t *tree, unsigned *seed);
+static int   check_hits(kl_bvh_ray_t *ray, kl_bvh_hit_t *hits, int n);
+static bool  ray_sphere(kl_bvh_ray_t *ray, kl_sphere_t *sphere, float *t);
+static void  check_near(kl_bvh_t *tree, unsigned *seed);
+static float near_dist(kl_sphere_t *bounds, kl_vec3f_t *point);
+static int   compare_t(const void *a, const void *b);
+static int   infrustum(kl_sphere_t *bounds, void *data);
+static bool  sphere_contains(kl_sphere_t *outer, kl_sphere_t *inner);
+static void  random_bounds(kl_sphere_t *bounds, unsigned *seed);
+static float frand(unsigned *seed);
+
+static object_t objects[STRESS_ITEMS];
+static int checks = 0;
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  kl_bvh_t tree = KL_BVH_INIT;
+  for (int i=0; i < STRESS_ITEMS; i++) {
+    objects[i].handle = -1;
+  }
+  unsigned seed = 1;
+  check(&tree);
+  check_near(&tree, &seed);
+  stress_ops(&tree, seed);
+  check_frames(&tree, &seed);
+
+  /* emptied out one by one, it has to end up as it started */
+  for (int i=0; i < STRESS_ITEMS; i++) {
+    if (objects[i].handle < 0) continue;
+    kl_bvh_remove(&tree, objects[i].handle);
+    objects[i].handle = -1;
+    check(&tree);
+  }
+  assert(tree.root == KL_BVH_NULL && tree.count == 0);
+  check_near(&tree, &seed);
+  kl_bvh_free(&tree);
+
+  printf("stress-bvh: ok, %d checks\n", checks);
+  return 0;
+}
+
+/* ------------------------- */
+static void stress_ops(kl_bvh_t *tree, unsigned seed) {
+  for (int op=0; op < STRESS_OPS; op++) {
+    object_t *object = objects + rand_r(&seed) % STRESS_ITEMS;
+    void *item = (void*)(intptr_t)(object - objects + 1);
+    int r = rand_r(&seed) % 100;
+
+    if (object->handle < 0) {
+      random_bounds(&object->bounds, &seed);
+      object->handle = kl_bvh_insert(tree, &object->bounds, item);
+    } else if (r < 15) {
+      kl_bvh_remove(tree, object->handle);
+      object->handle = -1;
+    } else if (r < 85) {
+      /* a small move, which mostly refits and rotates */
+      object->bounds.center.x += (frand(&seed) - 0.5f) * 20.0f;
+      object->bounds.center.y += (frand(&seed) - 0.5f) * 20.0f;
+      object->bounds.center.z += (frand(&seed) - 0.5f) * 20.0f;
+      object->bounds.radius    = fmaxf(0.5f, object->bounds.radius + (frand(&seed) - 0.5f) * 2.0f);
+      kl_bvh_update(tree, object->handle, &object->bounds);
+    } else if (r < 99) {
+      /* a jump, which has to reinsert */
+      random_bounds(&object->bounds, &seed);
+      kl_bvh_update(tree, object->handle, &object->bounds);
+    } else if (rand_r(&seed) % 20 == 0) {
+      /* the same objects, in a tree built all at once */
+      kl_sphere_t bounds[STRESS_ITEMS];
+      void *items[STRESS_ITEMS];
+      int handles[STRESS_ITEMS], live[STRESS_ITEMS], n = 0;
+      for (int i=0; i < STRESS_ITEMS; i++) {
+        if (objects[i].handle < 0) continue;
+        bounds[n] = objects[i].bounds;
+        items[n]  = (void*)(intptr_t)(i + 1);
+        live[n++] = i;
+      }
+      kl_bvh_build(tree, items, bounds, n, handles);
+      for (int i=0; i < n; i++) {
+        objects[live[i]].handle = handles[i];
+      }
+    }
+    check(tree);
+    if (op % 100 == 0) {
+      check_query(tree, &seed);
+      check_rays(tree, &seed);
+      check_near(tree, &seed);
+      check_views(tree, &seed);
+    }
+  }
+}
+
+static void check(kl_bvh_t *tree) {
+  checks++;
+  assert(tree->count >= 0 && tree->count <= tree->capacity);
+  uint8_t *marks = calloc(tree->capacity > 0 ? tree->capacity : 1, 1);
+
+  int leaves = 0;
+  if (tree->root == KL_BVH_NULL) {
+    assert(tree->count == 0);
+  } else {
+    assert(tree->root >= 0 && tree->root < tree->capacity);
+    leaves = check_node(tree, tree->root, KL_BVH_NULL, marks);
+  }
+  assert(leaves == tree->count);
+
+  int used = 0;
+  for (int32_t i=0; i < tree->capacity; i++) {
+    used += marks[i] == MARK_TREE;
+  }
+  assert(used == (tree->count > 0 ? 2 * tree->count - 1 : 0));
+
+  /* a pool that kl_bvh_build sized exactly can have no free list at all */
+  int unused = 0;
+  for (int32_t i=tree->free; i != KL_BVH_NULL; i = tree->nodes[i].parent) {
+    assert(i >= 0 && i < tree->capacity);
+    assert(marks[i] == MARK_NONE);
+    marks[i] = MARK_FREE;
+    unused++;
+  }
+  assert(used + unused == tree->capacity);
+
+  for (int i=0; i < STRESS_ITEMS; i++) {
+    int h = objects[i].handle;
+    if (h < 0) continue;
+    assert(h < tree->capacity && marks[h] == MARK_TREE);
+    kl_bvh_node_t *leaf = tree->nodes + h;
+    assert(leaf->children[0] == KL_BVH_NULL);
+    assert(leaf->item == (void*)(intptr_t)(i + 1));
+    assert(memcmp(&leaf->bounds, &objects[i].bounds, sizeof(kl_sphere_t)) == 0);
+  }
+  free(marks);
+}
+
+/* returns the leaves under i */
+static int check_node(kl_bvh_t *tree, int32_t i, int32_t parent, uint8_t *marks) {
+  assert(i >= 0 && i < tree->capacity);
+  assert(marks[i] == MARK_NONE);
+  marks[i] = MARK_TREE;
+  kl_bvh_node_t *node = tree->nodes + i;
+  assert(node->parent == parent);
+
+  if (node->children[0] == KL_BVH_NULL) {
+    assert(node->children[1] == KL_BVH_NULL);
+    kl_sphere_t *s = &node->bounds;
+    assert(node->min.x == s->center.x - s->radius && node->max.x == s->center.x + s->radius);
+    assert(node->min.y == s->center.y - s->radius && node->max.y == s->center.y + s->radius);
+    assert(node->min.z == s->center.z - s->radius && node->max.z == s->center.z + s->radius);
+    check_leaf(tree, i);
+    return 1;
+  }
+
+  kl_bvh_node_t *l = tree->nodes + node->children[0];
+  kl_bvh_node_t *r = tree->nodes + node->children[1];
+  assert(node->children[1] != KL_BVH_NULL);
+  assert(node->min.x == fminf(l->min.x, r->min.x) && node->max.x == fmaxf(l->max.x, r->max.x));
+  assert(node->min.y == fminf(l->min.y, r->min.y) && node->max.y == fmaxf(l->max.y, r->max.y));
+  assert(node->min.z == fminf(l->min.z, r->min.z) && node->max.z == fmaxf(l->max.z, r->max.z));
+  return check_node(tree, node->children[0], i, marks) + check_node(tree, node->children[1], i, marks);
+}
+
+/* the sphere of a branch isn't always around its children's, only around every leaf below */
+static void check_leaf(kl_bvh_t *tree, int32_t leaf) {
+  kl_bvh_node_t *node = tree->nodes + leaf;
+  for (int32_t i=node->parent; i != KL_BVH_NULL; i = tree->nodes[i].parent) {
+    kl_bvh_node_t *above = tree->nodes + i;
+    assert(sphere_contains(&above->bounds, &node->bounds));
+    assert(above->min.x <= node->min.x && above->max.x >= node->max.x);
+    assert(above->min.y <= node->min.y && above->max.y >= node->max.y);
+    assert(above->min.z <= node->min.z && above->max.z >= node->max.z);
+  }
+}
+
+/* what the tree finds against what testing every object does */
+static void check_query(kl_bvh_t *tree, unsigned *seed) {
+  kl_frustum_t frustum;
+  random_frustum(&frustum, seed);
+
+  bool expected[STRESS_ITEMS] = { false };
+  int n = 0;
+  for (int i=0; i < STRESS_ITEMS; i++) {
+    if (objects[i].handle < 0 || !infrustum(&objects[i].bounds, &frustum)) continue;
+    expected[i] = true;
+    n++;
+  }
+
+  kl_array_t found;
+  kl_array_init(&found, sizeof(void*));
+  kl_bvh_search(tree, &infrustum, &frustum, &found);
+  check_found(&found, expected, n);
+
+  kl_bvh4_t wide;
+  kl_bvh4_flatten(&wide, tree);
+  kl_array_clear(&found);
+  kl_bvh4_cull(&wide, &frustum, &found);
+  check_found(&found, expected, n);
+  kl_bvh4_free(&wide);
+  kl_array_free(&found);
+}
+
+/* a camera, then lights of all sizes filling the rest with their cube faces.  what each view sees
+ * is checked above, kl_bvh4_cull here just has to agree with it */
+static void check_views(kl_bvh_t *tree, unsigned *seed) {
+  static const int counts[] = { 1, 7, KL_BVH_VIEWS };
+  kl_bvh4_t wide;
+  kl_bvh4_flatten(&wide, tree);
+  kl_array_t found, visible;
+  kl_array_init(&found, sizeof(void*));
+  kl_array_init(&visible, sizeof(kl_bvh_visible_t));
+
+  for (int c=0; c < 3; c++) {
+    int n = counts[c];
+    /* the last light can be cut short, only some of its faces fitting */
+    kl_frustum_t frusta[KL_BVH_VIEWS + 5];
+    kl_vec3f_t   lights[(KL_BVH_VIEWS + 5) / 6];
+    float        reach[(KL_BVH_VIEWS + 5) / 6];
+    random_frustum(frusta, seed);
+    for (int l=0; 1 + 6 * l < n; l++) {
+      lights[l] = (kl_vec3f_t){ (frand(seed) - 0.5f) * STRESS_WORLD, (frand(seed) - 0.5f) * 100.0f, (frand(seed) - 0.5f) * STRESS_WORLD };
+      reach[l]  = 5.0f + frand(seed) * frand(seed) * STRESS_WORLD * 0.5f;
+      kl_camera_cube_frusta(lights + l, reach[l], frusta + 1 + 6 * l);
+    }
+
+    uint32_t expected[STRESS_ITEMS] = { 0 };
+    for (int v=0; v < n; v++) {
+      kl_array_clear(&found);
+      kl_bvh4_cull(&wide, frusta + v, &found);
+      void **items = kl_array_data(&found);
+      for (int i=0; i < kl_array_size(&found); i++) {
+        expected[(intptr_t)items[i] - 1] |= 1u << v;
+      }
+    }
+    int seen = 0;
+    for (int i=0; i < STRESS_ITEMS; i++) {
+      seen += expected[i] != 0;
+      /* between them a light's faces cover the cube around its reach, let alone the sphere */
+      for (int l=0; 7 + 6 * l <= n && objects[i].handle >= 0; l++) {
+        if (kl_vec3f_dist(&objects[i].bounds.center, lights + l) > reach[l] + objects[i].bounds.radius) continue;
+        assert((expected[i] >> (1 + 6 * l) & 0x3f) != 0);
+      }
+    }
+
+    kl_array_clear(&visible);
+    kl_bvh4_cull_views(&wide, frusta, n, &visible);
+    assert(kl_array_size(&visible) == seen);
+    kl_bvh_visible_t *v = kl_array_data(&visible);
+    for (int i=0; i < seen; i++) {
+      int index = (int)(intptr_t)v[i].item - 1;
+      assert(index >= 0 && index < STRESS_ITEMS);
+      assert(v[i].views != 0 && v[i].views == expected[index]);
+      expected[index] = 0; /* reported twice would fail here */
+    }
+  }
+  kl_array_free(&visible);
+  kl_array_free(&found);
+  kl_bvh4_free(&wide);
+}
+
+static void check_frames(kl_bvh_t *tree, unsigned *seed) {
+  kl_bvh4_t models, lights;
+  kl_bvh4_flatten(&models, tree);
+  kl_bvh_t lighttree = KL_BVH_INIT;
+  kl_sphere_t reach[STRESS_LIGHTS];
+  for (int l=0; l < STRESS_LIGHTS; l++) {
+    reach[l].center = (kl_vec3f_t){ (frand(seed) - 0.5f) * STRESS_WORLD, 0.0f, (frand(seed) - 0.5f) * STRESS_WORLD };
+    reach[l].radius = 5.0f + frand(seed) * STRESS_WORLD * 0.2f;
+    kl_bvh_insert(&lighttree, reach + l, (void*)(intptr_t)(l + 1));
+  }
+  kl_bvh4_flatten(&lights, &lighttree);
+  kl_frustum_t frusta[STRESS_FRAMES];
+  for (int f=0; f < STRESS_FRAMES; f++) {
+    random_frustum(frusta + f, seed);
+  }
+
+  /* the arena grows, and coalesces, until it fits the biggest frame */
+  int found[STRESS_FRAMES];
+  uint64_t warmup = kl_mem_thread_heapcalls();
+  for (int f=0; f < STRESS_FRAMES; f++) {
+    found[f] = draw_frame(&models, &lights, reach, frusta + f);
+  }
+  assert(kl_mem_thread_heapcalls() > warmup);
+  for (int f=0; f < STRESS_FRAMES; f++) {
+    uint64_t heapcalls = kl_mem_thread_heapcalls();
+    int n = draw_frame(&models, &lights, reach, frusta + f);
+    assert(kl_mem_thread_heapcalls() == heapcalls);
+    assert(n == found[f]);
+    checks++;
+  }
+
+  kl_frame_reset();
+  kl_bvh4_free(&lights);
+  kl_bvh_free(&lighttree);
+  kl_bvh4_free(&models);
+}
+
+/* kl_render_draw's culls, returning how many items they found between them */
+static int draw_frame(kl_bvh4_t *models, kl_bvh4_t *lights, kl_sphere_t *reach, kl_frustum_t *frustum) {
+  kl_frame_reset();
+  kl_array_t visible;
+  kl_array_init_frame(&visible, sizeof(void*));
+  kl_bvh4_cull(lights, frustum, &visible);
+  int n = kl_array_size(&visible);
+
+  kl_array_t drawn;
+  kl_array_t *casters = kl_frame_alloc(6 * n * sizeof(kl_array_t));
+  kl_array_init_frame(&drawn, sizeof(void*));
+  kl_bvh4_cull(models, frustum, &drawn);
+  int found = n + kl_array_size(&drawn);
+  for (int l=0; l < n; l++) {
+    kl_sphere_t *light = reach + (intptr_t)((void**)kl_array_data(&visible))[l] - 1;
+    kl_frustum_t faces[6];
+    kl_camera_cube_frusta(&light->center, light->radius, faces);
+    for (int f=0; f < 6; f++) {
+      kl_array_init_frame(casters + 6 * l + f, sizeof(void*));
+      kl_bvh4_cull(models, faces + f, casters + 6 * l + f);
+      found += kl_array_size(casters + 6 * l + f);
+    }
+  }
+  return found;
+}
+
+/* narrow to wide, near to far, so some subtrees are wholly inside and some straddle -- kept to
+ * fovs the camera can make at this aspect */
+static void random_frustum(kl_frustum_t *frustum, unsigned *seed) {
+  kl_camera_t cam = { .aspect = 1.333f, .fov = 0.2f + frand(seed) * 1.4f, .near = 1.0f };
+  cam.far = 20.0f + frand(seed) * STRESS_WORLD;
+  float yaw = frand(seed) * 6.283f;
+  cam.orientation = (kl_quat_t){ cosf(yaw / 2.0f), 0.0f, sinf(yaw / 2.0f), 0.0f };
+  cam.position.x = (frand(seed) - 0.5f) * STRESS_WORLD;
+  cam.position.z = (frand(seed) - 0.5f) * STRESS_WORLD;
+  kl_camera_update_frustum(&cam, frustum);
+}
+
+/* found has to hold the n items expected, each once */
+static void check_found(kl_array_t *found, const bool *expected, int n) {
+  bool left[STRESS_ITEMS];
+  memcpy(left, expected, sizeof(left));
+  assert(kl_array_size(found) == n);
+  void **items = kl_array_data(found);
+  for (int i=0; i < n; i++) {
+    int index = (int)(intptr_t)items[i] - 1;
+    assert(index >= 0 && index < STRESS_ITEMS && left[index]);
+    left[index] = false; /* found twice would fail here */
+  }
+}
+
+static void check_rays(kl_bvh_t *tree, unsigned *seed) {
+  kl_bvh_ray_t rays[STRESS_RAYS];
+  kl_array_t   hits[STRESS_RAYS], shared;
+  kl_array_init(&shared, sizeof(kl_bvh_hit_t));
+  for (int r=0; r < STRESS_RAYS; r++) {
+    kl_bvh_ray_t *ray = rays + r;
+    object_t *from = objects + rand_r(seed) % STRESS_ITEMS;
+    if (from->handle >= 0 && r % 4 == 0) {
+      ray->origin = from->bounds.center; /* starting inside one */
+    } else {
+      ray->origin = (kl_vec3f_t){ (frand(seed) - 0.5f) * STRESS_WORLD, (frand(seed) - 0.5f) * 100.0f, (frand(seed) - 0.5f) * STRESS_WORLD };
+    }
+    ray->dir = (kl_vec3f_t){ frand(seed) - 0.5f, (frand(seed) - 0.5f) * 0.2f, frand(seed) - 0.5f };
+    if (r % 2) {
+      /* a segment to somewhere in the world */
+      kl_vec3f_scale(&ray->dir, &ray->dir, STRESS_WORLD * frand(seed));
+      ray->tmax = 1.0f;
+    } else {
+      ray->tmax = INFINITY;
+    }
+    ray->max  = r % 3 == 0 ? 0 : 1 + rand_r(seed) % 4;
+    ray->hits = r % 3 == 1 ? &shared : hits + r;
+    kl_array_init(hits + r, sizeof(kl_bvh_hit_t));
+
+    int n = kl_bvh_raycast(tree, &ray->origin, &ray->dir, ray->tmax, ray->max, hits + r);
+    assert(n == kl_array_size(hits + r));
+    check_hits(ray, kl_array_data(hits + r), n);
+    kl_array_clear(hits + r);
+  }
+
+  /* the rays sharing an array find theirs one after another, in the order they were given */
+  kl_bvh_raycast_n(tree, rays, STRESS_RAYS);
+  int at = 0;
+  for (int r=0; r < STRESS_RAYS; r++) {
+    if (rays[r].hits == &shared) {
+      at += check_hits(rays + r, (kl_bvh_hit_t*)kl_array_data(&shared) + at, kl_array_size(&shared) - at);
+    } else {
+      int n = check_hits(rays + r, kl_array_data(hits + r), kl_array_size(hits + r));
+      assert(n == kl_array_size(hits + r));
+    }
+    kl_array_free(hits + r);
+  }
+  assert(at == kl_array_size(&shared));
+  kl_array_free(&shared);
+}
+
+/* the ray's hits start at hits, and there are up to n of them -- returns how many they were
+ * supposed to be, having checked them */
+static int check_hits(kl_bvh_ray_t *ray, kl_bvh_hit_t *hits, int n) {
+  kl_bvh_hit_t expected[STRESS_ITEMS];
+  float t[STRESS_ITEMS];
+  int count = 0;
+  for (int i=0; i < STRESS_ITEMS; i++) {
+    t[i] = -1.0f;
+    if (objects[i].handle < 0 || !ray_sphere(ray, &objects[i].bounds, t + i)) continue;
+    expected[count++] = (kl_bvh_hit_t){ .item = (void*)(intptr_t)(i + 1), .t = t[i] };
+  }
+  qsort(expected, count, sizeof(kl_bvh_hit_t), &compare_t);
+  if (ray->max > 0 && count > ray->max) count = ray->max;
+  assert(n >= count);
+
+  /* items the same distance away can come in either order, and either be cut by max */
+  for (int i=0; i < count; i++) {
+    int index = (int)(intptr_t)hits[i].item - 1;
+    assert(index >= 0 && index < STRESS_ITEMS);
+    assert(hits[i].t == expected[i].t && t[index] == hits[i].t);
+    t[index] = -1.0f; /* hit twice would fail here */
+  }
+  return count;
+}
+
+/* what the tree's leaves are cast against, written the same way so the distances agree exactly */
+static bool ray_sphere(kl_bvh_ray_t *ray, kl_sphere_t *sphere, float *t) {
+  kl_vec3f_t offset;
+  kl_vec3f_sub(&offset, &ray->origin, &sphere->center);
+  float c = kl_vec3f_dot(&offset, &offset) - sphere->radius * sphere->radius;
+  if (c <= 0.0f) {
+    *t = 0.0f;
+    return true;
+  }
+  float b = kl_vec3f_dot(&offset, &ray->dir);
+  if (b >= 0.0f) return false;
+  float dd = kl_vec3f_dot(&ray->dir, &ray->dir);
+  float closest = -b / dd;
+  kl_vec3f_t miss;
+  kl_vec3f_scale(&miss, &ray->dir, closest);
+  kl_vec3f_add(&miss, &miss, &offset);
+  float disc = sphere->radius * sphere->radius - kl_vec3f_dot(&miss, &miss);
+  if (disc < 0.0f) return false;
+  *t = closest - sqrtf(disc / dd);
+  return *t <= ray->tmax;
+}
+
+static void check_near(kl_bvh_t *tree, unsigned *seed) {
+  for (int q=0; q < 8; q++) {
+    kl_vec3f_t point;
+    object_t *at = objects + rand_r(seed) % STRESS_ITEMS;
+    if (at->handle >= 0 && q % 2 == 0) {
+      point = at->bounds.center;
+    } else {
+      point = (kl_vec3f_t){ (frand(seed) - 0.5f) * STRESS_WORLD, (frand(seed) - 0.5f) * 100.0f, (frand(seed) - 0.5f) * STRESS_WORLD };
+    }
+    float radius = q % 4 == 0 ? 0.0f : q % 4 == 1 ? INFINITY : frand(seed) * 200.0f;
+    int   k      = q % 3 == 0 ? STRESS_ITEMS + 1 : rand_r(seed) % 10;
+    int   max    = q % 3 == 1 ? STRESS_ITEMS : rand_r(seed) % 10;
+
+    /* the same measures the tree's leaves take */
+    kl_bvh_hit_t expected[STRESS_ITEMS];
+    float dist[STRESS_ITEMS];
+    bool  inside[STRESS_ITEMS] = { false };
+    int count = 0, reached = 0;
+    for (int i=0; i < STRESS_ITEMS; i++) {
+      dist[i] = -1.0f;
+      if (objects[i].handle < 0) continue;
+      dist[i] = near_dist(&objects[i].bounds, &point);
+      if (dist[i] <= radius) expected[count++] = (kl_bvh_hit_t){ .item = (void*)(intptr_t)(i + 1), .t = dist[i] };
+      kl_vec3f_t offset;
+      kl_vec3f_sub(&offset, &point, &objects[i].bounds.center);
+      float reach = objects[i].bounds.radius + radius;
+      inside[i] = kl_vec3f_dot(&offset, &offset) <= reach * reach;
+      reached  += inside[i];
+    }
+    qsort(expected, count, sizeof(kl_bvh_hit_t), &compare_t);
+    if (count > k) count = k;
+
+    kl_array_t hits;
+    kl_array_init(&hits, sizeof(kl_bvh_hit_t));
+    int n = kl_bvh_nearest(tree, &point, k, radius, &hits);
+    assert(n == count && kl_array_size(&hits) == count);
+    kl_bvh_hit_t *found = kl_array_data(&hits);
+    for (int i=0; i < n; i++) {
+      int index = (int)(intptr_t)found[i].item - 1;
+      assert(index >= 0 && index < STRESS_ITEMS);
+      /* the same distance apart can come in either order */
+      assert(found[i].t == expected[i].t && dist[index] == found[i].t);
+      dist[index] = -1.0f; /* found twice would fail here */
+    }
+    kl_array_free(&hits);
+
+    void *items[STRESS_ITEMS];
+    n = kl_bvh_within(tree, &point, radius, items, max);
+    assert(n == reached);
+    for (int i=0; i < n && i < max; i++) {
+      int index = (int)(intptr_t)items[i] - 1;
+      assert(index >= 0 && index < STRESS_ITEMS && inside[index]);
+      inside[index] = false;
+    }
+  }
+}
+
+/* a leaf's box is the one around its sphere, so this is the larger of the distances to both */
+static float near_dist(kl_sphere_t *bounds, kl_vec3f_t *point) {
+  float p[3] = { point->x, point->y, point->z };
+  float c[3] = { bounds->center.x, bounds->center.y, bounds->center.z };
+  float box = 0.0f;
+  for (int axis=0; axis < 3; axis++) {
+    float d = fmaxf((c[axis] - bounds->radius) - p[axis], p[axis] - (c[axis] + bounds->radius));
+    if (d > 0.0f) box += d * d;
+  }
+  float sphere = kl_vec3f_dist(point, &bounds->center) - bounds->radius;
+  return fmaxf(fmaxf(sqrtf(box), sphere), 0.0f);
+}
+
+static int compare_t(const void *a, const void *b) {
+  float ta = ((kl_bvh_hit_t*)a)->t;
+  float tb = ((kl_bvh_hit_t*)b)->t;
+  return ta < tb ? -1 : ta > tb;
+}
+
+static int infrustum(kl_sphere_t *bounds, void *data) {
+  kl_frustum_t *frustum = data;
+  if (kl_plane_dist(&frustum->near, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->far, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->top, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->bottom, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->left, &bounds->center) > bounds->radius) return 0;
+  if (kl_plane_dist(&frustum->right, &bounds->center) > bounds->radius) return 0;
+  return 1;
+}
+
+/* with some slack for rounding, which grows with the size of the spheres */
+static bool sphere_contains(kl_sphere_t *outer, kl_sphere_t *inner) {
+  float slack = 1e-4f * (outer->radius + fabsf(outer->center.x) + fabsf(outer->center.y) + fabsf(outer->center.z));
+  return kl_vec3f_dist(&outer->center, &inner->center) + inner->radius <= outer->radius + slack;
+}
+
+/* clumped towards the middle, so small moves keep crossing each other's branches */
+static void random_bounds(kl_sphere_t *bounds, unsigned *seed) {
+  float spread = rand_r(seed) % 4 == 0 ? STRESS_WORLD : STRESS_WORLD * 0.1f;
+  bounds->center.x = (frand(seed) - 0.5f) * spread;
+  bounds->center.y = (frand(seed) - 0.5f) * spread * 0.2f;
+  bounds->center.z = (frand(seed) - 0.5f) * spread;
+  bounds->radius   = 0.5f + frand(seed) * frand(seed) * 20.0f;
+}
+
+static float frand(unsigned *seed) {
+  return (rand_r(seed) & 0xffffff) / 16777216.0f;
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -0,0 +1,654 @@
+#define _XOPEN_SOURCE 600 /* rand_r, usleep, pthread_barrier_t */
+
+/* stress-resource: sixteen threads hammering the same resource entries, asserting as they go
+ *
+ *   make stress                                   (asserts on, address and undefined checks)
+ *   make stress SANITIZE=-fsanitize=thread
+ *
+ * there are two loaders with an entry set each.  "cpu" loads anywhere, is reloaded and has its
+ * entries removed and re-added underneath the others, and prefetches its "gpu" counterpart once
+ * decoded.  "gpu" is main_thread, so its uploads have to wait for the main thread's
+ * kl_resource_pump, which is all the main thread does.  a few entries of each always fail.
+ *
+ * before any of that, on the main thread alone, a third loader "lru" loads synchronously.  a
+ * known run of increfs, failures and a reload has to show up in both dumps as exactly those
+ * counts, the json one parsing as json.  then it works under a small budget, against a model of
+ * what the cache should hold: the most recently released that fit, with increfs reviving cached
+ * ones instead of loading them again.
+ *
+ * then textures, with the renderer and the PNG decoder stubbed out: two identical files loaded a
+ * frame apart have to end up on one GL texture, a different one on its own, and the savings have
+ * to show up in kl_texture_dump_shared.
+ *
+ * first every thread increfs every entry at once, which has to decode each of them exactly once.
+ * then they mix sync and async increfs, prefetches, decrefs, pumps, budget changes, reloads,
+ * removals and dumps.  at the end nothing may be referenced, in flight or left allocated, and prefetches
+ * must have let go of theirs whether they loaded or failed. */
+
+#include "resource.h"
+#include "texture.h"
+#include "texture-png.h"
+#include "texture-cooked.h"
+#include "renderer.h"
+#include "mem.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STRESS_THREADS 16
+#define STRESS_ENTRIES 64
+#define STRESS_FAILING 4 /* more entries, past the others, which fail to decode */
+#define STRESS_OPS     20000
+#define LRU_ENTRIES    8 /* then one which fails, and one with a name to escape */
+#define LRU_OPS        2000
+#define TEXTURE_SIZE   512 /* big enough for the report's MB to show it */
+
+#define LOADER_CPU 0
+#define LOADER_GPU 1
+#define LOADER_LRU 2
+
+#define MAGIC 0x4b4c5354
+
+typedef struct stress_item {
+  uint32_t magic;
+  int loader, entry;
+} stress_item_t;
+
+typedef struct stress_counts {
+  int decodes[STRESS_ENTRIES + STRESS_FAILING];
+  int copies[STRESS_ENTRIES + STRESS_FAILING]; /* uploaded and not yet freed */
+} stress_counts_t;
+
+static void   check_stats();
+static char  *dump(bool json);
+static const char *json_value(const char *json);
+static const char *json_skip(const char *json, const char *literal);
+static void   check_lru();
+static void   lru_use(int entry, int *model, int *cached, int budget);
+static void   check_textures();
+static void   write_texture(char *path, int variant);
+static void  *stress_thread(void *arg);
+static void   stress_ops(unsigned seed);
+static void   *incref(int loader, int entry);
+static stress_item_t *decode(int loader, const char *vpath);
+static stress_item_t *decode_item(int loader, int entry);
+static void  *cpu_decode(kl_resource_blob_t *blob, const char *vpath);
+static void  *gpu_decode(kl_resource_blob_t *blob, const char *vpath);
+static void  *lru_load(const char *path, const char *vpath);
+static void  *upload(void *data, const char *path, const char *vpath);
+static void   discard(void *data);
+static void   item_free(void *data);
+static void   item_size(void *data, size_t *cpu, size_t *gpu);
+static void   item_reload(void *data, void *fresh);
+static void   cpu_deps(void *data, const char *vpath);
+static void   entry_vpath(char *vpath, int loader, int entry);
+static int    entry_index(const char *vpath);
+static bool   settled();
+
+static kl_resource_loader_t *loaders[3];
+static stress_counts_t counts[3];
+static pthread_t main_thread;
+static pthread_barrier_t barrier;
+static int finished = 0;
+static FILE *sink;
+static int gl_uploads, gl_textures; /* by the stubs, on the main thread */
+
+/* ------------------------- */
+int main(int argc, char **argv) {
+  loaders[LOADER_CPU] = kl_resource_loader_new_async(&cpu_decode, &upload, &discard, &item_free);
+  loaders[LOADER_GPU] = kl_resource_loader_new_async(&gpu_decode, &upload, &discard, &item_free);
+  loaders[LOADER_CPU]->name   = "cpu";
+  loaders[LOADER_CPU]->reload = &item_reload;
+  loaders[LOADER_CPU]->deps   = &cpu_deps;
+  loaders[LOADER_GPU]->name   = "gpu";
+  loaders[LOADER_GPU]->main_thread = true;
+  loaders[LOADER_LRU] = kl_resource_loader_new(&lru_load, &item_free);
+  loaders[LOADER_LRU]->name   = "lru";
+  loaders[LOADER_LRU]->reload = &item_reload;
+  for (int i=0; i < 3; i++) loaders[i]->size = &item_size;
+
+  char vpath[32];
+  for (int l=0; l < 2; l++) {
+    for (int i=0; i < STRESS_ENTRIES + STRESS_FAILING; i++) {
+      entry_vpath(vpath, l, i);
+      kl_resource_add_entry("", vpath);
+    }
+  }
+  for (int i=0; i < LRU_ENTRIES + 2; i++) {
+    entry_vpath(vpath, LOADER_LRU, i);
+    kl_resource_add_entry("", vpath);
+  }
+
+  sink = fopen("/dev/null", "w");
+  assert(sink != NULL);
+  main_thread = pthread_self();
+  kl_resource_set_main_thread();
+  check_stats();
+  check_lru();
+  check_textures();
+  pthread_barrier_init(&barrier, NULL, STRESS_THREADS);
+  pthread_t threads[STRESS_THREADS];
+  for (int i=0; i < STRESS_THREADS; i++) {
+    pthread_create(&threads[i], NULL, &stress_thread, (void*)(size_t)(i + 1));
+  }
+  /* the gpu loader's uploads happen here, everyone else waits on them */
+  while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < STRESS_THREADS) {
+    if (kl_resource_pump(1.0f) == 0) usleep(100);
+  }
+  for (int i=0; i < STRESS_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  /* the workers finish what's queued before they stop, the pump lets go of it */
+  kl_resource_shutdown();
+  kl_resource_pump(1000.0f);
+  kl_resource_set_budget(0, 0);
+  assert(settled());
+  for (int l=0; l < 2; l++) {
+    for (int i=0; i < STRESS_ENTRIES + STRESS_FAILING; i++) {
+      assert(counts[l].copies[i] == 0);
+    }
+  }
+
+  kl_resource_dump(stdout, 0);
+  kl_texture_dump_shared(stdout);
+  printf("stress-resource: ok\n");
+  return 0;
+}
+
+/* ------------------------- */
+static void check_stats() {
+  char vpath[32];
+  int loaded = 0;
+  entry_vpath(vpath, LOADER_LRU, 1);
+  loaded += incref(LOADER_LRU, 1) != NULL; /* miss */
+  kl_resource_decref(vpath);
+  entry_vpath(vpath, LOADER_LRU, 0);
+  loaded += incref(LOADER_LRU, 0) != NULL; /* miss */
+  loaded += incref(LOADER_LRU, 0) != NULL; /* hit */
+  kl_resource_decref(vpath);
+  kl_resource_decref(vpath);
+  loaded += incref(LOADER_LRU, 0) != NULL; /* hit, cached */
+  loaded += incref(LOADER_LRU, LRU_ENTRIES) != NULL;
+  loaded += incref(LOADER_LRU, LRU_ENTRIES) != NULL; /* failed ones are tried again */
+  loaded += incref(LOADER_LRU, LRU_ENTRIES + 1) != NULL;
+  int reloaded = kl_resource_reload(vpath);
+  assert(loaded == 5 && reloaded == 0);
+  /* 4 loads, the reload included, 2 failures, 2 hits, 5 misses */
+
+  char *text = dump(false);
+  char name[16];
+  uint64_t loads, failures, hits, misses, reloads;
+  const char *line = strstr(text, "Resource: lru ");
+  assert(line != NULL);
+  int scanned = sscanf(line, "Resource: %15s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+    name, &loads, &failures, &hits, &misses, &reloads);
+  assert(scanned == 6);
+  assert(loads == 4 && failures == 2 && hits == 2 && misses == 5 && reloads == 1);
+  assert(strstr(text, "Resource: 3 slowest of 3 loaded:") != NULL);
+  free(text);
+
+  char *json = dump(true);
+  const char *end = json_value(json);
+  assert(end != NULL && *json_skip(end, "") == '\0');
+  const char *lru = strstr(json, "{ \"name\": \"lru\", ");
+  assert(lru != NULL);
+  scanned = sscanf(lru, "{ \"name\": \"lru\", \"loads\": %" SCNu64 ", \"failures\": %" SCNu64
+    ", \"hits\": %" SCNu64 ", \"misses\": %" SCNu64 ", \"reloads\": %" SCNu64,
+    &loads, &failures, &hits, &misses, &reloads);
+  assert(scanned == 5);
+  assert(loads == 4 && failures == 2 && hits == 2 && misses == 5 && reloads == 1);
+  assert(strstr(json, "\"vpath\": \"/lru/00\"") != NULL && strstr(json, "\"vpath\": \"/lru/01\"") != NULL);
+  assert(strstr(json, "\"vpath\": \"/lru \\\"x\\\"\\u0009/09\"") != NULL);
+  free(json);
+
+  kl_resource_decref(vpath);
+  entry_vpath(vpath, LOADER_LRU, LRU_ENTRIES + 1);
+  kl_resource_decref(vpath);
+  kl_resource_set_budget(0, 0);
+  kl_resource_set_budget(KL_RESOURCE_CPU_BUDGET, KL_RESOURCE_GPU_BUDGET);
+}
+
+/* the whole of a dump, nul terminated, to free */
+static char *dump(bool json) {
+  FILE *out = tmpfile();
+  assert(out != NULL);
+  if (json) kl_resource_dump_json(out, 8);
+  else kl_resource_dump(out, 8);
+  long size = ftell(out);
+  char *text = malloc(size + 1);
+  rewind(out);
+  size_t read = fread(text, 1, size, out);
+  assert(read == (size_t)size);
+  text[size] = '\0';
+  fclose(out);
+  return text;
+}
+
+/* returns past the json value json starts with, leading space included, or NULL if it isn't one */
+static const char *json_value(const char *json) {
+  json = json_skip(json, "");
+  if (*json == '{' || *json == '[') {
+    char close = *json == '{' ? '}' : ']';
+    json = json_skip(json + 1, "");
+    if (*json == close) return json + 1;
+    for (;;) {
+      if (close == '}') {
+        json = json_skip(json, "");
+        if (*json != '"' || (json = json_value(json)) == NULL) return NULL;
+        if ((json = json_skip(json, ":")) == NULL) return NULL;
+      }
+      if ((json = json_value(json)) == NULL) return NULL;
+      json = json_skip(json, "");
+      if (*json == close) return json + 1;
+      if ((json = json_skip(json, ",")) == NULL) return NULL;
+    }
+  }
+  if (*json == '"') {
+    for (json++; *json != '"'; json++) {
+      if ((unsigned char)*json < 0x20) return NULL;
+      if (*json != '\\') continue;
+      json++;
+      if (*json == 'u') {
+        for (int i=1; i <= 4; i++) {
+          if (!isxdigit((unsigned char)json[i])) return NULL;
+        }
+        json += 4;
+      } else if (strchr("\"\\/bfnrt", *json) == NULL || *json == '\0') {
+        return NULL;
+      }
+    }
+    return json + 1;
+  }
+  static const char *literals[] = { "true", "false", "null" };
+  for (int i=0; i < 3; i++) {
+    if (strncmp(json, literals[i], strlen(literals[i])) == 0) return json + strlen(literals[i]);
+  }
+  /* numbers, as strictly as json has them */
+  const char *start = json;
+  if (*json == '-') json++;
+  if (*json == '0') json++;
+  else if (*json >= '1' && *json <= '9') while (isdigit((unsigned char)*json)) json++;
+  else return NULL;
+  if (*json == '.') {
+    if (!isdigit((unsigned char)*++json)) return NULL;
+    while (isdigit((unsigned char)*json)) json++;
+  }
+  if (*json == 'e' || *json == 'E') {
+    json++;
+    if (*json == '+' || *json == '-') json++;
+    if (!isdigit((unsigned char)*json)) return NULL;
+    while (isdigit((unsigned char)*json)) json++;
+  }
+  return json > start ? json : NULL;
+}
+
+/* skips white space and then literal, NULL if literal isn't there */
+static const char *json_skip(const char *json, const char *literal) {
+  while (*json == ' ' || *json == '\t' || *json == '\n' || *json == '\r') json++;
+  size_t n = strlen(literal);
+  if (strncmp(json, literal, n) != 0) return NULL;
+  return json + n;
+}
+
+static void check_lru() {
+  int model[LRU_ENTRIES]; /* the cached entries, most recently released first */
+  int cached = 0;
+  unsigned seed = 1;
+  for (int op=0; op < LRU_OPS; op++) {
+    /* the budget moves now and then, evicting whatever no longer fits */
+    int budget = 1 + op / 250 % 4;
+    if (op % 250 == 0) {
+      kl_resource_set_budget(budget * sizeof(stress_item_t), 0);
+      if (cached > budget) cached = budget;
+    }
+    lru_use(rand_r(&seed) % LRU_ENTRIES, model, &cached, budget);
+
+    size_t bytes = 0;
+    for (int i=0; i < LRU_ENTRIES; i++) {
+      bool expected = false;
+      for (int j=0; j < cached; j++) expected |= model[j] == i;
+      assert(counts[LOADER_LRU].copies[i] == expected);
+      bytes += counts[LOADER_LRU].copies[i] * sizeof(stress_item_t);
+    }
+    assert(bytes <= budget * sizeof(stress_item_t));
+  }
+
+  /* referenced, it stays over any budget, and goes as soon as it's let go of */
+  char vpath[32];
+  entry_vpath(vpath, LOADER_LRU, 0);
+  stress_item_t *held = incref(LOADER_LRU, 0);
+  assert(held != NULL);
+  kl_resource_set_budget(0, 0);
+  for (int i=0; i < LRU_ENTRIES; i++) {
+    assert(counts[LOADER_LRU].copies[i] == (i == 0));
+  }
+  kl_resource_decref(vpath);
+  assert(counts[LOADER_LRU].copies[0] == 0);
+  kl_resource_set_budget(KL_RESOURCE_CPU_BUDGET, KL_RESOURCE_GPU_BUDGET);
+}
+
+/* increfs and decrefs an entry, moving it to the front of the model -- only loading it if it wasn't
+ * cached, and pushing the least recently released out of the budget */
+static void lru_use(int entry, int *model, int *cached, int budget) {
+  int decodes = counts[LOADER_LRU].decodes[entry];
+  int at = 0;
+  while (at < *cached && model[at] != entry) at++;
+  bool revived = at < *cached;
+  if (!revived && *cached < budget) (*cached)++;
+  if (at == *cached) at--;
+  memmove(model + 1, model, at * sizeof(int));
+  model[0] = entry;
+
+  char vpath[32];
+  entry_vpath(vpath, LOADER_LRU, entry);
+  stress_item_t *item = incref(LOADER_LRU, entry);
+  assert(item != NULL);
+  assert(counts[LOADER_LRU].decodes[entry] == decodes + !revived);
+  kl_resource_decref(vpath);
+}
+
+static void check_textures() {
+  static const char *vpaths[] = { "/tex/00", "/tex/01", "/tex/02" };
+  char paths[3][32];
+  for (int i=0; i < 3; i++) {
+    write_texture(paths[i], i == 2);
+    kl_resource_add_entry(paths[i], vpaths[i]);
+  }
+
+  /* the first is on the GPU by the time its twin turns up */
+  kl_texture_t *first = kl_texture_incref(vpaths[0]);
+  assert(first != NULL && gl_uploads == 1);
+  kl_resource_pump(1.0f);
+  kl_texture_t *twin  = kl_texture_incref(vpaths[1]);
+  kl_texture_t *other = kl_texture_incref(vpaths[2]);
+  assert(twin != NULL && other != NULL);
+  assert(twin->share == first->share && twin->id == first->id);
+  assert(other->share != first->share && other->id != first->id);
+  assert(gl_uploads == 2 && gl_textures == 2);
+
+  FILE *out = tmpfile();
+  assert(out != NULL);
+  kl_texture_dump_shared(out);
+  rewind(out);
+  char line[128];
+  int textures, live;
+  uint64_t aliased, decodes_saved;
+  double bytes_saved, gpu_saved;
+  int scanned = fscanf(out, "Texture: %d textures on %d GL textures\n", &textures, &live);
+  assert(scanned == 2 && textures == 3 && live == 2);
+  scanned = fscanf(out, "Texture: %" SCNu64 " loads found identical contents already on the GPU, %" SCNu64 " without decoding\n",
+    &aliased, &decodes_saved);
+  assert(scanned == 2 && aliased == 1 && decodes_saved == 1);
+  scanned = fscanf(out, "Texture: saved %lf MB of decoding and %lf MB of video memory\n", &bytes_saved, &gpu_saved);
+  assert(scanned == 2 && bytes_saved >= 1.3 && gpu_saved >= 1.3);
+  assert(fgets(line, sizeof(line), out) == NULL);
+  fclose(out);
+
+  for (int i=0; i < 3; i++) {
+    kl_resource_decref(vpaths[i]);
+  }
+  kl_resource_set_budget(0, 0);
+  kl_resource_pump(1.0f);
+  assert(gl_textures == 0);
+  kl_resource_set_budget(KL_RESOURCE_CPU_BUDGET, KL_RESOURCE_GPU_BUDGET);
+  for (int i=0; i < 3; i++) {
+    kl_resource_remove_entry(vpaths[i]);
+    unlink(paths[i]);
+  }
+}
+
+/* a cooked TEXTURE_SIZE square, the variants differ in one texel */
+static void write_texture(char *path, int variant) {
+  kl_texture_image_t image = { TEXTURE_SIZE, TEXTURE_SIZE, KL_TEXFMT_RGBA, 1, NULL };
+  uint32_t *texels = malloc(TEXTURE_SIZE * TEXTURE_SIZE * 4);
+  for (int i=0; i < TEXTURE_SIZE * TEXTURE_SIZE; i++) {
+    texels[i] = 0xFF000000 | (i * 2654435761u >> 8);
+  }
+  texels[0] += variant;
+  image.data = texels;
+
+  strcpy(path, "/tmp/stress-texture-XXXXXX");
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  FILE *out = fdopen(fd, "wb");
+  assert(out != NULL);
+  int cooked = kl_texture_cook(&image, out);
+  assert(cooked == 0);
+  fclose(out);
+  free(texels);
+}
+
+static void *stress_thread(void *arg) {
+  unsigned seed = (unsigned)(size_t)arg;
+
+  /* everyone at once, each in their own order */
+  int order[STRESS_ENTRIES];
+  for (int i=0; i < STRESS_ENTRIES; i++) order[i] = i;
+  for (int i=STRESS_ENTRIES-1; i > 0; i--) {
+    int j = rand_r(&seed) % (i + 1);
+    int t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  pthread_barrier_wait(&barrier);
+  for (int i=0; i < STRESS_ENTRIES; i++) {
+    for (int l=0; l < 2; l++) {
+      stress_item_t *item = incref(l, order[i]);
+      assert(item != NULL);
+    }
+  }
+  if (pthread_barrier_wait(&barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+    for (int l=0; l < 2; l++) {
+      for (int i=0; i < STRESS_ENTRIES; i++) {
+        assert(counts[l].decodes[i] == 1);
+        assert(counts[l].copies[i] == 1);
+      }
+    }
+  }
+  pthread_barrier_wait(&barrier);
+  char vpath[32];
+  for (int l=0; l < 2; l++) {
+    for (int i=0; i < STRESS_ENTRIES; i++) {
+      entry_vpath(vpath, l, i);
+      kl_resource_decref(vpath);
+    }
+  }
+
+  stress_ops(seed);
+  __atomic_add_fetch(&finished, 1, __ATOMIC_ACQ_REL);
+  return NULL;
+}
+
+static void stress_ops(unsigned seed) {
+  char vpath[32];
+  for (int i=0; i < STRESS_OPS; i++) {
+    int loader = rand_r(&seed) % 2;
+    int entry  = rand_r(&seed) % (STRESS_ENTRIES + STRESS_FAILING);
+    entry_vpath(vpath, loader, entry);
+
+    int op = rand_r(&seed) % 100;
+    if (op < 35) {
+      stress_item_t *item = incref(loader, entry);
+      if (item == NULL) continue; /* failed, or removed for the moment */
+      if (op < 10) kl_resource_pump(0.1f);
+      kl_resource_decref(vpath);
+    } else if (op < 65) {
+      kl_resource_item_t *handle = kl_resource_incref_async(loaders[loader], vpath);
+      if (handle == NULL) continue;
+      stress_item_t *item = kl_resource_get(handle);
+      assert(item == NULL || (item->magic == MAGIC && item->loader == loader && item->entry == entry));
+      kl_resource_decref(vpath);
+    } else if (op < 80) {
+      /* the reference is the load's, to drop when it's over */
+      kl_resource_prefetch(loaders[loader], vpath);
+    } else if (op < 90) {
+      kl_resource_pump(0.1f);
+    } else if (op < 95) {
+      /* the gpu loader's can only be reloaded, or removed, on the main thread */
+      entry_vpath(vpath, LOADER_CPU, entry);
+      kl_resource_item_t *handle = kl_resource_incref_async(loaders[LOADER_CPU], vpath);
+      if (handle == NULL) continue;
+      kl_resource_reload(vpath);
+      kl_resource_decref(vpath);
+    } else if (op < 98) {
+      /* fails while anyone's using it, and nobody can load it again until it's back -- so whatever
+       * was loaded has to have been let go of, once a free already unloaded from the cache lands */
+      entry_vpath(vpath, LOADER_CPU, entry);
+      if (kl_resource_remove_entry(vpath) == 0) {
+        for (int spins=0; spins < 100000 && __atomic_load_n(&counts[LOADER_CPU].copies[entry], __ATOMIC_ACQUIRE) != 0; spins++) {
+          sched_yield();
+        }
+        assert(__atomic_load_n(&counts[LOADER_CPU].copies[entry], __ATOMIC_ACQUIRE) == 0);
+        kl_resource_add_entry("", vpath);
+      }
+    } else if (op < 99) {
+      /* reads the items it reports on while they're removed underneath */
+      if (rand_r(&seed) % 2) kl_resource_dump(sink, 8);
+      else kl_resource_dump_json(sink, 8);
+    } else {
+      kl_resource_set_budget(rand_r(&seed) % 2 ? 0 : 30 * sizeof(stress_item_t), 0);
+    }
+  }
+}
+
+static void *incref(int loader, int entry) {
+  char vpath[32];
+  entry_vpath(vpath, loader, entry);
+  stress_item_t *item = kl_resource_incref(loaders[loader], vpath);
+  assert(item == NULL || (item->magic == MAGIC && item->loader == loader && item->entry == entry));
+  return item;
+}
+
+static stress_item_t *decode(int loader, const char *vpath) {
+  int entry = entry_index(vpath);
+  __atomic_add_fetch(&counts[loader].decodes[entry], 1, __ATOMIC_RELAXED);
+  usleep(50); /* long enough for the others to pile up on it */
+  if (entry >= STRESS_ENTRIES) return NULL;
+  return decode_item(loader, entry);
+}
+
+static stress_item_t *decode_item(int loader, int entry) {
+  stress_item_t *item = malloc(sizeof(stress_item_t));
+  item->magic  = MAGIC;
+  item->loader = loader;
+  item->entry  = entry;
+  return item;
+}
+
+static void *lru_load(const char *path, const char *vpath) {
+  int entry = entry_index(vpath);
+  counts[LOADER_LRU].decodes[entry]++;
+  if (entry == LRU_ENTRIES) return NULL;
+  return upload(decode_item(LOADER_LRU, entry), path, vpath);
+}
+
+static void *cpu_decode(kl_resource_blob_t *blob, const char *vpath) {
+  return decode(LOADER_CPU, vpath);
+}
+
+static void *gpu_decode(kl_resource_blob_t *blob, const char *vpath) {
+  return decode(LOADER_GPU, vpath);
+}
+
+static void *upload(void *data, const char *path, const char *vpath) {
+  stress_item_t *item = data;
+  assert(item->magic == MAGIC);
+  assert(item->loader != LOADER_GPU || pthread_equal(pthread_self(), main_thread));
+  __atomic_add_fetch(&counts[item->loader].copies[item->entry], 1, __ATOMIC_RELAXED);
+  return item;
+}
+
+static void discard(void *data) {
+  stress_item_t *item = data;
+  assert(item->magic == MAGIC);
+  item->magic = 0;
+  free(item);
+}
+
+static void item_free(void *data) {
+  stress_item_t *item = data;
+  assert(item->magic == MAGIC);
+  assert(item->loader != LOADER_GPU || pthread_equal(pthread_self(), main_thread));
+  __atomic_sub_fetch(&counts[item->loader].copies[item->entry], 1, __ATOMIC_RELAXED);
+  item->magic = 0;
+  free(item);
+}
+
+static void item_size(void *data, size_t *cpu, size_t *gpu) {
+  *cpu = sizeof(stress_item_t);
+  *gpu = 0;
+}
+
+/* nothing to move over, the fresh copy is identical */
+static void item_reload(void *data, void *fresh) {
+  item_free(fresh);
+}
+
+/* from the worker thread, like a model prefetching its materials */
+static void cpu_deps(void *data, const char *vpath) {
+  char dep[32];
+  entry_vpath(dep, LOADER_GPU, entry_index(vpath));
+  kl_resource_prefetch(loaders[LOADER_GPU], dep);
+}
+
+static void entry_vpath(char *vpath, int loader, int entry) {
+  static const char *dirs[] = { "cpu", "gpu", "lru" };
+  if (loader == LOADER_LRU && entry == LRU_ENTRIES + 1) {
+    snprintf(vpath, 32, "/lru \"x\"\t/%02d", entry);
+    return;
+  }
+  snprintf(vpath, 32, "/%s/%02d", dirs[loader], entry);
+}
+
+static int entry_index(const char *vpath) {
+  int entry = atoi(strrchr(vpath, '/') + 1);
+  assert(entry >= 0 && entry < STRESS_ENTRIES + STRESS_FAILING);
+  return entry;
+}
+
+/* nothing referenced, in flight or held past the budget */
+static bool settled() {
+  char vpath[32];
+  for (int l=0; l < 2; l++) {
+    for (int i=0; i < STRESS_ENTRIES + STRESS_FAILING; i++) {
+      entry_vpath(vpath, l, i);
+      kl_resource_item_t *item = kl_resource_find(vpath);
+      if (item == NULL) return false;
+      if (item->refs != 0 || item->prefetch) return false;
+      if (item->state != KL_RESOURCE_UNLOADED && item->state != KL_RESOURCE_FAILED) return false;
+    }
+  }
+  return true;
+}
+
+/* texture.c without a GL context or libpng -- uploads hand out ids, and only cooked files decode */
+unsigned int kl_render_upload_texture(void *data, int w, int h, int format, bool clamp, bool filter) {
+  assert(pthread_equal(pthread_self(), main_thread));
+  gl_textures++;
+  return ++gl_uploads;
+}
+
+unsigned int kl_render_upload_texture_mips(void *data, int w, int h, int levels, int format, bool clamp) {
+  return kl_render_upload_texture(data, w, h, format, clamp, true);
+}
+
+void kl_render_free_texture(unsigned int texture) {
+  assert(pthread_equal(pthread_self(), main_thread));
+  assert(texture > 0 && texture <= gl_uploads);
+  gl_textures--;
+}
+
+bool kl_texture_decodepng(const uint8_t *data, size_t size, const char *name, kl_texture_image_t *image) {
+  return false;
+}
+
+/* vim: set ts=2 sw=2 et */
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "vec.h"
 #include "renderer.h"
+#include "mem.h"
 
 #include <stdio.h>
 
@@ -31,18 +32,21 @@ typedef struct svo_node {
   struct svo_node*  children[8];
 } svo_node_t;
 
+KL_ARRAY_DECLARE(kl_vec3f_t, vec3f)
+KL_ARRAY_DECLARE(triangle_t, tris)
+
 static void svo_free(svo_node_t *node) {
   if (node == NULL) return;
   for (int i=0; i < 8; i++) {
     svo_free(node->children[i]);
   }
-  free(node);
+  kl_mem_free(KL_MEM_TERRAIN, node);
 }
 
 static void mesh_init(mesh_t *mesh) {
-  kl_array_init(&mesh->verts, sizeof(kl_vec3f_t));
-  kl_array_init(&mesh->norms, sizeof(kl_vec3f_t));
-  kl_array_init(&mesh->tris, sizeof(triangle_t));
+  kl_array_vec3f_init(&mesh->verts);
+  kl_array_vec3f_init(&mesh->norms);
+  kl_array_tris_init(&mesh->tris);
 }
 
 static void mesh_free(mesh_t *mesh) {
@@ -55,7 +59,7 @@ static svo_node_t* testsphere(kl_sphere_t *sphere, int depth, int x, int y, int
   if (depth < 0) return NULL;
   int size   = 1 << depth;
   int center = depth > 0 ? 1 << (depth - 1) : 0;
-  svo_node_t *node = malloc(sizeof(svo_node_t));
+  svo_node_t *node = kl_mem_alloc(KL_MEM_TERRAIN, sizeof(svo_node_t));
 
   kl_vec3f_t position, normal;
   position.x = (float)(x + center);
@@ -134,8 +138,8 @@ static int genvert(mesh_t *mesh, voxel_info_t *v0, voxel_info_t *v1) {
   kl_vec3f_midpoint(&vert, &v0->position, &v1->position);
   kl_vec3f_midpoint(&norm, &v0->normal,   &v1->normal);
   kl_vec3f_norm(&norm, &norm);
-  int i = kl_array_push(&mesh->verts, &vert);
-  kl_array_set_expand(&mesh->norms, i, &norm, 0);
+  int i = kl_array_vec3f_push(&mesh->verts, vert);
+  kl_array_vec3f_push(&mesh->norms, norm);
   return i;
 }
 
@@ -150,63 +154,63 @@ static void genfaces(mesh_t *mesh, voxel_info_t *voxel) {
       tri.vert[0] = genvert(mesh, &voxel[0], &voxel[1]);
       tri.vert[1] = genvert(mesh, &voxel[0], &voxel[2]);
       tri.vert[2] = genvert(mesh, &voxel[0], &voxel[4]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       break;
     case 0x02:
       tri.vert[0] = genvert(mesh, &voxel[1], &voxel[0]);
       tri.vert[1] = genvert(mesh, &voxel[1], &voxel[5]);
       tri.vert[2] = genvert(mesh, &voxel[1], &voxel[3]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       break;
     case 0x03:
       tri.vert[0] = genvert(mesh, &voxel[0], &voxel[2]);
       tri.vert[1] = genvert(mesh, &voxel[0], &voxel[4]);
       tri.vert[2] = genvert(mesh, &voxel[1], &voxel[5]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       tri.vert[0] = genvert(mesh, &voxel[1], &voxel[3]);
       tri.vert[1] = genvert(mesh, &voxel[0], &voxel[2]);
       tri.vert[2] = genvert(mesh, &voxel[1], &voxel[5]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       break;
     case 0x04:
       tri.vert[0] = genvert(mesh, &voxel[2], &voxel[0]);
       tri.vert[1] = genvert(mesh, &voxel[2], &voxel[3]);
       tri.vert[2] = genvert(mesh, &voxel[2], &voxel[6]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       break;
     case 0x05:
       tri.vert[0] = genvert(mesh, &voxel[0], &voxel[1]);
       tri.vert[1] = genvert(mesh, &voxel[2], &voxel[6]);
       tri.vert[2] = genvert(mesh, &voxel[0], &voxel[4]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       tri.vert[0] = genvert(mesh, &voxel[2], &voxel[3]);
       tri.vert[1] = genvert(mesh, &voxel[2], &voxel[6]);
       tri.vert[2] = genvert(mesh, &voxel[0], &voxel[1]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       break;
     case 0x06:
       tri.vert[0] = genvert(mesh, &voxel[1], &voxel[0]);
       tri.vert[1] = genvert(mesh, &voxel[1], &voxel[5]);
       tri.vert[2] = genvert(mesh, &voxel[1], &voxel[3]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       tri.vert[0] = genvert(mesh, &voxel[2], &voxel[0]);
       tri.vert[1] = genvert(mesh, &voxel[2], &voxel[3]);
       tri.vert[2] = genvert(mesh, &voxel[2], &voxel[6]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       break;
     case 0x07:
       tri.vert[0] = genvert(mesh, &voxel[0], &voxel[4]);
       tri.vert[1] = genvert(mesh, &voxel[1], &voxel[5]);
       tri.vert[2] = genvert(mesh, &voxel[2], &voxel[6]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       tri.vert[0] = genvert(mesh, &voxel[1], &voxel[3]);
       tri.vert[1] = genvert(mesh, &voxel[2], &voxel[3]);
       tri.vert[2] = genvert(mesh, &voxel[1], &voxel[5]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       tri.vert[0] = genvert(mesh, &voxel[2], &voxel[3]);
       tri.vert[1] = genvert(mesh, &voxel[2], &voxel[6]);
       tri.vert[2] = genvert(mesh, &voxel[1], &voxel[5]);
-      kl_array_push(&mesh->tris, &tri);
+      kl_array_tris_push(&mesh->tris, tri);
       break;
   }
 }
@@ -303,13 +307,13 @@ kl_terrain_t* kl_terrain_testsphere() {
   mesh_init(&mesh);
   meshify(root, &mesh, depth, 0, 0, 0);
   svo_free(root);
-  mesh_free(&mesh);
 
-  kl_terrain_t* terrain = malloc(sizeof(kl_terrain_t));
+  kl_terrain_t* terrain = kl_mem_alloc(KL_MEM_TERRAIN, sizeof(kl_terrain_t));
   terrain->buf_verts = kl_render_upload_vertdata(kl_array_data(&mesh.verts), kl_array_bytes(&mesh.verts));
   terrain->buf_norms = kl_render_upload_vertdata(kl_array_data(&mesh.norms), kl_array_bytes(&mesh.norms));
   terrain->buf_tris  = kl_render_upload_tris(kl_array_data(&mesh.tris), kl_array_bytes(&mesh.tris));
   terrain->tris_n = kl_array_size(&mesh.tris);
+  mesh_free(&mesh);
 
   kl_render_attrib_t cfg[2];
   cfg[0] = (kl_render_attrib_t){
@@ -0,0 +1,192 @@
+#include "texture-cooked.h"
+
+#include "mem.h"
+
+#include <math.h>
+#include <string.h>
+
+typedef struct cooked_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t w, h;
+  uint32_t format;
+  uint32_t levels;
+} cooked_header_t;
+
+static int    channels(int format);
+static bool   is_srgb(int format);
+static size_t chain_bytes(unsigned int w, unsigned int h, int c, int levels);
+static void   downsample(const uint8_t *src, int w, int h, uint8_t *dst, int c, bool srgb, const float *tolinear);
+static float  to_srgb(float v);
+
+/* ------------------ */
+bool kl_texture_iscooked(const uint8_t *data, size_t size) {
+  if (data == NULL) return false;
+  if (size < sizeof(cooked_header_t)) return false;
+  uint32_t magic;
+  memcpy(&magic, data, sizeof(magic));
+  return magic == KL_TEXTURE_COOKED_MAGIC;
+}
+
+bool kl_texture_decodecooked(const uint8_t *data, size_t size, const char *name, kl_texture_image_t *image) {
+  image->w    = 0;
+  image->h    = 0;
+  image->data = NULL;
+
+  if (!kl_texture_iscooked(data, size)) {
+    fprintf(stderr, "image-cooked: %s is not a cooked texture\n", name);
+    return false;
+  }
+  cooked_header_t header;
+  memcpy(&header, data, sizeof(header));
+  if (header.version != KL_TEXTURE_COOKED_VERSION) {
+    fprintf(stderr, "image-cooked: %s was cooked by a different version, recook it\n", name);
+    return false;
+  }
+  int c = channels(header.format);
+  if (c == 0 || header.w == 0 || header.h == 0 || header.w > 0x8000 || header.h > 0x8000 || header.levels < 1 || header.levels > 16) {
+    fprintf(stderr, "image-cooked: Bad image format for %s\n", name);
+    return false;
+  }
+  size_t bytes = chain_bytes(header.w, header.h, c, header.levels);
+  if (size != sizeof(header) + bytes) {
+    fprintf(stderr, "image-cooked: %s is truncated\n", name);
+    return false;
+  }
+
+  image->w      = header.w;
+  image->h      = header.h;
+  image->format = header.format;
+  image->levels = header.levels;
+  image->data   = kl_mem_alloc(KL_MEM_TEXTURE, bytes);
+  memcpy(image->data, data + sizeof(header), bytes);
+  return true;
+}
+
+int kl_texture_cook(kl_texture_image_t *image, FILE *out) {
+  int c = channels(image->format);
+  if (c == 0 || image->levels != 1) return -1;
+
+  int levels = 1;
+  while ((image->w >> levels) > 0 || (image->h >> levels) > 0) levels++;
+
+  cooked_header_t header = {
+    .magic   = KL_TEXTURE_COOKED_MAGIC,
+    .version = KL_TEXTURE_COOKED_VERSION,
+    .w       = image->w,
+    .h       = image->h,
+    .format  = image->format,
+    .levels  = levels
+  };
+  if (fwrite(&header, sizeof(header), 1, out) != 1) return -1;
+
+  size_t bytes = (size_t)image->w * image->h * c;
+  if (bytes > 0 && fwrite(image->data, bytes, 1, out) != 1) return -1;
+
+  /* filtering sRGB values directly would darken every level */
+  float tolinear[0x100];
+  for (int i=0; i < 0x100; i++) {
+    float v = i / 255.0f;
+    tolinear[i] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+  }
+
+  int err = 0;
+  int w = image->w;
+  int h = image->h;
+  uint8_t *src = image->data;
+  uint8_t *buf = kl_mem_alloc(KL_MEM_TEXTURE, bytes / 2 + c);
+  uint8_t *tmp = kl_mem_alloc(KL_MEM_TEXTURE, bytes / 2 + c);
+  for (int i=1; i < levels; i++) {
+    int nw = w > 1 ? w / 2 : 1;
+    int nh = h > 1 ? h / 2 : 1;
+    downsample(src, w, h, buf, c, is_srgb(image->format), tolinear);
+    if (fwrite(buf, (size_t)nw * nh * c, 1, out) != 1) {
+      err = -1;
+      break;
+    }
+    /* each level is filtered from the one above it */
+    uint8_t *swap = buf;
+    buf = tmp;
+    tmp = swap;
+    src = tmp;
+    w   = nw;
+    h   = nh;
+  }
+  kl_mem_free(KL_MEM_TEXTURE, buf);
+  kl_mem_free(KL_MEM_TEXTURE, tmp);
+  return err;
+}
+
+/* ------------------ */
+static int channels(int format) {
+  switch (format) {
+    case KL_TEXFMT_I:
+    case KL_TEXFMT_X:
+      return 1;
+    case KL_TEXFMT_IA:
+    case KL_TEXFMT_XY:
+      return 2;
+    case KL_TEXFMT_RGB:
+    case KL_TEXFMT_BGR:
+    case KL_TEXFMT_XYZ:
+      return 3;
+    case KL_TEXFMT_RGBA:
+    case KL_TEXFMT_BGRA:
+    case KL_TEXFMT_XYZW:
+      return 4;
+  }
+  return 0;
+}
+
+static bool is_srgb(int format) {
+  return format < KL_TEXFMT_X;
+}
+
+static size_t chain_bytes(unsigned int w, unsigned int h, int c, int levels) {
+  size_t bytes = 0;
+  for (int i=0; i < levels; i++) {
+    bytes += (size_t)w * h * c;
+    w = w > 1 ? w / 2 : 1;
+    h = h > 1 ? h / 2 : 1;
+  }
+  return bytes;
+}
+
+/* 2x2 box filter, odd rows and columns are folded into the last texel */
+static void downsample(const uint8_t *src, int w, int h, uint8_t *dst, int c, bool srgb, const float *tolinear) {
+  int nw = w > 1 ? w / 2 : 1;
+  int nh = h > 1 ? h / 2 : 1;
+  /* alpha is always linear, for IA and RGBA alike */
+  int alpha = (c == 2 || c == 4) ? c - 1 : -1;
+  for (int y=0; y < nh; y++) {
+    int y0 = 2 * y;
+    int y1 = y0 + 1 < h ? y0 + 1 : y0;
+    for (int x=0; x < nw; x++) {
+      int x0 = 2 * x;
+      int x1 = x0 + 1 < w ? x0 + 1 : x0;
+      const uint8_t *s[4] = {
+        src + (y0 * w + x0) * c,
+        src + (y0 * w + x1) * c,
+        src + (y1 * w + x0) * c,
+        src + (y1 * w + x1) * c
+      };
+      uint8_t *d = dst + (y * nw + x) * c;
+      for (int k=0; k < c; k++) {
+        if (srgb && k != alpha) {
+          float v = (tolinear[s[0][k]] + tolinear[s[1][k]] + tolinear[s[2][k]] + tolinear[s[3][k]]) * 0.25f;
+          d[k] = (uint8_t)(to_srgb(v) * 255.0f + 0.5f);
+        } else {
+          d[k] = ((int)s[0][k] + s[1][k] + s[2][k] + s[3][k] + 2) / 4;
+        }
+      }
+    }
+  }
+}
+
+static float to_srgb(float v) {
+  if (v <= 0.0031308f) return v * 12.92f;
+  if (v >= 1.0f) return 1.0f;
+  return 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+}
+
+/* vim: set ts=2 sw=2 et */
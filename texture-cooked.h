@@ -0,0 +1,26 @@
+#ifndef KL_TEXTURE_COOKED_H
+#define KL_TEXTURE_COOKED_H
+
+/* textures as kl-cook writes them: a header, then every mip level back to
+ * back, largest first, rows tightly packed.  they keep the name of the PNG
+ * they were cooked from, and are told apart by their magic number. */
+
+#include "texture.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define KL_TEXTURE_COOKED_MAGIC   0x5845544b /* "KTEX" */
+#define KL_TEXTURE_COOKED_VERSION 1
+
+bool kl_texture_iscooked(const uint8_t *data, size_t size);
+/* copies out the pixels, name is only used for errors -- thread-safe, doesn't touch the renderer,
+ * image->data must be freed with kl_mem_free(KL_MEM_TEXTURE, ...) */
+bool kl_texture_decodecooked(const uint8_t *data, size_t size, const char *name, kl_texture_image_t *image);
+/* generates the mip chain for a single-level image (gamma-correct for the sRGB formats) and writes it out */
+int  kl_texture_cook(kl_texture_image_t *image, FILE *out);
+
+#endif /* KL_TEXTURE_COOKED_H */
+/* vim: set ts=2 sw=2 et */
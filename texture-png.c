@@ -1,23 +1,31 @@
 #include "texture-png.h"
 
 #include "texture.h"
-#include "renderer.h"
+#include "mem.h"
 
 #include <png.h>
 #include <setjmp.h>
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+typedef struct png_source {
+  const uint8_t *data;
+  size_t size, pos;
+} png_source_t;
+
+static void read_data(png_structp png, png_bytep out, png_size_t n);
 
-bool kl_texture_loadpng(char* path, kl_texture_t *texture) {
-  strncpy(texture->path, path, KL_TEXTURE_PATHLEN);
-  texture->path[KL_TEXTURE_PATHLEN-1] = '\0';
-  texture->w  = 0;
-  texture->h  = 0;
-  texture->id = 0;
+/* ------------------ */
+bool kl_texture_decodepng(const uint8_t *data, size_t size, const char *name, kl_texture_image_t *image) {
+  image->w    = 0;
+  image->h    = 0;
+  image->data = NULL;
 
-  FILE    *file   = NULL;
   uint8_t *buffer = NULL;
+  png_source_t source = { .data = data, .size = size, .pos = 0 };
 
   png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (png == NULL) {
@@ -34,19 +42,17 @@ bool kl_texture_loadpng(char* path, kl_texture_t *texture) {
  
   /* error handling & cleanup routine */ 
   if (setjmp(png_jmpbuf(png)) != 0) {
-    fprintf(stderr, "image-png: Failed to parse %s\n", path);
+    fprintf(stderr, "image-png: Failed to parse %s\n", name);
     png_destroy_read_struct(&png, &info, NULL);
-    if (file != NULL) fclose(file);
-    if (buffer != NULL) free(buffer);
+    if (buffer != NULL) kl_mem_free(KL_MEM_TEXTURE, buffer);
     return false;
   }
 
-  file = fopen(path, "rb");
-  if (file == NULL) {
-    fprintf(stderr, "image-png: %s does not exist\n", path);
+  if (data == NULL) {
+    fprintf(stderr, "image-png: %s does not exist\n", name);
     longjmp(png_jmpbuf(png), 1);
   }
-  png_init_io(png, file);
+  png_set_read_fn(png, &source, &read_data);
 
   png_read_info(png, info);
 
@@ -77,17 +83,15 @@ bool kl_texture_loadpng(char* path, kl_texture_t *texture) {
       channels = 4;
       break;
     default:
-      fprintf(stderr, "image-png: Bad image format for %s\n", path);
-      fclose(file);
+      fprintf(stderr, "image-png: Bad image format for %s\n", name);
       longjmp(png_jmpbuf(png), 1);
   }
   if (png_get_bit_depth(png, info) != 8) {
-    fprintf(stderr, "image-png: Unsupported pixel format for %s\n", path);
-    fclose(file);
+    fprintf(stderr, "image-png: Unsupported pixel format for %s\n", name);
     longjmp(png_jmpbuf(png), 1);
   }
   
-  buffer = malloc(w * h * channels);
+  buffer = kl_mem_alloc(KL_MEM_TEXTURE, w * h * channels);
 
   png_bytep rows[h];
   for (uint32_t i=0; i < h; i++) {
@@ -96,14 +100,24 @@ bool kl_texture_loadpng(char* path, kl_texture_t *texture) {
   
   png_read_image(png, rows);
 
-  texture->w  = w;
-  texture->h  = h;
-  texture->id = kl_render_upload_texture(buffer, w, h, format, false, true);
+  image->w      = w;
+  image->h      = h;
+  image->format = format;
+  image->levels = 1;
+  image->data   = buffer;
 
   png_destroy_read_struct(&png, &info, NULL);
-  fclose(file);
-  free(buffer);
 
   return true;
 }
+
+/* ------------------ */
+static void read_data(png_structp png, png_bytep out, png_size_t n) {
+  png_source_t *source = png_get_io_ptr(png);
+  if (n > source->size - source->pos) {
+    png_error(png, "unexpected end of data");
+  }
+  memcpy(out, source->data + source->pos, n);
+  source->pos += n;
+}
 /* vim: set ts=2 sw=2 et */
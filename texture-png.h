@@ -3,8 +3,12 @@
 
 #include "texture.h"
 
+#include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
-bool kl_texture_loadpng(char* path, kl_texture_t *texture);
+/* decodes from memory, name is only used for errors -- thread-safe, doesn't touch the renderer,
+ * image->data must be freed with kl_mem_free(KL_MEM_TEXTURE, ...) */
+bool kl_texture_decodepng(const uint8_t *data, size_t size, const char *name, kl_texture_image_t *image);
 
 #endif /* KL_TEXTURE_PNG_H */
@@ -1,84 +1,328 @@
 #include "texture.h"
 
 #include "texture-png.h"
+#include "texture-cooked.h"
 #include "resource.h"
 #include "renderer.h"
+#include "intern.h"
+#include "array.h"
+#include "mem.h"
 
 #include <stdlib.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
-static kl_texture_t *texture_load(char *path, char *vpath);
+/* decoded pixels and the GL texture they end up in, shared by every path with identical contents
+ * for as long as any of them is loaded -- two fingerprints stand in for the contents, which aren't kept */
+#define SHARE_DECODING 0
+#define SHARE_DECODED  1 /* waiting for the first upload */
+#define SHARE_UPLOADED 2
+#define SHARE_FAILED   3
+typedef struct texture_share {
+  uint64_t hash;  /* kl_resource_blob_hash, 0 for generated textures, which are never looked up */
+  uint64_t check; /* kl_resource_blob_check */
+  size_t   size;
+  int      state;
+  kl_texture_image_t image; /* the pixels are freed once uploaded */
+  unsigned int id;
+  int users;      /* textures, plus decodes which haven't been uploaded or discarded */
+  kl_texture_t *owner; /* the first texture, which accounts for the video memory -- NULL once it's freed */
+} texture_share_t;
+
+/* totals since startup */
+typedef struct texture_share_stats {
+  uint64_t aliased;       /* uploads which found their contents already on the GPU */
+  uint64_t decodes_saved; /* decodes which found them already decoded or decoding */
+  uint64_t bytes_saved;   /* file bytes left undecoded */
+  uint64_t gpu_saved;     /* estimated, like texture_size */
+} texture_share_stats_t;
+
+KL_ARRAY_DECLARE(texture_share_t*, share)
+
+static texture_share_t *texture_decode(kl_resource_blob_t *blob, const char *vpath);
+static kl_texture_t *texture_upload(texture_share_t *share, const char *path, const char *vpath);
+static void texture_discard(texture_share_t *share);
 static void texture_free(kl_texture_t *texture);
-static void texture_load_default_diffuse(char* path, kl_texture_t *texture);
-static void texture_load_default_specular(char* path, kl_texture_t *texture);
-static void texture_load_default_normal(char* path, kl_texture_t *texture);
-static void texture_load_default_emissive(char* path, kl_texture_t *texture);
+static void texture_size(kl_texture_t *texture, size_t *cpu, size_t *gpu);
+static void texture_reload(kl_texture_t *texture, kl_texture_t *fresh);
+static size_t texture_gpu_bytes(unsigned int w, unsigned int h);
+static texture_share_t* share_find(uint64_t hash, uint64_t check, size_t size);
+static void share_release(texture_share_t *share, kl_texture_t *user);
+static void texture_decode_default_diffuse(kl_texture_image_t *image);
+static void texture_decode_default_specular(kl_texture_image_t *image);
+static void texture_decode_default_normal(kl_texture_image_t *image);
+static void texture_decode_default_emissive(kl_texture_image_t *image);
+static void texture_init();
+static void loader_init();
 
 static kl_resource_loader_t *loader = NULL;
+static pthread_once_t loader_once = PTHREAD_ONCE_INIT;
+/* interned, compared by pointer */
+static const char *default_diffuse, *default_specular, *default_normal, *default_emissive;
+/* shares being decoded or on the GPU -- there are few enough for a linear search */
+static kl_array_t shares;
+static texture_share_stats_t share_stats;
+static pthread_mutex_t share_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  share_cond = PTHREAD_COND_INITIALIZER; /* signals decodes waiting on an identical one */
 
 /* ----------------- */
-kl_texture_t *kl_texture_incref(char *path) {
-  static char buf[256];
-
-  if (loader == NULL) {
-    loader = kl_resource_loader_new((kl_resources_load_cb)&texture_load, (kl_resources_free_cb)&texture_free);
-    kl_resource_add_entry("", "DEFAULT_DIFFUSE");
-    kl_resource_add_entry("", "DEFAULT_SPECULAR");
-    kl_resource_add_entry("", "DEFAULT_NORMAL");
-    kl_resource_add_entry("", "DEFAULT_EMISSIVE");
-  }
-  kl_resource_id_t resid = kl_resource_getid(path);
-  kl_texture_t *texture = kl_resource_incref(loader, resid);
+kl_texture_t *kl_texture_incref(const char *path) {
+  char buf[KL_RESITEM_PATHLEN];
+
+  texture_init();
+  kl_texture_t *texture = kl_resource_incref(loader, path);
   if (texture == NULL) {
-    snprintf(buf, 256, "%s.png", path);
-    kl_resource_id_t resid = kl_resource_getid(buf);
-    texture = kl_resource_incref(loader, resid);
+    snprintf(buf, KL_RESITEM_PATHLEN, "%s.png", path);
+    texture = kl_resource_incref(loader, buf);
   }
 
   return texture;
 }
 
+kl_resource_item_t *kl_texture_incref_async(const char *path) {
+  char buf[KL_RESITEM_PATHLEN];
+
+  texture_init();
+  if (kl_resource_exists(path)) {
+    return kl_resource_incref_async(loader, path);
+  }
+  snprintf(buf, KL_RESITEM_PATHLEN, "%s.png", path);
+  return kl_resource_incref_async(loader, buf);
+}
+
+void kl_texture_prefetch(const char *path) {
+  char buf[KL_RESITEM_PATHLEN];
+
+  texture_init();
+  if (kl_resource_exists(path)) {
+    kl_resource_prefetch(loader, path);
+    return;
+  }
+  snprintf(buf, KL_RESITEM_PATHLEN, "%s.png", path);
+  kl_resource_prefetch(loader, buf);
+}
+
 void kl_texture_decref(kl_texture_t *texture) {
-  kl_resource_id_t resid = kl_resource_getid(texture->path);
-  kl_resource_decref(resid);
+  kl_resource_decref(texture->path);
+}
+
+void kl_texture_dump_shared(FILE *out) {
+  pthread_mutex_lock(&share_lock);
+  int n = shares.item_size == 0 ? 0 : kl_array_size(&shares);
+  int live = 0, users = 0;
+  for (int i=0; i < n; i++) {
+    texture_share_t *share = kl_array_share_data(&shares)[i];
+    if (share->state != SHARE_UPLOADED) continue;
+    live++;
+    users += share->users;
+  }
+  texture_share_stats_t stats = share_stats;
+  pthread_mutex_unlock(&share_lock);
+
+  fprintf(out, "Texture: %d textures on %d GL textures\n", users, live);
+  fprintf(out, "Texture: %" PRIu64 " loads found identical contents already on the GPU, %" PRIu64 " without decoding\n",
+    stats.aliased, stats.decodes_saved);
+  fprintf(out, "Texture: saved %.1f MB of decoding and %.1f MB of video memory\n",
+    stats.bytes_saved / 1048576.0, stats.gpu_saved / 1048576.0);
 }
 
 /* ---------------- */
-static kl_texture_t *texture_load(char *path, char *vpath) {
-  kl_texture_t *texture = malloc(sizeof(kl_texture_t));
+static void texture_init() {
+  pthread_once(&loader_once, &loader_init);
+}
+
+static void loader_init() {
+  loader = kl_resource_loader_new_async(
+    (kl_resources_decode_cb)&texture_decode,
+    (kl_resources_upload_cb)&texture_upload,
+    (kl_resources_free_cb)&texture_discard,
+    (kl_resources_free_cb)&texture_free);
+  loader->name   = "texture";
+  loader->size   = (kl_resources_size_cb)&texture_size;
+  loader->reload = (kl_resources_reload_cb)&texture_reload;
+  loader->main_thread = true;
+  default_diffuse  = kl_intern("DEFAULT_DIFFUSE");
+  default_specular = kl_intern("DEFAULT_SPECULAR");
+  default_normal   = kl_intern("DEFAULT_NORMAL");
+  default_emissive = kl_intern("DEFAULT_EMISSIVE");
+  kl_resource_add_entry("", default_diffuse);
+  kl_resource_add_entry("", default_specular);
+  kl_resource_add_entry("", default_normal);
+  kl_resource_add_entry("", default_emissive);
+  kl_array_share_init(&shares);
+}
+
+static texture_share_t *texture_decode(kl_resource_blob_t *blob, const char *vpath) {
+  uint64_t hash  = kl_resource_blob_hash(blob);
+  uint64_t check = hash != 0 ? kl_resource_blob_check(blob) : 0;
 
-  if (strcmp(vpath, "DEFAULT_DIFFUSE") == 0) {
-    texture_load_default_diffuse(path, texture);
-    return texture;
+  pthread_mutex_lock(&share_lock);
+  texture_share_t *share = hash != 0 ? share_find(hash, check, blob->size) : NULL;
+  if (share != NULL) {
+    /* the same file under another path, wait for its pixels instead of decoding them again --
+     * decodes never wait on anything else, so this can't deadlock */
+    share->users++;
+    while (share->state == SHARE_DECODING) {
+      pthread_cond_wait(&share_cond, &share_lock);
+    }
+    bool failed = share->state == SHARE_FAILED;
+    if (!failed) {
+      share_stats.decodes_saved++;
+      share_stats.bytes_saved += blob->size;
+    }
+    pthread_mutex_unlock(&share_lock);
+    if (failed) {
+      share_release(share, NULL);
+      return NULL;
+    }
+    return share;
   }
-  if (strcmp(vpath, "DEFAULT_SPECULAR") == 0) {
-    texture_load_default_specular(path, texture);
-    return texture;
+
+  share = kl_mem_alloc(KL_MEM_TEXTURE, sizeof(texture_share_t));
+  share->hash  = hash;
+  share->check = check;
+  share->size  = blob->size;
+  share->state = SHARE_DECODING;
+  share->image.data = NULL;
+  share->id    = 0;
+  share->users = 1;
+  share->owner = NULL;
+  kl_array_share_push(&shares, share);
+  pthread_mutex_unlock(&share_lock);
+
+  kl_texture_image_t image;
+  bool ok = true;
+  if (vpath == default_diffuse) {
+    texture_decode_default_diffuse(&image);
+  } else if (vpath == default_specular) {
+    texture_decode_default_specular(&image);
+  } else if (vpath == default_normal) {
+    texture_decode_default_normal(&image);
+  } else if (vpath == default_emissive) {
+    texture_decode_default_emissive(&image);
+  } else if (kl_texture_iscooked(blob->data, blob->size)) {
+    ok = kl_texture_decodecooked(blob->data, blob->size, vpath, &image);
+  } else {
+    ok = kl_texture_decodepng(blob->data, blob->size, vpath, &image);
   }
-  if (strcmp(vpath, "DEFAULT_NORMAL") == 0) {
-    texture_load_default_normal(path, texture);
-    return texture;
+
+  pthread_mutex_lock(&share_lock);
+  if (ok) share->image = image;
+  share->state = ok ? SHARE_DECODED : SHARE_FAILED;
+  pthread_cond_broadcast(&share_cond);
+  pthread_mutex_unlock(&share_lock);
+
+  if (!ok) {
+    share_release(share, NULL);
+    return NULL;
   }
-  if (strcmp(vpath, "DEFAULT_EMISSIVE") == 0) {
-    texture_load_default_emissive(path, texture);
-    return texture;
+  return share;
+}
+
+static kl_texture_t *texture_upload(texture_share_t *share, const char *path, const char *vpath) {
+  kl_texture_t *texture = kl_mem_alloc(KL_MEM_TEXTURE, sizeof(kl_texture_t));
+  /* kl_texture_decref looks the resource up by virtual path, so each path gets its own texture even if the GL texture is shared */
+  texture->path  = vpath;
+  texture->share = share; /* takes over the decode's claim on it */
+
+  /* uploaded under the lock, so a second path can't get in between -- it's on the GL thread anyway */
+  pthread_mutex_lock(&share_lock);
+  kl_texture_image_t *image = &share->image;
+  if (share->state == SHARE_DECODED) {
+    if (image->levels > 1) {
+      share->id  = kl_render_upload_texture_mips(image->data, image->w, image->h, image->levels, image->format, false);
+    } else {
+      share->id  = kl_render_upload_texture(image->data, image->w, image->h, image->format, false, true);
+    }
+    share->state = SHARE_UPLOADED;
+    share->owner = texture;
+    kl_mem_free(KL_MEM_TEXTURE, image->data);
+    image->data = NULL;
+  } else {
+    share_stats.aliased++;
+    share_stats.gpu_saved += texture_gpu_bytes(image->w, image->h);
   }
+  texture->w  = image->w;
+  texture->h  = image->h;
+  texture->id = share->id;
+  pthread_mutex_unlock(&share_lock);
+  return texture;
+}
 
-  if (kl_texture_loadpng(path, texture)) return texture;
-  
-  free(texture);
-  return NULL;
+static void texture_discard(texture_share_t *share) {
+  share_release(share, NULL);
 }
 
 static void texture_free(kl_texture_t *texture) {
-  kl_render_free_texture(texture->id);
-  free(texture);
+  share_release(texture->share, texture);
+  kl_mem_free(KL_MEM_TEXTURE, texture);
+}
+
+static void texture_size(kl_texture_t *texture, size_t *cpu, size_t *gpu) {
+  *cpu = sizeof(kl_texture_t);
+  /* only counted once -- if the first texture goes before the others, they're undercounted until they reload */
+  *gpu = texture->share->owner == texture ? texture_gpu_bytes(texture->w, texture->h) : 0;
+}
+
+static void texture_reload(kl_texture_t *texture, kl_texture_t *fresh) {
+  texture_share_t *share = texture->share;
+  texture->w     = fresh->w;
+  texture->h     = fresh->h;
+  texture->id    = fresh->id;
+  texture->share = fresh->share;
+  fresh->share = share;
+  pthread_mutex_lock(&share_lock);
+  if (texture->share->owner == fresh) texture->share->owner = texture;
+  if (share->owner == texture) share->owner = fresh; /* cleared by texture_free below */
+  pthread_mutex_unlock(&share_lock);
+  texture_free(fresh);
+}
+
+static size_t texture_gpu_bytes(unsigned int w, unsigned int h) {
+  /* assumes 4 bytes per texel, plus a third for mipmaps */
+  return (size_t)w * h * 4 * 4 / 3;
+}
+
+/* share_lock held */
+static texture_share_t* share_find(uint64_t hash, uint64_t check, size_t size) {
+  texture_share_t **shared = kl_array_share_data(&shares);
+  for (int i=0; i < kl_array_size(&shares); i++) {
+    texture_share_t *share = shared[i];
+    /* 128 bits between them, so different files won't both match by accident */
+    if (share->hash == hash && share->check == check && share->size == size) return share;
+  }
+  return NULL;
+}
+
+static void share_release(texture_share_t *share, kl_texture_t *user) {
+  pthread_mutex_lock(&share_lock);
+  if (user != NULL && share->owner == user) share->owner = NULL;
+  bool last = --share->users == 0;
+  if (last) {
+    texture_share_t **data = kl_array_share_data(&shares);
+    int n = kl_array_size(&shares);
+    for (int i=0; i < n; i++) {
+      if (data[i] == share) {
+        data[i] = data[n-1];
+        kl_array_resize(&shares, n-1);
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&share_lock);
+
+  if (last) {
+    if (share->state == SHARE_UPLOADED) kl_render_free_texture(share->id);
+    kl_mem_free(KL_MEM_TEXTURE, share->image.data);
+    kl_mem_free(KL_MEM_TEXTURE, share);
+  }
 }
 
-static void texture_load_default_diffuse(char *path, kl_texture_t *texture) {
-  uint32_t *buf = malloc(0x4000);
+static void texture_decode_default_diffuse(kl_texture_image_t *image) {
+  uint32_t *buf = kl_mem_alloc(KL_MEM_TEXTURE, 0x4000);
   for (int i=0; i < 0x40; i++) {
     for (int j=0; j < 0x40; j++) {
       if ((i & 0x20) ^ (j & 0x20)) {
@@ -88,53 +332,53 @@ static void texture_load_default_diffuse(char *path, kl_texture_t *texture) {
       }
     }
   }
-  strncpy(texture->path, path, KL_TEXTURE_PATHLEN);
-  texture->w  = 0x40;
-  texture->h  = 0x40;
-  texture->id = kl_render_upload_texture(buf, 0x40, 0x40, KL_TEXFMT_RGBA, false, true);
-  free(buf);
+  image->w      = 0x40;
+  image->h      = 0x40;
+  image->format = KL_TEXFMT_RGBA;
+  image->levels = 1;
+  image->data   = buf;
 }
 
-static void texture_load_default_specular(char *path, kl_texture_t *texture) {
-  uint32_t *buf = malloc(0x400);
+static void texture_decode_default_specular(kl_texture_image_t *image) {
+  uint32_t *buf = kl_mem_alloc(KL_MEM_TEXTURE, 0x400);
   for (int i=0; i < 0x10; i++) {
     for (int j=0; j < 0x10; j++) {
       buf[i*0x10 + j] = 0x10808080;
     }
   }
-  strncpy(texture->path, path, KL_TEXTURE_PATHLEN);
-  texture->w  = 0x10;
-  texture->h  = 0x10;
-  texture->id = kl_render_upload_texture(buf, 0x10, 0x10, KL_TEXFMT_RGBA, false, true);
-  free(buf);
+  image->w      = 0x10;
+  image->h      = 0x10;
+  image->format = KL_TEXFMT_RGBA;
+  image->levels = 1;
+  image->data   = buf;
 }
   
-static void texture_load_default_normal(char *path, kl_texture_t *texture) {
-  uint32_t *buf = malloc(0x400);
+static void texture_decode_default_normal(kl_texture_image_t *image) {
+  uint32_t *buf = kl_mem_alloc(KL_MEM_TEXTURE, 0x400);
   for (int i=0; i < 0x10; i++) {
     for (int j=0; j < 0x10; j++) {
       buf[i*0x10 + j] = 0xFFFF8080;
     }
   }
-  strncpy(texture->path, path, KL_TEXTURE_PATHLEN);
-  texture->w  = 0x10;
-  texture->h  = 0x10;
-  texture->id = kl_render_upload_texture(buf, 0x10, 0x10, KL_TEXFMT_XYZW, false, true);
-  free(buf);
+  image->w      = 0x10;
+  image->h      = 0x10;
+  image->format = KL_TEXFMT_XYZW;
+  image->levels = 1;
+  image->data   = buf;
 }
 
-static void texture_load_default_emissive(char *path, kl_texture_t *texture) {
-  uint32_t *buf = malloc(0x400);
+static void texture_decode_default_emissive(kl_texture_image_t *image) {
+  uint32_t *buf = kl_mem_alloc(KL_MEM_TEXTURE, 0x400);
   for (int i=0; i < 0x10; i++) {
     for (int j=0; j < 0x10; j++) {
       buf[i*0x10 + j] = 0x00000000;
     }
   }
-  strncpy(texture->path, path, KL_TEXTURE_PATHLEN);
-  texture->w  = 0x10;
-  texture->h  = 0x10;
-  texture->id = kl_render_upload_texture(buf, 0x10, 0x10, KL_TEXFMT_RGBA, false, true);
-  free(buf);
+  image->w      = 0x10;
+  image->h      = 0x10;
+  image->format = KL_TEXFMT_RGBA;
+  image->levels = 1;
+  image->data   = buf;
 }
 
 /* vim: set ts=2 sw=2 et */
@@ -1,6 +1,10 @@
 #ifndef KL_TEXTURE_H
 #define KL_TEXTURE_H
 
+#include "resource.h"
+
+#include <stdio.h>
+
 /* sRGB color texture formats */
 #define KL_TEXFMT_I    0x01
 #define KL_TEXFMT_IA   0x02
@@ -14,15 +18,29 @@
 #define KL_TEXFMT_XYZ  0x13
 #define KL_TEXFMT_XYZW 0x14
 
-#define KL_TEXTURE_PATHLEN 0x100
 typedef struct kl_texture_t {
-  char path[KL_TEXTURE_PATHLEN];
+  const char *path; /* interned */
   unsigned int w, h;
-  unsigned int id;
+  unsigned int id;  /* shared by every texture loaded from identical files */
+  struct texture_share *share; /* private */
 } kl_texture_t;
 
-kl_texture_t *kl_texture_incref(char *path);
+/* decoded pixels, prior to upload */
+typedef struct kl_texture_image {
+  unsigned int w, h;
+  int format;
+  int levels; /* mip levels stored back to back in data, 1 leaves them to the renderer */
+  void *data;
+} kl_texture_image_t;
+
+kl_texture_t *kl_texture_incref(const char *path);
+/* starts loading a texture in the background, release with kl_resource_decref(handle->vpath) */
+kl_resource_item_t *kl_texture_incref_async(const char *path);
+/* starts loading a texture in the background without referencing it */
+void kl_texture_prefetch(const char *path);
 void kl_texture_decref(kl_texture_t *texture);
+/* reports how much decoding and video memory identical files have saved */
+void kl_texture_dump_shared(FILE *out);
 
 #endif /* KL_TEXTURE_H */
 /* vim: set ts=2 sw=2 et */